@@ -0,0 +1,995 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Aboria.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef ADAPTIVE_CELL_LIST_H_
+#define ADAPTIVE_CELL_LIST_H_
+
+#include "CudaInclude.h"
+#include "Get.h"
+#include "NeighbourSearchBase.h"
+#include "SpatialUtil.h"
+#include "Traits.h"
+#include "Vector.h"
+#include "detail/Algorithms.h"
+
+#include "Log.h"
+#include <iostream>
+
+namespace Aboria {
+
+template <typename Traits> struct AdaptiveCellListQuery;
+
+namespace detail {
+
+///
+/// @brief a regular grid of sub-cells that an overfull cell (or sub-cell)
+/// of an AdaptiveCellList is divided into
+///
+template <unsigned int D> struct adaptive_sub_grid {
+  typedef Vector<int, D> int_d;
+
+  point_to_bucket_index<D> m_point_to_bucket_index;
+  int_d m_end_bucket;
+
+  // index of the first sub-cell of this grid in the list of cells
+  int m_first_cell;
+};
+
+} // namespace detail
+
+/// @brief An adaptive cell list spatial data structure that is paired with a
+/// AdaptiveCellListQuery query type
+///
+/// Like CellListOrdered, the domain is divided up into a regular grid of
+/// constant size cells, and the particle set is reordered so that the
+/// particles in each bucket are sequential in memory. The cell size assumes
+/// that the particles are uniformly distributed, so for strongly clustered
+/// particles each cell that holds more than twice `n_particles_in_leaf`
+/// particles is further divided into a regular grid of sub-cells, chosen so
+/// that these hold about `n_particles_in_leaf` particles each. Overfull
+/// sub-cells are divided in turn, up to a fixed maximum number of levels.
+///
+/// The buckets (or leafs) of this data structure are the undivided cells and
+/// sub-cells, and the leafs within each cell are numbered sequentially. A
+/// point is located by finding its cell and then its sub-cell on each level,
+/// so in constant time. Only the host (std::vector) storage is supported
+///
+template <typename Traits>
+class AdaptiveCellList
+    : public neighbour_search_base<AdaptiveCellList<Traits>, Traits,
+                                   AdaptiveCellListQuery<Traits>> {
+
+  typedef typename Traits::double_d double_d;
+  typedef typename Traits::int_d int_d;
+  typedef typename Traits::unsigned_int_d unsigned_int_d;
+  typedef typename Traits::position position;
+  typedef typename Traits::iterator iterator;
+  typedef bbox<Traits::dimension> box_type;
+  typedef detail::adaptive_sub_grid<Traits::dimension> sub_grid_type;
+
+  typedef neighbour_search_base<AdaptiveCellList<Traits>, Traits,
+                                AdaptiveCellListQuery<Traits>>
+      base_type;
+
+  friend base_type;
+
+public:
+  AdaptiveCellList()
+      : base_type(),
+        m_size_calculated_with_n(std::numeric_limits<size_t>::max()),
+        m_size_calculated_with_n_in_leaf(0),
+        m_reorder_needed(true) {}
+
+  static constexpr bool ordered() { return true; }
+
+  ///
+  /// @return false if the last update left every particle in the same
+  /// bucket, so the particle set does not need to be reordered
+  ///
+  bool reorder_needed() const { return m_reorder_needed; }
+
+  void print_data_structure() const {
+#ifndef __CUDA_ARCH__
+    LOG(1, "\tcells:");
+    for (size_t i = 0; i + 1 < m_cell_first_leaf.size(); ++i) {
+      LOG(1, "\ti = " << i << " leafs = " << m_cell_first_leaf[i] << " to "
+                      << m_cell_first_leaf[i + 1]);
+    }
+    LOG(1, "\tend cells");
+    LOG(1, "\tleafs:");
+    for (size_t i = 0; i < m_leaf_begin.size(); ++i) {
+      LOG(1, "\ti = " << i << " bounds = " << m_leaf_bounds[i]
+                      << " contents = " << m_leaf_begin[i] << " to "
+                      << m_leaf_end[i]);
+    }
+    LOG(1, "\tend leafs");
+#endif
+  }
+
+private:
+  bool set_domain_impl() {
+    const size_t n = this->m_alive_indices.size();
+    if (n < 0.5 * m_size_calculated_with_n ||
+        n > 2 * m_size_calculated_with_n ||
+        (this->m_bounds.bmin != m_size_calculated_with_bounds.bmin).any() ||
+        (this->m_bounds.bmax != m_size_calculated_with_bounds.bmax).any() ||
+        this->m_n_particles_in_leaf != m_size_calculated_with_n_in_leaf) {
+      LOG(2, "AdaptiveCellList: recalculating cell size");
+      m_size_calculated_with_n = n;
+      m_size_calculated_with_bounds = this->m_bounds;
+      m_size_calculated_with_n_in_leaf = this->m_n_particles_in_leaf;
+      if (this->m_n_particles_in_leaf > n) {
+        m_size = unsigned_int_d::Constant(1);
+      } else {
+        const double total_volume =
+            (this->m_bounds.bmax - this->m_bounds.bmin).prod();
+        const double box_volume =
+            this->m_n_particles_in_leaf / double(n) * total_volume;
+        const double box_side_length =
+            std::pow(box_volume, 1.0 / Traits::dimension);
+        m_size =
+            floor((this->m_bounds.bmax - this->m_bounds.bmin) / box_side_length)
+                .template cast<unsigned int>();
+        for (size_t i = 0; i < Traits::dimension; ++i) {
+          if (m_size[i] == 0) {
+            m_size[i] = 1;
+          }
+        }
+      }
+      m_bucket_side_length =
+          (this->m_bounds.bmax - this->m_bounds.bmin) / m_size;
+      m_point_to_bucket_index =
+          detail::point_to_bucket_index<Traits::dimension>(
+              m_size, m_bucket_side_length, this->m_bounds);
+
+      LOG(2, "\tcell side length = " << m_bucket_side_length);
+      LOG(2, "\tnumber of cells = " << m_size << " (total=" << m_size.prod()
+                                    << ")");
+
+      m_query.m_bucket_side_length = m_bucket_side_length;
+      m_query.m_bounds.bmin = this->m_bounds.bmin;
+      m_query.m_bounds.bmax = this->m_bounds.bmax;
+      m_query.m_periodic = this->m_periodic;
+      m_query.m_end_bucket = m_size.template cast<int>() - 1;
+      m_query.m_point_to_bucket_index = m_point_to_bucket_index;
+
+      // until the next update every cell is an empty leaf
+      m_cell_indices.clear();
+      m_leaf_indices.clear();
+      build_leafs();
+      return true;
+    } else {
+      return false;
+    }
+  }
+
+  ///
+  /// @brief divides the overfull cells into sub-cells, given the index of
+  /// the cell containing each alive particle in m_cell_indices, and sets
+  /// the leaf index of each particle in m_leaf_indices
+  ///
+  void build_leafs() {
+    const unsigned int D = Traits::dimension;
+    const int ncells = m_size.prod();
+    const int n = m_cell_indices.size();
+    const double n_particles_in_leaf = this->m_n_particles_in_leaf;
+    const double_d *positions =
+        n > 0 ? iterator_to_raw_pointer(get<position>(this->m_particles_begin))
+              : nullptr;
+    const int *alive_indices = this->m_alive_indices.data();
+
+    // the first ncells entries are the cells of the top level grid, the
+    // sub-cells of each divided (sub-)cell are appended to the end
+    m_cells.assign(ncells, 0);
+    m_cell_bounds.resize(ncells);
+    m_sub_grids.clear();
+    const detail::bucket_index<D> cells(m_size);
+    for (int c = 0; c < ncells; ++c) {
+      const int_d cell = cells.reassemble_index_vector(c);
+      m_cell_bounds[c] =
+          box_type(cell * m_bucket_side_length + this->m_bounds.bmin,
+                   (cell + 1) * m_bucket_side_length + this->m_bounds.bmin);
+    }
+    m_leaf_indices = m_cell_indices;
+
+    // divide the overfull cells one level at a time, m_leaf_indices holds
+    // the index of the cell or sub-cell containing each particle
+    std::vector<int> counts;
+    int level_begin = 0;
+    for (unsigned int level = 1; level < m_query.max_levels; ++level) {
+      const int level_end = m_cells.size();
+      counts.assign(level_end - level_begin, 0);
+      for (const int c : m_leaf_indices) {
+        if (c >= level_begin) {
+          ++counts[c - level_begin];
+        }
+      }
+
+      for (int c = level_begin; c < level_end; ++c) {
+        const int count = counts[c - level_begin];
+        if (count <= 2 * n_particles_in_leaf) {
+          continue;
+        }
+
+        // divide the cell into s^D sub-cells, each with about
+        // n_particles_in_leaf particles
+        const int s = std::max(
+            2, static_cast<int>(std::min(
+                   std::ceil(std::pow(count / n_particles_in_leaf, 1.0 / D)),
+                   std::floor(std::pow(static_cast<double>(count), 1.0 / D)))));
+        const box_type bounds = m_cell_bounds[c];
+        const double_d sub_side_length = (bounds.bmax - bounds.bmin) / s;
+        sub_grid_type sub_grid;
+        sub_grid.m_point_to_bucket_index = detail::point_to_bucket_index<D>(
+            unsigned_int_d::Constant(s), sub_side_length, bounds);
+        sub_grid.m_end_bucket = int_d::Constant(s - 1);
+        sub_grid.m_first_cell = m_cells.size();
+        m_cells[c] = -static_cast<int>(m_sub_grids.size()) - 1;
+        m_sub_grids.push_back(sub_grid);
+
+        for (lattice_iterator<D> sub_cell(int_d::Constant(0),
+                                          int_d::Constant(s));
+             sub_cell != false; ++sub_cell) {
+          m_cells.push_back(0);
+          m_cell_bounds.push_back(
+              box_type((*sub_cell) * sub_side_length + bounds.bmin,
+                       ((*sub_cell) + 1) * sub_side_length + bounds.bmin));
+        }
+      }
+      if (static_cast<int>(m_cells.size()) == level_end) {
+        break;
+      }
+
+      // move the particles in the divided cells down a level
+      m_query.m_cells = m_cells.data();
+      m_query.m_sub_grids = m_sub_grids.data();
+#ifdef HAVE_OPENMP
+#pragma omp parallel for if (detail::use_omp_backend<int *>(n))
+#endif
+      for (int i = 0; i < n; ++i) {
+        const int c = m_leaf_indices[i];
+        if (m_cells[c] < 0) {
+          m_leaf_indices[i] =
+              m_query.find_sub_cell(positions[alive_indices[i]], c);
+        }
+      }
+      level_begin = level_end;
+    }
+
+    // number the leafs so that those within each top level cell are
+    // sequential
+    m_cell_first_leaf.resize(ncells + 1);
+    m_leaf_bounds.clear();
+    for (int c = 0; c < ncells; ++c) {
+      m_cell_first_leaf[c] = m_leaf_bounds.size();
+      number_leafs(c);
+    }
+    const int nleafs = m_leaf_bounds.size();
+    m_cell_first_leaf[ncells] = nleafs;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for if (detail::use_omp_backend<int *>(n))
+#endif
+    for (int i = 0; i < n; ++i) {
+      m_leaf_indices[i] = m_cells[m_leaf_indices[i]];
+    }
+
+    m_leaf_begin.resize(nleafs);
+    m_leaf_end.resize(nleafs);
+    update_query_pointers();
+  }
+
+  ///
+  /// @brief points the query at the cells and leafs of this object. Called on
+  /// every update, as a copy of this object starts with a query that points
+  /// into the original
+  ///
+  void update_query_pointers() {
+    m_query.m_cells = m_cells.data();
+    m_query.m_sub_grids = m_sub_grids.data();
+    m_query.m_cell_first_leaf = m_cell_first_leaf.data();
+    m_query.m_leaf_begin = m_leaf_begin.data();
+    m_query.m_leaf_end = m_leaf_end.data();
+    m_query.m_leaf_bounds = m_leaf_bounds.data();
+    m_query.m_nleafs = m_leaf_bounds.size();
+  }
+
+  ///
+  /// @brief gives a leaf index to the cell @p c if it is not divided, or
+  /// else to each of its sub-cells in turn
+  ///
+  void number_leafs(const int c) {
+    if (m_cells[c] >= 0) {
+      m_cells[c] = m_leaf_bounds.size();
+      m_leaf_bounds.push_back(m_cell_bounds[c]);
+    } else {
+      const sub_grid_type &sub_grid = m_sub_grids[-m_cells[c] - 1];
+      int nsub_cells = 1;
+      for (size_t i = 0; i < Traits::dimension; ++i) {
+        nsub_cells *= sub_grid.m_end_bucket[i] + 1;
+      }
+      const int first = sub_grid.m_first_cell;
+      for (int sub_cell = first; sub_cell < first + nsub_cells; ++sub_cell) {
+        number_leafs(sub_cell);
+      }
+    }
+  }
+
+  void update_iterator_impl() {}
+
+  void update_positions_impl(iterator update_begin, iterator update_end,
+                             const int new_n,
+                             const bool call_set_domain = true) {
+    ASSERT(update_begin == this->m_particles_begin &&
+               update_end == this->m_particles_end,
+           "error should be update all");
+
+    const bool reset_domain = call_set_domain ? set_domain_impl() : true;
+    update_query_pointers();
+
+    const int n = this->m_alive_indices.size();
+    const double_d *positions =
+        n > 0 ? iterator_to_raw_pointer(get<position>(this->m_particles_begin))
+              : nullptr;
+    const int *alive_indices = this->m_alive_indices.data();
+
+    // if the particle set is the same and no particle has changed leaf then
+    // the particles are still sorted
+    if (!reset_domain && new_n == 0 && update_end - update_begin == n &&
+        static_cast<int>(m_leaf_indices.size()) == n && n > 0) {
+      m_new_leaf_indices.resize(n);
+#ifdef HAVE_OPENMP
+#pragma omp parallel for if (detail::use_omp_backend<int *>(n))
+#endif
+      for (int i = 0; i < n; ++i) {
+        m_new_leaf_indices[i] = m_query.find_leaf(positions[alive_indices[i]]);
+      }
+      if (m_new_leaf_indices == m_leaf_indices) {
+        LOG(2, "AdaptiveCellList: no particles changed leaf");
+        m_reorder_needed = false;
+        return;
+      }
+    }
+    m_reorder_needed = true;
+
+    // find the top level cell of each particle, and from these the leafs
+    m_cell_indices.resize(n);
+#ifdef HAVE_OPENMP
+#pragma omp parallel for if (detail::use_omp_backend<int *>(n))
+#endif
+    for (int i = 0; i < n; ++i) {
+      m_cell_indices[i] = m_query.find_cell(positions[alive_indices[i]]);
+    }
+    build_leafs();
+
+    // sort the particles by their leaf index, and find the beginning and end
+    // of each leaf's list of particles
+    if (n > 0) {
+      detail::counting_sort_by_key(
+          m_leaf_indices.begin(), m_leaf_indices.end(),
+          this->m_alive_indices.begin(), m_leaf_begin.size(),
+          m_leaf_begin.begin(), m_leaf_end.begin());
+    } else {
+      std::fill(m_leaf_begin.begin(), m_leaf_begin.end(), 0);
+      std::fill(m_leaf_end.begin(), m_leaf_end.end(), 0);
+    }
+
+    LOG(2, "AdaptiveCellList: " << m_sub_grids.size()
+                                << " cells divided, giving "
+                                << m_leaf_begin.size() << " leafs");
+  }
+
+  const AdaptiveCellListQuery<Traits> &get_query_impl() const {
+    return m_query;
+  }
+
+  AdaptiveCellListQuery<Traits> &get_query_impl() { return m_query; }
+
+  // the leaf index of each undivided cell, or -1 minus the index into
+  // m_sub_grids of each divided cell. The first entries are the top level
+  // cells, followed by the sub-cells of each sub-grid
+  std::vector<int> m_cells;
+  std::vector<box_type> m_cell_bounds;
+  std::vector<sub_grid_type> m_sub_grids;
+
+  // the leafs of top level cell i are m_cell_first_leaf[i] to
+  // m_cell_first_leaf[i+1]-1
+  std::vector<int> m_cell_first_leaf;
+
+  // the particles in leaf i are m_leaf_begin[i] to m_leaf_end[i]-1
+  std::vector<unsigned int> m_leaf_begin;
+  std::vector<unsigned int> m_leaf_end;
+  std::vector<box_type> m_leaf_bounds;
+
+  // the top level cell and leaf of each particle
+  std::vector<int> m_cell_indices;
+  std::vector<int> m_leaf_indices;
+  std::vector<int> m_new_leaf_indices;
+
+  AdaptiveCellListQuery<Traits> m_query;
+
+  double_d m_bucket_side_length;
+  unsigned_int_d m_size;
+  size_t m_size_calculated_with_n;
+  bbox<Traits::dimension> m_size_calculated_with_bounds;
+  double m_size_calculated_with_n_in_leaf;
+  detail::point_to_bucket_index<Traits::dimension> m_point_to_bucket_index;
+  bool m_reorder_needed;
+};
+
+///
+/// @brief iterates through a range of the leafs of an AdaptiveCellList
+///
+template <typename Query> class adaptive_leaf_iterator {
+  typedef adaptive_leaf_iterator<Query> iterator;
+
+public:
+  typedef int value_type;
+  typedef const int *pointer;
+  typedef std::forward_iterator_tag iterator_category;
+  typedef const int &reference;
+  typedef std::ptrdiff_t difference_type;
+
+  adaptive_leaf_iterator() : m_leaf(0), m_end(0) {}
+
+  adaptive_leaf_iterator(const int begin, const int end)
+      : m_leaf(begin), m_end(end) {}
+
+  const adaptive_leaf_iterator &get_child_iterator() const { return *this; }
+
+  reference operator*() const { return m_leaf; }
+
+  pointer operator->() const { return &m_leaf; }
+
+  iterator &operator++() {
+    ++m_leaf;
+    return *this;
+  }
+
+  iterator operator++(int) {
+    iterator tmp(*this);
+    operator++();
+    return tmp;
+  }
+
+  size_t operator-(const iterator &start) const {
+    return m_leaf - start.m_leaf;
+  }
+
+  inline bool operator==(const iterator &rhs) const {
+    return m_leaf == rhs.m_leaf && m_end == rhs.m_end;
+  }
+
+  inline bool operator==(const bool rhs) const {
+    return (m_leaf < m_end) == rhs;
+  }
+
+  inline bool operator!=(const iterator &rhs) const { return !operator==(rhs); }
+
+  inline bool operator!=(const bool rhs) const { return !operator==(rhs); }
+
+private:
+  int m_leaf;
+  int m_end;
+};
+
+///
+/// @brief iterates through the leafs of an AdaptiveCellList that are within
+/// a given distance of a point.
+///
+/// The top level cells within the distance are found using a
+/// lattice_iterator_within_distance. For each divided cell the sub-cells
+/// that overlap the bounding box of the search region are visited in turn
+/// (or all the sub-cells if the search uses a transform)
+///
+template <typename Query, int LNormNumber, typename Transform>
+class adaptive_cell_iterator_within_distance {
+  typedef adaptive_cell_iterator_within_distance<Query, LNormNumber, Transform>
+      iterator;
+  static const unsigned int dimension = Query::dimension;
+  typedef Vector<double, dimension> double_d;
+  typedef Vector<int, dimension> int_d;
+  typedef detail::adaptive_sub_grid<dimension> sub_grid_type;
+  typedef lattice_iterator_within_distance<Query, LNormNumber, Transform>
+      cell_iterator;
+  typedef lattice_iterator<dimension> sub_cell_iterator;
+
+public:
+  typedef int value_type;
+  typedef const int *pointer;
+  typedef std::forward_iterator_tag iterator_category;
+  typedef const int &reference;
+  typedef std::ptrdiff_t difference_type;
+
+  adaptive_cell_iterator_within_distance()
+      : m_query(nullptr), m_depth(0), m_leaf(-1) {}
+
+  adaptive_cell_iterator_within_distance(const double_d &query_point,
+                                         const double max_distance,
+                                         const Query *query,
+                                         const Transform &transform)
+      : m_query_point(query_point), m_max_distance(max_distance),
+        m_query(query), m_cell(query_point, max_distance, query, transform),
+        m_depth(0), m_leaf(-1) {
+    settle();
+  }
+
+  typename Query::child_iterator get_child_iterator() const {
+    return typename Query::child_iterator(m_leaf, m_leaf + 1);
+  }
+
+  reference operator*() const { return m_leaf; }
+
+  pointer operator->() const { return &m_leaf; }
+
+  iterator &operator++() {
+    increment();
+    settle();
+    return *this;
+  }
+
+  iterator operator++(int) {
+    iterator tmp(*this);
+    operator++();
+    return tmp;
+  }
+
+  size_t operator-(const iterator &start) const {
+    size_t distance = 0;
+    iterator tmp = start;
+    while (tmp != *this) {
+      ++distance;
+      ++tmp;
+    }
+    return distance;
+  }
+
+  inline bool operator==(const iterator &rhs) const {
+    return m_leaf == rhs.m_leaf;
+  }
+
+  inline bool operator==(const bool rhs) const { return (m_leaf >= 0) == rhs; }
+
+  inline bool operator!=(const iterator &rhs) const { return !operator==(rhs); }
+
+  inline bool operator!=(const bool rhs) const { return !operator==(rhs); }
+
+private:
+  void increment() {
+    if (m_depth == 0) {
+      ++m_cell;
+    } else {
+      ++m_sub_cells[m_depth - 1];
+    }
+  }
+
+  ///
+  /// @brief moves to the next leaf from the current position, descending
+  /// into the sub-grid of each divided cell and back up again once all its
+  /// sub-cells have been visited
+  ///
+  void settle() {
+    while (true) {
+      int cell;
+      if (m_depth == 0) {
+        if (m_cell == false) {
+          m_leaf = -1;
+          return;
+        }
+        cell = m_query->m_point_to_bucket_index.collapse_index_vector(*m_cell);
+      } else {
+        const sub_cell_iterator &sub_cell = m_sub_cells[m_depth - 1];
+        if (sub_cell == false) {
+          --m_depth;
+          increment();
+          continue;
+        }
+        const sub_grid_type &grid = m_query->m_sub_grids[m_grids[m_depth - 1]];
+        cell = grid.m_first_cell +
+               grid.m_point_to_bucket_index.collapse_index_vector(*sub_cell);
+      }
+
+      const int value = m_query->m_cells[cell];
+      if (value >= 0) {
+        m_leaf = value;
+        return;
+      }
+      m_grids[m_depth] = -value - 1;
+      m_sub_cells[m_depth] = get_sub_cells(m_query->m_sub_grids[-value - 1]);
+      ++m_depth;
+    }
+  }
+
+  ///
+  /// @return an iterator to the sub-cells of @p grid that overlap the
+  /// bounding box of the search region
+  ///
+  sub_cell_iterator get_sub_cells(const sub_grid_type &grid) const {
+    int_d min_index = int_d::Constant(0);
+    int_d max_index = grid.m_end_bucket;
+    if (std::is_same<Transform, IdentityTransform>::value) {
+      const double_d distance = double_d::Constant(m_max_distance);
+      const int_d lower = grid.m_point_to_bucket_index.find_bucket_index_vector(
+          m_query_point - distance);
+      const int_d upper = grid.m_point_to_bucket_index.find_bucket_index_vector(
+          m_query_point + distance);
+      for (size_t i = 0; i < dimension; ++i) {
+        min_index[i] = std::max(lower[i], 0);
+        max_index[i] = std::min(upper[i], grid.m_end_bucket[i]);
+        if (min_index[i] > max_index[i]) {
+          return sub_cell_iterator();
+        }
+      }
+    }
+    return sub_cell_iterator(min_index, max_index + int_d::Constant(1));
+  }
+
+  double_d m_query_point;
+  double m_max_distance;
+  const Query *m_query;
+  cell_iterator m_cell;
+  sub_cell_iterator m_sub_cells[Query::max_levels - 1];
+  int m_grids[Query::max_levels - 1];
+  int m_depth;
+  int m_leaf;
+};
+
+/// @copydetails NeighbourQueryBase
+///
+/// @brief This is a query object for the AdaptiveCellList spatial data
+/// structure
+///
+template <typename Traits>
+struct AdaptiveCellListQuery : public NeighbourQueryBase<Traits> {
+
+  typedef Traits traits_type;
+  typedef typename Traits::raw_pointer raw_pointer;
+  typedef typename Traits::double_d double_d;
+  typedef typename Traits::bool_d bool_d;
+  typedef typename Traits::int_d int_d;
+  typedef typename Traits::unsigned_int_d unsigned_int_d;
+  const static unsigned int dimension = Traits::dimension;
+  template <int LNormNumber, typename Transform = IdentityTransform>
+  using query_iterator =
+      adaptive_cell_iterator_within_distance<AdaptiveCellListQuery,
+                                             LNormNumber, Transform>;
+  typedef adaptive_leaf_iterator<AdaptiveCellListQuery> child_iterator;
+  typedef child_iterator all_iterator;
+  typedef typename child_iterator::reference reference;
+  typedef typename child_iterator::pointer pointer;
+  typedef typename child_iterator::value_type value_type;
+  typedef ranges_iterator<Traits> particle_iterator;
+  typedef bbox<dimension> box_type;
+  typedef detail::adaptive_sub_grid<dimension> sub_grid_type;
+
+  ///
+  /// @brief the maximum number of levels of cells, including the top level
+  ///
+  const static unsigned int max_levels = 4;
+
+  ///
+  /// @brief pointer to the beginning of the particle set
+  ///
+  raw_pointer m_particles_begin;
+
+  ///
+  /// @brief pointer to the end of the particle set
+  ///
+  raw_pointer m_particles_end;
+
+  ///
+  /// @brief periodicity of the domain
+  ///
+  bool_d m_periodic;
+
+  ///
+  /// @brief dimensions of each cell
+  ///
+  double_d m_bucket_side_length;
+
+  ///
+  /// @brief index of the last cell in the grid
+  ///
+  int_d m_end_bucket;
+
+  ///
+  /// @brief min/max bounds of the domain
+  ///
+  bbox<dimension> m_bounds;
+
+  ///
+  /// @brief function object to transform a point to a cell index
+  ///
+  detail::point_to_bucket_index<dimension> m_point_to_bucket_index;
+
+  ///
+  /// @brief pointer to the leaf index of each cell and sub-cell, or -1 minus
+  /// the index of its sub-grid if it is divided
+  ///
+  const int *m_cells;
+
+  ///
+  /// @brief pointer to the sub-grids of the divided cells
+  ///
+  const sub_grid_type *m_sub_grids;
+
+  ///
+  /// @brief pointer to the index of the first leaf of each top level cell
+  ///
+  const int *m_cell_first_leaf;
+
+  ///
+  /// @brief pointer to the beginning of each leaf's particles
+  ///
+  const unsigned int *m_leaf_begin;
+
+  ///
+  /// @brief pointer to the end of each leaf's particles
+  ///
+  const unsigned int *m_leaf_end;
+
+  ///
+  /// @brief pointer to the bounds of each leaf
+  ///
+  const box_type *m_leaf_bounds;
+
+  ///
+  /// @brief the number of leafs
+  ///
+  int m_nleafs;
+
+  ///
+  /// @brief a pointer to the "key" values of the find-by-id map
+  ///
+  size_t *m_id_map_key;
+
+  ///
+  /// @brief a pointer to the "value" values of the find-by-id map
+  ///
+  size_t *m_id_map_value;
+
+  AdaptiveCellListQuery()
+      : m_cells(nullptr), m_sub_grids(nullptr), m_cell_first_leaf(nullptr),
+        m_leaf_begin(nullptr), m_leaf_end(nullptr),
+        m_leaf_bounds(nullptr), m_nleafs(0) {}
+
+  /*
+   * functions for id mapping
+   */
+
+  ///
+  /// @copydoc NeighbourQueryBase::find()
+  ///
+  raw_pointer find(const size_t id) const {
+    const size_t n = number_of_particles();
+    size_t *last = m_id_map_key + n;
+    size_t *first = detail::lower_bound(m_id_map_key, last, id);
+    if ((first != last) && !(id < *first)) {
+      return m_particles_begin + m_id_map_value[first - m_id_map_key];
+    } else {
+      return m_particles_begin + n;
+    }
+  }
+
+  /*
+   * functions for trees
+   */
+
+  ///
+  /// @copydoc NeighbourQueryBase::is_leaf_node()
+  ///
+  /// always true for AdaptiveCellList
+  ///
+  static bool is_leaf_node(const value_type &bucket) { return true; }
+
+  ///
+  /// @copydoc NeighbourQueryBase::is_tree()
+  ///
+  /// always false for AdaptiveCellList
+  ///
+  static bool is_tree() { return false; }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_children() const
+  ///
+  child_iterator get_children() const { return child_iterator(0, m_nleafs); }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_children(const child_iterator&) const
+  ///
+  child_iterator get_children(const child_iterator &ci) const {
+    return child_iterator();
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::num_children(const child_iterator&) const
+  ///
+  static size_t num_children(const child_iterator &ci) { return 0; }
+
+  ///
+  /// @copydoc NeighbourQueryBase::num_children() const
+  ///
+  size_t num_children() const { return number_of_buckets(); }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_bounds()
+  ///
+  const box_type &get_bounds(const child_iterator &ci) const {
+    return m_leaf_bounds[*ci];
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_bounds()
+  ///
+  const box_type &get_bounds() const { return m_bounds; }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_periodic()
+  ///
+  const bool_d &get_periodic() const { return m_periodic; }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_bucket_particles()
+  ///
+  particle_iterator get_bucket_particles(const reference bucket) const {
+    ASSERT(bucket >= 0 && bucket < m_nleafs, "invalid bucket");
+    return particle_iterator(m_particles_begin + m_leaf_begin[bucket],
+                             m_particles_begin + m_leaf_end[bucket]);
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_bucket_bbox()
+  ///
+  const box_type &get_bucket_bbox(const reference bucket) const {
+    return m_leaf_bounds[bucket];
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_bucket()
+  ///
+  child_iterator get_bucket(const double_d &position) const {
+    const int leaf = find_leaf(position);
+    return child_iterator(leaf, leaf + 1);
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_bucket_index()
+  ///
+  size_t get_bucket_index(const reference bucket) const { return bucket; }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_buckets_near_point()
+  ///
+  template <int LNormNumber, typename Transform = IdentityTransform>
+  query_iterator<LNormNumber, Transform>
+  get_buckets_near_point(const double_d &position, const double max_distance,
+                         const Transform &transform = Transform()) const {
+#ifndef __CUDA_ARCH__
+    LOG(4, "\tget_buckets_near_point: position = "
+               << position << " max_distance = " << max_distance);
+#endif
+    return query_iterator<LNormNumber, Transform>(position, max_distance, this,
+                                                  transform);
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_end_bucket()
+  ///
+  const int_d &get_end_bucket() const { return m_end_bucket; }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_subtree(const child_iterator&) const
+  ///
+  all_iterator get_subtree(const child_iterator &ci) const {
+    return all_iterator();
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_subtree() const
+  ///
+  all_iterator get_subtree() const { return all_iterator(0, m_nleafs); }
+
+  ///
+  /// @copydoc NeighbourQueryBase::number_of_buckets()
+  ///
+  /// This is the number of leafs
+  ///
+  size_t number_of_buckets() const { return m_nleafs; }
+
+  ///
+  /// @copydoc NeighbourQueryBase::number_of_particles()
+  ///
+  size_t number_of_particles() const {
+    return (m_particles_end - m_particles_begin);
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_particles_begin() const
+  ///
+  const raw_pointer &get_particles_begin() const { return m_particles_begin; }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_particles_begin()
+  ///
+  raw_pointer &get_particles_begin() { return m_particles_begin; }
+
+  ///
+  /// @copydoc NeighbourQueryBase::number_of_levels()
+  ///
+  /// always max_levels for AdaptiveCellList
+  ///
+  unsigned number_of_levels() const { return max_levels; }
+
+  ///
+  /// @return the index of the cell containing @p position (clamped to the
+  /// grid)
+  ///
+  int find_cell(const double_d &position) const {
+    int_d cell = m_point_to_bucket_index.find_bucket_index_vector(position);
+    for (size_t d = 0; d < dimension; ++d) {
+      cell[d] = std::min(std::max(cell[d], 0), m_end_bucket[d]);
+    }
+    return m_point_to_bucket_index.collapse_index_vector(cell);
+  }
+
+  ///
+  /// @return the index of the sub-cell of the divided cell @p cell that
+  /// contains @p position (clamped to the cell)
+  ///
+  int find_sub_cell(const double_d &position, const int cell) const {
+    const sub_grid_type &grid = m_sub_grids[-m_cells[cell] - 1];
+    int_d sub_cell =
+        grid.m_point_to_bucket_index.find_bucket_index_vector(position);
+    for (size_t d = 0; d < dimension; ++d) {
+      sub_cell[d] = std::min(std::max(sub_cell[d], 0), grid.m_end_bucket[d]);
+    }
+    return grid.m_first_cell +
+           grid.m_point_to_bucket_index.collapse_index_vector(sub_cell);
+  }
+
+  ///
+  /// @return the index of the leaf containing @p position
+  ///
+  int find_leaf(const double_d &position) const {
+    int cell = find_cell(position);
+    while (m_cells[cell] < 0) {
+      cell = find_sub_cell(position, cell);
+    }
+    return m_cells[cell];
+  }
+};
+
+} // namespace Aboria
+
+#endif /* ADAPTIVE_CELL_LIST_H_ */
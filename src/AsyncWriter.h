@@ -0,0 +1,311 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Aboria.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef ASYNC_WRITER_H_
+#define ASYNC_WRITER_H_
+
+#include "Log.h"
+#include "Snapshot.h"
+#include "VtuWriter.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Aboria {
+
+namespace detail {
+
+struct staged_column {
+  snapshot_column column;
+  std::vector<char> data;
+};
+
+///
+/// @brief a copy of some of the variables of a particle set, waiting to be
+/// written to a file by the AsyncWriter
+///
+struct staged_frame {
+  enum format_type { snapshot, vtu };
+
+  format_type format;
+  std::string filename;
+  unsigned int dimension;
+  size_t size;
+  std::vector<staged_column> columns;
+
+  /// for vtu frames, the positions are in the first column and these
+  /// describe the remaining columns
+  std::vector<vtk_column> vtk_columns;
+};
+
+} // namespace detail
+
+///
+/// @brief writes particle sets to file on a background thread, so that the
+/// simulation can carry on while the file is written.
+///
+/// Each call to a write function (write_snapshot() or write_vtu()) copies the
+/// selected variables of the particle set to a staging buffer, which is a
+/// parallel copy of a few contiguous blocks, and queues the buffer to be
+/// written by the background thread. If @p max_queued buffers are already
+/// waiting, the call blocks until the oldest has been written. Written buffers
+/// are reused, so with the default of one queued buffer the writer
+/// double-buffers: one frame is written while the next is staged.
+///
+/// The destructor waits for all queued frames to be written
+///
+class AsyncWriter {
+public:
+  explicit AsyncWriter(const size_t max_queued = 1)
+      : m_max_queued(max_queued), m_number_written(0), m_writing(false),
+        m_stop(false) {
+    CHECK(max_queued > 0, "AsyncWriter must be able to queue a frame");
+    m_thread = std::thread(&AsyncWriter::run, this);
+  }
+
+  AsyncWriter(const AsyncWriter &) = delete;
+  AsyncWriter &operator=(const AsyncWriter &) = delete;
+
+  ~AsyncWriter() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_condition.notify_all();
+    m_thread.join();
+  }
+
+  ///
+  /// @brief queue the variables @p Variables (or all variables if empty) of
+  /// @p particles to be written to the snapshot file @p filename
+  ///
+  /// @see write_snapshot()
+  ///
+  template <typename... Variables, typename ParticlesType>
+  void write_snapshot(const std::string &filename,
+                      const ParticlesType &particles) {
+    detail::staged_frame frame = get_frame();
+    frame.format = detail::staged_frame::snapshot;
+    frame.filename = filename;
+    stage<Variables...>(particles, frame);
+    push_frame(std::move(frame));
+  }
+
+  ///
+  /// @brief queue the positions and variables @p Variables (or all variables
+  /// if empty) of @p particles to be written to the VTK unstructured grid
+  /// file @p filename
+  ///
+  /// @see write_vtu()
+  ///
+  template <typename... Variables, typename ParticlesType>
+  void write_vtu(const std::string &filename, const ParticlesType &particles) {
+    detail::staged_frame frame = get_frame();
+    frame.format = detail::staged_frame::vtu;
+    frame.filename = filename;
+    frame.dimension = ParticlesType::dimension;
+    frame.size = particles.size();
+    std::vector<detail::vtk_column> columns;
+    mpl::for_each<
+        typename detail::select_variables<ParticlesType, Variables...>::type>(
+        detail::gather_vtk_columns<ParticlesType>(particles, columns));
+    std::vector<detail::column_copy> copies;
+    copies.push_back({reinterpret_cast<const char *>(
+                          detail::positions_data(particles)),
+                      nullptr,
+                      particles.size() * ParticlesType::dimension *
+                          sizeof(double)});
+    for (const detail::vtk_column &column : columns) {
+      copies.push_back({column.data, nullptr, column.bytes});
+    }
+    stage(copies, frame);
+    frame.vtk_columns = columns;
+    for (size_t i = 0; i < columns.size(); ++i) {
+      frame.vtk_columns[i].data = frame.columns[i + 1].data.data();
+    }
+    push_frame(std::move(frame));
+  }
+
+  ///
+  /// @brief wait until all the queued frames have been written
+  ///
+  void flush() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_condition.wait(lock, [this] { return m_queue.empty() && !m_writing; });
+  }
+
+  ///
+  /// @brief the number of frames written so far
+  ///
+  size_t number_written() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_number_written;
+  }
+
+private:
+  ///
+  /// @brief copies the variables of @p particles into the buffers of @p frame
+  ///
+  template <typename... Variables, typename ParticlesType>
+  void stage(const ParticlesType &particles, detail::staged_frame &frame) {
+    std::vector<detail::snapshot_column> columns;
+    std::vector<detail::column_copy> copies;
+    mpl::for_each<
+        typename detail::select_variables<ParticlesType, Variables...>::type>(
+        detail::gather_snapshot_columns<ParticlesType>(particles, columns,
+                                                       copies));
+    frame.dimension = ParticlesType::dimension;
+    frame.size = particles.size();
+    stage(copies, frame);
+    for (size_t i = 0; i < columns.size(); ++i) {
+      frame.columns[i].column = columns[i];
+    }
+  }
+
+  ///
+  /// @brief copies the sources of @p copies into the buffers of @p frame
+  ///
+  void stage(std::vector<detail::column_copy> &copies,
+             detail::staged_frame &frame) {
+    frame.columns.resize(copies.size());
+    for (size_t i = 0; i < copies.size(); ++i) {
+      frame.columns[i].data.resize(copies[i].bytes);
+      copies[i].dst = frame.columns[i].data.data();
+    }
+    detail::copy_columns(copies);
+  }
+
+  ///
+  /// @brief returns a written frame to reuse its buffers, once there is room
+  /// in the queue for it
+  ///
+  detail::staged_frame get_frame() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_condition.wait(lock,
+                     [this] { return m_queue.size() < m_max_queued; });
+    detail::staged_frame frame;
+    if (!m_free.empty()) {
+      frame = std::move(m_free.back());
+      m_free.pop_back();
+    }
+    return frame;
+  }
+
+  void push_frame(detail::staged_frame &&frame) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_queue.push_back(std::move(frame));
+    }
+    m_condition.notify_all();
+  }
+
+  static void write_frame(const detail::staged_frame &frame) {
+    switch (frame.format) {
+    case detail::staged_frame::snapshot: {
+      std::vector<detail::snapshot_column> columns(frame.columns.size());
+      std::vector<detail::column_copy> copies(frame.columns.size());
+      for (size_t i = 0; i < frame.columns.size(); ++i) {
+        columns[i] = frame.columns[i].column;
+        copies[i].src = frame.columns[i].data.data();
+        copies[i].bytes = frame.columns[i].data.size();
+      }
+      detail::write_snapshot(frame.filename, frame.dimension, frame.size,
+                             columns, copies);
+      break;
+    }
+    case detail::staged_frame::vtu:
+      detail::write_vtu(
+          frame.filename, frame.dimension, frame.size,
+          reinterpret_cast<const double *>(frame.columns[0].data.data()),
+          frame.vtk_columns);
+      break;
+    }
+  }
+
+  ///
+  /// @brief the background thread, writes frames until the writer is
+  /// destroyed and the queue is empty
+  ///
+  void run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+      m_condition.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+      if (m_queue.empty()) {
+        return;
+      }
+      detail::staged_frame frame = std::move(m_queue.front());
+      m_queue.pop_front();
+      m_writing = true;
+      lock.unlock();
+
+      write_frame(frame);
+
+      lock.lock();
+      m_writing = false;
+      ++m_number_written;
+      m_free.push_back(std::move(frame));
+      m_condition.notify_all();
+    }
+  }
+
+  /// the maximum number of frames waiting to be written
+  const size_t m_max_queued;
+
+  /// the frames waiting to be written, oldest first
+  std::deque<detail::staged_frame> m_queue;
+
+  /// written frames, kept to reuse their buffers
+  std::vector<detail::staged_frame> m_free;
+
+  size_t m_number_written;
+
+  /// true while the background thread writes a frame
+  bool m_writing;
+
+  /// set by the destructor to stop the background thread
+  bool m_stop;
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::thread m_thread;
+};
+
+} // namespace Aboria
+
+#endif /* ASYNC_WRITER_H_ */
@@ -86,7 +86,9 @@ public:
   CellList()
       : base_type(),
         m_size_calculated_with_n(std::numeric_limits<size_t>::max()),
-        m_serial(detail::concurrent_processes<Traits>() == 1) {}
+        m_size_calculated_with_n_in_leaf(0),
+        m_serial(detail::concurrent_processes<Traits>() == 1),
+        m_bucket_ordering(bucket_ordering::lexicographic) {}
 
   ///
   /// @brief This structure is not ordered. That is, the order of the particles
@@ -95,6 +97,30 @@ public:
   ///
   static constexpr bool ordered() { return false; }
 
+  ///
+  /// @brief replicates the particles within @p width of each periodic face of
+  /// the domain into a layer of halo cells around it.
+  ///
+  /// Searches of up to @p width around a point in the domain using
+  /// for_each_neighbour() (and so the Verlet lists and symbolic sums) then
+  /// loop over a plain box of cells, rather than searching each periodic
+  /// image of the point. The halo is rebuilt at every update. Set to 0 (the
+  /// default) to disable
+  ///
+  /// @param width the largest search distance that uses the halo, which must
+  /// be no larger than the width of the domain in each periodic dimension
+  ///
+  void set_ghost_width(const double width) {
+    m_ghosts.m_width = width;
+    update_ghosts();
+  }
+
+  ///
+  /// @return the largest search distance that uses the halo
+  /// @see set_ghost_width()
+  ///
+  double get_ghost_width() const { return m_ghosts.m_width; }
+
   struct delete_points_in_bucket_lambda;
   struct insert_points_lambda_sequential_serial;
   struct insert_points_lambda_non_sequential_serial;
@@ -143,8 +169,14 @@ private:
   bool set_domain_impl() {
     const size_t n = this->m_particles_end - this->m_particles_begin;
     if (n < 0.5 * m_size_calculated_with_n ||
-        n > 2 * m_size_calculated_with_n) {
+        n > 2 * m_size_calculated_with_n ||
+        m_bucket_ordering != this->m_bucket_ordering ||
+        (this->m_bounds.bmin != m_size_calculated_with_bounds.bmin).any() ||
+        (this->m_bounds.bmax != m_size_calculated_with_bounds.bmax).any() ||
+        this->m_n_particles_in_leaf != m_size_calculated_with_n_in_leaf) {
       m_size_calculated_with_n = n;
+      m_size_calculated_with_bounds = this->m_bounds;
+      m_size_calculated_with_n_in_leaf = this->m_n_particles_in_leaf;
       LOG(2, "CellList: recalculating bucket size");
       if (this->m_n_particles_in_leaf > n) {
         m_size = unsigned_int_d::Constant(1);
@@ -166,15 +198,14 @@ private:
       }
       m_bucket_side_length =
           (this->m_bounds.bmax - this->m_bounds.bmin) / m_size;
-      m_point_to_bucket_index =
-          detail::point_to_bucket_index<Traits::dimension>(
-              m_size, m_bucket_side_length, this->m_bounds);
+      set_bucket_ordering_impl();
 
       LOG(2, "\tbucket side length = " << m_bucket_side_length);
       LOG(2, "\tnumber of buckets = " << m_size << " (total=" << m_size.prod()
                                       << ")");
 
       m_buckets.assign(m_size.prod(), detail::get_empty_id());
+      m_dirty_buckets.clear();
 
       // TODO: should always be true?
       m_use_dirty_cells = true;
@@ -194,6 +225,43 @@ private:
     }
   }
 
+  ///
+  /// @brief (re)calculate the mapping between bucket coordinates and bucket
+  /// index according to the current bucket ordering
+  ///
+  void set_bucket_ordering_impl() {
+    m_bucket_ordering = this->m_bucket_ordering;
+    if (m_bucket_ordering == bucket_ordering::lexicographic) {
+      m_bucket_order.clear();
+      m_bucket_inverse_order.clear();
+    } else {
+      std::vector<int> order, inverse_order;
+      detail::bucket_ordering_maps(m_size, m_bucket_ordering, order,
+                                   inverse_order);
+      m_bucket_order.assign(order.begin(), order.end());
+      m_bucket_inverse_order.assign(inverse_order.begin(),
+                                    inverse_order.end());
+    }
+    update_bucket_ordering_pointers();
+  }
+
+  ///
+  /// @brief point m_point_to_bucket_index (and the copy held by the query) at
+  /// this object's bucket ordering tables. These raw pointers are invalidated
+  /// whenever the container is copied, so this is called on every update
+  ///
+  void update_bucket_ordering_pointers() {
+    m_point_to_bucket_index = detail::point_to_bucket_index<Traits::dimension>(
+        m_size, m_bucket_side_length, this->m_bounds,
+        m_bucket_order.empty()
+            ? nullptr
+            : iterator_to_raw_pointer(m_bucket_order.begin()),
+        m_bucket_inverse_order.empty()
+            ? nullptr
+            : iterator_to_raw_pointer(m_bucket_inverse_order.begin()));
+    this->m_query.m_point_to_bucket_index = m_point_to_bucket_index;
+  }
+
   ///
   /// @brief check that the data structure is internally consistent
   ///
@@ -246,10 +314,30 @@ private:
   }
 
   ///
-  /// @brief called by base class, does nothing for this data structure
+  /// @brief called by base class, rebuilds the halo of periodic images (if
+  /// enabled) after the particles are reordered
   ///
   void update_iterator_impl() {
     // check_data_structure();
+    update_ghosts();
+  }
+
+  ///
+  /// @brief (re)builds the halo of periodic images, if enabled
+  ///
+  void update_ghosts() {
+    const size_t n = this->m_particles_end - this->m_particles_begin;
+    if (m_ghosts.m_width > 0 && this->domain_has_been_set() &&
+        this->m_periodic.any()) {
+      m_ghosts.build(
+          n > 0 ? iterator_to_raw_pointer(get<position>(this->m_particles_begin))
+                : nullptr,
+          n, this->m_bounds, this->m_periodic, m_bucket_side_length,
+          m_size.template cast<int>());
+      m_query.m_ghosts = &m_ghosts;
+    } else {
+      m_query.m_ghosts = nullptr;
+    }
   }
 
   ///
@@ -272,6 +360,10 @@ private:
     // if call_set_domain == false then set_domain_impl() has already
     // been called, and returned true
     const bool reset_domain = call_set_domain ? set_domain_impl() : true;
+
+    // the query's raw pointers are stale if this object has been copied
+    update_bucket_ordering_pointers();
+    this->m_query.m_buckets_begin = iterator_to_raw_pointer(m_buckets.begin());
     const size_t n_update = update_end - update_begin;
     const size_t n_alive = this->m_alive_indices.size();
     const size_t n_dead_in_update = n_update - n_alive;
@@ -398,6 +490,11 @@ private:
 
     this->m_query.m_linked_list_begin =
         iterator_to_raw_pointer(this->m_linked_list.begin());
+
+    // otherwise the halo is rebuilt once the dead particles are removed
+    if (n_dead_in_update == 0) {
+      update_ghosts();
+    }
   }
 
   ///
@@ -533,6 +630,16 @@ private:
   ///
   size_t m_size_calculated_with_n;
 
+  ///
+  /// @brief last resizing of the buckets occurred with this domain
+  ///
+  bbox<Traits::dimension> m_size_calculated_with_bounds;
+
+  ///
+  /// @brief last resizing of the buckets occurred with this bucket size
+  ///
+  double m_size_calculated_with_n_in_leaf;
+
   ///
   /// @brief running with multiple processes, or on gpu
   ///
@@ -552,6 +659,23 @@ private:
   /// @brief struct to convert a point to a bucket index
   ///
   detail::point_to_bucket_index<Traits::dimension> m_point_to_bucket_index;
+
+  ///
+  /// @brief the bucket ordering used to calculate m_point_to_bucket_index
+  ///
+  bucket_ordering m_bucket_ordering;
+
+  ///
+  /// @brief maps between lexicographic and space-filling curve bucket
+  /// indices, empty for lexicographic ordering
+  ///
+  vector_int m_bucket_order;
+  vector_int m_bucket_inverse_order;
+
+  ///
+  /// @brief periodic images for the halo, see set_ghost_width()
+  ///
+  detail::ghost_layer<Traits::dimension> m_ghosts;
 };
 
 ///
@@ -986,13 +1110,18 @@ struct CellListQuery : public NeighbourQueryBase<Traits> {
   ///
   size_t *m_id_map_value;
 
+  ///
+  /// @brief the halo of periodic images, nullptr if disabled
+  ///
+  const detail::ghost_layer<dimension> *m_ghosts;
+
   ///
   /// @brief constructor checks that we are not using std::vector and cuda
   /// at the same time
   ///
   ABORIA_HOST_DEVICE_IGNORE_WARN
   CUDA_HOST_DEVICE
-  CellListQuery() {
+  CellListQuery() : m_ghosts(nullptr) {
 #if defined(__CUDA_ARCH__)
     CHECK_CUDA((!std::is_same<typename Traits::template vector<double>,
                               std::vector<double>>::value),
@@ -90,6 +90,7 @@ class CellListOrdered
   typedef typename Traits::vector_unsigned_int_iterator
       vector_unsigned_int_iterator;
   typedef typename Traits::vector_unsigned_int vector_unsigned_int;
+  typedef typename Traits::vector_int vector_int;
   typedef typename Traits::unsigned_int_d unsigned_int_d;
   typedef typename Traits::iterator iterator;
   typedef CellListOrdered_params<Traits> params_type;
@@ -103,10 +104,67 @@ class CellListOrdered
 public:
   CellListOrdered()
       : base_type(),
-        m_size_calculated_with_n(std::numeric_limits<size_t>::max()) {}
+        m_size_calculated_with_n(std::numeric_limits<size_t>::max()),
+        m_size_calculated_with_n_in_leaf(0),
+        m_bucket_ordering(bucket_ordering::lexicographic),
+        m_incremental_threshold(0.1), m_reorder_needed(true) {}
 
   static constexpr bool ordered() { return true; }
 
+  ///
+  /// @brief sets the maximum fraction of particles that can change bucket
+  /// between updates before a full rebuild is triggered.
+  ///
+  /// If the particle set is the same (i.e. no particles added or deleted)
+  /// and fewer than this fraction of particles have changed bucket since the
+  /// last update, only the particles that have moved are re-inserted into the
+  /// (already sorted) particle order. Set to 0 to always do a full rebuild.
+  ///
+  /// @param fraction fraction of particles, default 0.1
+  ///
+  void set_incremental_update_threshold(const double fraction) {
+    m_incremental_threshold = fraction;
+  }
+
+  ///
+  /// @return the fraction of particles that can change bucket before a full
+  /// rebuild is triggered
+  /// @see set_incremental_update_threshold()
+  ///
+  double get_incremental_update_threshold() const {
+    return m_incremental_threshold;
+  }
+
+  ///
+  /// @return false if the last update left every particle where it was, so
+  /// the particle set does not need to be reordered
+  ///
+  bool reorder_needed() const { return m_reorder_needed; }
+
+  ///
+  /// @brief replicates the particles within @p width of each periodic face of
+  /// the domain into a layer of halo cells around it.
+  ///
+  /// Searches of up to @p width around a point in the domain using
+  /// for_each_neighbour() (and so the Verlet lists and symbolic sums) then
+  /// loop over a plain box of cells, rather than searching each periodic
+  /// image of the point. The halo is rebuilt at every update. Set to 0 (the
+  /// default) to disable
+  ///
+  /// @param width the largest search distance that uses the halo, which must
+  /// be no larger than the width of the domain in each periodic dimension
+  ///
+  void set_ghost_width(const double width) {
+    m_ghosts.m_width = width;
+    update_ghosts();
+  }
+
+  ///
+  /// @return the largest search distance that uses the halo
+  /// @see set_ghost_width()
+  ///
+  double get_ghost_width() const { return m_ghosts.m_width; }
+
   struct delete_points_lambda;
 
   void print_data_structure() const {
@@ -132,9 +190,15 @@ private:
   bool set_domain_impl() {
     const size_t n = this->m_alive_indices.size();
     if (n < 0.5 * m_size_calculated_with_n ||
-        n > 2 * m_size_calculated_with_n) {
+        n > 2 * m_size_calculated_with_n ||
+        m_bucket_ordering != this->m_bucket_ordering ||
+        (this->m_bounds.bmin != m_size_calculated_with_bounds.bmin).any() ||
+        (this->m_bounds.bmax != m_size_calculated_with_bounds.bmax).any() ||
+        this->m_n_particles_in_leaf != m_size_calculated_with_n_in_leaf) {
       LOG(2, "CellListOrdered: recalculating bucket size");
       m_size_calculated_with_n = n;
+      m_size_calculated_with_bounds = this->m_bounds;
+      m_size_calculated_with_n_in_leaf = this->m_n_particles_in_leaf;
       if (this->m_n_particles_in_leaf > n) {
         m_size = unsigned_int_d::Constant(1);
       } else {
@@ -155,9 +219,7 @@ private:
       }
       m_bucket_side_length =
           (this->m_bounds.bmax - this->m_bounds.bmin) / m_size;
-      m_point_to_bucket_index =
-          detail::point_to_bucket_index<Traits::dimension>(
-              m_size, m_bucket_side_length, this->m_bounds);
+      set_bucket_ordering_impl();
 
       LOG(2, "\tbucket side length = " << m_bucket_side_length);
       LOG(2, "\tnumber of buckets = " << m_size << " (total=" << m_size.prod()
@@ -167,6 +229,9 @@ private:
       m_bucket_begin.resize(m_size.prod());
       m_bucket_end.resize(m_size.prod());
 
+      // the bucket indices of the last update are no longer valid
+      m_bucket_indices.clear();
+
       this->m_query.m_bucket_begin =
           iterator_to_raw_pointer(m_bucket_begin.begin());
       this->m_query.m_bucket_end =
@@ -185,7 +250,153 @@ private:
     }
   }
 
-  void update_iterator_impl() {}
+  ///
+  /// @brief (re)calculate the mapping between bucket coordinates and bucket
+  /// index according to the current bucket ordering
+  ///
+  void set_bucket_ordering_impl() {
+    m_bucket_ordering = this->m_bucket_ordering;
+    if (m_bucket_ordering == bucket_ordering::lexicographic) {
+      m_bucket_order.clear();
+      m_bucket_inverse_order.clear();
+    } else {
+      std::vector<int> order, inverse_order;
+      detail::bucket_ordering_maps(m_size, m_bucket_ordering, order,
+                                   inverse_order);
+      m_bucket_order.assign(order.begin(), order.end());
+      m_bucket_inverse_order.assign(inverse_order.begin(),
+                                    inverse_order.end());
+    }
+    update_bucket_ordering_pointers();
+  }
+
+  ///
+  /// @brief point m_point_to_bucket_index (and the copy held by the query) at
+  /// this object's bucket ordering tables. These raw pointers are invalidated
+  /// whenever the container is copied, so this is called on every update
+  ///
+  void update_bucket_ordering_pointers() {
+    m_point_to_bucket_index = detail::point_to_bucket_index<Traits::dimension>(
+        m_size, m_bucket_side_length, this->m_bounds,
+        m_bucket_order.empty()
+            ? nullptr
+            : iterator_to_raw_pointer(m_bucket_order.begin()),
+        m_bucket_inverse_order.empty()
+            ? nullptr
+            : iterator_to_raw_pointer(m_bucket_inverse_order.begin()));
+    this->m_query.m_point_to_bucket_index = m_point_to_bucket_index;
+  }
+
+  void update_iterator_impl() { update_ghosts(); }
+
+  ///
+  /// @brief (re)builds the halo of periodic images, if enabled
+  ///
+  void update_ghosts() {
+    const size_t n = this->m_particles_end - this->m_particles_begin;
+    if (m_ghosts.m_width > 0 && this->domain_has_been_set() &&
+        this->m_periodic.any()) {
+      m_ghosts.build(
+          n > 0 ? iterator_to_raw_pointer(get<position>(this->m_particles_begin))
+                : nullptr,
+          n, this->m_bounds, this->m_periodic, m_bucket_side_length,
+          m_size.template cast<int>());
+      m_query.m_ghosts = &m_ghosts;
+    } else {
+      m_query.m_ghosts = nullptr;
+    }
+  }
+
+  ///
+  /// @brief try to update the data structure by only moving the particles that
+  /// have changed bucket.
+  ///
+  /// The particles are still stored in the order given by the last update,
+  /// so m_bucket_indices holds the (sorted) old bucket index of each. Those
+  /// that have not moved remain sorted, so the new order is found by sorting
+  /// the few that have moved and merging them back in.
+  ///
+  /// @return false if too many particles have moved, in which case the
+  /// new bucket indices are left in m_bucket_indices and the caller
+  /// should do a full rebuild
+  ///
+  bool update_positions_incremental(std::true_type) {
+    const size_t n = m_bucket_indices.size();
+    m_new_bucket_indices.resize(n);
+    detail::transform(get<position>(this->m_particles_begin),
+                      get<position>(this->m_particles_begin) + n,
+                      m_new_bucket_indices.begin(), m_point_to_bucket_index);
+
+    m_moved_indices.clear();
+    for (size_t i = 0; i < n; ++i) {
+      if (m_new_bucket_indices[i] != m_bucket_indices[i]) {
+        m_moved_indices.push_back(i);
+        if (m_moved_indices.size() > m_incremental_threshold * n) {
+          m_bucket_indices.swap(m_new_bucket_indices);
+          return false;
+        }
+      }
+    }
+
+    LOG(2, "CellListOrdered: incremental update, "
+               << m_moved_indices.size() << " particles changed bucket");
+    if (m_moved_indices.empty()) {
+      // m_alive_indices is already the identity
+      m_reorder_needed = false;
+      update_ghosts();
+      return true;
+    }
+
+    // update bucket ranges using the change in each bucket's size
+    const size_t nbuckets = m_bucket_begin.size();
+    for (size_t b = 0; b < nbuckets; ++b) {
+      m_bucket_end[b] -= m_bucket_begin[b];
+    }
+    for (const int i : m_moved_indices) {
+      --m_bucket_end[m_bucket_indices[i]];
+      ++m_bucket_end[m_new_bucket_indices[i]];
+    }
+    unsigned int sum = 0;
+    for (size_t b = 0; b < nbuckets; ++b) {
+      m_bucket_begin[b] = sum;
+      sum += m_bucket_end[b];
+      m_bucket_end[b] = sum;
+    }
+
+    // merge the (sorted) moved particles with those that haven't moved,
+    // within a bucket the moved particles go last
+    const auto &new_keys = m_new_bucket_indices;
+    std::sort(m_moved_indices.begin(), m_moved_indices.end(),
+              [&new_keys](const int a, const int b) {
+                return new_keys[a] < new_keys[b] ||
+                       (new_keys[a] == new_keys[b] && a < b);
+              });
+    auto &order = this->m_alive_indices;
+    size_t next_moved = 0;
+    size_t out = 0;
+    for (size_t i = 0; i < n; ++i) {
+      if (new_keys[i] != m_bucket_indices[i]) {
+        continue;
+      }
+      while (next_moved < m_moved_indices.size() &&
+             new_keys[m_moved_indices[next_moved]] < new_keys[i]) {
+        order[out++] = m_moved_indices[next_moved++];
+      }
+      order[out++] = i;
+    }
+    while (next_moved < m_moved_indices.size()) {
+      order[out++] = m_moved_indices[next_moved++];
+    }
+
+    detail::gather(order.begin(), order.end(), m_new_bucket_indices.begin(),
+                   m_bucket_indices.begin());
+    return true;
+  }
+
+  bool update_positions_incremental(std::false_type) {
+    ASSERT(false, "incremental update only implemented for std iterators");
+    return false;
+  }
 
   void update_positions_impl(iterator update_begin, iterator update_end,
                              const int new_n,
@@ -195,13 +406,33 @@ private:
                update_end == this->m_particles_end,
            "error should be update all");
 
-    if (call_set_domain) {
-      set_domain_impl();
-    }
+    const bool reset_domain = call_set_domain ? set_domain_impl() : true;
+
+    // the query's raw pointers are stale if this object has been copied
+    update_bucket_ordering_pointers();
+    this->m_query.m_bucket_begin =
+        iterator_to_raw_pointer(m_bucket_begin.begin());
+    this->m_query.m_bucket_end = iterator_to_raw_pointer(m_bucket_end.begin());
+
+    typedef typename detail::is_std_iterator<vector_unsigned_int_iterator>::type
+        is_std;
 
     const size_t n = this->m_alive_indices.size();
+    m_reorder_needed = true;
+    bool calculate_bucket_indices = true;
+    if (is_std::value && m_incremental_threshold > 0 && !reset_domain &&
+        new_n == 0 && static_cast<size_t>(update_end - update_begin) == n &&
+        m_bucket_indices.size() == n && n > 0) {
+      if (update_positions_incremental(is_std())) {
+        return;
+      }
+      // too many particles changed bucket, but the new bucket indices have
+      // already been calculated
+      calculate_bucket_indices = false;
+    }
+
     m_bucket_indices.resize(n);
-    if (n > 0) {
+    if (n > 0 && calculate_bucket_indices) {
       // transform the points to their bucket indices
       if (static_cast<size_t>(update_end - update_begin) == n) {
         // m_alive_indicies is just a sequential list of indices
@@ -221,22 +452,17 @@ private:
                               this->m_alive_indices.end()),
                           m_bucket_indices.begin(), m_point_to_bucket_index);
       }
-
-      // sort the points by their bucket index
-      detail::sort_by_key(m_bucket_indices.begin(), m_bucket_indices.end(),
-                          this->m_alive_indices.begin());
     }
 
-    // find the beginning of each bucket's list of points
-    auto search_begin = Traits::make_counting_iterator(0);
-    detail::lower_bound(m_bucket_indices.begin(), m_bucket_indices.end(),
-                        search_begin, search_begin + m_size.prod(),
-                        m_bucket_begin.begin());
-
-    // find the end of each bucket's list of points
-    detail::upper_bound(m_bucket_indices.begin(), m_bucket_indices.end(),
-                        search_begin, search_begin + m_size.prod(),
-                        m_bucket_end.begin());
+    if (n > 0) {
+      // sort the points by their bucket index, and find the beginning and
+      // end of each bucket's list of points
+      sort_by_bucket_index(
+          std::integral_constant<bool, Traits::is_out_of_core>());
+    } else {
+      detail::fill(m_bucket_begin.begin(), m_bucket_begin.end(), 0);
+      detail::fill(m_bucket_end.begin(), m_bucket_end.end(), 0);
+    }
 
 #ifndef __CUDA_ARCH__
     if (4 <= ABORIA_LOG_LEVEL) {
@@ -256,6 +482,32 @@ private:
       LOG(4, "\tend particles:");
     }
 #endif
+
+    // otherwise the halo is rebuilt once the particles are reordered
+    if (!m_reorder_needed) {
+      update_ghosts();
+    }
+  }
+
+  void sort_by_bucket_index(std::false_type) {
+    detail::counting_sort_by_key(
+        m_bucket_indices.begin(), m_bucket_indices.end(),
+        this->m_alive_indices.begin(), m_size.prod(), m_bucket_begin.begin(),
+        m_bucket_end.begin());
+  }
+
+  // out-of-core particle sets are sorted in partitions that fit in
+  // get_out_of_core_threshold() bytes of memory, using temporary vectors
+  // that are themselves stored out-of-core
+  void sort_by_bucket_index(std::true_type) {
+    const size_t n = m_bucket_indices.size();
+    vector_unsigned_int sorted_bucket_indices(n);
+    vector_int sorted_alive_indices(n);
+    detail::external_counting_sort_by_key(
+        m_bucket_indices.begin(), m_bucket_indices.end(),
+        this->m_alive_indices.begin(), m_size.prod(), m_bucket_begin.begin(),
+        m_bucket_end.begin(), sorted_bucket_indices.begin(),
+        sorted_alive_indices.begin(), get_out_of_core_threshold());
   }
 
   const CellListOrderedQuery<Traits> &get_query_impl() const { return m_query; }
@@ -274,7 +526,24 @@ private:
   double_d m_bucket_side_length;
   unsigned_int_d m_size;
   size_t m_size_calculated_with_n;
+  bbox<Traits::dimension> m_size_calculated_with_bounds;
+  double m_size_calculated_with_n_in_leaf;
   detail::point_to_bucket_index<Traits::dimension> m_point_to_bucket_index;
+
+  // maps between lexicographic and space-filling curve bucket indices, empty
+  // for lexicographic ordering
+  bucket_ordering m_bucket_ordering;
+  vector_int m_bucket_order;
+  vector_int m_bucket_inverse_order;
+
+  // storage for the incremental update
+  double m_incremental_threshold;
+  bool m_reorder_needed;
+  vector_unsigned_int m_new_bucket_indices;
+  std::vector<int> m_moved_indices;
+
+  // periodic images for the halo, see set_ghost_width()
+  detail::ghost_layer<Traits::dimension> m_ghosts;
 };
 
 /// @copydetails NeighbourQueryBase
@@ -363,9 +632,14 @@ struct CellListOrderedQuery : public NeighbourQueryBase<Traits> {
   ///
   size_t *m_id_map_value;
 
+  ///
+  /// @brief the halo of periodic images, nullptr if disabled
+  ///
+  const detail::ghost_layer<dimension> *m_ghosts;
+
   ABORIA_HOST_DEVICE_IGNORE_WARN
   CUDA_HOST_DEVICE
-  CellListOrderedQuery() {}
+  CellListOrderedQuery() : m_ghosts(nullptr) {}
 
   /*
    * functions for id mapping
@@ -0,0 +1,778 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Aboria.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef HASHED_CELL_LIST_H_
+#define HASHED_CELL_LIST_H_
+
+#include "CudaInclude.h"
+#include "Get.h"
+#include "NeighbourSearchBase.h"
+#include "SpatialUtil.h"
+#include "Traits.h"
+#include "Vector.h"
+#include "detail/Algorithms.h"
+
+#include "Log.h"
+#include <iostream>
+
+namespace Aboria {
+
+template <typename Traits> struct HashedCellListQuery;
+
+/// @brief A sparse cell list spatial data structure that is paired with a
+/// HashedCellListQuery query type
+///
+/// Like CellListOrdered, the domain is divided up into a regular grid of
+/// constant size "buckets", and the particle set is reordered so that the
+/// particles in each bucket are sequential in memory. The difference is that
+/// only the occupied buckets are stored, and these are found using an
+/// open-addressing hash table keyed by the bucket's (64-bit) lattice index.
+/// Finding a bucket is still O(1), but the memory used scales with the number
+/// of particles rather than the volume of the domain, which suits very large
+/// or mostly empty domains.
+///
+/// The bucket side length is chosen so that the occupied buckets hold
+/// roughly `n_particles_in_leaf` particles on average, rather than the
+/// domain as a whole. Only the host (std::vector) storage is supported
+///
+template <typename Traits>
+class HashedCellList
+    : public neighbour_search_base<HashedCellList<Traits>, Traits,
+                                   HashedCellListQuery<Traits>> {
+
+  typedef typename Traits::double_d double_d;
+  typedef typename Traits::int_d int_d;
+  typedef typename Traits::unsigned_int_d unsigned_int_d;
+  typedef typename Traits::position position;
+  typedef typename Traits::iterator iterator;
+  typedef typename HashedCellListQuery<Traits>::value_type cell_type;
+
+  typedef neighbour_search_base<HashedCellList<Traits>, Traits,
+                                HashedCellListQuery<Traits>>
+      base_type;
+
+  friend base_type;
+
+public:
+  HashedCellList()
+      : base_type(),
+        m_size_calculated_with_n(std::numeric_limits<size_t>::max()),
+        m_reorder_needed(true) {}
+
+  static constexpr bool ordered() { return true; }
+
+  ///
+  /// @return false if the last update left every particle in the same
+  /// bucket, so the particle set does not need to be reordered
+  ///
+  bool reorder_needed() const { return m_reorder_needed; }
+
+  void print_data_structure() const {
+#ifndef __CUDA_ARCH__
+    LOG(1, "\toccupied buckets:");
+    for (size_t i = 0; i < m_cells.size(); ++i) {
+      LOG(1, "\ti = " << i << " bucket = " << m_cells[i]
+                      << " bucket contents = " << m_bucket_begin[i] << " to "
+                      << m_bucket_end[i]);
+    }
+    LOG(1, "\tend buckets");
+#endif
+  }
+
+private:
+  bool set_domain_impl() {
+    // the bucket size depends on the particle positions, so is recalculated
+    // at the next update. Until then there is a single empty bucket
+    m_size_calculated_with_n = std::numeric_limits<size_t>::max();
+    set_size(int_d::Constant(1));
+    m_new_cell_keys.clear();
+    build_cells();
+    return true;
+  }
+
+  ///
+  /// @brief sets the number of buckets along each side of the domain
+  ///
+  void set_size(const int_d &size) {
+    m_size = size;
+    m_bucket_side_length = (this->m_bounds.bmax - this->m_bounds.bmin) / m_size;
+    m_point_to_bucket_index = detail::point_to_bucket_index<Traits::dimension>(
+        m_size.template cast<unsigned int>(), m_bucket_side_length,
+        this->m_bounds);
+
+    m_query.m_bucket_side_length = m_bucket_side_length;
+    m_query.m_bounds.bmin = this->m_bounds.bmin;
+    m_query.m_bounds.bmax = this->m_bounds.bmax;
+    m_query.m_periodic = this->m_periodic;
+    m_query.m_end_bucket = m_size - 1;
+    m_query.m_size = m_size;
+    m_query.m_point_to_bucket_index = m_point_to_bucket_index;
+  }
+
+  ///
+  /// @return the key of the bucket containing @p p
+  ///
+  uint64_t find_cell_key(const double_d &p) const {
+    int_d cell = m_point_to_bucket_index.find_bucket_index_vector(p);
+    for (size_t d = 0; d < Traits::dimension; ++d) {
+      cell[d] = std::min(std::max(cell[d], 0), m_size[d] - 1);
+    }
+    return detail::collapse_cell_key(cell, m_size);
+  }
+
+  ///
+  /// @brief calculates the key of the bucket containing each alive particle
+  ///
+  void calculate_cell_keys(std::vector<uint64_t> &keys) const {
+    const int n = this->m_alive_indices.size();
+    keys.resize(n);
+    if (n == 0) {
+      return;
+    }
+    const double_d *positions =
+        iterator_to_raw_pointer(get<position>(this->m_particles_begin));
+    const int *alive_indices = this->m_alive_indices.data();
+#ifdef HAVE_OPENMP
+#pragma omp parallel for if (detail::use_omp_backend<int *>(n))
+#endif
+    for (int i = 0; i < n; ++i) {
+      keys[i] = find_cell_key(positions[alive_indices[i]]);
+    }
+  }
+
+  ///
+  /// @brief chooses the bucket size so that the occupied buckets hold about
+  /// `n_particles_in_leaf` particles.
+  ///
+  /// The first guess assumes the particles fill the domain. Where they only
+  /// fill part of it, the occupied buckets hold too many particles, so the
+  /// side length is reduced in proportion to this excess until the average
+  /// is close enough
+  ///
+  void calculate_size() {
+    const unsigned int D = Traits::dimension;
+    const size_t n = this->m_alive_indices.size();
+    const double n_particles_in_leaf = this->m_n_particles_in_leaf;
+    const double_d width = this->m_bounds.bmax - this->m_bounds.bmin;
+
+    // limit the size so that every bucket has a unique 64-bit key
+    const int max_size = 1 << std::min(30, static_cast<int>(63 / D));
+
+    if (n_particles_in_leaf >= n) {
+      set_size(int_d::Constant(1));
+      return;
+    }
+    double side_length =
+        std::pow(n_particles_in_leaf / n * width.prod(), 1.0 / D);
+    const int max_iterations = 10;
+    for (int iteration = 0;; ++iteration) {
+      int_d size;
+      for (size_t d = 0; d < D; ++d) {
+        size[d] = static_cast<int>(std::min(
+            std::max(std::floor(width[d] / side_length), 1.0),
+            static_cast<double>(max_size)));
+      }
+      set_size(size);
+      if (iteration == max_iterations || size.minCoeff() == max_size) {
+        break;
+      }
+
+      // count the occupied buckets
+      calculate_cell_keys(m_new_cell_keys);
+      m_hash_keys.assign(detail::cell_hash_table::number_of_slots(n),
+                         uint64_t(detail::cell_hash_table::empty_key));
+      m_hash_values.resize(m_hash_keys.size());
+      detail::cell_hash_table table(m_hash_keys.data(), m_hash_values.data(),
+                                    m_hash_keys.size());
+      int noccupied = 0;
+      for (const uint64_t key : m_new_cell_keys) {
+        if (table.insert(key, noccupied) == noccupied) {
+          ++noccupied;
+        }
+      }
+
+      const double mean = static_cast<double>(n) / noccupied;
+      if (mean <= 2 * n_particles_in_leaf) {
+        break;
+      }
+      side_length *= std::pow(n_particles_in_leaf / mean, 1.0 / D);
+    }
+
+    LOG(2, "\tbucket side length = " << m_bucket_side_length);
+    LOG(2, "\tnumber of buckets = " << m_size);
+  }
+
+  ///
+  /// @brief sorts the alive particles by bucket, using the keys in
+  /// m_new_cell_keys, and rebuilds the hash table of occupied buckets
+  ///
+  void build_cells() {
+    const size_t n = m_new_cell_keys.size();
+    m_cell_keys.swap(m_new_cell_keys);
+
+    // number the occupied buckets in the order that they are found
+    m_hash_keys.assign(detail::cell_hash_table::number_of_slots(n),
+                       uint64_t(detail::cell_hash_table::empty_key));
+    m_hash_values.resize(m_hash_keys.size());
+    detail::cell_hash_table table(m_hash_keys.data(), m_hash_values.data(),
+                                  m_hash_keys.size());
+    m_occupied_keys.clear();
+    m_bucket_indices.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+      const int next = m_occupied_keys.size();
+      m_bucket_indices[i] = table.insert(m_cell_keys[i], next);
+      if (m_bucket_indices[i] == next) {
+        m_occupied_keys.push_back(m_cell_keys[i]);
+      }
+    }
+    const size_t ncells = m_occupied_keys.size();
+
+    // renumber them in lexicographic (or space-filling curve) order, so that
+    // particles in neighbouring buckets are stored close together
+    std::vector<uint64_t> order_keys(ncells);
+    if (this->m_bucket_ordering == bucket_ordering::lexicographic) {
+      order_keys = m_occupied_keys;
+    } else {
+      int bits = 0;
+      while ((1 << bits) < m_size.maxCoeff()) {
+        ++bits;
+      }
+      for (size_t c = 0; c < ncells; ++c) {
+        const unsigned_int_d cell =
+            detail::reassemble_cell_key(m_occupied_keys[c], m_size)
+                .template cast<unsigned int>();
+        order_keys[c] = this->m_bucket_ordering == bucket_ordering::hilbert
+                            ? detail::hilbert_key(cell, bits)
+                            : detail::morton_key(cell, bits);
+      }
+    }
+    std::vector<int> order(ncells);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [&order_keys](const int a, const int b) {
+                return order_keys[a] < order_keys[b];
+              });
+    std::vector<int> rank(ncells);
+    m_cells.resize(ncells);
+    for (size_t c = 0; c < ncells; ++c) {
+      rank[order[c]] = c;
+      m_cells[c] =
+          detail::reassemble_cell_key(m_occupied_keys[order[c]], m_size);
+    }
+    for (size_t slot = 0; slot < m_hash_keys.size(); ++slot) {
+      if (m_hash_keys[slot] != detail::cell_hash_table::empty_key) {
+        m_hash_values[slot] = rank[m_hash_values[slot]];
+      }
+    }
+    for (size_t i = 0; i < n; ++i) {
+      m_bucket_indices[i] = rank[m_bucket_indices[i]];
+    }
+
+    // sort the particles by their bucket index, and find the beginning and
+    // end of each bucket's list of particles
+    m_bucket_begin.resize(ncells);
+    m_bucket_end.resize(ncells);
+    if (n > 0) {
+      detail::counting_sort_by_key(
+          m_bucket_indices.begin(), m_bucket_indices.end(),
+          this->m_alive_indices.begin(), ncells, m_bucket_begin.begin(),
+          m_bucket_end.begin());
+      for (size_t i = 0; i < n; ++i) {
+        m_cell_keys[i] = m_occupied_keys[order[m_bucket_indices[i]]];
+      }
+    }
+
+    update_query_pointers();
+  }
+
+  ///
+  /// @brief points the query at the bucket storage and hash table of this
+  /// object. Called on every update, as a copy of this object starts with a
+  /// query that points into the original
+  ///
+  void update_query_pointers() {
+    m_query.m_cell_hash = detail::cell_hash_table(
+        m_hash_keys.data(), m_hash_values.data(), m_hash_keys.size());
+    m_query.m_cells = m_cells.data();
+    m_query.m_bucket_begin = m_bucket_begin.data();
+    m_query.m_bucket_end = m_bucket_end.data();
+    m_query.m_nbuckets = m_cells.size();
+  }
+
+  void update_positions_impl(iterator update_begin, iterator update_end,
+                             const int new_n,
+                             const bool call_set_domain = true) {
+    ASSERT(update_begin == this->m_particles_begin &&
+               update_end == this->m_particles_end,
+           "error should be update all");
+
+    const size_t n = this->m_alive_indices.size();
+    bool resized = false;
+    if (call_set_domain && (n < 0.5 * m_size_calculated_with_n ||
+                            n > 2 * m_size_calculated_with_n)) {
+      LOG(2, "HashedCellList: recalculating bucket size");
+      m_size_calculated_with_n = n;
+      calculate_size();
+      resized = true;
+    }
+
+    calculate_cell_keys(m_new_cell_keys);
+
+    // if the particle set is the same and no particle has changed bucket
+    // then the particles are still sorted
+    m_reorder_needed =
+        resized || new_n != 0 ||
+        static_cast<size_t>(update_end - update_begin) != n ||
+        m_new_cell_keys != m_cell_keys;
+    if (m_reorder_needed) {
+      build_cells();
+    } else {
+      LOG(2, "HashedCellList: no particles changed bucket");
+      update_query_pointers();
+    }
+  }
+
+  void update_iterator_impl() {}
+
+  const HashedCellListQuery<Traits> &get_query_impl() const { return m_query; }
+
+  HashedCellListQuery<Traits> &get_query_impl() { return m_query; }
+
+  // the occupied buckets, in the order they are stored. The particles in
+  // bucket i are m_bucket_begin[i] to m_bucket_end[i]-1
+  std::vector<cell_type> m_cells;
+  std::vector<unsigned int> m_bucket_begin;
+  std::vector<unsigned int> m_bucket_end;
+
+  // slots of the hash table mapping bucket keys to their index in m_cells
+  std::vector<uint64_t> m_hash_keys;
+  std::vector<int> m_hash_values;
+
+  // the bucket key of each particle, and storage used to rebuild
+  std::vector<uint64_t> m_cell_keys;
+  std::vector<uint64_t> m_new_cell_keys;
+  std::vector<uint64_t> m_occupied_keys;
+  std::vector<int> m_bucket_indices;
+
+  HashedCellListQuery<Traits> m_query;
+
+  double_d m_bucket_side_length;
+  int_d m_size;
+  size_t m_size_calculated_with_n;
+  detail::point_to_bucket_index<Traits::dimension> m_point_to_bucket_index;
+  bool m_reorder_needed;
+};
+
+///
+/// @brief iterates through the occupied buckets of a HashedCellList
+///
+template <typename Query> class hashed_cell_iterator {
+  typedef hashed_cell_iterator<Query> iterator;
+  typedef typename Query::child_iterator child_iterator;
+
+public:
+  typedef typename Query::value_type value_type;
+  typedef const value_type *pointer;
+  typedef std::forward_iterator_tag iterator_category;
+  typedef const value_type &reference;
+  typedef std::ptrdiff_t difference_type;
+
+  hashed_cell_iterator()
+      : m_current(nullptr), m_end(nullptr), m_query(nullptr) {}
+
+  hashed_cell_iterator(const value_type *begin, const value_type *end,
+                       const Query *query)
+      : m_current(begin), m_end(end), m_query(query) {}
+
+  ///
+  /// @return the bucket as an iterator over the full lattice of buckets
+  ///
+  child_iterator get_child_iterator() const {
+    child_iterator ret = m_query->get_children();
+    ret = *m_current;
+    return ret;
+  }
+
+  reference operator*() const { return *m_current; }
+
+  pointer operator->() const { return m_current; }
+
+  iterator &operator++() {
+    ++m_current;
+    return *this;
+  }
+
+  iterator operator++(int) {
+    iterator tmp(*this);
+    operator++();
+    return tmp;
+  }
+
+  size_t operator-(const iterator &start) const {
+    return m_current - start.m_current;
+  }
+
+  inline bool operator==(const iterator &rhs) const {
+    return m_current == rhs.m_current;
+  }
+
+  inline bool operator==(const bool rhs) const {
+    return (m_current != m_end) == rhs;
+  }
+
+  inline bool operator!=(const iterator &rhs) const { return !operator==(rhs); }
+
+  inline bool operator!=(const bool rhs) const { return !operator==(rhs); }
+
+private:
+  const value_type *m_current;
+  const value_type *m_end;
+  const Query *m_query;
+};
+
+/// @copydetails NeighbourQueryBase
+///
+/// @brief This is a query object for the HashedCellList spatial data structure
+///
+template <typename Traits>
+struct HashedCellListQuery : public NeighbourQueryBase<Traits> {
+
+  typedef Traits traits_type;
+  typedef typename Traits::raw_pointer raw_pointer;
+  typedef typename Traits::double_d double_d;
+  typedef typename Traits::bool_d bool_d;
+  typedef typename Traits::int_d int_d;
+  typedef typename Traits::unsigned_int_d unsigned_int_d;
+  const static unsigned int dimension = Traits::dimension;
+  template <int LNormNumber, typename Transform = IdentityTransform>
+  using query_iterator =
+      lattice_iterator_within_distance<HashedCellListQuery, LNormNumber,
+                                       Transform>;
+  typedef lattice_iterator<dimension> child_iterator;
+  typedef typename query_iterator<2>::reference reference;
+  typedef typename query_iterator<2>::pointer pointer;
+  typedef typename query_iterator<2>::value_type value_type;
+  typedef hashed_cell_iterator<HashedCellListQuery> all_iterator;
+  typedef ranges_iterator<Traits> particle_iterator;
+  typedef bbox<dimension> box_type;
+
+  ///
+  /// @brief pointer to the beginning of the particle set
+  ///
+  raw_pointer m_particles_begin;
+
+  ///
+  /// @brief pointer to the end of the particle set
+  ///
+  raw_pointer m_particles_end;
+
+  ///
+  /// @brief periodicity of the domain
+  ///
+  bool_d m_periodic;
+
+  ///
+  /// @brief dimensions of each bucket
+  ///
+  double_d m_bucket_side_length;
+
+  ///
+  /// @brief index of the last bucket in the (full) lattice of buckets
+  ///
+  int_d m_end_bucket;
+
+  ///
+  /// @brief number of buckets along each side of the domain
+  ///
+  int_d m_size;
+
+  ///
+  /// @brief min/max bounds of the domain
+  ///
+  bbox<dimension> m_bounds;
+
+  ///
+  /// @brief function object to transform a point to a bucket index
+  ///
+  detail::point_to_bucket_index<dimension> m_point_to_bucket_index;
+
+  ///
+  /// @brief hash table mapping the key of each occupied bucket to its index
+  ///
+  detail::cell_hash_table m_cell_hash;
+
+  ///
+  /// @brief pointer to the occupied buckets
+  ///
+  const value_type *m_cells;
+
+  ///
+  /// @brief pointer to the beginning of the occupied buckets' particles
+  ///
+  const unsigned int *m_bucket_begin;
+
+  ///
+  /// @brief pointer to the end of the occupied buckets' particles
+  ///
+  const unsigned int *m_bucket_end;
+
+  ///
+  /// @brief the number of occupied buckets
+  ///
+  unsigned int m_nbuckets;
+
+  ///
+  /// @brief a pointer to the "key" values of the find-by-id map
+  ///
+  size_t *m_id_map_key;
+
+  ///
+  /// @brief a pointer to the "value" values of the find-by-id map
+  ///
+  size_t *m_id_map_value;
+
+  HashedCellListQuery()
+      : m_cells(nullptr), m_bucket_begin(nullptr), m_bucket_end(nullptr),
+        m_nbuckets(0) {}
+
+  /*
+   * functions for id mapping
+   */
+
+  ///
+  /// @copydoc NeighbourQueryBase::find()
+  ///
+  raw_pointer find(const size_t id) const {
+    const size_t n = number_of_particles();
+    size_t *last = m_id_map_key + n;
+    size_t *first = detail::lower_bound(m_id_map_key, last, id);
+    if ((first != last) && !(id < *first)) {
+      return m_particles_begin + m_id_map_value[first - m_id_map_key];
+    } else {
+      return m_particles_begin + n;
+    }
+  }
+
+  /*
+   * functions for trees
+   */
+
+  ///
+  /// @copydoc NeighbourQueryBase::is_leaf_node()
+  ///
+  /// always true for HashedCellList
+  ///
+  static bool is_leaf_node(const value_type &bucket) { return true; }
+
+  ///
+  /// @copydoc NeighbourQueryBase::is_tree()
+  ///
+  /// always false for HashedCellList
+  ///
+  static bool is_tree() { return false; }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_children() const
+  ///
+  /// Note that this iterates over the full lattice of buckets, including
+  /// those that are empty. Use get_subtree() to iterate over the occupied
+  /// buckets
+  ///
+  child_iterator get_children() const {
+    return child_iterator(int_d::Constant(0), m_end_bucket + 1);
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_children(const child_iterator&) const
+  ///
+  child_iterator get_children(const child_iterator &ci) const {
+    return child_iterator();
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::num_children(const child_iterator&) const
+  ///
+  static size_t num_children(const child_iterator &ci) { return 0; }
+
+  ///
+  /// @copydoc NeighbourQueryBase::num_children() const
+  ///
+  size_t num_children() const { return number_of_buckets(); }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_bounds()
+  ///
+  const box_type get_bounds(const child_iterator &ci) const {
+    box_type bounds;
+    bounds.bmin = (*ci) * m_bucket_side_length + m_bounds.bmin;
+    bounds.bmax = ((*ci) + 1) * m_bucket_side_length + m_bounds.bmin;
+    return bounds;
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_bounds()
+  ///
+  const box_type &get_bounds() const { return m_bounds; }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_periodic()
+  ///
+  const bool_d &get_periodic() const { return m_periodic; }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_bucket_particles()
+  ///
+  particle_iterator get_bucket_particles(const reference bucket) const {
+#ifndef __CUDA_ARCH__
+    ASSERT((bucket >= int_d::Constant(0)).all() &&
+               (bucket <= m_end_bucket).all(),
+           "invalid bucket");
+#endif
+    const int bucket_index = find_occupied_index(bucket);
+    if (bucket_index < 0) {
+      return particle_iterator(m_particles_begin, m_particles_begin);
+    }
+    return particle_iterator(m_particles_begin + m_bucket_begin[bucket_index],
+                             m_particles_begin + m_bucket_end[bucket_index]);
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_bucket_bbox()
+  ///
+  bbox<dimension> get_bucket_bbox(const reference bucket) const {
+    return bbox<dimension>(bucket * m_bucket_side_length + m_bounds.bmin,
+                           (bucket + 1) * m_bucket_side_length + m_bounds.bmin);
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_bucket()
+  ///
+  child_iterator get_bucket(const double_d &position) const {
+    auto bucket = m_point_to_bucket_index.find_bucket_index_vector(position);
+    return child_iterator(bucket, bucket + 1);
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_bucket_index()
+  ///
+  /// The occupied buckets are numbered from 0 to number_of_buckets()-1, in
+  /// the order they are stored. All the empty buckets have the index
+  /// number_of_buckets()
+  ///
+  size_t get_bucket_index(const reference bucket) const {
+    const int bucket_index = find_occupied_index(bucket);
+    return bucket_index < 0 ? m_nbuckets : bucket_index;
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_buckets_near_point()
+  ///
+  template <int LNormNumber, typename Transform = IdentityTransform>
+  query_iterator<LNormNumber, Transform>
+  get_buckets_near_point(const double_d &position, const double max_distance,
+                         const Transform &transform = Transform()) const {
+#ifndef __CUDA_ARCH__
+    LOG(4, "\tget_buckets_near_point: position = "
+               << position << " max_distance = " << max_distance);
+#endif
+    return query_iterator<LNormNumber, Transform>(position, max_distance, this,
+                                                  transform);
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_end_bucket()
+  ///
+  const int_d &get_end_bucket() const { return m_end_bucket; }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_subtree(const child_iterator&) const
+  ///
+  all_iterator get_subtree(const child_iterator &ci) const {
+    return all_iterator();
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_subtree() const
+  ///
+  /// Only the occupied buckets are visited
+  ///
+  all_iterator get_subtree() const {
+    return all_iterator(m_cells, m_cells + m_nbuckets, this);
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::number_of_buckets()
+  ///
+  /// This is the number of occupied buckets
+  ///
+  size_t number_of_buckets() const { return m_nbuckets; }
+
+  ///
+  /// @copydoc NeighbourQueryBase::number_of_particles()
+  ///
+  size_t number_of_particles() const {
+    return (m_particles_end - m_particles_begin);
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_particles_begin() const
+  ///
+  const raw_pointer &get_particles_begin() const { return m_particles_begin; }
+
+  ///
+  /// @copydoc NeighbourQueryBase::get_particles_begin()
+  ///
+  raw_pointer &get_particles_begin() { return m_particles_begin; }
+
+  ///
+  /// @copydoc NeighbourQueryBase::number_of_levels()
+  ///
+  /// always 2 for HashedCellList
+  ///
+  unsigned number_of_levels() const { return 2; }
+
+private:
+  ///
+  /// @return the index of @p bucket in the occupied buckets, or -1 if it is
+  /// empty
+  ///
+  int find_occupied_index(const int_d &bucket) const {
+    return m_cell_hash.find(detail::collapse_cell_key(bucket, m_size));
+  }
+};
+
+} // namespace Aboria
+
+#endif /* HASHED_CELL_LIST_H_ */
@@ -45,12 +45,23 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <boost/iterator/iterator_facade.hpp>
 #include <iostream>
 #include <set>
+#include <tuple>
 #include <vector>
 
 namespace Aboria {
 
 template <typename Traits> struct KdtreeQuery;
 
+namespace detail {
+struct kdtree_build_node {
+  int depth;
+  int begin;
+  int end;
+  int split_dim; // -1 for a leaf
+  double split_pos;
+};
+} // namespace detail
+
 /// \brief KdTree
 ///
 template <typename Traits>
@@ -66,13 +77,17 @@ class Kdtree : public neighbour_search_base<Kdtree<Traits>, Traits,
   typedef typename Traits::iterator iterator;
   typedef typename Traits::unsigned_int_d unsigned_int_d;
   static const unsigned int dimension = Traits::dimension;
+  typedef bbox<dimension> box_type;
+  typedef detail::kdtree_build_node build_node;
 
   typedef neighbour_search_base<Kdtree<Traits>, Traits, KdtreeQuery<Traits>>
       base_type;
   friend base_type;
 
 public:
-  Kdtree() : base_type(), m_number_of_levels(0) {
+  Kdtree()
+      : base_type(), m_number_of_levels(0), m_refit_imbalance_factor(0),
+        m_tree_valid(false), m_reorder_needed(true) {
 
     this->m_query.m_nodes_child =
         iterator_to_raw_pointer(m_nodes_child.begin());
@@ -80,6 +95,7 @@ public:
         iterator_to_raw_pointer(m_nodes_split_dim.begin());
     this->m_query.m_nodes_split_pos =
         iterator_to_raw_pointer(m_nodes_split_pos.begin());
+    this->m_query.m_nodes_bounds = nullptr;
     this->m_query.m_number_of_buckets = m_nodes_child.size();
     this->m_query.m_number_of_levels = m_number_of_levels;
   }
@@ -88,10 +104,43 @@ public:
 
   static constexpr bool ordered() { return true; }
 
+  ///
+  /// @brief turns on refitting of the tree in update_positions(), rather than
+  /// rebuilding it from scratch.
+  ///
+  /// When refitting, the split structure of the tree is kept and each
+  /// particle is moved to the leaf that now contains it. The split positions
+  /// are then moved to the middle of the gap between the particles on either
+  /// side. The tree is rebuilt if particles are added or deleted, if the
+  /// domain changes, or if the largest leaf holds more than `factor` times
+  /// the number of particles per leaf given to set_domain().
+  ///
+  /// @param factor maximum leaf imbalance before a rebuild, set to 0 to always
+  /// rebuild (the default)
+  ///
+  void set_refit_imbalance_factor(const double factor) {
+    m_refit_imbalance_factor = factor;
+  }
+
+  ///
+  /// @return the maximum leaf imbalance before a rebuild
+  /// @see set_refit_imbalance_factor()
+  ///
+  double get_refit_imbalance_factor() const {
+    return m_refit_imbalance_factor;
+  }
+
+  ///
+  /// @return false if the last update left every particle in the same leaf,
+  /// so the particle set does not need to be reordered
+  ///
+  bool reorder_needed() const { return m_reorder_needed; }
+
   void print_data_structure() const { print_tree(); }
 
 private:
   void set_domain_impl() {
+    m_tree_valid = false;
     this->m_query.m_bounds.bmin = this->m_bounds.bmin;
     this->m_query.m_bounds.bmax = this->m_bounds.bmax;
     this->m_query.m_periodic = this->m_periodic;
@@ -136,10 +185,379 @@ private:
                update_end == this->m_particles_end,
            "error should be update all");
 
+    typedef
+        typename detail::is_std_iterator<typename vector_int::iterator>::type
+            is_std;
+
+    const size_t num_points = this->m_alive_indices.size();
+    m_reorder_needed = true;
+    bool refitted = false;
+    if (is_std::value && m_refit_imbalance_factor > 0 && m_tree_valid &&
+        new_n == 0 &&
+        num_points == static_cast<size_t>(this->m_particles_end -
+                                          this->m_particles_begin) &&
+        num_points > 0) {
+      LOG(3, "update_positions_impl(kdtree): refit tree");
+      refitted = refit_tree(is_std());
+    }
+
+    if (!refitted) {
+      LOG(3, "update_positions_impl(kdtree): build tree");
+      build_tree(is_std());
+    }
+
+    this->m_query.m_nodes_child =
+        iterator_to_raw_pointer(m_nodes_child.begin());
+    this->m_query.m_nodes_split_dim =
+        iterator_to_raw_pointer(m_nodes_split_dim.begin());
+    this->m_query.m_nodes_split_pos =
+        iterator_to_raw_pointer(m_nodes_split_pos.begin());
+    this->m_query.m_nodes_bounds =
+        m_nodes_bounds.empty() ? nullptr : m_nodes_bounds.data();
+    this->m_query.m_number_of_buckets = m_nodes_child.size();
+    this->m_query.m_number_of_levels = m_number_of_levels;
+    m_tree_valid = true;
+  }
+
+  const KdtreeQuery<Traits> &get_query_impl() const { return m_query; }
+
+  KdtreeQuery<Traits> &get_query_impl() { return m_query; }
+
+private:
+  ///
+  /// @brief move particles between the leafs of the current tree, then refit
+  /// the split positions bottom-up.
+  ///
+  /// The particles are still stored in the order given by the last update,
+  /// so each leaf holds a contiguous range of particles. Particles are
+  /// assigned to their new leaf by descending the tree, and then stably
+  /// counting sorted by leaf.
+  ///
+  /// @return false if the leafs have become too unbalanced, in which case
+  /// the caller should rebuild the tree
+  ///
+  bool refit_tree(std::true_type) {
+    const size_t num_points = this->m_alive_indices.size();
+    const size_t num_nodes = m_nodes_child.size();
+    const double_d *p =
+        iterator_to_raw_pointer(get<position>(this->m_particles_begin));
+
+    // order the leafs by their current particle range
+    m_leaf_nodes.clear();
+    for (size_t i = 0; i < num_nodes; ++i) {
+      if (m_nodes_child[i] < 0) {
+        m_leaf_nodes.push_back(i);
+      }
+    }
+    std::sort(m_leaf_nodes.begin(), m_leaf_nodes.end(),
+              [&](const int a, const int b) {
+                return m_nodes_child[a] > m_nodes_child[b];
+              });
+    const size_t num_leafs = m_leaf_nodes.size();
+    m_node_leaf.resize(num_nodes);
+    for (size_t i = 0; i < num_leafs; ++i) {
+      m_node_leaf[m_leaf_nodes[i]] = i;
+    }
+
+    // find the new leaf of each particle, counting the number that have
+    // moved and the number in each leaf
+    m_particle_leaf.resize(num_points);
+    m_leaf_count.assign(num_leafs, 0);
+    size_t num_moved = 0;
+    for (size_t l = 0; l < num_leafs; ++l) {
+      const int leaf = m_leaf_nodes[l];
+      const int begin = -m_nodes_child[leaf] - 1;
+      const int end = -m_nodes_split_dim[leaf] - 1;
+      for (int i = begin; i < end; ++i) {
+        int node = 0;
+        while (m_nodes_child[node] >= 0) {
+          const int split_d = m_nodes_split_dim[node];
+          node = m_nodes_child[node] +
+                 static_cast<int>(p[i][split_d] >= m_nodes_split_pos[node]);
+        }
+        const int new_l = m_node_leaf[node];
+        m_particle_leaf[i] = new_l;
+        ++m_leaf_count[new_l];
+        num_moved += new_l != static_cast<int>(l);
+      }
+    }
+
+    const int max_count =
+        *std::max_element(m_leaf_count.begin(), m_leaf_count.end());
+    LOG(3, "refit_tree(kdtree): " << num_moved
+                                  << " particles changed leaf, largest leaf "
+                                     "has "
+                                  << max_count << " particles");
+    if (max_count > m_refit_imbalance_factor * this->m_n_particles_in_leaf) {
+      return false;
+    }
+
+    // move the particles to their new leaf (m_alive_indices is the identity
+    // on entry)
+    if (num_moved > 0) {
+      vector_int leaf_begin(num_leafs);
+      vector_int leaf_end(num_leafs);
+      detail::counting_sort_by_key(m_particle_leaf.begin(),
+                                   m_particle_leaf.end(),
+                                   this->m_alive_indices.begin(), num_leafs,
+                                   leaf_begin.begin(), leaf_end.begin());
+      for (size_t l = 0; l < num_leafs; ++l) {
+        m_nodes_child[m_leaf_nodes[l]] = -leaf_begin[l] - 1;
+        m_nodes_split_dim[m_leaf_nodes[l]] = -leaf_end[l] - 1;
+      }
+    } else {
+      m_reorder_needed = false;
+    }
+
+    calculate_bounds(true);
+
+    return true;
+  }
+
+  bool refit_tree(std::false_type) {
+    ASSERT(false, "tree refit only implemented for std iterators");
+    return false;
+  }
+
+  ///
+  /// @brief calculates the tight bounding box of the particles in each node
+  ///
+  /// The leaf boxes are calculated first, then the internal nodes bottom-up
+  /// (children are always stored after their parent). A box with zero width
+  /// in a dimension is padded, and an empty node is given a padded point box
+  /// at the centre of its parent, so that every box lies within its parent.
+  ///
+  /// @param move_splits if true, each split is also moved to the centre of
+  /// the gap between its children. This does not change which side of the
+  /// split any particle is on
+  ///
+  void calculate_bounds(const bool move_splits) {
+    const int num_nodes = m_nodes_child.size();
+    const int *indicies = iterator_to_raw_pointer(this->m_alive_indices.begin());
+    const double_d *p =
+        iterator_to_raw_pointer(get<position>(this->m_particles_begin));
+    const double_d min_width = double_d::Constant(
+        1e-10 * (this->m_bounds.bmax - this->m_bounds.bmin).maxCoeff());
+
+    m_nodes_bounds.resize(num_nodes);
+#ifdef HAVE_OPENMP
+#pragma omp parallel for if (detail::use_omp_backend<int *>(                   \
+    this->m_alive_indices.size()))
+#endif
+    for (int i = 0; i < num_nodes; ++i) {
+      if (m_nodes_child[i] < 0) {
+        box_type &bounds = m_nodes_bounds[i];
+        bounds = box_type();
+        const int begin = -m_nodes_child[i] - 1;
+        const int end = -m_nodes_split_dim[i] - 1;
+        for (int j = begin; j < end; ++j) {
+          bounds = bounds + box_type(p[indicies[j]]);
+        }
+        if (begin < end) {
+          detail::pad_bounds(bounds, min_width);
+        }
+      }
+    }
+
+    for (int i = num_nodes - 1; i >= 0; --i) {
+      if (m_nodes_child[i] >= 0) {
+        box_type &low = m_nodes_bounds[m_nodes_child[i]];
+        box_type &high = m_nodes_bounds[m_nodes_child[i] + 1];
+        m_nodes_bounds[i] = low + high;
+        const int split_d = m_nodes_split_dim[i];
+        if (move_splits && !low.is_empty() && !high.is_empty()) {
+          const double split = 0.5 * (low.bmax[split_d] + high.bmin[split_d]);
+          if (split > low.bmax[split_d] && split <= high.bmin[split_d]) {
+            m_nodes_split_pos[i] = split;
+          }
+        }
+      }
+    }
+
+    if (m_nodes_bounds[0].is_empty()) {
+      m_nodes_bounds[0] = this->m_bounds;
+    }
+    for (int i = 0; i < num_nodes; ++i) {
+      if (m_nodes_child[i] >= 0) {
+        const double_d centre =
+            0.5 * (m_nodes_bounds[i].bmin + m_nodes_bounds[i].bmax);
+        for (int j = m_nodes_child[i]; j < m_nodes_child[i] + 2; ++j) {
+          if (m_nodes_bounds[j].is_empty()) {
+            m_nodes_bounds[j] = box_type(centre);
+            detail::pad_bounds(m_nodes_bounds[j], min_width);
+          }
+        }
+      }
+    }
+  }
+
+  ///
+  /// @brief recursively split the particles in [begin, end) at the median of
+  /// the dimension with the largest spread, recording each node in @p nodes
+  ///
+  /// The root node is always split (at the centre of the domain if
+  /// necessary) so that the query always starts with two children. Each
+  /// other node is split only if it holds more than m_n_particles_in_leaf
+  /// particles and the split leaves particles on both sides. Subtrees larger
+  /// than detail::omp_serial_threshold are built in a separate OpenMP task.
+  ///
+  void build_subtree(int *indicies, const double_d *p, const int begin,
+                     const int end, const int depth,
+                     std::vector<std::vector<build_node>> *nodes) {
+    build_node node{depth, begin, end, -1, 0};
+    int *first = indicies + begin;
+    int *last = indicies + end;
+    int *middle = last;
+    const int n = end - begin;
+    if (n > this->m_n_particles_in_leaf || depth == 0) {
+      box_type bounds;
+      for (int *i = first; i != last; ++i) {
+        bounds = bounds + box_type(p[*i]);
+      }
+      int split_d = 0;
+      for (size_t d = 1; d < dimension; ++d) {
+        if (bounds.bmax[d] - bounds.bmin[d] >
+            bounds.bmax[split_d] - bounds.bmin[split_d]) {
+          split_d = d;
+        }
+      }
+      auto less_than_split = [&](const int i) {
+        return p[i][split_d] < node.split_pos;
+      };
+
+      if (n > 1 && bounds.bmax[split_d] > bounds.bmin[split_d]) {
+        std::nth_element(first, first + n / 2, last,
+                         [&](const int a, const int b) {
+                           return p[a][split_d] < p[b][split_d];
+                         });
+        node.split_dim = split_d;
+        node.split_pos = p[first[n / 2]][split_d];
+        middle = std::partition(first, last, less_than_split);
+        if (middle == first) {
+          // the median is the minimum, split at the next larger value instead
+          double next = detail::get_max<double>();
+          for (int *i = first; i != last; ++i) {
+            if (p[*i][split_d] > node.split_pos && p[*i][split_d] < next) {
+              next = p[*i][split_d];
+            }
+          }
+          node.split_pos = next;
+          middle = std::partition(first, last, less_than_split);
+        }
+      } else if (depth == 0) {
+        const double_d span = this->m_bounds.bmax - this->m_bounds.bmin;
+        split_d = 0;
+        for (size_t d = 1; d < dimension; ++d) {
+          if (span[d] > span[split_d]) {
+            split_d = d;
+          }
+        }
+        node.split_dim = split_d;
+        node.split_pos =
+            0.5 * (this->m_bounds.bmax[split_d] + this->m_bounds.bmin[split_d]);
+        middle = std::partition(first, last, less_than_split);
+      }
+    }
+
+#ifdef HAVE_OPENMP
+    (*nodes)[omp_get_thread_num()].push_back(node);
+#else
+    (*nodes)[0].push_back(node);
+#endif
+
+    if (node.split_dim >= 0) {
+      const int split = begin + (middle - first);
+#ifdef HAVE_OPENMP
+      const bool left_task =
+          static_cast<size_t>(split - begin) > detail::omp_serial_threshold;
+      const bool right_task =
+          static_cast<size_t>(end - split) > detail::omp_serial_threshold;
+#pragma omp task if (left_task)
+#endif
+      build_subtree(indicies, p, begin, split, depth + 1, nodes);
+#ifdef HAVE_OPENMP
+#pragma omp task if (right_task)
+#endif
+      build_subtree(indicies, p, split, end, depth + 1, nodes);
+    }
+  }
+
+  ///
+  /// @brief builds the tree top-down by median splits, reordering
+  /// m_alive_indices in-place
+  ///
+  /// The nodes are then laid out level by level, as expected by
+  /// KdtreeQuery. Within a level nodes are ordered by their particle range,
+  /// which keeps siblings together and in the same order as their parents.
+  ///
+  void build_tree(std::true_type) {
+    const size_t num_points = this->m_alive_indices.size();
+    int *indicies = iterator_to_raw_pointer(this->m_alive_indices.begin());
+    const double_d *p =
+        iterator_to_raw_pointer(get<position>(this->m_particles_begin));
+
+    std::vector<std::vector<build_node>> nodes(1);
+#ifdef HAVE_OPENMP
+    if (detail::use_omp_backend<int *>(num_points)) {
+      nodes.resize(omp_get_max_threads());
+#pragma omp parallel
+#pragma omp single
+      build_subtree(indicies, p, 0, num_points, 0, &nodes);
+    } else {
+      build_subtree(indicies, p, 0, num_points, 0, &nodes);
+    }
+#else
+    build_subtree(indicies, p, 0, num_points, 0, &nodes);
+#endif
+
+    for (size_t i = 1; i < nodes.size(); ++i) {
+      nodes[0].insert(nodes[0].end(), nodes[i].begin(), nodes[i].end());
+    }
+    std::vector<build_node> &tree = nodes[0];
+    std::sort(tree.begin(), tree.end(),
+              [](const build_node &a, const build_node &b) {
+                return std::tie(a.depth, a.begin, a.end) <
+                       std::tie(b.depth, b.begin, b.end);
+              });
+
+    const size_t num_nodes = tree.size();
+    m_nodes_child.resize(num_nodes);
+    m_nodes_split_dim.resize(num_nodes);
+    m_nodes_split_pos.resize(num_nodes);
+    int next_child = 1;
+    for (size_t i = 0; i < num_nodes; ++i) {
+      const build_node &node = tree[i];
+      if (node.split_dim >= 0) {
+        m_nodes_child[i] = next_child;
+        m_nodes_split_dim[i] = node.split_dim;
+        m_nodes_split_pos[i] = node.split_pos;
+        next_child += 2;
+      } else {
+        m_nodes_child[i] = -node.begin - 1;
+        m_nodes_split_dim[i] = -node.end - 1;
+        m_nodes_split_pos[i] = 0;
+      }
+    }
+    m_number_of_levels = tree.back().depth + 1;
+
+    calculate_bounds(false);
+
+#ifndef __CUDA_ARCH__
+    if (3 <= ABORIA_LOG_LEVEL) {
+      print_tree();
+    }
+#endif
+  }
+
+  ///
+  /// @brief builds the tree level by level using sorted copies of the
+  /// particle indicies for each dimension (used for thrust vectors)
+  ///
+  void build_tree(std::false_type) {
     const size_t num_points = this->m_alive_indices.size();
 
     // setup particles
-    LOG(3, "update_positions_impl(kdtree): setup particles");
+    LOG(3, "build_tree(kdtree): setup particles");
     m_particle_node.resize(dimension * num_points);
     detail::fill(m_particle_node.begin(), m_particle_node.end(), 0);
     m_particle_indicies.resize(dimension * num_points);
@@ -169,31 +587,16 @@ private:
     */
 
     // build the tree
-    LOG(3, "update_positions_impl(kdtree): build tree");
-    build_tree();
+    build_tree_by_level();
 
     // copy sorted indicies from 1st dim back to m_alive_indicies
-    LOG(3, "update_positions_impl(kdtree): finished build tree");
+    LOG(3, "build_tree(kdtree): finished build tree");
     detail::copy(m_particle_indicies.begin(),
                  m_particle_indicies.begin() + num_points,
                  this->m_alive_indices.begin());
-
-    this->m_query.m_nodes_child =
-        iterator_to_raw_pointer(m_nodes_child.begin());
-    this->m_query.m_nodes_split_dim =
-        iterator_to_raw_pointer(m_nodes_split_dim.begin());
-    this->m_query.m_nodes_split_pos =
-        iterator_to_raw_pointer(m_nodes_split_pos.begin());
-    this->m_query.m_number_of_buckets = m_nodes_child.size();
-    this->m_query.m_number_of_levels = m_number_of_levels;
   }
 
-  const KdtreeQuery<Traits> &get_query_impl() const { return m_query; }
-
-  KdtreeQuery<Traits> &get_query_impl() { return m_query; }
-
-private:
-  void build_tree() {
+  void build_tree_by_level() {
     const size_t num_points = this->m_alive_indices.size();
 
     // setup nodes
@@ -564,11 +967,22 @@ private:
   vector_int m_nodes_child;
   vector_int m_nodes_split_dim;
   vector_double m_nodes_split_pos;
+  // tight bounding box of each node (only calculated for std::vector)
+  std::vector<box_type> m_nodes_bounds;
 
   vector_int m_particle_indicies;
   vector_int m_particle_node;
   int m_number_of_levels;
   KdtreeQuery<Traits> m_query;
+
+  // storage for refitting the tree
+  double m_refit_imbalance_factor;
+  bool m_tree_valid;
+  bool m_reorder_needed;
+  std::vector<int> m_leaf_nodes;
+  std::vector<int> m_node_leaf;
+  std::vector<int> m_leaf_count;
+  vector_int m_particle_leaf;
 }; // namespace Aboria
 
 template <typename Query> class KdtreeChildIterator {
@@ -676,6 +1090,7 @@ template <typename Traits> struct KdtreeQuery {
   int *m_nodes_child;
   int *m_nodes_split_dim;
   double *m_nodes_split_pos;
+  box_type *m_nodes_bounds;
 
   size_t *m_id_map_key;
   size_t *m_id_map_value;
@@ -726,7 +1141,7 @@ public:
   child_iterator get_children(const child_iterator &ci) const {
     if (!is_leaf_node(*ci)) {
       return child_iterator((m_nodes_child + get_child_index(*ci)),
-                            get_bounds(ci));
+                            get_split_bounds(ci));
     } else {
       return child_iterator();
     }
@@ -745,7 +1160,24 @@ public:
     }
   }
 
+  ///
+  /// @return the tight bounding box of the particles in the node @p ci, or
+  /// the region of space given by the splits of its parents if this has not
+  /// been calculated (thrust vectors)
+  ///
   const box_type get_bounds(const child_iterator &ci) const {
+    if (m_nodes_bounds != nullptr) {
+      return m_nodes_bounds[get_child_index(*ci)];
+    }
+    return get_split_bounds(ci);
+  }
+
+  ///
+  /// @return the region of space given by the splits of the parents of @p ci.
+  /// Unlike the tight bounds, these cover the whole domain at each level of
+  /// the tree, and are used to navigate down the tree to a given position
+  ///
+  box_type get_split_bounds(const child_iterator &ci) const {
     box_type ret = (*ci).bounds;
     const int pindex = get_parent_index(*ci);
     const int i = m_nodes_split_dim[pindex];
@@ -777,8 +1209,9 @@ public:
     const int i = m_nodes_split_dim[pindex];
     ASSERT(position[i] < ci.m_data.bounds.bmax[i], "position out of bounds");
     ASSERT(position[i] >= ci.m_data.bounds.bmin[i], "position out of bounds");
+    // particles on the split belong to the high child
     const double diff = position[i] - m_nodes_split_pos[pindex];
-    if (diff > 0)
+    if (diff >= 0)
       ++ci;
   }
 
@@ -799,6 +1232,9 @@ public:
   }
 
   const box_type &get_parent_bounds(const child_iterator &ci) const {
+    if (m_nodes_bounds != nullptr) {
+      return m_nodes_bounds[get_parent_index(*ci)];
+    }
     return ci.m_data.bounds;
   }
 
@@ -631,25 +631,16 @@ public:
     const RowElements &a = this->m_row_elements;
     const ColElements &b = this->m_col_elements;
 
-    const size_t na = a.size();
-
     const_cast<MatrixType &>(matrix).setZero();
 
     // sparse a x b block
-    for (size_t i = 0; i < na; ++i) {
-      const_row_reference ai = a[i];
-      const double radius = m_radius_function(ai);
-      for (auto pairj =
-               euclidean_search(b.get_query(), get<position>(ai), radius);
-           pairj != false; ++pairj) {
-        const_col_reference bj = *pairj;
-        const_position_reference dx = pairj.dx();
-        const size_t j = &get<position>(bj) - get<position>(b).data();
-        const_cast<MatrixType &>(matrix).template block<BlockRows, BlockCols>(
-            i * BlockRows, j * BlockCols) =
-            static_cast<Block>(m_dx_function(dx, ai, bj));
-      }
-    }
+    for_each_pair(
+        [&](const size_t i, const size_t j, const_position_reference dx) {
+          const_cast<MatrixType &>(matrix).template block<BlockRows, BlockCols>(
+              i * BlockRows, j * BlockCols) =
+              static_cast<Block>(m_dx_function(dx, a[i], b[j]));
+        },
+        true);
   }
 
   template <typename Triplet>
@@ -659,29 +650,21 @@ public:
     const RowElements &a = this->m_row_elements;
     const ColElements &b = this->m_col_elements;
 
-    const size_t na = a.size();
-
     // sparse a x b block
     // std::cout << "sparse a x b block" << std::endl;
-    for (size_t i = 0; i < na; ++i) {
-      const_row_reference ai = a[i];
-      const double radius = m_radius_function(ai);
-      for (auto pairj =
-               euclidean_search(b.get_query(), get<position>(ai), radius);
-           pairj != false; ++pairj) {
-        const_col_reference bj = *pairj;
-        const_position_reference dx = pairj.dx();
-        const size_t j = &get<position>(bj) - get<position>(b).data();
-        const Block element = static_cast<Block>(m_dx_function(dx, ai, bj));
-        for (size_t ii = 0; ii < BlockRows; ++ii) {
-          for (size_t jj = 0; jj < BlockCols; ++jj) {
-            triplets.push_back(Triplet(i * BlockRows + ii + startI,
-                                       j * BlockCols + jj + startJ,
-                                       element(ii, jj)));
+    for_each_pair(
+        [&](const size_t i, const size_t j, const_position_reference dx) {
+          const Block element =
+              static_cast<Block>(m_dx_function(dx, a[i], b[j]));
+          for (size_t ii = 0; ii < BlockRows; ++ii) {
+            for (size_t jj = 0; jj < BlockCols; ++jj) {
+              triplets.push_back(Triplet(i * BlockRows + ii + startI,
+                                         j * BlockCols + jj + startJ,
+                                         element(ii, jj)));
+            }
           }
-        }
-      }
-    }
+        },
+        false);
   }
 
   /// Evaluates a matrix-free linear operator given by \p expr \p if_expr,
@@ -700,21 +683,11 @@ public:
     ASSERT(na == rhs.size(), "lhs vector has incompatible size");
     ASSERT(b.size() == lhs.size(), "rhs vector has incompatible size");
 
-#ifdef HAVE_OPENMP
-#pragma omp parallel for
-#endif
-    for (size_t i = 0; i < na; ++i) {
-      const_row_reference ai = a[i];
-      const double radius = m_radius_function(ai);
-      for (auto pairj =
-               euclidean_search(b.get_query(), get<position>(ai), radius);
-           pairj != false; ++pairj) {
-        const_position_reference dx = pairj.dx();
-        const_col_reference bj = *pairj;
-        const size_t j = &get<position>(bj) - get<position>(b).data();
-        lhs[i] += m_dx_function(dx, ai, bj) * rhs[j];
-      }
-    }
+    for_each_pair(
+        [&](const size_t i, const size_t j, const_position_reference dx) {
+          lhs[i] += m_dx_function(dx, a[i], b[j]) * rhs[j];
+        },
+        true);
   }
 
   template <typename DerivedLHS, typename DerivedRHS>
@@ -729,24 +702,57 @@ public:
     const RowElements &a = this->m_row_elements;
     const ColElements &b = this->m_col_elements;
 
+    for_each_pair(
+        [&](const size_t i, const size_t j, const_position_reference dx) {
+          lhs.template segment<BlockRows>(i * BlockRows) +=
+              m_dx_function(dx, a[i], b[j]) *
+              rhs.template segment<BlockCols>(j * BlockCols);
+        },
+        true);
+  }
+
+private:
+  /// calls \p function(i, j, dx) for every pair of row particle (with index
+  /// i) and column particle (with index j) within the radius of the row
+  /// particle. If the row and column particle sets are the same, and the set
+  /// has a Verlet list that covers the radius, then this list is used instead
+  /// of the neighbour search data structure. Otherwise the row particles are
+  /// searched in batches using batch_distance_search(). If \p parallel is
+  /// true then \p function may be called concurrently, but all the calls for
+  /// a given row are made by the same thread
+  template <typename Function>
+  void for_each_pair(Function &&function, const bool parallel) const {
+    const RowElements &a = this->m_row_elements;
+    const ColElements &b = this->m_col_elements;
     const size_t na = a.size();
 
+    bool use_verlet_list =
+        static_cast<const void *>(&a) == static_cast<const void *>(&b);
+    for (size_t i = 0; use_verlet_list && i < na; ++i) {
+      use_verlet_list = b.get_verlet_list().is_valid_for(
+          b.size(), m_radius_function(a[i]));
+    }
+
+    if (use_verlet_list) {
 #ifdef HAVE_OPENMP
-#pragma omp parallel for
+#pragma omp parallel for if (parallel)
 #endif
-    for (size_t i = 0; i < na; ++i) {
-      const_row_reference ai = a[i];
-      const double radius = m_radius_function(ai);
-      for (auto pairj =
-               euclidean_search(b.get_query(), get<position>(ai), radius);
-           pairj != false; ++pairj) {
-        const_position_reference dx = pairj.dx();
-        const_col_reference bj = *pairj;
-        const size_t j = &get<position>(bj) - get<position>(b).data();
-        lhs.template segment<BlockRows>(i * BlockRows) +=
-            m_dx_function(dx, ai, bj) *
-            rhs.template segment<BlockCols>(j * BlockCols);
+      for (size_t i = 0; i < na; ++i) {
+        const_row_reference ai = a[i];
+        const double radius2 = std::pow(m_radius_function(ai), 2);
+        for (const int j : b.get_verlet_list().get_neighbours(i)) {
+          const double_d dx = b.correct_dx_for_periodicity(
+              get<position>(b[j]) - get<position>(ai));
+          if (dx.squaredNorm() <= radius2) {
+            function(i, j, dx);
+          }
+        }
       }
+    } else {
+      detail::batch_distance_search_impl<2>(
+          b.get_query(), get<position>(a).begin(), get<position>(a).end(),
+          [&](const int i) { return m_radius_function(a[i]); }, function,
+          parallel);
     }
   }
 };
@@ -0,0 +1,690 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Aboria.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef LBVH_H_
+#define LBVH_H_
+
+#include "Get.h"
+#include "Log.h"
+#include "NeighbourSearchBase.h"
+#include "SpatialUtil.h"
+#include "Traits.h"
+#include "Vector.h"
+#include "detail/Algorithms.h"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+namespace Aboria {
+
+template <typename Traits> struct LBVHQuery;
+
+namespace detail {
+
+///
+/// @brief number of leading zero bits in @p x, which must be non-zero
+///
+inline int count_leading_zeros(const uint32_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_clz(x);
+#else
+  int n = 0;
+  for (uint32_t mask = 1u << 31; !(x & mask); mask >>= 1) {
+    ++n;
+  }
+  return n;
+#endif
+}
+
+} // namespace detail
+
+///
+/// @brief A linear bounding volume hierarchy (LBVH) spatial data structure
+/// that is paired with a LBVHQuery query type
+///
+/// The particles are sorted along a Morton (z-order) curve, and consecutive
+/// runs of at most n_particles_in_leaf particles form the leafs of the tree.
+/// The internal nodes form a binary radix tree over the Morton keys of the
+/// leafs, which is built in parallel with every internal node calculated
+/// independently (Karras, T. (2012). "Maximizing parallelism in the
+/// construction of BVHs, octrees, and k-d trees". High Performance Graphics,
+/// 33-37).
+///
+/// Unlike the HyperOctree or Kdtree, each node stores the tight bounding box
+/// of its particles rather than a region of the domain, so that empty space
+/// is pruned early by queries on clustered data. Each node always has two
+/// children, regardless of the dimension.
+///
+/// Only std::vector storage is supported.
+///
+/// @tparam Traits an instatiation of TraitsCommon
+///
+template <typename Traits>
+class LBVH : public neighbour_search_base<LBVH<Traits>, Traits,
+                                          LBVHQuery<Traits>> {
+
+  typedef typename Traits::double_d double_d;
+  typedef typename Traits::position position;
+  typedef typename Traits::vector_int vector_int;
+  typedef typename Traits::vector_int2 vector_int2;
+  typedef typename Traits::iterator iterator;
+  typedef typename Traits::unsigned_int_d unsigned_int_d;
+  static const unsigned int dimension = Traits::dimension;
+  typedef bbox<dimension> box_type;
+  typedef typename Traits::template vector_type<box_type>::type vector_box;
+  typedef typename Traits::template vector_type<uint32_t>::type vector_key;
+
+  typedef neighbour_search_base<LBVH<Traits>, Traits, LBVHQuery<Traits>>
+      base_type;
+  friend base_type;
+
+  // total number of bits used for the morton keys
+  static const int m_key_bits = 30;
+
+public:
+  LBVH() : base_type(), m_number_of_levels(0) { update_query(); }
+
+  static constexpr bool ordered() { return true; }
+
+  void print_data_structure() const { print_tree(); }
+
+private:
+  void set_domain_impl() {
+    this->m_query.m_bounds.bmin = this->m_bounds.bmin;
+    this->m_query.m_bounds.bmax = this->m_bounds.bmax;
+    this->m_query.m_periodic = this->m_periodic;
+  }
+
+  void update_iterator_impl() {}
+
+  void print_tree() const {
+    const int num_leafs = m_leafs.size();
+    for (size_t i = 0; i < m_nodes_child.size(); ++i) {
+      std::cout << "node " << i << ": children = (" << m_nodes_child[i][0]
+                << "," << m_nodes_child[i][1] << ") bounds = "
+                << m_nodes_bounds[i] << std::endl;
+    }
+    for (int i = 0; i < num_leafs; ++i) {
+      std::cout << "leaf " << i + num_leafs - 1 << ": particles = ("
+                << m_leafs[i][0] << "," << m_leafs[i][1] << ") bounds = "
+                << m_nodes_bounds[i + num_leafs - 1] << std::endl;
+    }
+  }
+
+  void update_positions_impl(iterator update_begin, iterator update_end,
+                             const int new_n,
+                             const bool call_set_domain = true) {
+    ASSERT(update_begin == this->m_particles_begin &&
+               update_end == this->m_particles_end,
+           "error should be update all");
+
+    LOG(3, "update_positions_impl(lbvh): sort particles");
+    sort_particles();
+
+    LOG(3, "update_positions_impl(lbvh): build tree");
+    build_tree();
+    calculate_bounds();
+
+#ifndef __CUDA_ARCH__
+    if (3 <= ABORIA_LOG_LEVEL) {
+      print_tree();
+    }
+#endif
+
+    update_query();
+  }
+
+  const LBVHQuery<Traits> &get_query_impl() const { return m_query; }
+
+  LBVHQuery<Traits> &get_query_impl() { return m_query; }
+
+  void update_query() {
+    m_query.m_nodes_child = iterator_to_raw_pointer(m_nodes_child.begin());
+    m_query.m_nodes_bounds = iterator_to_raw_pointer(m_nodes_bounds.begin());
+    m_query.m_leafs = iterator_to_raw_pointer(m_leafs.begin());
+    m_query.m_number_of_leafs = m_leafs.size();
+    m_query.m_number_of_buckets = m_nodes_bounds.size();
+    m_query.m_number_of_levels = m_number_of_levels;
+  }
+
+  ///
+  /// @brief sorts m_alive_indices by the morton key of each particle, using
+  /// the bounding box of the particles (rather than the domain) for the
+  /// quantisation
+  ///
+  void sort_particles() {
+    const int n = this->m_alive_indices.size();
+    const int *alive = iterator_to_raw_pointer(this->m_alive_indices.begin());
+    const double_d *p =
+        iterator_to_raw_pointer(get<position>(this->m_particles_begin));
+
+    m_particle_bounds = box_type();
+    for (int i = 0; i < n; ++i) {
+      m_particle_bounds = m_particle_bounds + box_type(p[alive[i]]);
+    }
+
+    // quantise each dimension to bits integer values (if there are more
+    // dimensions than bits then all keys are 0 and the tree is built from
+    // the particle order alone)
+    const int bits = m_key_bits / dimension;
+    const double max_index = static_cast<double>((1u << bits) - 1);
+    double_d scale;
+    for (size_t d = 0; d < dimension; ++d) {
+      const double span =
+          m_particle_bounds.bmax[d] - m_particle_bounds.bmin[d];
+      scale[d] = span > 0 ? max_index / span : 0;
+    }
+
+    m_keys.resize(n);
+    uint32_t *keys = iterator_to_raw_pointer(m_keys.begin());
+    const double_d bmin = m_particle_bounds.bmin;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for if (detail::use_omp_backend<int *>(n))
+#endif
+    for (int i = 0; i < n; ++i) {
+      unsigned_int_d index;
+      for (size_t d = 0; d < dimension; ++d) {
+        index[d] = static_cast<unsigned int>(
+            std::min(max_index, (p[alive[i]][d] - bmin[d]) * scale[d]));
+      }
+      keys[i] = static_cast<uint32_t>(detail::morton_key(index, bits));
+    }
+
+    detail::sort_by_key(m_keys.begin(), m_keys.end(),
+                        this->m_alive_indices.begin());
+  }
+
+  ///
+  /// @brief builds the binary radix tree over the leafs.
+  ///
+  /// Internal node i covers a range of leafs with i at one end, and the
+  /// range and split of each node only depend on the sorted keys, so all
+  /// nodes can be calculated in parallel. Internal nodes are numbered [0,
+  /// m-1) (0 is the root), and leafs [m-1, 2m-1)
+  ///
+  void build_tree() {
+    const int n = this->m_alive_indices.size();
+    // always have at least 2 leafs so that the root is an internal node
+    const int n_in_leaf =
+        std::max(1, static_cast<int>(this->m_n_particles_in_leaf));
+    const int m = std::max(2, (n + n_in_leaf - 1) / n_in_leaf);
+
+    m_leafs.resize(m);
+    m_leaf_keys.resize(m);
+    for (int l = 0; l < m; ++l) {
+      const int begin = static_cast<int64_t>(l) * n / m;
+      const int end = static_cast<int64_t>(l + 1) * n / m;
+      m_leafs[l] = vint2(begin, end);
+      m_leaf_keys[l] = begin < n ? m_keys[begin] : 0;
+    }
+
+    m_nodes_child.resize(m - 1);
+    m_nodes_parent.resize(2 * m - 1);
+    m_nodes_parent[0] = -1;
+    const uint32_t *keys = iterator_to_raw_pointer(m_leaf_keys.begin());
+    vint2 *child = iterator_to_raw_pointer(m_nodes_child.begin());
+    int *parent = iterator_to_raw_pointer(m_nodes_parent.begin());
+
+    // length of the common prefix of keys a and b, using the leaf index to
+    // break ties between duplicate keys
+    auto delta = [keys, m](const int a, const int b) {
+      if (b < 0 || b >= m) {
+        return -1;
+      }
+      const uint32_t diff = keys[a] ^ keys[b];
+      return diff != 0 ? detail::count_leading_zeros(diff)
+                       : 32 + detail::count_leading_zeros(a ^ b);
+    };
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for if (detail::use_omp_backend<int *>(m))
+#endif
+    for (int i = 0; i < m - 1; ++i) {
+      // direction of the range
+      const int d = delta(i, i + 1) > delta(i, i - 1) ? 1 : -1;
+
+      // find the other end of the range
+      const int delta_min = delta(i, i - d);
+      int l_max = 2;
+      while (delta(i, i + l_max * d) > delta_min) {
+        l_max *= 2;
+      }
+      int l = 0;
+      for (int t = l_max / 2; t >= 1; t /= 2) {
+        if (delta(i, i + (l + t) * d) > delta_min) {
+          l += t;
+        }
+      }
+      const int j = i + l * d;
+
+      // find the split position
+      const int delta_node = delta(i, j);
+      int s = 0;
+      int t = l;
+      do {
+        t = (t + 1) / 2;
+        if (delta(i, i + (s + t) * d) > delta_node) {
+          s += t;
+        }
+      } while (t > 1);
+      const int gamma = i + s * d + std::min(d, 0);
+
+      const int left = std::min(i, j) == gamma ? m - 1 + gamma : gamma;
+      const int right =
+          std::max(i, j) == gamma + 1 ? m - 1 + gamma + 1 : gamma + 1;
+      child[i] = vint2(left, right);
+      parent[left] = i;
+      parent[right] = i;
+    }
+
+    // depth of the tree
+    m_number_of_levels = 0;
+    std::vector<vint2> stack(1, vint2(0, 0));
+    while (!stack.empty()) {
+      const vint2 node = stack.back();
+      stack.pop_back();
+      if (node[1] + 1 > static_cast<int>(m_number_of_levels)) {
+        m_number_of_levels = node[1] + 1;
+      }
+      if (node[0] < m - 1) {
+        stack.push_back(vint2(child[node[0]][0], node[1] + 1));
+        stack.push_back(vint2(child[node[0]][1], node[1] + 1));
+      }
+    }
+    ASSERT(m_number_of_levels <= LBVHQuery<Traits>::m_max_tree_depth,
+           "lbvh build_tree: tree has exceeded max levels");
+  }
+
+  ///
+  /// @brief calculates the tight bounding box of each node.
+  ///
+  /// The leaf boxes are calculated from their particles. Each leaf then
+  /// walks up the tree, and the second child to arrive at a node calculates
+  /// its box, so each internal node is only calculated once both its children
+  /// are finished.
+  ///
+  void calculate_bounds() {
+    const int m = m_leafs.size();
+    const int n = this->m_alive_indices.size();
+    const int *alive = iterator_to_raw_pointer(this->m_alive_indices.begin());
+    const double_d *p =
+        iterator_to_raw_pointer(get<position>(this->m_particles_begin));
+    const vint2 *leafs = iterator_to_raw_pointer(m_leafs.begin());
+    const vint2 *child = iterator_to_raw_pointer(m_nodes_child.begin());
+    const int *parent = iterator_to_raw_pointer(m_nodes_parent.begin());
+
+    const double max_span =
+        (m_particle_bounds.bmax - m_particle_bounds.bmin).maxCoeff();
+    const double_d min_width =
+        double_d::Constant(1e-10 * (max_span > 0 ? max_span : 1.0));
+
+    m_nodes_bounds.resize(2 * m - 1);
+    box_type *bounds = iterator_to_raw_pointer(m_nodes_bounds.begin());
+    m_nodes_visited.assign(m - 1, 0);
+    int *visited = iterator_to_raw_pointer(m_nodes_visited.begin());
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for if (detail::use_omp_backend<int *>(n))
+#endif
+    for (int l = 0; l < m; ++l) {
+      box_type &leaf_bounds = bounds[m - 1 + l];
+      leaf_bounds = box_type();
+      for (int i = leafs[l][0]; i < leafs[l][1]; ++i) {
+        leaf_bounds = leaf_bounds + box_type(p[alive[i]]);
+      }
+      if (leafs[l][0] == leafs[l][1]) {
+        // only occurs for less than two particles
+        leaf_bounds = n > 0 ? box_type(p[alive[0]]) : this->m_bounds;
+      }
+      detail::pad_bounds(leaf_bounds, min_width);
+
+      int node = parent[m - 1 + l];
+      while (node >= 0) {
+        int arrived;
+#ifdef HAVE_OPENMP
+#pragma omp atomic capture seq_cst
+#endif
+        arrived = visited[node]++;
+        if (arrived == 0) {
+          break;
+        }
+        bounds[node] = bounds[child[node][0]] + bounds[child[node][1]];
+        node = parent[node];
+      }
+    }
+  }
+
+  // internal nodes [0,m-1) index of the left and right child
+  vector_int2 m_nodes_child;
+  // internal nodes and leafs [0,2m-1) tight bounding box
+  vector_box m_nodes_bounds;
+  // internal nodes and leafs [0,2m-1) index of parent node
+  vector_int m_nodes_parent;
+  // leafs [0,m) range of particles
+  vector_int2 m_leafs;
+  unsigned m_number_of_levels;
+  LBVHQuery<Traits> m_query;
+
+  // storage for building the tree
+  box_type m_particle_bounds;
+  vector_key m_keys;
+  vector_key m_leaf_keys;
+  vector_int m_nodes_visited;
+};
+
+template <typename Query> class LBVHChildIterator {
+  typedef bbox<Query::dimension> box_type;
+  template <typename Traits> friend struct LBVHQuery;
+
+public:
+  struct value_type {
+    int high;
+    int parent;
+  };
+  value_type m_data;
+
+  typedef const value_type *pointer;
+  typedef std::forward_iterator_tag iterator_category;
+  typedef const value_type &reference;
+  typedef std::ptrdiff_t difference_type;
+
+  LBVHChildIterator() : m_data{2, -1} {}
+
+  explicit LBVHChildIterator(const int parent) : m_data{0, parent} {}
+
+  bool is_high() const { return m_data.high > 0; }
+
+  int get_child_number() const { return m_data.high; }
+
+  reference operator*() const { return dereference(); }
+
+  reference operator->() const { return dereference(); }
+
+  LBVHChildIterator &operator++() {
+    increment();
+    return *this;
+  }
+
+  LBVHChildIterator operator++(int) {
+    LBVHChildIterator tmp(*this);
+    operator++();
+    return tmp;
+  }
+
+  inline bool operator==(const LBVHChildIterator &rhs) const {
+    return equal(rhs);
+  }
+
+  inline bool operator!=(const LBVHChildIterator &rhs) const {
+    return !operator==(rhs);
+  }
+
+  inline bool operator==(const bool rhs) const { return equal(rhs); }
+
+  inline bool operator!=(const bool rhs) const { return !operator==(rhs); }
+
+private:
+  bool equal(LBVHChildIterator const &other) const {
+    return m_data.parent == other.m_data.parent &&
+           m_data.high == other.m_data.high;
+  }
+
+  bool equal(const bool other) const { return (m_data.high < 2) == other; }
+
+  reference dereference() const { return m_data; }
+
+  void increment() { ++m_data.high; }
+};
+
+/// @copydetails NeighbourQueryBase
+///
+/// @brief This is a query object for the @ref LBVH spatial data
+/// structure
+///
+template <typename Traits> struct LBVHQuery {
+  const static unsigned int dimension = Traits::dimension;
+  // the depth is bounded by the number of bits in the keys plus the leaf
+  // index used to break ties
+  const static unsigned int m_max_tree_depth = 64;
+
+  typedef Traits traits_type;
+  typedef typename Traits::raw_pointer raw_pointer;
+  typedef typename Traits::double_d double_d;
+  typedef typename Traits::bool_d bool_d;
+  typedef typename Traits::int_d int_d;
+  typedef typename Traits::unsigned_int_d unsigned_int_d;
+
+  template <int LNormNumber, typename Transform = IdentityTransform>
+  using query_iterator = tree_query_iterator<LBVHQuery, LNormNumber, Transform>;
+
+  typedef depth_first_iterator<LBVHQuery> all_iterator;
+  typedef LBVHChildIterator<LBVHQuery> child_iterator;
+
+  typedef typename child_iterator::value_type value_type;
+  typedef typename child_iterator::reference reference;
+  typedef typename child_iterator::pointer pointer;
+  typedef ranges_iterator<Traits> particle_iterator;
+  typedef bbox<dimension> box_type;
+
+  bool_d m_periodic;
+  bbox<dimension> m_bounds;
+  raw_pointer m_particles_begin;
+  raw_pointer m_particles_end;
+  size_t m_number_of_buckets;
+  size_t m_number_of_levels;
+  size_t m_number_of_leafs;
+
+  vint2 *m_nodes_child;
+  box_type *m_nodes_bounds;
+  vint2 *m_leafs;
+
+  size_t *m_id_map_key;
+  size_t *m_id_map_value;
+
+  const box_type &get_bounds() const { return m_bounds; }
+  const bool_d &get_periodic() const { return m_periodic; }
+
+private:
+  inline int get_child_index(reference b) const {
+    return m_nodes_child[b.parent][b.high];
+  }
+
+  inline bool is_leaf_index(const int index) const {
+    return index >= static_cast<int>(m_number_of_leafs) - 1;
+  }
+
+public:
+  /*
+   * functions for id mapping
+   */
+  ABORIA_HOST_DEVICE_IGNORE_WARN
+  CUDA_HOST_DEVICE
+  raw_pointer find(const size_t id) const {
+    const size_t n = number_of_particles();
+    size_t *last = m_id_map_key + n;
+    size_t *first = detail::lower_bound(m_id_map_key, last, id);
+    if ((first != last) && !(id < *first)) {
+      return m_particles_begin + m_id_map_value[first - m_id_map_key];
+    } else {
+      return m_particles_begin + n;
+    }
+  }
+
+  /*
+   * functions for tree_query_iterator
+   */
+  bool is_leaf_node(reference bucket) const {
+    return is_leaf_index(get_child_index(bucket));
+  }
+  static bool is_tree() { return true; }
+
+  /*
+   * end functions for tree_query_iterator
+   */
+
+  child_iterator get_children() const {
+    if (m_nodes_child != nullptr) {
+      return child_iterator(0);
+    } else {
+      return child_iterator();
+    }
+  }
+
+  child_iterator get_children(const child_iterator &ci) const {
+    if (!is_leaf_node(*ci)) {
+      return child_iterator(get_child_index(*ci));
+    } else {
+      return child_iterator();
+    }
+  }
+
+  ///
+  /// @copydoc NeighbourQueryBase::num_children() const
+  ///
+  size_t num_children() const { return m_nodes_child != nullptr ? 2 : 0; }
+
+  size_t num_children(const child_iterator &ci) const {
+    if (is_leaf_node(*ci)) {
+      return 0;
+    } else {
+      return 2;
+    }
+  }
+
+  ///
+  /// @brief returns the tight bounding box of the particles within @p ci
+  ///
+  const box_type &get_bounds(const child_iterator &ci) const {
+    return m_nodes_bounds[get_child_index(*ci)];
+  }
+
+  particle_iterator get_bucket_particles(reference bucket) const {
+#ifndef __CUDA_ARCH__
+    LOG(4, "\tget_bucket_particles: looking in bucket with idx = "
+               << get_child_index(bucket));
+#endif
+    if (!is_leaf_node(bucket)) {
+      return particle_iterator();
+    }
+
+    const vint2 &leaf =
+        m_leafs[get_child_index(bucket) - (m_number_of_leafs - 1)];
+
+    return particle_iterator(m_particles_begin + leaf[0],
+                             m_particles_begin + leaf[1]);
+  }
+
+  ///
+  /// @brief returns the leaf containing @p position, or if there is no such
+  /// leaf (the boxes do not cover the domain) then a nearby leaf
+  ///
+  child_iterator get_bucket(const double_d &position) const {
+    child_iterator i = get_children();
+    go_to(position, i);
+
+    while (!is_leaf_node(*i)) {
+      i = get_children(i);
+      go_to(position, i);
+    }
+
+    return i;
+  }
+
+  size_t get_parent_index(const child_iterator &ci) const {
+    return ci.m_data.parent;
+  }
+
+  const box_type &get_parent_bounds(const child_iterator &ci) const {
+    return m_nodes_bounds[ci.m_data.parent];
+  }
+
+  size_t get_bucket_index(reference bucket) const {
+    return get_child_index(bucket);
+  }
+
+  size_t number_of_buckets() const { return m_number_of_buckets; }
+
+  template <int LNormNumber, typename Transform = IdentityTransform>
+  query_iterator<LNormNumber, Transform>
+  get_buckets_near_point(const double_d &position, const double max_distance,
+                         const Transform &transform = Transform()) const {
+#ifndef __CUDA_ARCH__
+    LOG(4, "\tget_buckets_near_point: position = "
+               << position << " max_distance= " << max_distance);
+#endif
+    return query_iterator<LNormNumber, Transform>(
+        get_children(), position, max_distance, m_number_of_levels, this,
+        transform);
+  }
+
+  all_iterator get_subtree(const child_iterator &ci) const {
+    return all_iterator(get_children(ci), m_number_of_levels, this);
+  }
+
+  all_iterator get_subtree() const {
+    return all_iterator(get_children(), m_number_of_levels, this);
+  }
+
+  size_t number_of_particles() const {
+    return m_particles_end - m_particles_begin;
+  }
+
+  raw_pointer get_particles_begin() const { return m_particles_begin; }
+
+  unsigned number_of_levels() const { return m_number_of_levels; }
+
+private:
+  // goes to the child of @p ci's parent with the closest box to @p position
+  void go_to(const double_d &position, child_iterator &ci) const {
+    double dist[2];
+    for (int high = 0; high < 2; ++high) {
+      const box_type &box =
+          m_nodes_bounds[m_nodes_child[ci.m_data.parent][high]];
+      dist[high] = 0;
+      for (size_t d = 0; d < dimension; ++d) {
+        const double dx = std::max(
+            std::max(box.bmin[d] - position[d], position[d] - box.bmax[d]),
+            0.0);
+        dist[high] += dx * dx;
+      }
+    }
+    ci.m_data.high = dist[1] < dist[0] ? 1 : 0;
+  }
+};
+
+} // namespace Aboria
+
+#endif /* LBVH_H_ */
@@ -41,19 +41,27 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #endif
 
 // Level1
+#include "AdaptiveCellList.h"
+#include "AsyncWriter.h"
 #include "CellList.h"
 #include "CellListOrdered.h"
 #include "CudaInclude.h"
 #include "Elements.h"
 #include "Get.h"
+#include "HashedCellList.h"
 #include "Kdtree.h"
+#include "LBVH.h"
 #include "NanoFlannAdaptor.h"
+#include "NeighbourGraph.h"
 #include "OctTree.h"
 #include "Particles.h"
 #include "PrintTuple.h"
+#include "Snapshot.h"
 #include "Traits.h"
+#include "Trajectory.h"
 #include "Utils.h"
 #include "Variable.h"
 #include "Vector.h"
+#include "VtuWriter.h"
 
 #endif /* ABORIA_H_ */
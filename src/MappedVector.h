@@ -0,0 +1,410 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Aboria.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef MAPPED_VECTOR_H_
+#define MAPPED_VECTOR_H_
+
+#include "Log.h"
+#include "detail/MappedFile.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace Aboria {
+
+namespace detail {
+
+struct out_of_core_settings {
+  /// the size in bytes above which a mapped_vector is stored in a file
+  size_t threshold;
+
+  /// the directory in which the files are created
+  std::string directory;
+
+  out_of_core_settings() : threshold(size_t(64) << 20) {
+    const char *tmpdir = std::getenv("TMPDIR");
+    directory = tmpdir != nullptr && *tmpdir != 0 ? tmpdir : "/tmp";
+  }
+};
+
+inline out_of_core_settings &get_out_of_core_settings() {
+  static out_of_core_settings settings;
+  return settings;
+}
+
+} // namespace detail
+
+///
+/// @brief set the size in bytes above which the storage of a @ref
+/// mapped_vector is moved to a temporary file. This is also the memory used by
+/// the out-of-core rebuild of @ref CellListOrdered. The default is 64MB
+///
+inline void set_out_of_core_threshold(const size_t bytes) {
+  detail::get_out_of_core_settings().threshold = bytes;
+}
+
+inline size_t get_out_of_core_threshold() {
+  return detail::get_out_of_core_settings().threshold;
+}
+
+///
+/// @brief set the directory in which @ref mapped_vector creates its temporary
+/// files. The default is `$TMPDIR`, or `/tmp` if this is not set
+///
+inline void set_out_of_core_directory(const std::string &directory) {
+  detail::get_out_of_core_settings().directory = directory;
+}
+
+inline const std::string &get_out_of_core_directory() {
+  return detail::get_out_of_core_settings().directory;
+}
+
+///
+/// @brief a vector that stores its elements in memory until they take more
+/// than get_out_of_core_threshold() bytes, after which they are stored in a
+/// temporary file that is mapped into memory. The OS then pages the elements
+/// in and out of memory as they are used, so a vector can be larger than the
+/// available memory.
+///
+/// This can be passed as the `VECTOR` template argument of @ref Particles,
+/// which then stores each variable (and the neighbour search data
+/// structures) in its own file. Iterators are raw pointers, so sequential
+/// access streams through the file. The temporary files are created in
+/// get_out_of_core_directory(), and are deleted when the vector is.
+///
+/// As for `std::vector`, iterators are invalidated when the capacity grows.
+/// Elements are moved by copying their bytes, so @p T must be trivially
+/// destructible and not hold pointers into itself
+///
+/// @tparam T the element type
+/// @tparam Alloc unused, for compatibility with `std::vector`
+///
+template <typename T, typename Alloc = std::allocator<T>> class mapped_vector {
+  static_assert(std::is_trivially_destructible<T>::value,
+                "mapped_vector elements must be trivially destructible");
+
+public:
+  typedef T value_type;
+  typedef Alloc allocator_type;
+  typedef size_t size_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef T &reference;
+  typedef const T &const_reference;
+  typedef T *pointer;
+  typedef const T *const_pointer;
+  typedef T *iterator;
+  typedef const T *const_iterator;
+  typedef std::reverse_iterator<iterator> reverse_iterator;
+  typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+  mapped_vector() : m_data(nullptr), m_size(0), m_capacity(0) {}
+
+  explicit mapped_vector(const size_type n) : mapped_vector() { resize(n); }
+
+  mapped_vector(const size_type n, const T &value) : mapped_vector() {
+    resize(n, value);
+  }
+
+  template <typename InputIterator,
+            typename = typename std::enable_if<
+                !std::is_integral<InputIterator>::value>::type>
+  mapped_vector(InputIterator first, InputIterator last) : mapped_vector() {
+    assign(first, last);
+  }
+
+  mapped_vector(std::initializer_list<T> values) : mapped_vector() {
+    assign(values.begin(), values.end());
+  }
+
+  mapped_vector(const mapped_vector &other) : mapped_vector() {
+    assign(other.begin(), other.end());
+  }
+
+  mapped_vector(mapped_vector &&other) : mapped_vector() { swap(other); }
+
+  mapped_vector &operator=(const mapped_vector &other) {
+    if (this != &other) {
+      assign(other.begin(), other.end());
+    }
+    return *this;
+  }
+
+  mapped_vector &operator=(mapped_vector &&other) {
+    mapped_vector moved(std::move(other));
+    swap(moved);
+    return *this;
+  }
+
+  ~mapped_vector() { deallocate(); }
+
+  iterator begin() { return m_data; }
+  iterator end() { return m_data + m_size; }
+  const_iterator begin() const { return m_data; }
+  const_iterator end() const { return m_data + m_size; }
+  const_iterator cbegin() const { return m_data; }
+  const_iterator cend() const { return m_data + m_size; }
+  reverse_iterator rbegin() { return reverse_iterator(end()); }
+  reverse_iterator rend() { return reverse_iterator(begin()); }
+  const_reverse_iterator rbegin() const {
+    return const_reverse_iterator(end());
+  }
+  const_reverse_iterator rend() const {
+    return const_reverse_iterator(begin());
+  }
+
+  size_type size() const { return m_size; }
+  size_type capacity() const { return m_capacity; }
+  bool empty() const { return m_size == 0; }
+
+  ///
+  /// @brief returns true if the elements are stored in a file
+  ///
+  bool is_mapped() const { return m_file.is_open(); }
+
+  reference operator[](const size_type i) {
+    ASSERT(i < m_size, "mapped_vector index out of range");
+    return m_data[i];
+  }
+  const_reference operator[](const size_type i) const {
+    ASSERT(i < m_size, "mapped_vector index out of range");
+    return m_data[i];
+  }
+  reference front() { return m_data[0]; }
+  const_reference front() const { return m_data[0]; }
+  reference back() { return m_data[m_size - 1]; }
+  const_reference back() const { return m_data[m_size - 1]; }
+  T *data() { return m_data; }
+  const T *data() const { return m_data; }
+
+  void reserve(const size_type n) {
+    if (n > m_capacity) {
+      reallocate(n);
+    }
+  }
+
+  void resize(const size_type n) { resize(n, T()); }
+
+  void resize(const size_type n, const T &value) {
+    if (n > m_size) {
+      const T copy(value);
+      reserve(grow(n));
+      for (size_type i = m_size; i < n; ++i) {
+        new (m_data + i) T(copy);
+      }
+    }
+    m_size = n;
+  }
+
+  void clear() { m_size = 0; }
+
+  void push_back(const T &value) {
+    const T copy(value);
+    reserve(grow(m_size + 1));
+    new (m_data + m_size) T(copy);
+    ++m_size;
+  }
+
+  template <typename... Args> void emplace_back(Args &&... args) {
+    const T value(std::forward<Args>(args)...);
+    push_back(value);
+  }
+
+  void pop_back() {
+    ASSERT(m_size > 0, "pop_back on empty mapped_vector");
+    --m_size;
+  }
+
+  void assign(const size_type n, const T &value) {
+    const T copy(value);
+    clear();
+    resize(n, copy);
+  }
+
+  template <typename InputIterator,
+            typename = typename std::enable_if<
+                !std::is_integral<InputIterator>::value>::type>
+  void assign(InputIterator first, InputIterator last) {
+    const size_type n = std::distance(first, last);
+    clear();
+    reserve(n);
+    for (size_type i = 0; i < n; ++i, ++first) {
+      new (m_data + i) T(*first);
+    }
+    m_size = n;
+  }
+
+  iterator insert(const_iterator position, const T &value) {
+    return insert(position, 1, value);
+  }
+
+  iterator insert(const_iterator position, const size_type n,
+                  const T &value) {
+    const T copy(value);
+    const size_type i = make_gap(position, n);
+    for (size_type j = i; j < i + n; ++j) {
+      new (m_data + j) T(copy);
+    }
+    return m_data + i;
+  }
+
+  template <typename InputIterator,
+            typename = typename std::enable_if<
+                !std::is_integral<InputIterator>::value>::type>
+  iterator insert(const_iterator position, InputIterator first,
+                  InputIterator last) {
+    // copy first, in case the range is in this vector
+    const mapped_vector values(first, last);
+    const size_type i = make_gap(position, values.size());
+    std::memcpy(static_cast<void *>(m_data + i), values.data(),
+                values.size() * sizeof(T));
+    return m_data + i;
+  }
+
+  iterator erase(const_iterator position) {
+    return erase(position, position + 1);
+  }
+
+  iterator erase(const_iterator first, const_iterator last) {
+    const size_type i = first - m_data;
+    const size_type n = last - first;
+    std::memmove(static_cast<void *>(m_data + i), m_data + i + n,
+                 (m_size - i - n) * sizeof(T));
+    m_size -= n;
+    return m_data + i;
+  }
+
+  void swap(mapped_vector &other) {
+    std::swap(m_data, other.m_data);
+    std::swap(m_size, other.m_size);
+    std::swap(m_capacity, other.m_capacity);
+    std::swap(m_file, other.m_file);
+  }
+
+private:
+  size_type grow(const size_type n) const {
+    return n > m_capacity ? std::max(n, 2 * m_capacity) : m_capacity;
+  }
+
+  ///
+  /// @brief moves the elements from @p position onwards up by @p n
+  ///
+  /// @return the index of the start of the gap
+  ///
+  size_type make_gap(const_iterator position, const size_type n) {
+    const size_type i = position - m_data;
+    reserve(grow(m_size + n));
+    std::memmove(static_cast<void *>(m_data + i + n), m_data + i,
+                 (m_size - i) * sizeof(T));
+    m_size += n;
+    return i;
+  }
+
+  void reallocate(const size_type capacity) {
+    const size_t bytes = capacity * sizeof(T);
+    if (m_file.is_open()) {
+      // the file keeps its contents when it is resized
+      m_file.resize(bytes);
+      m_data = reinterpret_cast<T *>(m_file.data());
+    } else if (bytes > get_out_of_core_threshold()) {
+      detail::mapped_file file(get_out_of_core_directory(),
+                               detail::mapped_file::temporary, bytes);
+      LOG(2, "mapped_vector: moving " << m_size << " elements to "
+                                      << file.filename());
+      if (m_size > 0) {
+        std::memcpy(file.data(), static_cast<const void *>(m_data),
+                    m_size * sizeof(T));
+      }
+      ::operator delete(m_data);
+      m_file = std::move(file);
+      m_data = reinterpret_cast<T *>(m_file.data());
+    } else {
+      T *data = static_cast<T *>(::operator new(bytes));
+      if (m_size > 0) {
+        std::memcpy(static_cast<void *>(data),
+                    static_cast<const void *>(m_data), m_size * sizeof(T));
+      }
+      ::operator delete(m_data);
+      m_data = data;
+    }
+    m_capacity = capacity;
+  }
+
+  void deallocate() {
+    if (m_file.is_open()) {
+      m_file.close();
+    } else {
+      ::operator delete(m_data);
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_capacity = 0;
+  }
+
+  T *m_data;
+  size_type m_size;
+  size_type m_capacity;
+
+  /// the temporary file holding the elements, if they are not in memory
+  detail::mapped_file m_file;
+};
+
+template <typename T, typename Alloc>
+bool operator==(const mapped_vector<T, Alloc> &a,
+                const mapped_vector<T, Alloc> &b) {
+  return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+}
+
+template <typename T, typename Alloc>
+bool operator!=(const mapped_vector<T, Alloc> &a,
+                const mapped_vector<T, Alloc> &b) {
+  return !(a == b);
+}
+
+template <typename T, typename Alloc>
+void swap(mapped_vector<T, Alloc> &a, mapped_vector<T, Alloc> &b) {
+  a.swap(b);
+}
+
+} // namespace Aboria
+
+#endif /* MAPPED_VECTOR_H_ */
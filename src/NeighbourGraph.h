@@ -0,0 +1,180 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Aboria.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef NEIGHBOUR_GRAPH_H_
+#define NEIGHBOUR_GRAPH_H_
+
+#include "Get.h"
+#include "Log.h"
+#include "Search.h"
+#include "Vector.h"
+#include "detail/Algorithms.h"
+
+#include <vector>
+
+namespace Aboria {
+
+///
+/// @brief the graph of all pairs of particles within a given distance of
+/// each other, stored in compressed sparse row (CSR) format
+///
+/// The neighbours of particle i are `col_idx[row_ptr[i]]` to
+/// `col_idx[row_ptr[i+1]-1]`. If the distance vectors were stored then
+/// `dx[k]` is the vector $r_j-r_i$ for the neighbour `j = col_idx[k]`,
+/// taking into account periodicity
+///
+/// @see build_neighbour_graph()
+///
+template <unsigned int D> struct neighbour_graph {
+  typedef Vector<double, D> double_d;
+
+  ///
+  /// @brief index of the first neighbour of each particle, has one more
+  /// element than the number of particles
+  ///
+  std::vector<int> row_ptr;
+
+  ///
+  /// @brief the index of each neighbour
+  ///
+  std::vector<int> col_idx;
+
+  ///
+  /// @brief the distance vector to each neighbour (empty if not stored)
+  ///
+  std::vector<double_d> dx;
+
+  ///
+  /// @brief true if only the pairs with j >= i are stored
+  ///
+  bool symmetric;
+
+  neighbour_graph() : row_ptr(1, 0), symmetric(false) {}
+
+  ///
+  /// @brief the number of particles (rows) in the graph
+  ///
+  size_t size() const { return row_ptr.size() - 1; }
+
+  ///
+  /// @brief the number of stored pairs
+  ///
+  size_t number_of_pairs() const { return col_idx.size(); }
+};
+
+///
+/// @brief builds the graph of all pairs of particles in @p particles within
+/// a euclidean distance @p radius of each other
+///
+/// The graph is built in two passes over the particles, both run in
+/// parallel if OpenMP is enabled. The first counts the neighbours of each
+/// particle, which gives the row offsets of the CSR graph, and the second
+/// searches again and writes each neighbour directly into its place in the
+/// graph. No temporary per-particle lists are needed, and the memory used is
+/// exactly that of the final graph. The searches use for_each_neighbour(), so
+/// any neighbour search data structure can be used.
+///
+/// Each particle is a neighbour of itself. If @p symmetric is true then
+/// only the pairs with j >= i are stored, halving the size of the graph.
+///
+/// @param particles the particle set, its neighbour search must be
+/// initialised and up to date
+/// @param radius the maximum distance between the particles in a pair
+/// @param symmetric if true, only store the pairs with j >= i
+/// @param store_dx if true, also store the distance vector to each
+/// neighbour
+///
+template <typename ParticlesType>
+neighbour_graph<ParticlesType::dimension>
+build_neighbour_graph(const ParticlesType &particles, const double radius,
+                      const bool symmetric = false,
+                      const bool store_dx = false) {
+  typedef typename ParticlesType::position position;
+  typedef typename ParticlesType::double_d double_d;
+
+  const int n = particles.size();
+  const auto &query = particles.get_query();
+  const double_d *positions = get<position>(particles).data();
+  LOG(2, "build_neighbour_graph: building graph for "
+             << n << " particles with radius " << radius);
+
+  neighbour_graph<ParticlesType::dimension> graph;
+  graph.symmetric = symmetric;
+  graph.row_ptr.resize(n + 1);
+  graph.row_ptr[0] = 0;
+
+  // first pass counts the neighbours of each particle
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
+  for (int i = 0; i < n; ++i) {
+    int count = 0;
+    for_each_neighbour(query, positions[i], radius,
+                       [&](const int j, const double_d &) {
+                         count += !symmetric || j >= i;
+                       });
+    graph.row_ptr[i + 1] = count;
+  }
+  detail::inclusive_scan(graph.row_ptr.begin() + 1, graph.row_ptr.end(),
+                         graph.row_ptr.begin() + 1);
+  graph.col_idx.resize(graph.row_ptr[n]);
+  if (store_dx) {
+    graph.dx.resize(graph.row_ptr[n]);
+  }
+
+  // second pass fills in the neighbours
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
+  for (int i = 0; i < n; ++i) {
+    int k = graph.row_ptr[i];
+    for_each_neighbour(query, positions[i], radius,
+                       [&](const int j, const double_d &dx) {
+                         if (!symmetric || j >= i) {
+                           graph.col_idx[k] = j;
+                           if (store_dx) {
+                             graph.dx[k] = dx;
+                           }
+                           ++k;
+                         }
+                       });
+  }
+
+  return graph;
+}
+
+} // namespace Aboria
+
+#endif /* NEIGHBOUR_GRAPH_H_ */
@@ -158,7 +158,9 @@ public:
   /// possible using the `double` type. All periodicity is turned off, and the
   /// number of particle per bucket is set to 10
   ///
-  neighbour_search_base() : m_id_map(false) {
+  neighbour_search_base()
+      : m_id_map(false), m_bucket_ordering(bucket_ordering::lexicographic),
+        m_auto_domain(false), m_auto_domain_padding(0) {
     LOG_CUDA(2, "neighbour_search_base: constructor, setting default domain");
     const double min = std::numeric_limits<double>::min();
     const double max = std::numeric_limits<double>::max();
@@ -175,6 +177,15 @@ public:
   ///
   static constexpr bool ordered() { return true; }
 
+  ///
+  /// @brief Returns true if the last call to update_positions() changed the
+  ///        required order of the particles. Only used if ordered() is true.
+  ///        This can be overloaded by the Derived class
+  ///
+  /// @return true
+  ///
+  bool reorder_needed() const { return true; }
+
   ///
   /// @brief A function object used to enforce the domain extents on the set
   ///        of particles
@@ -255,6 +266,7 @@ public:
                   const bool not_in_constructor = true) {
     LOG(2, "neighbour_search_base: set_domain:");
     m_domain_has_been_set = not_in_constructor;
+    m_auto_domain = false;
     m_bounds.bmin = min_in;
     m_bounds.bmax = max_in;
     m_periodic = periodic_in;
@@ -267,6 +279,41 @@ public:
     LOG(2, "\tperiodic = " << m_periodic);
   }
 
+  ///
+  /// @brief sets the domain to the bounding box of the particles, and keeps
+  ///        it up to date as the particles move
+  ///
+  /// The domain is non-periodic, and is the bounding box of the alive
+  /// particles enlarged on each side by @p padding times its longest side.
+  /// It is first set at the next call to update_positions(). On each call to
+  /// update_positions() the bounding box is recalculated, and
+  /// the domain is reset if a particle has left it, or if the domain has
+  /// become more than twice as wide as needed along any dimension. Like the
+  /// bucket size (which is only recalculated once the number of particles
+  /// doubles or halves), this means that a steadily growing or shrinking
+  /// particle set only rebuilds the data structure a logarithmic number of
+  /// times. Only supported for `std::vector` storage
+  ///
+  /// @param padding the fraction of the longest side of the bounding box
+  ///        added to each side of the domain. Must be greater than zero
+  /// @param n_particles_in_leaf indicates the average, or maximum number of
+  ///        particles in each bucket
+  ///
+  void set_auto_domain(const double padding = 0.2,
+                       const double n_particles_in_leaf = 10) {
+    LOG(2, "neighbour_search_base: set_auto_domain:");
+    CHECK(padding > 0, "the auto domain padding must be greater than zero");
+    m_domain_has_been_set = true;
+    m_auto_domain = true;
+    m_auto_domain_padding = padding;
+    m_periodic = bool_d::Constant(false);
+    m_n_particles_in_leaf = n_particles_in_leaf;
+    // an empty domain, so that it is reset at the next update
+    m_bounds = bbox<Traits::dimension>();
+    LOG(2, "\tpadding = " << m_auto_domain_padding);
+    LOG(2, "\tparticles_in_leaf = " << m_n_particles_in_leaf);
+  }
+
   ///
   /// @brief returns an index into the particle set given a particle id
   ///
@@ -377,6 +424,15 @@ public:
     if (update_n == 0)
       return false;
 
+    // grow or shrink an automatic domain to fit the particles. This changes
+    // the buckets of every particle, so all of them must be updated
+    if (m_auto_domain && update_auto_domain()) {
+      CHECK(update_begin == begin && update_end == end,
+            "the automatic domain has changed, so all the particles must be "
+            "updated");
+      cast().set_domain_impl();
+    }
+
     // enforce domain
     if (m_domain_has_been_set) {
       detail::for_each(update_begin, update_end,
@@ -441,8 +497,8 @@ public:
       LOG(2, "neighbour_search_base: update_id_map:");
       // if no new particles, no dead, no reorder, or no init than can assume
       // that previous id map is correct
-      if (cast().ordered() || new_n > 0 || num_dead > 0 ||
-          m_id_map_key.size() == 0) {
+      if ((cast().ordered() && cast().reorder_needed()) || new_n > 0 ||
+          num_dead > 0 || m_id_map_key.size() == 0) {
         m_id_map_key.resize(dead_and_alive_n - num_dead);
         m_id_map_value.resize(dead_and_alive_n - num_dead);
 
@@ -491,7 +547,7 @@ public:
     query.m_particles_begin = iterator_to_raw_pointer(m_particles_begin);
     query.m_particles_end = iterator_to_raw_pointer(m_particles_end);
 
-    return cast().ordered() || num_dead > 0;
+    return (cast().ordered() && cast().reorder_needed()) || num_dead > 0;
   }
 
   ///
@@ -554,6 +610,42 @@ public:
   ///
   double get_max_bucket_size() const { return m_n_particles_in_leaf; }
 
+  ///
+  /// @brief sets the number of particles in each bucket (average or maximum),
+  /// keeping the current domain. The data structure is rebuilt on the next
+  /// call to update_positions()
+  ///
+  void set_max_bucket_size(const double n_particles_in_leaf) {
+    LOG(2, "neighbour_search_base: set_max_bucket_size: "
+               << n_particles_in_leaf);
+    m_n_particles_in_leaf = n_particles_in_leaf;
+    if (m_domain_has_been_set && (m_bounds.bmin <= m_bounds.bmax).all()) {
+      cast().set_domain_impl();
+    }
+  }
+
+  ///
+  /// @brief sets the order in which buckets are numbered. This is only used
+  /// by the cell list data structures, and takes effect on the next call to
+  /// update_positions()
+  ///
+  /// @see bucket_ordering
+  ///
+  void set_bucket_ordering(const bucket_ordering ordering) {
+    m_bucket_ordering = ordering;
+  }
+
+  ///
+  /// @return the order in which buckets are numbered
+  ///
+  bucket_ordering get_bucket_ordering() const { return m_bucket_ordering; }
+
+  ///
+  /// @return true if the domain is set automatically from the particles
+  /// @see set_auto_domain()
+  ///
+  bool get_auto_domain() const { return m_auto_domain; }
+
 protected:
   ///
   /// @brief a copy of the `begin` iterator for the particle set
@@ -615,6 +707,116 @@ protected:
   ///
   ///
   double m_n_particles_in_leaf;
+
+  ///
+  /// @brief the order in which buckets are numbered (cell lists only)
+  ///
+  bucket_ordering m_bucket_ordering;
+
+  ///
+  /// @brief true if the domain is set automatically from the particles
+  /// @see set_auto_domain()
+  ///
+  bool m_auto_domain;
+
+  ///
+  /// @brief the padding added to the bounding box of the particles to get
+  /// the automatic domain
+  ///
+  double m_auto_domain_padding;
+
+private:
+  ///
+  /// @return the bounding box of the alive particles with finite positions
+  ///
+  bbox<Traits::dimension> calculate_particle_bounds() const {
+    typedef bbox<Traits::dimension> box_type;
+    typedef typename Traits::position position;
+    const int n = m_particles_end - m_particles_begin;
+    box_type bounds;
+    if (n == 0) {
+      return bounds;
+    }
+    const double_d *r =
+        iterator_to_raw_pointer(get<position>(m_particles_begin));
+    const uint8_t *is_alive =
+        iterator_to_raw_pointer(get<alive>(m_particles_begin));
+#ifdef HAVE_OPENMP
+#pragma omp parallel if (detail::use_omp_backend<int *>(n))
+#endif
+    {
+      box_type local_bounds;
+#ifdef HAVE_OPENMP
+#pragma omp for
+#endif
+      for (int i = 0; i < n; ++i) {
+        bool finite = is_alive[i];
+        for (size_t d = 0; d < Traits::dimension; ++d) {
+          finite &= std::isfinite(r[i][d]);
+        }
+        if (finite) {
+          local_bounds = local_bounds + box_type(r[i]);
+        }
+      }
+#ifdef HAVE_OPENMP
+#pragma omp critical
+#endif
+      bounds = bounds + local_bounds;
+    }
+    return bounds;
+  }
+
+  ///
+  /// @return the automatic domain for the particle bounding box @p bounds
+  ///
+  bbox<Traits::dimension>
+  get_auto_domain_bounds(const bbox<Traits::dimension> &bounds) const {
+    if ((bounds.bmin > bounds.bmax).any()) {
+      // no particles, so use a unit domain
+      return bbox<Traits::dimension>(double_d::Constant(0),
+                                     double_d::Constant(1));
+    }
+    double max_width = (bounds.bmax - bounds.bmin).maxCoeff();
+    if (max_width == 0) {
+      max_width = 1;
+    }
+    const double_d padding =
+        double_d::Constant(m_auto_domain_padding * max_width);
+    return bbox<Traits::dimension>(bounds.bmin - padding,
+                                   bounds.bmax + padding);
+  }
+
+  ///
+  /// @brief resets the automatic domain if a particle has left it, or if it
+  /// is more than twice as wide as needed along any dimension
+  ///
+  /// @return true if the domain was reset
+  ///
+  bool update_auto_domain() {
+    const bbox<Traits::dimension> particle_bounds =
+        calculate_particle_bounds();
+    const bool no_domain = (m_bounds.bmin > m_bounds.bmax).any();
+    if ((particle_bounds.bmin > particle_bounds.bmax).any() && !no_domain) {
+      // no particles, so keep the current domain
+      return false;
+    }
+    const bbox<Traits::dimension> new_bounds =
+        get_auto_domain_bounds(particle_bounds);
+    if (!no_domain) {
+      const double_d width = m_bounds.bmax - m_bounds.bmin;
+      const double_d new_width = new_bounds.bmax - new_bounds.bmin;
+      const bool grow = (particle_bounds.bmin < m_bounds.bmin).any() ||
+                        (particle_bounds.bmax >= m_bounds.bmax).any();
+      const bool shrink = (width > 2 * new_width).any();
+      if (!grow && !shrink) {
+        return false;
+      }
+    }
+    LOG(2, "neighbour_search_base: resetting auto domain from "
+               << m_bounds << " to " << new_bounds);
+    m_bounds = new_bounds;
+    return true;
+  }
 };
 
 ///
@@ -764,6 +966,10 @@ template <typename Traits> struct NeighbourQueryBase {
   ///
   /// @brief returns the min/max bounds of the given child_iterator @p ci
   ///
+  /// For the tree data structures this is the tight bounding box of the
+  /// particles within the node, which can be smaller than the region of
+  /// space covered by the node
+  ///
   /// @return a @bbox containing the bounds
   ///
   const box_type get_bounds(const child_iterator &ci) const;
@@ -924,6 +1130,8 @@ public:
   ranges_iterator(const p_pointer &begin, const p_pointer &end)
       : m_current_p(begin), m_end_p(end) {}
 
+  ABORIA_HOST_DEVICE_IGNORE_WARN
+  CUDA_HOST_DEVICE
   size_t distance_to_end() const { return m_end_p - m_current_p; }
 
   ABORIA_HOST_DEVICE_IGNORE_WARN
@@ -1808,7 +2016,7 @@ public:
   }
 
   lattice_iterator<dimension> get_child_iterator() const {
-    lattice_iterator<dimension> ret = m_query->get_subtree();
+    lattice_iterator<dimension> ret = m_query->get_children();
     ret = m_index;
     return ret;
   }
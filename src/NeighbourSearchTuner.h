@@ -0,0 +1,304 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Aboria.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef NEIGHBOUR_SEARCH_TUNER_H_
+#define NEIGHBOUR_SEARCH_TUNER_H_
+
+#include "Get.h"
+#include "Log.h"
+#include "Search.h"
+#include "Vector.h"
+
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <vector>
+
+namespace Aboria {
+
+///
+/// @brief the bucket size chosen by the NeighbourSearchTuner, along with the
+/// timings that it was chosen on
+///
+struct neighbour_search_tuning {
+  /// the chosen `n_particles_in_leaf`, 0 if not yet tuned
+  double n_particles_in_leaf;
+
+  /// the time taken to rebuild the data structure (seconds)
+  double rebuild_time;
+
+  /// the estimated time taken to search around every particle (seconds)
+  double search_time;
+
+  /// the number of particles in the set when the timings were taken
+  size_t n;
+
+  /// true if the setting was taken from the cache rather than timed
+  bool cached;
+
+  neighbour_search_tuning()
+      : n_particles_in_leaf(0), rebuild_time(0), search_time(0), n(0),
+        cached(false) {}
+};
+
+namespace detail {
+
+///
+/// @brief the tunings found so far for the search method @p SearchMethod in
+/// @p D dimensions, keyed by the binned ratio of the search radius to the
+/// domain width (see NeighbourSearchTuner)
+///
+template <template <typename> class SearchMethod, unsigned int D>
+std::map<int, neighbour_search_tuning> &neighbour_search_tuning_cache() {
+  static std::map<int, neighbour_search_tuning> cache;
+  return cache;
+}
+
+} // namespace detail
+
+///
+/// @brief Opt-in auto-tuning of the bucket size (`n_particles_in_leaf`) of a
+/// particle set's neighbour search data structure.
+///
+/// For each candidate bucket size, the tuner rebuilds the data structure of
+/// the live particle set and times a sample of euclidean searches of a given
+/// radius (in parallel if OpenMP is enabled, so the thread count is taken
+/// into account). The bucket size with the smallest sum of rebuild time and
+/// estimated time to search around every particle is kept.
+///
+/// The result is cached for each search method, dimension and ratio of search
+/// radius to domain width (binned to the nearest half power of 2), so other
+/// particle sets of a similar size reuse it without timing. The particle set
+/// is re-tuned once the number of particles doubles or halves.
+///
+/// The tuner is owned by @ref Particles, and is enabled using
+/// Particles::init_neighbour_search_tuning(). It is updated on every call to
+/// Particles::update_positions(). Note that the cache is not thread-safe
+///
+/// @tparam SearchMethod the neighbour search data structure of the set
+/// @tparam Traits the @ref TraitsCommon type of the particle set
+///
+template <template <typename> class SearchMethod, typename Traits>
+class NeighbourSearchTuner {
+  typedef typename Traits::double_d double_d;
+  typedef typename Traits::position position;
+  static const unsigned int dimension = Traits::dimension;
+  typedef std::chrono::steady_clock clock_type;
+
+public:
+  NeighbourSearchTuner()
+      : m_radius(0), m_n_queries(0), m_enabled(false),
+        m_tuning_in_progress(false), m_number_of_tunings(0) {}
+
+  ///
+  /// @brief enable the tuner. The particle set is tuned on the next call to
+  /// update()
+  ///
+  /// @param radius the search radius that the bucket size is tuned for
+  /// @param n_queries the number of searches timed for each candidate
+  /// @param candidates the bucket sizes that are tried
+  ///
+  void init(const double radius, const size_t n_queries,
+            const std::vector<double> &candidates) {
+    CHECK(radius > 0, "tuning radius must be positive");
+    CHECK(n_queries > 0, "number of tuning queries must be positive");
+    CHECK(!candidates.empty(), "no candidate bucket sizes given");
+    m_radius = radius;
+    m_n_queries = n_queries;
+    m_candidates = candidates;
+    m_enabled = true;
+    m_tuning = neighbour_search_tuning();
+  }
+
+  ///
+  /// @brief returns true if init() has been called
+  ///
+  bool is_enabled() const { return m_enabled; }
+
+  double get_radius() const { return m_radius; }
+
+  ///
+  /// @brief the bucket size chosen at the last tuning, with its timings
+  ///
+  const neighbour_search_tuning &get_tuning() const { return m_tuning; }
+
+  ///
+  /// @brief the number of times the candidates have been timed (tunings
+  /// taken from the cache are not counted)
+  ///
+  size_t number_of_tunings() const { return m_number_of_tunings; }
+
+  ///
+  /// @brief tunes the particle set if it has not been tuned, or if the number
+  /// of particles has doubled or halved since the last tuning
+  ///
+  /// @return true if the particle set was tuned
+  ///
+  template <typename ParticlesType> bool update(ParticlesType &particles) {
+    if (!m_enabled || m_tuning_in_progress) {
+      return false;
+    }
+    const size_t n = particles.size();
+    if (n == 0 || (m_tuning.n > 0 && n >= 0.5 * m_tuning.n &&
+                   n <= 2 * m_tuning.n)) {
+      return false;
+    }
+    m_tuning_in_progress = true;
+    tune(particles);
+    m_tuning_in_progress = false;
+    return true;
+  }
+
+private:
+  template <typename ParticlesType> void tune(ParticlesType &particles) {
+    const size_t n = particles.size();
+    const double width = (particles.get_max() - particles.get_min()).maxCoeff();
+    const int ratio_bin =
+        width > 0
+            ? static_cast<int>(std::lround(2 * std::log2(m_radius / width)))
+            : 0;
+    std::map<int, neighbour_search_tuning> &cache =
+        detail::neighbour_search_tuning_cache<SearchMethod, dimension>();
+
+    auto cached = cache.find(ratio_bin);
+    if (cached != cache.end() && n >= 0.5 * cached->second.n &&
+        n <= 2 * cached->second.n) {
+      m_tuning = cached->second;
+      m_tuning.cached = true;
+      LOG(2, "NeighbourSearchTuner: using cached n_particles_in_leaf = "
+                 << m_tuning.n_particles_in_leaf);
+      set_bucket_size(particles, m_tuning.n_particles_in_leaf);
+      return;
+    }
+
+    // the search points are copied, as the particles are reordered by each
+    // rebuild
+    const size_t n_queries = std::min(n, m_n_queries);
+    std::vector<double_d> points(n_queries);
+    for (size_t i = 0; i < n_queries; ++i) {
+      points[i] = get<position>(particles)[i * n / n_queries];
+    }
+
+    double best_time = std::numeric_limits<double>::max();
+    for (const double candidate : m_candidates) {
+      const double rebuild_time = set_bucket_size(particles, candidate);
+      const double search_time =
+          time_searches(particles.get_query(), points) * n / n_queries;
+      LOG(2, "NeighbourSearchTuner: n_particles_in_leaf = "
+                 << candidate << " rebuild time = " << rebuild_time
+                 << " search time = " << search_time);
+      if (rebuild_time + search_time < best_time) {
+        best_time = rebuild_time + search_time;
+        m_tuning.n_particles_in_leaf = candidate;
+        m_tuning.rebuild_time = rebuild_time;
+        m_tuning.search_time = search_time;
+      }
+    }
+    m_tuning.n = n;
+    m_tuning.cached = false;
+    ++m_number_of_tunings;
+    cache[ratio_bin] = m_tuning;
+    LOG(2, "NeighbourSearchTuner: chose n_particles_in_leaf = "
+               << m_tuning.n_particles_in_leaf);
+    set_bucket_size(particles, m_tuning.n_particles_in_leaf);
+  }
+
+  ///
+  /// @brief rebuilds the data structure of @p particles with the bucket size
+  /// @p n_particles_in_leaf
+  ///
+  /// @return the time taken (seconds)
+  ///
+  template <typename ParticlesType>
+  double set_bucket_size(ParticlesType &particles,
+                         const double n_particles_in_leaf) {
+    const clock_type::time_point start = clock_type::now();
+    particles.get_neighbour_search().set_max_bucket_size(n_particles_in_leaf);
+    particles.update_positions();
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+  }
+
+  ///
+  /// @return the time taken to search around each of @p points (seconds)
+  ///
+  template <typename Query>
+  double time_searches(const Query &query,
+                       const std::vector<double_d> &points) const {
+    const int n = points.size();
+    const double radius = m_radius;
+    size_t count = 0;
+    const clock_type::time_point start = clock_type::now();
+#ifdef HAVE_OPENMP
+#pragma omp parallel for reduction(+ : count)
+#endif
+    for (int i = 0; i < n; ++i) {
+      for (auto j = euclidean_search(query, points[i], radius); j != false;
+           ++j) {
+        ++count;
+      }
+    }
+    const double time =
+        std::chrono::duration<double>(clock_type::now() - start).count();
+    LOG(3, "NeighbourSearchTuner: found " << count << " neighbours");
+    return time;
+  }
+
+  /// the search radius that the bucket size is tuned for
+  double m_radius;
+
+  /// the number of searches timed for each candidate
+  size_t m_n_queries;
+
+  /// the bucket sizes that are tried
+  std::vector<double> m_candidates;
+
+  /// has init() been called
+  bool m_enabled;
+
+  /// set while tune() rebuilds the particle set, so that update() does not
+  /// recurse
+  bool m_tuning_in_progress;
+
+  /// number of times the candidates have been timed
+  size_t m_number_of_tunings;
+
+  /// the result of the last tuning
+  neighbour_search_tuning m_tuning;
+};
+
+} // namespace Aboria
+
+#endif /* NEIGHBOUR_SEARCH_TUNER_H_ */
@@ -115,6 +115,7 @@ class HyperOctree : public neighbour_search_base<HyperOctree<Traits>, Traits,
   typedef typename Traits::unsigned_int_d unsigned_int_d;
   typedef typename Traits::template vector_type<vint2>::type vector_int2;
   static const unsigned int dimension = Traits::dimension;
+  typedef bbox<dimension> box_type;
 
   // number of children = 2^d
   static const size_t nchild = (1 << dimension);
@@ -138,6 +139,7 @@ public:
         iterator_to_raw_pointer(this->m_nodes.begin());
     this->m_query.m_leaves_begin =
         iterator_to_raw_pointer(this->m_leaves.begin());
+    this->m_query.m_nodes_bounds = nullptr;
     this->m_query.m_number_of_nodes = m_nodes.size();
   }
 
@@ -208,6 +210,8 @@ private:
     }
 
     build_tree();
+    calculate_bounds(
+        typename detail::is_std_iterator<typename vector_int::iterator>::type());
 
 #ifndef __CUDA_ARCH__
     if (3 <= ABORIA_LOG_LEVEL) {
@@ -221,9 +225,82 @@ private:
         iterator_to_raw_pointer(this->m_nodes.begin());
     this->m_query.m_leaves_begin =
         iterator_to_raw_pointer(this->m_leaves.begin());
+    this->m_query.m_nodes_bounds =
+        m_nodes_bounds.empty() ? nullptr : m_nodes_bounds.data();
     this->m_query.m_number_of_nodes = m_nodes.size();
   }
 
+  ///
+  /// @brief calculates the tight bounding box of the particles in each node
+  ///
+  /// The leaf boxes are calculated first, then the internal nodes bottom-up
+  /// (children are always stored after their parent). A box with zero width
+  /// in a dimension is padded, and an empty node is given a padded point box
+  /// at the centre of its parent, so that every box lies within its parent.
+  ///
+  void calculate_bounds(std::true_type) {
+    const int num_nodes = m_nodes.size();
+    const int *indicies = iterator_to_raw_pointer(this->m_alive_indices.begin());
+    const double_d *p =
+        iterator_to_raw_pointer(get<position>(this->m_particles_begin));
+    const double_d min_width = double_d::Constant(
+        1e-10 * (this->m_bounds.bmax - this->m_bounds.bmin).maxCoeff());
+
+    m_nodes_bounds.resize(num_nodes);
+#ifdef HAVE_OPENMP
+#pragma omp parallel for if (detail::use_omp_backend<int *>(                   \
+    this->m_alive_indices.size()))
+#endif
+    for (int i = 0; i < num_nodes; ++i) {
+      if (!detail::is_node(m_nodes[i])) {
+        box_type &bounds = m_nodes_bounds[i];
+        bounds = box_type();
+        if (!detail::is_empty(m_nodes[i])) {
+          const vint2 &leaf = m_leaves[detail::get_leaf_offset(m_nodes[i])];
+          for (int j = leaf[0]; j < leaf[1]; ++j) {
+            bounds = bounds + box_type(p[indicies[j]]);
+          }
+          detail::pad_bounds(bounds, min_width);
+        }
+      }
+    }
+
+    box_type root_bounds;
+    for (int i = num_nodes - 1; i >= 0; --i) {
+      if (detail::is_node(m_nodes[i])) {
+        box_type &bounds = m_nodes_bounds[i];
+        bounds = box_type();
+        for (int j = m_nodes[i]; j < m_nodes[i] + static_cast<int>(nchild);
+             ++j) {
+          bounds = bounds + m_nodes_bounds[j];
+        }
+      }
+      if (i < static_cast<int>(nchild)) {
+        root_bounds = root_bounds + m_nodes_bounds[i];
+      }
+    }
+
+    if (root_bounds.is_empty()) {
+      root_bounds = this->m_bounds;
+    }
+    for (int i = -1; i < num_nodes; ++i) {
+      const int first_child = i < 0 ? 0 : m_nodes[i];
+      if (i >= 0 && !detail::is_node(first_child)) {
+        continue;
+      }
+      const box_type &parent = i < 0 ? root_bounds : m_nodes_bounds[i];
+      for (int j = first_child; j < first_child + static_cast<int>(nchild);
+           ++j) {
+        if (m_nodes_bounds[j].is_empty()) {
+          m_nodes_bounds[j] = box_type(0.5 * (parent.bmin + parent.bmax));
+          detail::pad_bounds(m_nodes_bounds[j], min_width);
+        }
+      }
+    }
+  }
+
+  void calculate_bounds(std::false_type) { m_nodes_bounds.clear(); }
+
   /*
   bool add_points_at_end_impl(const size_t dist) {
       const size_t num_points  = this->m_particles_end -
@@ -321,6 +398,8 @@ private:
   vector_int m_tags;
   vector_int m_nodes;
   vector_int2 m_leaves;
+  // tight bounding box of each node (only calculated for std::vector)
+  std::vector<box_type> m_nodes_bounds;
 
   HyperOctreeQuery<Traits> m_query;
 };
@@ -728,6 +807,7 @@ template <typename Traits> struct HyperOctreeQuery {
 
   vint2 *m_leaves_begin;
   int *m_nodes_begin;
+  box_type *m_nodes_bounds;
 
   size_t *m_id_map_key;
   size_t *m_id_map_value;
@@ -809,9 +889,16 @@ template <typename Traits> struct HyperOctreeQuery {
   ///
   /// @copydoc NeighbourQueryBase::get_bounds()
   ///
+  /// This is the tight bounding box of the particles in the node, or the
+  /// octant of space covered by the node if this has not been calculated
+  /// (thrust vectors)
+  ///
   ABORIA_HOST_DEVICE_IGNORE_WARN
   CUDA_HOST_DEVICE
-  static box_type get_bounds(const child_iterator &ci) {
+  box_type get_bounds(const child_iterator &ci) const {
+    if (m_nodes_bounds != nullptr) {
+      return m_nodes_bounds[&(*ci) - m_nodes_begin];
+    }
     return ci.get_bounds();
   }
 
@@ -64,9 +64,11 @@ class Particles;
 
 #include "CellList.h"
 #include "Get.h"
+#include "NeighbourSearchTuner.h"
 #include "Traits.h"
 #include "Variable.h"
 #include "Vector.h"
+#include "VerletList.h"
 #include "Zip.h"
 #include "detail/Particles.h"
 //#include "OctTree.h"
@@ -100,7 +102,8 @@ namespace Aboria {
 ///         are currently `std::vector` or `thrust::device_vector`.
 ///  \param SearchMethod (default `CellList`) an Aboria spatial
 ///         data structure. Valid options are `Aboria::CellList`,
-///         `Aboria::CellListOrdered`, `Aboria::Kdtree`, or
+///         `Aboria::CellListOrdered`, `Aboria::HashedCellList`,
+///         `Aboria::AdaptiveCellList`, `Aboria::Kdtree`, or
 ///         `Aboria::HyperOctree`
 ///  \param TRAITS_USER the class Aboria::Traits must be specialised on VECTOR
 ///
@@ -178,6 +181,15 @@ public:
   /// the query class that is associated with search_type
   typedef typename search_type::query_type query_type;
 
+  ///
+  /// the cached Verlet neighbour list type
+  typedef VerletList<traits_type> verlet_list_type;
+
+  ///
+  /// the auto-tuner type for the bucket size of the neighbour search
+  typedef NeighbourSearchTuner<SearchMethod, traits_type>
+      neighbour_search_tuner_type;
+
   /// a boost mpl vector type containing a vector of Variable
   /// attached to the particles (includes position, id and
   /// alive flag as well as all user-supplied variables)
@@ -224,7 +236,8 @@ public:
   /// to \a *this
   Particles(const particles_type &other)
       : data(other.data), next_id(other.next_id), searchable(other.searchable),
-        seed(other.seed), search(other.search) {}
+        seed(other.seed), search(other.search), verlet(other.verlet),
+        tuner(other.tuner) {}
 
   /// range-based copy-constructor. performs deep copying of all
   /// particles from \p first to \p last
@@ -449,11 +462,57 @@ public:
                << low << " high = " << high << " periodic = " << periodic
                << " n_particles_in_leaf = " << n_particles_in_leaf);
     search.set_domain(low, high, periodic, n_particles_in_leaf);
+    verlet.invalidate();
     update_positions(begin(), end());
 
     searchable = true;
   }
 
+  /// initialise the neighbourhood searching for the particle container over
+  /// a non-periodic domain that is set automatically from the bounding box of
+  /// the particles. The domain grows whenever a particle leaves it, and
+  /// shrinks if it becomes more than twice as wide as needed, so particles
+  /// are never removed for being outside the domain. As the domain can change
+  /// at any update, every call to update_positions() updates the whole
+  /// particle set
+  ///
+  /// \param padding the fraction of the longest side of the bounding box
+  /// added to each side of the domain, so that the particles can move this
+  /// far before the domain is reset
+  /// \param n_particles_in_leaf By default the neighbourhood data structure
+  /// will have either an average (cell-list) or a maximum of this number of
+  /// particles within each bucket. Set this argument to change this number
+  /// \see init_neighbour_search(const double_d&, const double_d&, const
+  /// bool_d&, const double)
+  void init_neighbour_search(const double padding,
+                             const double n_particles_in_leaf = 10.0) {
+    LOG(2, "Particles:init_neighbour_search: automatic domain, padding = "
+               << padding << " n_particles_in_leaf = " << n_particles_in_leaf);
+    search.set_auto_domain(padding, n_particles_in_leaf);
+    verlet.invalidate();
+    update_positions(begin(), end());
+
+    searchable = true;
+  }
+
+  /// Sets the order in which the buckets of the cell list data structures
+  /// (CellList and CellListOrdered) are numbered. For CellListOrdered, this is
+  /// also the order in which the particles are stored, so a space-filling
+  /// curve ordering (bucket_ordering::morton or bucket_ordering::hilbert)
+  /// keeps neighbouring particles close in memory. Has no effect for the other
+  /// data structures
+  ///
+  /// \param ordering the new bucket ordering
+  /// \see init_neighbour_search()
+  void set_bucket_ordering(const bucket_ordering ordering) {
+    LOG(2, "Particles:set_bucket_ordering: ordering = "
+               << static_cast<int>(ordering));
+    search.set_bucket_ordering(ordering);
+    if (searchable) {
+      update_positions(begin(), end());
+    }
+  }
+
   /// Initialise the "search by id" functionality. This will switch on the
   /// creation and updating of an internal data structure to enable search by
   /// id.
@@ -474,6 +533,71 @@ public:
     return search.get_query();
   }
 
+  /// Returns the spatial data structure used for neighbourhood queries, so
+  /// that structure specific options can be set (e.g.
+  /// CellListOrdered::set_incremental_update_threshold)
+  search_type &get_neighbour_search() { return search; }
+
+  /// const version of get_neighbour_search()
+  const search_type &get_neighbour_search() const { return search; }
+
+  /// Initialise a cached Verlet neighbour list for the particle container.
+  /// The list stores, for each particle, all the particles within a distance
+  /// of \p cutoff + \p skin. It is updated on every call to
+  /// update_positions(), but is only rebuilt once a particle has moved more
+  /// than \p skin/2 since the last build. Neighbour queries with a radius of
+  /// up to \p cutoff (e.g. AccumulateWithinDistance or KernelSparse) will then
+  /// use the list instead of the neighbour search data structure.
+  ///
+  /// Must be called after init_neighbour_search(). For periodic domains,
+  /// \p cutoff + \p skin must be less than half the domain width
+  ///
+  /// \param cutoff the maximum search radius that the list can be used for
+  /// \param skin the extra distance added to \p cutoff when building the list
+  /// \see get_verlet_list()
+  void init_verlet_list(const double cutoff, const double skin) {
+    LOG(2, "Particles:init_verlet_list: cutoff = " << cutoff
+                                                   << " skin = " << skin);
+    ASSERT(searchable, "init_neighbour_search not called on this particle set");
+    verlet.init(cutoff, skin);
+    verlet.update(*this);
+  }
+
+  /// Returns the cached Verlet neighbour list
+  /// \see init_verlet_list()
+  const verlet_list_type &get_verlet_list() const { return verlet; }
+
+  /// Enables auto-tuning of the `n_particles_in_leaf` argument of
+  /// init_neighbour_search(). Each candidate bucket size is timed by
+  /// rebuilding the data structure of this particle set and performing \p
+  /// n_queries searches of radius \p radius, and the fastest is kept. The
+  /// result is cached for each search method, dimension and ratio of \p
+  /// radius to the domain width, and the particle set is re-tuned in
+  /// update_positions() once the number of particles doubles or halves.
+  ///
+  /// Must be called after init_neighbour_search()
+  ///
+  /// \param radius the search radius that the bucket size is tuned for
+  /// \param n_queries the number of searches timed for each candidate
+  /// \param candidates the bucket sizes that are tried
+  /// \see get_neighbour_search_tuner()
+  void init_neighbour_search_tuning(
+      const double radius, const size_t n_queries = 1000,
+      const std::vector<double> &candidates = {2, 4, 8, 16, 32, 64}) {
+    LOG(2, "Particles:init_neighbour_search_tuning: radius = "
+               << radius << " n_queries = " << n_queries);
+    ASSERT(searchable, "init_neighbour_search not called on this particle set");
+    tuner.init(radius, n_queries, candidates);
+    tuner.update(*this);
+  }
+
+  /// Returns the auto-tuner for the bucket size, use
+  /// `get_neighbour_search_tuner().get_tuning()` to get the chosen setting
+  /// \see init_neighbour_search_tuning()
+  const neighbour_search_tuner_type &get_neighbour_search_tuner() const {
+    return tuner;
+  }
+
   /// takes an vector \p uncorrected_dx that might come from the difference
   /// between two particle positions, and returns the shortest possible dx,
   /// according to the periodicity of the domain
@@ -483,11 +607,9 @@ public:
     const bool_d &periodic = get_periodic();
     for (size_t d = 0; d < traits_type::dimension; ++d) {
       if (periodic[d]) {
+        // shift into (-domain_width/2, domain_width/2] in one step
         const double domain_width = get_max()[d] - get_min()[d];
-        while (dx[d] > domain_width / 2)
-          dx[d] -= domain_width;
-        while (dx[d] <= -domain_width / 2)
-          dx[d] += domain_width;
+        dx[d] -= domain_width * std::ceil(dx[d] / domain_width - 0.5);
       }
     }
     return dx;
@@ -524,10 +646,17 @@ public:
   /// be the same as that returned by end()
   ///
   void update_positions(iterator update_begin, iterator update_end) {
+    if (search.get_auto_domain()) {
+      // the domain might change, which moves every particle's bucket
+      update_begin = begin();
+      update_end = end();
+    }
     if (search.update_positions(begin(), end(), update_begin, update_end)) {
       reorder(update_begin, update_end, search.get_alive_indicies().begin(),
               search.get_alive_indicies().end());
     }
+    tuner.update(*this);
+    verlet.update(*this);
   }
 
   /// Update the neighbourhood search data for all particles in the container
@@ -701,6 +830,7 @@ private:
     const size_t n_alive = order_end - order_start;
     const size_t old_n = size();
     const size_t new_n = old_n - (n_update - n_alive);
+    verlet.reorder(update_begin - begin(), order_start, order_end);
     if (n_alive > old_n / 2) {
       traits_type::resize(other_data, new_n);
       // copy non-update region to other data buffer
@@ -768,6 +898,12 @@ private:
   /// The neighbourhood search data structure
   search_type search;
 
+  /// The cached Verlet neighbour list \see init_verlet_list()
+  verlet_list_type verlet;
+
+  /// The bucket size auto-tuner \see init_neighbour_search_tuning()
+  neighbour_search_tuner_type tuner;
+
 #ifdef HAVE_VTK
   /// An vtkUnstructuredGrid to store particle data in (if neccessary)
   vtkSmartPointer<vtkUnstructuredGrid> cache_grid;
@@ -57,6 +57,31 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 namespace Aboria {
 
+template <typename Traits> struct CellListQuery;
+template <typename Traits> struct CellListOrderedQuery;
+template <typename Traits> struct AdaptiveCellListQuery;
+
+namespace detail {
+
+///
+/// @brief number of trailing zero bits in @p x, which must be non-zero
+///
+inline CUDA_HOST_DEVICE int count_trailing_zeros(const uint32_t x) {
+#if defined(__CUDA_ARCH__)
+  return __ffs(x) - 1;
+#elif defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctz(x);
+#else
+  int n = 0;
+  for (uint32_t mask = 1u; !(x & mask); mask <<= 1) {
+    ++n;
+  }
+  return n;
+#endif
+}
+
+} // namespace detail
+
 /// A const iterator to a set of neighbouring points. This iterator implements
 /// a STL forward iterator type
 // assume that these iterators, and query functions, are only called from device
@@ -80,6 +105,27 @@ class search_iterator {
   typedef typename particle_iterator::pointer p_pointer;
   typedef lattice_iterator<dimension> periodic_iterator_type;
 
+  ///
+  /// @brief true if the particles in each bucket are stored contiguously, in
+  /// which case the candidates are checked in blocks of block_size
+  ///
+  typedef std::integral_constant<
+      bool, std::is_same<particle_iterator, ranges_iterator<Traits>>::value>
+      is_contiguous;
+
+  ///
+  /// @brief true if no transform is applied to the distance between points,
+  /// in which case the distance calculation for a block is vectorised
+  ///
+  typedef std::integral_constant<
+      bool, std::is_same<Transform, IdentityTransform>::value>
+      is_identity;
+
+  ///
+  /// @brief number of candidates checked at a time for contiguous buckets
+  ///
+  static const int block_size = 8;
+
   ///
   /// @brief true if the iterator has run out of particles within the search
   /// distance
@@ -134,6 +180,18 @@ class search_iterator {
   ///
   particle_iterator m_current_particle;
 
+  ///
+  /// @brief for contiguous buckets, bit k is set if the candidate at
+  /// m_current_particle + k is within the search distance
+  ///
+  uint32_t m_block_hits;
+
+  ///
+  /// @brief for contiguous buckets, the number of candidates left in the
+  /// current block, including m_current_particle
+  ///
+  int m_block_left;
+
   Transform m_transform;
 
 public:
@@ -191,7 +249,7 @@ public:
         m_current_bucket(
             query.template get_buckets_near_point<LNormNumber, Transform>(
                 m_current_point, max_distance, transform)),
-        m_transform(transform) {
+        m_block_hits(0), m_block_left(0), m_transform(transform) {
 
 #if defined(__CUDA_ARCH__)
     CHECK_CUDA((!std::is_same<typename Traits::template vector<double>,
@@ -205,11 +263,7 @@ public:
 #endif
     if ((m_valid = get_valid_bucket())) {
       m_current_particle = m_query->get_bucket_particles(*m_current_bucket);
-      if ((m_valid = get_valid_candidate())) {
-        if (!check_candidate()) {
-          increment();
-        }
-      }
+      m_valid = find_candidate(false, is_contiguous());
     }
 #if defined(__CUDA_ARCH__)
     if (m_valid) {
@@ -464,6 +518,140 @@ private:
     return !outside;
   }
 
+  ///
+  /// @brief iterates internal iterators until a candidate particle is found
+  /// (i.e. one within the search distance), checking one candidate at a time
+  ///
+  /// @param skip_current if true, start the search from the candidate after
+  /// m_current_particle
+  /// @return false if there are no more candidates
+  ///
+  ABORIA_HOST_DEVICE_IGNORE_WARN
+  CUDA_HOST_DEVICE
+  bool find_candidate(const bool skip_current, std::false_type) {
+    if (skip_current ? !go_to_next_candidate() : !get_valid_candidate()) {
+      return false;
+    }
+    while (!check_candidate()) {
+      if (!go_to_next_candidate()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  ///
+  /// @brief iterates internal iterators until a candidate particle is found
+  /// (i.e. one within the search distance). Each bucket is checked in blocks
+  /// of block_size candidates using check_block(), and then the iterator
+  /// steps through the hits for each block
+  ///
+  /// @param skip_current if true, start the search from the candidate after
+  /// m_current_particle
+  /// @return false if there are no more candidates
+  ///
+  ABORIA_HOST_DEVICE_IGNORE_WARN
+  CUDA_HOST_DEVICE
+  bool find_candidate(bool skip_current, std::true_type) {
+    while (true) {
+      const uint32_t hits = skip_current ? m_block_hits & ~1u : m_block_hits;
+      if (hits) {
+        const int k = detail::count_trailing_zeros(hits);
+        m_current_particle = m_current_particle + k;
+        m_block_hits >>= k;
+        m_block_left -= k;
+        m_dx = m_transform(get<position>(*m_current_particle) -
+                           m_current_point);
+        return true;
+      }
+
+      // no more hits in this block, go to the start of the next one
+      m_current_particle = m_current_particle + m_block_left;
+      if (!get_valid_candidate()) {
+        return false;
+      }
+      m_block_left = m_current_particle.distance_to_end();
+      if (m_block_left > block_size) {
+        m_block_left = block_size;
+      }
+      m_block_hits = check_block(&get<position>(*m_current_particle),
+                                 m_block_left, is_identity());
+      skip_current = false;
+    }
+  }
+
+  ///
+  /// @brief checks the @p n (at most block_size) contiguous candidates
+  /// starting at @p p, for the identity transform. Full blocks are checked
+  /// with fixed length loops
+  ///
+  /// @return a mask with bit k set if candidate k is within the search
+  /// distance
+  ///
+  ABORIA_HOST_DEVICE_IGNORE_WARN
+  CUDA_HOST_DEVICE
+  uint32_t check_block(const double_d *p, const int n, std::true_type) const {
+    const uint32_t hits = n == block_size ? check_block<block_size>(p, n)
+                                          : check_block<block_size - 1>(p, n);
+#ifndef __CUDA_ARCH__
+    LOG(4, "\tcheck_block: m_r = " << m_current_point << " n = " << n
+                                   << " hits = " << hits);
+#endif
+    return hits;
+  }
+
+  ///
+  /// @brief checks the @p n (at most @p N) contiguous candidates starting at
+  /// @p p. The distance to each candidate is accumulated one dimension at a
+  /// time, so for a full block the loops have a fixed length and can be
+  /// unrolled and vectorised
+  ///
+  template <int N>
+  ABORIA_HOST_DEVICE_IGNORE_WARN CUDA_HOST_DEVICE uint32_t
+  check_block(const double_d *p, const int n) const {
+    const int m = N == block_size ? N : n;
+    double accum[N];
+    for (int k = 0; k < m; ++k) {
+      accum[k] = 0;
+    }
+    for (size_t d = 0; d < dimension; ++d) {
+      const double centre = m_current_point[d];
+      for (int k = 0; k < m; ++k) {
+        accum[k] = detail::distance_helper<LNormNumber>::accumulate_norm(
+            accum[k], p[k][d] - centre);
+      }
+    }
+    uint32_t hits = 0;
+    for (int k = 0; k < m; ++k) {
+      hits |= static_cast<uint32_t>(accum[k] <= m_max_distance2) << k;
+    }
+    return hits;
+  }
+
+  ///
+  /// @brief checks the @p n (at most block_size) contiguous candidates
+  /// starting at @p p, applying m_transform to the distance to each one
+  ///
+  /// @return a mask with bit k set if candidate k is within the search
+  /// distance
+  ///
+  ABORIA_HOST_DEVICE_IGNORE_WARN
+  CUDA_HOST_DEVICE
+  uint32_t check_block(const double_d *p, const int n,
+                       std::false_type) const {
+    uint32_t hits = 0;
+    for (int k = 0; k < n; ++k) {
+      const double accum = detail::distance_helper<LNormNumber>::norm2(
+          m_transform(p[k] - m_current_point));
+      hits |= static_cast<uint32_t>(accum <= m_max_distance2) << k;
+    }
+#ifndef __CUDA_ARCH__
+    LOG(4, "\tcheck_block: m_r = " << m_current_point << " n = " << n
+                                   << " hits = " << hits);
+#endif
+    return hits;
+  }
+
   ///
   /// @brief main increment function, iterates internal iterators until a
   /// candidate particle is found (i.e. one within the search distance)
@@ -474,13 +662,7 @@ private:
 #ifndef __CUDA_ARCH__
     LOG(3, "\tincrement (search_iterator):");
 #endif
-    bool found_good_candidate = false;
-    while (!found_good_candidate && (m_valid = go_to_next_candidate())) {
-      found_good_candidate = check_candidate();
-#ifndef __CUDA_ARCH__
-      LOG(4, "\tfound_good_candidate = " << found_good_candidate);
-#endif
-    }
+    m_valid = find_candidate(true, is_contiguous());
 #ifndef __CUDA_ARCH__
     LOG(3, "\tend increment (search_iterator): valid = " << m_valid);
 #endif
@@ -859,6 +1041,1063 @@ CUDA_HOST_DEVICE Iterator get_neighbouring_buckets(const Query &query) {
   return Iterator(query);
 }
 
+///
+/// @brief a single neighbour found by @ref knn_search()
+///
+/// @tparam Query the query object type
+///
+template <typename Query> struct knn_neighbour {
+  typedef typename Query::particle_iterator particle_iterator;
+  typedef Vector<double, Query::dimension> double_d;
+
+  ///
+  /// @brief iterator pointing to the neighbouring particle, dereference this
+  /// to get a reference to the particle
+  ///
+  particle_iterator particle;
+
+  ///
+  /// @brief the distance $r_b-r_a$ between the neighbouring particle $r_b$ and
+  /// the central search point $r_a$, taking into account periodicity
+  ///
+  double_d dx;
+
+  ///
+  /// @brief the distance between the neighbouring particle and the central
+  /// search point, measured using the norm used for the search
+  ///
+  double distance;
+};
+
+namespace detail {
+
+///
+/// @brief a bounded max-heap holding the @p k closest candidate particles
+/// found so far during a @ref knn_search()
+///
+template <typename Query, int LNormNumber> class knn_heap {
+  typedef typename Query::particle_iterator particle_iterator;
+  typedef typename Query::traits_type::position position;
+  typedef Vector<double, Query::dimension> double_d;
+
+  struct candidate {
+    double accum;
+    particle_iterator particle;
+    double_d dx;
+  };
+
+  struct candidate_less {
+    bool operator()(const candidate &a, const candidate &b) const {
+      return a.accum < b.accum;
+    }
+  };
+
+  std::vector<candidate> m_heap;
+  size_t m_k;
+
+public:
+  knn_heap(const size_t k) : m_k(k) { m_heap.reserve(k); }
+
+  ///
+  /// @brief the accumulated norm value that a new candidate needs to be less
+  /// than in order to enter the heap
+  ///
+  double bound() const {
+    return m_heap.size() < m_k ? get_max<double>() : m_heap.front().accum;
+  }
+
+  ///
+  /// @brief add all the particles in @p bucket to the heap, if they are closer
+  /// to @p point than the current k-th closest candidate
+  ///
+  template <typename Reference>
+  void scan_bucket(const Query &query, const Reference bucket,
+                   const double_d &point) {
+    for (particle_iterator p = query.get_bucket_particles(bucket); p != false;
+         ++p) {
+      const double_d dx = get<position>(*p) - point;
+      const double accum = distance_helper<LNormNumber>::norm2(dx);
+      if (accum < bound()) {
+        if (m_heap.size() == m_k) {
+          std::pop_heap(m_heap.begin(), m_heap.end(), candidate_less());
+          m_heap.pop_back();
+        }
+        m_heap.push_back(candidate{accum, p, dx});
+        std::push_heap(m_heap.begin(), m_heap.end(), candidate_less());
+      }
+    }
+  }
+
+  ///
+  /// @brief empties the heap, returning the candidates sorted in order of
+  /// increasing distance
+  ///
+  std::vector<knn_neighbour<Query>> get_sorted() {
+    std::sort_heap(m_heap.begin(), m_heap.end(), candidate_less());
+    std::vector<knn_neighbour<Query>> result;
+    result.reserve(m_heap.size());
+    for (const candidate &c : m_heap) {
+      result.push_back(knn_neighbour<Query>{
+          c.particle, c.dx,
+          distance_helper<LNormNumber>::get_distance_from_accumulate(
+              c.accum)});
+    }
+    m_heap.clear();
+    return result;
+  }
+};
+
+///
+/// @brief returns the accumulated norm value of the shortest distance between
+/// @p point and the box @p bounds
+///
+template <int LNormNumber, unsigned int D>
+double knn_dist_to_box(const bbox<D> &bounds, const Vector<double, D> &point) {
+  Vector<double, D> dx;
+  for (size_t i = 0; i < D; ++i) {
+    dx[i] = std::max(
+        std::max(bounds.bmin[i] - point[i], point[i] - bounds.bmax[i]), 0.0);
+  }
+  return distance_helper<LNormNumber>::norm2(dx);
+}
+
+///
+/// @brief true if the cells of @p Query form a regular lattice, so that the
+/// knn search can visit them in shells around the search point
+///
+template <typename Query>
+struct is_cell_list_query
+    : std::is_same<typename Query::child_iterator,
+                   lattice_iterator<Query::dimension>> {};
+
+template <typename Traits>
+struct is_cell_list_query<AdaptiveCellListQuery<Traits>> : std::true_type {};
+
+///
+/// @brief add the particles in the cell @p cell to the heap
+///
+template <typename Query, int LNormNumber>
+void knn_scan_cell(const Query &query,
+                   const Vector<int, Query::dimension> &cell,
+                   const Vector<double, Query::dimension> &point,
+                   knn_heap<Query, LNormNumber> &heap) {
+  heap.scan_bucket(query, cell, point);
+}
+
+///
+/// @brief add the particles in the cell @p cell to the heap, scanning only
+/// the leafs of a divided cell that could hold a closer particle
+///
+template <typename Traits, int LNormNumber>
+void knn_scan_cell(const AdaptiveCellListQuery<Traits> &query,
+                   const Vector<int, Traits::dimension> &cell,
+                   const Vector<double, Traits::dimension> &point,
+                   knn_heap<AdaptiveCellListQuery<Traits>, LNormNumber> &heap) {
+  const int index = query.m_point_to_bucket_index.collapse_index_vector(cell);
+  for (int leaf = query.m_cell_first_leaf[index];
+       leaf < query.m_cell_first_leaf[index + 1]; ++leaf) {
+    if (knn_dist_to_box<LNormNumber>(query.m_leaf_bounds[leaf], point) <
+        heap.bound()) {
+      heap.scan_bucket(query, leaf, point);
+    }
+  }
+}
+
+///
+/// @brief knn search for cell lists. Buckets are visited in shells of
+/// increasing (chebyshev) bucket distance around the bucket containing @p
+/// point, stopping once the nearest possible bucket in a shell is further away
+/// than the current k-th closest candidate
+///
+template <int LNormNumber, typename Query>
+void knn_search_impl(const Query &query,
+                     const Vector<double, Query::dimension> &point,
+                     knn_heap<Query, LNormNumber> &heap, std::true_type) {
+  const unsigned int D = Query::dimension;
+  typedef Vector<int, D> int_d;
+  typedef Vector<double, D> double_d;
+
+  const double_d &side_length = query.m_bucket_side_length;
+  const double min_side_length = side_length.minCoeff();
+  const int_d &end_bucket = query.get_end_bucket();
+  const int_d centre_bucket =
+      query.m_point_to_bucket_index.find_bucket_index_vector(point);
+
+  // shells that intersect the domain are between s_min and s_max
+  int s_min = 0;
+  int s_max = 0;
+  for (size_t i = 0; i < D; ++i) {
+    s_min = std::max(s_min, std::max(-centre_bucket[i],
+                                     centre_bucket[i] - end_bucket[i]));
+    s_max = std::max(s_max, std::max(centre_bucket[i],
+                                     end_bucket[i] - centre_bucket[i]));
+  }
+
+  for (int s = s_min; s <= s_max; ++s) {
+    // every bucket in shell s is at least s-1 buckets away along one dimension
+    if (s > 0 &&
+        distance_helper<LNormNumber>::get_value_to_accumulate(
+            (s - 1) * min_side_length) >= heap.bound()) {
+      break;
+    }
+
+    int_d min_bucket, max_bucket;
+    bool empty = false;
+    for (size_t i = 0; i < D; ++i) {
+      min_bucket[i] = std::max(centre_bucket[i] - s, 0);
+      max_bucket[i] = std::min(centre_bucket[i] + s, end_bucket[i]) + 1;
+      empty |= min_bucket[i] >= max_bucket[i];
+    }
+    if (empty) {
+      continue;
+    }
+
+    for (lattice_iterator<D> bucket(min_bucket, max_bucket); bucket != false;
+         ++bucket) {
+      int distance = 0;
+      for (size_t i = 0; i < D; ++i) {
+        distance = std::max(distance, std::abs((*bucket)[i] - centre_bucket[i]));
+      }
+      if (distance != s) {
+        continue;
+      }
+      const bbox<D> bounds(
+          (*bucket) * side_length + query.get_bounds().bmin,
+          ((*bucket) + 1) * side_length + query.get_bounds().bmin);
+      if (knn_dist_to_box<LNormNumber>(bounds, point) < heap.bound()) {
+        knn_scan_cell(query, *bucket, point, heap);
+      }
+    }
+  }
+}
+
+///
+/// @brief knn search for trees. Best-first traversal of the tree nodes using
+/// a priority queue ordered by the distance from @p point to each node
+///
+template <int LNormNumber, typename Query>
+void knn_search_impl(const Query &query,
+                     const Vector<double, Query::dimension> &point,
+                     knn_heap<Query, LNormNumber> &heap, std::false_type) {
+  typedef typename Query::child_iterator child_iterator;
+
+  struct node {
+    double accum;
+    child_iterator ci;
+  };
+  struct node_greater {
+    bool operator()(const node &a, const node &b) const {
+      return a.accum > b.accum;
+    }
+  };
+  std::priority_queue<node, std::vector<node>, node_greater> queue;
+
+  for (child_iterator ci = query.get_children(); ci != false; ++ci) {
+    queue.push(
+        node{knn_dist_to_box<LNormNumber>(query.get_bounds(ci), point), ci});
+  }
+
+  while (!queue.empty() && queue.top().accum < heap.bound()) {
+    const node current = queue.top();
+    queue.pop();
+    if (query.is_leaf_node(*current.ci)) {
+      heap.scan_bucket(query, *current.ci, point);
+    } else {
+      for (child_iterator ci = query.get_children(current.ci); ci != false;
+           ++ci) {
+        const double accum =
+            knn_dist_to_box<LNormNumber>(query.get_bounds(ci), point);
+        if (accum < heap.bound()) {
+          queue.push(node{accum, ci});
+        }
+      }
+    }
+  }
+}
+
+} // namespace detail
+
+///
+/// @brief returns the @p k particles closest to a given point, sorted in
+/// order of increasing distance. For periodic domains the search includes the
+/// periodic images of the particles adjacent to the domain (the same lattice
+/// searched by @ref distance_search()), and so if @p k is larger than the
+/// number of particles in the domain the same particle can be returned more
+/// than once
+///
+/// For cell lists the buckets are visited in shells of increasing distance
+/// around the central point, for trees the nodes are visited in a best-first
+/// order. In both cases a node or bucket is only visited if it could contain
+/// a particle closer than the current k-th closest candidate
+///
+/// @tparam LNormNumber the norm used to measure distance (default: 2, i.e.
+/// the euclidean distance)
+/// @tparam Query the query object type
+/// @param query the query object
+/// @param centre the central point of the search
+/// @param k the number of neighbours to find
+/// @return a std::vector of @ref knn_neighbour, with at most @p k elements
+///
+template <int LNormNumber = 2, typename Query>
+std::vector<knn_neighbour<Query>>
+knn_search(const Query &query, const typename Query::double_d &centre,
+           const size_t k) {
+  typedef typename Query::double_d double_d;
+  typedef detail::is_cell_list_query<Query> is_cell_list;
+
+  detail::knn_heap<Query, LNormNumber> heap(k);
+  if (k == 0 || query.number_of_particles() == 0) {
+    return heap.get_sorted();
+  }
+
+  const double_d domain_width =
+      query.get_bounds().bmax - query.get_bounds().bmin;
+  auto periodic = search_iterator<Query, LNormNumber>::get_periodic_range(
+      query.get_periodic());
+
+  // search the original domain first to get a tight bound for the
+  // periodic images
+  detail::knn_search_impl(query, centre, heap, is_cell_list());
+  for (; periodic != false; ++periodic) {
+    if (((*periodic) == 0).all()) {
+      continue;
+    }
+    const double_d point = centre + (*periodic) * domain_width;
+    if (detail::knn_dist_to_box<LNormNumber>(query.get_bounds(), point) <
+        heap.bound()) {
+      detail::knn_search_impl(query, point, heap, is_cell_list());
+    }
+  }
+  return heap.get_sorted();
+}
+
+namespace detail {
+
+///
+/// @brief calls @p function(j, p) for each particle in @p bucket, where j is
+/// the index of the particle in the particle set of @p query and p is its
+/// position. This overload is used by the data structures that store the
+/// particles of each bucket contiguously (CellListOrdered, Kdtree,
+/// HyperOctree, ...), and loops directly over the positions
+///
+template <typename Query, typename Function>
+void for_each_bucket_particle(const Query &query,
+                              const typename Query::reference bucket,
+                              Function &&function) {
+  typedef typename Query::traits_type::position position;
+  typedef typename Query::double_d double_d;
+  auto particles = query.get_bucket_particles(bucket);
+  const int n = particles.distance_to_end();
+  if (n == 0) {
+    return;
+  }
+  const double_d *p = &get<position>(*particles);
+  const int offset = p - &get<position>(*query.get_particles_begin());
+  for (int k = 0; k < n; ++k) {
+    function(offset + k, p[k]);
+  }
+}
+
+///
+/// @brief calls @p function(j, p) for each particle in @p bucket. CellList
+/// overload, follows the linked list of particles in the bucket
+///
+template <typename Traits, typename Function>
+void for_each_bucket_particle(
+    const CellListQuery<Traits> &query,
+    const typename CellListQuery<Traits>::reference bucket,
+    Function &&function) {
+  typedef typename Traits::position position;
+  typedef typename Traits::double_d double_d;
+  const double_d *positions = &get<position>(*query.get_particles_begin());
+  const int bucket_index =
+      query.m_point_to_bucket_index.collapse_index_vector(bucket);
+  for (int j = query.m_buckets_begin[bucket_index]; j != get_empty_id();
+       j = query.m_linked_list_begin[j]) {
+    function(j, positions[j]);
+  }
+}
+
+///
+/// @brief for_each_neighbour() using the halo of periodic images @p ghosts
+/// of a cell list. The cells within @p max_distance of @p centre are a
+/// plain box of the lattice extended by the halo, the interior cells are
+/// searched as normal and the halo cells hold the periodic images
+///
+/// @return false (and does nothing) if the halo does not cover the search,
+/// i.e. @p centre is outside the domain or @p max_distance is larger than
+/// the width of the halo
+///
+template <int LNormNumber, typename Query, typename Function>
+bool for_each_neighbour_in_ghost_layer(
+    const Query &query, const ghost_layer<Query::dimension> &ghosts,
+    const typename Query::double_d &centre, const double max_distance,
+    Function &function) {
+  const unsigned int D = Query::dimension;
+  typedef Vector<double, D> double_d;
+  typedef Vector<int, D> int_d;
+  const bbox<D> &bounds = ghosts.m_bounds;
+  if (max_distance > ghosts.m_width || (centre < bounds.bmin).any() ||
+      (centre >= bounds.bmax).any()) {
+    return false;
+  }
+  const double max_distance2 =
+      distance_helper<LNormNumber>::get_value_to_accumulate(max_distance);
+  const double_d &side_length = ghosts.m_bucket_side_length;
+
+  int_d lower, upper;
+  for (size_t d = 0; d < D; ++d) {
+    lower[d] = std::max(static_cast<int>(std::floor(
+                            (centre[d] - max_distance - bounds.bmin[d]) /
+                            side_length[d])),
+                        -ghosts.m_halo[d]);
+    upper[d] = std::min(static_cast<int>(std::floor(
+                            (centre[d] + max_distance - bounds.bmin[d]) /
+                            side_length[d])),
+                        ghosts.m_size[d] + ghosts.m_halo[d] - 1) +
+               1;
+  }
+
+  auto check_particle = [&](const int j, const double_d &p) {
+    const double_d dx = p - centre;
+    if (distance_helper<LNormNumber>::norm2(dx) <= max_distance2) {
+      function(j, dx);
+    }
+  };
+  for (lattice_iterator<D> cell(lower, upper); cell != false; ++cell) {
+    const int_d &c = *cell;
+    double_d dx_cell;
+    bool interior = true;
+    for (size_t d = 0; d < D; ++d) {
+      dx_cell[d] = std::max(
+          std::abs((c[d] + 0.5) * side_length[d] + bounds.bmin[d] - centre[d]) -
+              0.5 * side_length[d],
+          0.0);
+      interior &= c[d] >= 0 && c[d] < ghosts.m_size[d];
+    }
+    if (distance_helper<LNormNumber>::norm2(dx_cell) > max_distance2) {
+      continue;
+    }
+    if (interior) {
+      for_each_bucket_particle(query, c, check_particle);
+    } else {
+      const int index = ghosts.collapse_index_vector(c);
+      for (int k = ghosts.m_cell_begin[index];
+           k < ghosts.m_cell_begin[index + 1]; ++k) {
+        check_particle(ghosts.m_indices[k], ghosts.m_positions[k]);
+      }
+    }
+  }
+  return true;
+}
+
+///
+/// @brief searches the halo of periodic images of a cell list if it has one
+/// (see CellList::set_ghost_width()), returns false if the search should be
+/// done by for_each_neighbour() instead
+///
+template <int LNormNumber, typename Query, typename Function>
+bool for_each_neighbour_in_halo(const Query &query,
+                                const typename Query::double_d &centre,
+                                const double max_distance,
+                                Function &function) {
+  return false;
+}
+
+template <int LNormNumber, typename Traits, typename Function>
+bool for_each_neighbour_in_halo(const CellListQuery<Traits> &query,
+                                const typename Traits::double_d &centre,
+                                const double max_distance,
+                                Function &function) {
+  return query.m_ghosts != nullptr &&
+         for_each_neighbour_in_ghost_layer<LNormNumber>(
+             query, *query.m_ghosts, centre, max_distance, function);
+}
+
+template <int LNormNumber, typename Traits, typename Function>
+bool for_each_neighbour_in_halo(const CellListOrderedQuery<Traits> &query,
+                                const typename Traits::double_d &centre,
+                                const double max_distance,
+                                Function &function) {
+  return query.m_ghosts != nullptr &&
+         for_each_neighbour_in_ghost_layer<LNormNumber>(
+             query, *query.m_ghosts, centre, max_distance, function);
+}
+
+} // namespace detail
+
+///
+/// @brief calls @p function(j, dx) for every particle within @p max_distance
+/// of @p centre, where j is the index of the particle in the particle set of
+/// @p query and dx is the distance $r_j-centre$, taking into account
+/// periodicity
+///
+/// This finds the same particles as @ref distance_search(), but as a set of
+/// internal loops over the buckets near @p centre rather than an iterator, so
+/// no search state is carried between particles and the loop over the
+/// particles of each bucket can be inlined with @p function. If a cell list
+/// has a halo of periodic images (see CellList::set_ghost_width()) that
+/// covers the search, the periodic images of @p centre are not searched
+///
+/// @tparam LNormNumber the norm used to measure distance (default: 2, i.e.
+/// the euclidean distance)
+/// @param query the query object
+/// @param centre the central point of the search
+/// @param max_distance the maximum distance from @p centre
+/// @param function called as function(j, dx) for each particle found
+///
+template <int LNormNumber = 2, typename Query, typename Function>
+void for_each_neighbour(const Query &query,
+                        const typename Query::double_d &centre,
+                        const double max_distance, Function &&function) {
+  typedef typename Query::double_d double_d;
+  if (query.number_of_particles() == 0 ||
+      detail::for_each_neighbour_in_halo<LNormNumber>(query, centre,
+                                                      max_distance, function)) {
+    return;
+  }
+  const double max_distance2 =
+      detail::distance_helper<LNormNumber>::get_value_to_accumulate(
+          max_distance);
+  const double_d width = query.get_bounds().bmax - query.get_bounds().bmin;
+  for (auto periodic = search_iterator<Query, LNormNumber>::get_periodic_range(
+           query.get_periodic());
+       periodic != false; ++periodic) {
+    const double_d point = centre + (*periodic) * width;
+    for (auto b = query.template get_buckets_near_point<LNormNumber>(
+             point, max_distance);
+         b != false; ++b) {
+      detail::for_each_bucket_particle(
+          query, *b, [&](const int j, const double_d &p) {
+            const double_d dx = p - point;
+            if (detail::distance_helper<LNormNumber>::norm2(dx) <=
+                max_distance2) {
+              function(j, dx);
+            }
+          });
+    }
+  }
+}
+
+namespace detail {
+
+///
+/// @brief batched distance search around each point in [@p first, @p last)
+///
+/// The points are grouped by the bucket of the neighbour search data
+/// structure that contains them (points outside the domain are each given
+/// their own group). The candidate particles of each group are found with a
+/// single bucket search around the bounding box of the group, copied into a
+/// contiguous buffer, and then scanned for every point in the group.
+///
+/// @param radius called as radius(i), returns the search distance of point i
+/// @param function called as function(i, j, dx) for every particle j within
+/// the search distance of point i
+/// @param parallel if true the groups are processed in parallel, all the
+/// calls for a single point are made by the same thread
+///
+template <int LNormNumber, typename Query, typename PointIterator,
+          typename RadiusFunction, typename Function>
+void batch_distance_search_impl(const Query &query, PointIterator first,
+                                PointIterator last,
+                                const RadiusFunction &radius,
+                                Function &function, const bool parallel) {
+  const unsigned int D = Query::dimension;
+  typedef Vector<double, D> double_d;
+  typedef bbox<D> box_type;
+
+  const int n = std::distance(first, last);
+  if (n == 0 || query.number_of_particles() == 0) {
+    return;
+  }
+#ifdef HAVE_OPENMP
+  const bool use_omp = parallel && use_omp_backend<int *>(n);
+#endif
+
+  // key each point by the index of its bucket
+  const box_type &domain = query.get_bounds();
+  std::vector<int> keys(n);
+  std::vector<int> order(n);
+  int nbuckets = 0;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for reduction(max : nbuckets) if (use_omp)
+#endif
+  for (int i = 0; i < n; ++i) {
+    const double_d &p = first[i];
+    order[i] = i;
+    if ((p >= domain.bmin).all() && (p < domain.bmax).all()) {
+      keys[i] = query.get_bucket_index(*query.get_bucket(p));
+      nbuckets = std::max(nbuckets, keys[i] + 1);
+    } else {
+      keys[i] = -1;
+    }
+  }
+  for (int i = 0; i < n; ++i) {
+    if (keys[i] < 0) {
+      keys[i] = nbuckets;
+    }
+  }
+  std::vector<int> bucket_begin(nbuckets + 1);
+  std::vector<int> bucket_end(nbuckets + 1);
+  counting_sort_by_key(keys.begin(), keys.end(), order.begin(), nbuckets + 1,
+                       bucket_begin.begin(), bucket_end.begin(),
+                       std::true_type());
+
+  std::vector<Vector<int, 2>> groups;
+  for (int b = 0; b < nbuckets; ++b) {
+    if (bucket_begin[b] < bucket_end[b]) {
+      groups.push_back(Vector<int, 2>(bucket_begin[b], bucket_end[b]));
+    }
+  }
+  for (int k = bucket_begin[nbuckets]; k < bucket_end[nbuckets]; ++k) {
+    groups.push_back(Vector<int, 2>(k, k + 1));
+  }
+  const int ngroups = groups.size();
+
+  const double_d domain_width = domain.bmax - domain.bmin;
+  const double margin = 1e-10 * domain_width.maxCoeff();
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel if (use_omp)
+#endif
+  {
+    std::vector<double_d> candidate_positions;
+    std::vector<int> candidate_indices;
+#ifdef HAVE_OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+    for (int g = 0; g < ngroups; ++g) {
+      box_type bounds;
+      double max_radius = 0;
+      for (int k = groups[g][0]; k < groups[g][1]; ++k) {
+        bounds = bounds + box_type(first[order[k]]);
+        max_radius = std::max(max_radius, radius(order[k]));
+      }
+
+      // the candidates are all the particles in buckets within a chebyshev
+      // distance of max_radius from the bounding box of the group
+      const double_d centre = 0.5 * (bounds.bmin + bounds.bmax);
+      double_d scale;
+      for (size_t d = 0; d < D; ++d) {
+        scale[d] =
+            1.0 / (0.5 * (bounds.bmax[d] - bounds.bmin[d]) + max_radius +
+                   margin);
+      }
+      const auto transform = create_scale_transform(scale);
+
+      candidate_positions.clear();
+      candidate_indices.clear();
+      for (auto periodic = search_iterator<Query, LNormNumber>::
+               get_periodic_range(query.get_periodic());
+           periodic != false; ++periodic) {
+        const double_d shift = (*periodic) * domain_width;
+        for (auto b = query.template get_buckets_near_point<-1>(
+                 centre + shift, 1.0, transform);
+             b != false; ++b) {
+          for_each_bucket_particle(query, *b,
+                                   [&](const int j, const double_d &pj) {
+                                     candidate_positions.push_back(pj - shift);
+                                     candidate_indices.push_back(j);
+                                   });
+        }
+      }
+
+      const int ncandidates = candidate_positions.size();
+      for (int k = groups[g][0]; k < groups[g][1]; ++k) {
+        const int i = order[k];
+        const double_d &pi = first[i];
+        const double max_distance2 =
+            distance_helper<LNormNumber>::get_value_to_accumulate(radius(i));
+        for (int c = 0; c < ncandidates; ++c) {
+          const double_d dx = candidate_positions[c] - pi;
+          if (distance_helper<LNormNumber>::norm2(dx) <= max_distance2) {
+            function(i, candidate_indices[c], dx);
+          }
+        }
+      }
+    }
+  }
+}
+
+} // namespace detail
+
+///
+/// @brief a batched @ref distance_search() around each point in [@p first,
+/// @p last). Calls @p function(i, j, dx) for every particle within @p
+/// max_distance of the i-th point, where j is the index of the particle in
+/// the particle set of @p query and dx is the distance $r_j-r_i$, taking
+/// into account periodicity
+///
+/// This finds the same neighbours as calling @ref distance_search() for
+/// each point, but points in the same bucket (or tree leaf) share a single
+/// bucket search and scan the same contiguous buffer of candidate particles.
+/// When OpenMP is enabled groups of points are processed in parallel, so @p
+/// function can be called concurrently for different points (all the calls
+/// for a single point are made by the same thread)
+///
+/// @tparam LNormNumber the norm used to measure distance (default: 2, i.e.
+/// the euclidean distance)
+/// @param query the query object
+/// @param first iterator to the first query point
+/// @param last iterator to one past the last query point
+/// @param max_distance the maximum distance to search around each point
+/// @param function called as function(i, j, dx) for each neighbour
+///
+template <int LNormNumber = 2, typename Query, typename PointIterator,
+          typename Function>
+void batch_distance_search(const Query &query, PointIterator first,
+                           PointIterator last, const double max_distance,
+                           Function &&function) {
+  detail::batch_distance_search_impl<LNormNumber>(
+      query, first, last, [max_distance](const int) { return max_distance; },
+      function, true);
+}
+
+///
+/// @brief a batched @ref distance_search() around each point in [@p first,
+/// @p last), storing the result in compressed sparse row (CSR) format. The
+/// indices of the particles within @p max_distance of the i-th point are
+/// `col_indices[row_offsets[i]]` to `col_indices[row_offsets[i+1]-1]`, in no
+/// particular order
+///
+/// @see batch_distance_search(const Query &, PointIterator, PointIterator,
+/// const double, Function &&)
+///
+template <int LNormNumber = 2, typename Query, typename PointIterator,
+          typename IndexType>
+void batch_distance_search(const Query &query, PointIterator first,
+                           PointIterator last, const double max_distance,
+                           std::vector<IndexType> &row_offsets,
+                           std::vector<IndexType> &col_indices) {
+  typedef typename Query::double_d double_d;
+  const size_t n = std::distance(first, last);
+
+  // each thread records (i, j) pairs, and the number of neighbours of each
+  // point is counted in row_offsets[i+1]
+  int nthreads = 1;
+#ifdef HAVE_OPENMP
+  nthreads = omp_get_max_threads();
+#endif
+  std::vector<std::vector<IndexType>> pairs(nthreads);
+  row_offsets.assign(n + 1, 0);
+  auto record = [&](const int i, const int j, const double_d &) {
+#ifdef HAVE_OPENMP
+    std::vector<IndexType> &thread_pairs = pairs[omp_get_thread_num()];
+#else
+    std::vector<IndexType> &thread_pairs = pairs[0];
+#endif
+    thread_pairs.push_back(i);
+    thread_pairs.push_back(j);
+    ++row_offsets[i + 1];
+  };
+  detail::batch_distance_search_impl<LNormNumber>(
+      query, first, last, [max_distance](const int) { return max_distance; },
+      record, true);
+
+  detail::inclusive_scan(row_offsets.begin() + 1, row_offsets.end(),
+                         row_offsets.begin() + 1);
+  col_indices.resize(row_offsets[n]);
+  std::vector<IndexType> next(row_offsets.begin(), row_offsets.end() - 1);
+  for (const std::vector<IndexType> &thread_pairs : pairs) {
+    for (size_t k = 0; k < thread_pairs.size(); k += 2) {
+      col_indices[next[thread_pairs[k]]++] = thread_pairs[k + 1];
+    }
+  }
+}
+
+///
+/// @brief calls @p function(i, j, dx) for every pair of particles i and j in
+/// the particle set of @p query that are within @p max_distance of each
+/// other, where dx is the distance $r_j-r_i$, taking into account
+/// periodicity. Each pair is visited in both orders, and every particle is
+/// paired with itself
+///
+/// The particles are processed a bucket at a time (see
+/// batch_distance_search()). When OpenMP is enabled the buckets are processed
+/// in parallel, so @p function can be called concurrently for different i
+/// (all the calls for a single i are made by the same thread)
+///
+/// @tparam LNormNumber the norm used to measure distance (default: 2, i.e.
+/// the euclidean distance)
+/// @param query the query object
+/// @param max_distance the maximum distance between the particles in a pair
+/// @param function called as function(i, j, dx) for each pair
+///
+template <int LNormNumber = 2, typename Query, typename Function>
+void for_each_pair_within(const Query &query, const double max_distance,
+                          Function &&function) {
+  typedef typename Query::traits_type::position position;
+  typedef typename Query::double_d double_d;
+  const size_t n = query.number_of_particles();
+  if (n == 0) {
+    return;
+  }
+  const double_d *positions = &get<position>(*query.get_particles_begin());
+  detail::batch_distance_search_impl<LNormNumber>(
+      query, positions, positions + n,
+      [max_distance](const int) { return max_distance; }, function, true);
+}
+
+namespace detail {
+
+///
+/// @brief half-shell search over the pairs of particles in @p query that are
+/// within @p max_distance of each other
+///
+/// The particles are grouped by the bucket (or tree leaf) that contains them.
+/// Each group gathers the particles in the buckets around it, as in
+/// batch_distance_search_impl(), but a neighbouring bucket is only gathered if
+/// its index is larger than the index of the group's own bucket, so each pair
+/// of buckets is only searched from one side. Pairs within the same bucket
+/// are searched once, with j after i in the group. If a bucket is its own
+/// periodic neighbour then its periodic images are only gathered for the
+/// lexicographically positive shifts
+///
+/// @param function called as function(i, j, dx) once for every unordered
+/// pair of distinct particles, where dx is the distance $r_j-r_i$
+/// @param parallel if true the groups are processed in parallel, so @p
+/// function can be called concurrently for any i and j
+///
+template <int LNormNumber, typename Query, typename Function>
+void symmetric_pair_search_impl(const Query &query, const double max_distance,
+                                Function &function, const bool parallel) {
+  const unsigned int D = Query::dimension;
+  typedef Vector<double, D> double_d;
+  typedef Vector<int, D> int_d;
+  typedef bbox<D> box_type;
+  typedef typename Query::traits_type::position position;
+
+  const int n = query.number_of_particles();
+  if (n == 0) {
+    return;
+  }
+  const double_d *positions = &get<position>(*query.get_particles_begin());
+#ifdef HAVE_OPENMP
+  const bool use_omp = parallel && use_omp_backend<int *>(n);
+#endif
+
+  // key each particle by the index of the bucket that stores it. The leaf
+  // boxes of some trees (e.g. LBVH) overlap, so get_bucket() cannot be used
+  // to find this
+  std::vector<int> keys(n);
+  std::vector<int> order(n);
+  int nbuckets = 0;
+  for (auto b = query.get_subtree(); b != false; ++b) {
+    if (query.is_leaf_node(*b)) {
+      const int bucket_index = query.get_bucket_index(*b);
+      nbuckets = std::max(nbuckets, bucket_index + 1);
+      for_each_bucket_particle(query, *b,
+                               [&](const int j, const double_d &) {
+                                 keys[j] = bucket_index;
+                               });
+    }
+  }
+  for (int i = 0; i < n; ++i) {
+    order[i] = i;
+  }
+  std::vector<int> bucket_begin(nbuckets);
+  std::vector<int> bucket_end(nbuckets);
+  counting_sort_by_key(keys.begin(), keys.end(), order.begin(), nbuckets,
+                       bucket_begin.begin(), bucket_end.begin(),
+                       std::true_type());
+
+  // each group is (begin, end, bucket index)
+  std::vector<Vector<int, 3>> groups;
+  for (int b = 0; b < nbuckets; ++b) {
+    if (bucket_begin[b] < bucket_end[b]) {
+      groups.push_back(Vector<int, 3>(bucket_begin[b], bucket_end[b], b));
+    }
+  }
+  const int ngroups = groups.size();
+
+  const box_type &domain = query.get_bounds();
+  const double_d domain_width = domain.bmax - domain.bmin;
+  const double margin = 1e-10 * domain_width.maxCoeff();
+  const double max_distance2 =
+      distance_helper<LNormNumber>::get_value_to_accumulate(max_distance);
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel if (use_omp)
+#endif
+  {
+    std::vector<double_d> candidate_positions;
+    std::vector<int> candidate_indices;
+#ifdef HAVE_OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+    for (int g = 0; g < ngroups; ++g) {
+      const int begin = groups[g][0];
+      const int end = groups[g][1];
+      const int bucket_index = groups[g][2];
+
+      box_type bounds;
+      for (int k = begin; k < end; ++k) {
+        bounds = bounds + box_type(positions[order[k]]);
+      }
+      const double_d centre = 0.5 * (bounds.bmin + bounds.bmax);
+      double_d scale;
+      for (size_t d = 0; d < D; ++d) {
+        scale[d] =
+            1.0 / (0.5 * (bounds.bmax[d] - bounds.bmin[d]) + max_distance +
+                   margin);
+      }
+      const auto transform = create_scale_transform(scale);
+
+      // gather the particles in the upper half-shell of buckets
+      candidate_positions.clear();
+      candidate_indices.clear();
+      for (auto periodic = search_iterator<Query, LNormNumber>::
+               get_periodic_range(query.get_periodic());
+           periodic != false; ++periodic) {
+        const int_d &shift_index = *periodic;
+        bool positive_shift = false;
+        for (size_t d = 0; d < D; ++d) {
+          if (shift_index[d] != 0) {
+            positive_shift = shift_index[d] > 0;
+            break;
+          }
+        }
+        const double_d shift = shift_index * domain_width;
+        for (auto b = query.template get_buckets_near_point<-1>(
+                 centre + shift, 1.0, transform);
+             b != false; ++b) {
+          const int other_index = query.get_bucket_index(*b);
+          if (other_index < bucket_index ||
+              (other_index == bucket_index && !positive_shift)) {
+            continue;
+          }
+          for_each_bucket_particle(query, *b,
+                                   [&](const int j, const double_d &pj) {
+                                     candidate_positions.push_back(pj - shift);
+                                     candidate_indices.push_back(j);
+                                   });
+        }
+      }
+
+      const int ncandidates = candidate_positions.size();
+      for (int k = begin; k < end; ++k) {
+        const int i = order[k];
+        const double_d &pi = positions[i];
+
+        // pairs within the bucket
+        for (int l = k + 1; l < end; ++l) {
+          const int j = order[l];
+          const double_d dx = positions[j] - pi;
+          if (distance_helper<LNormNumber>::norm2(dx) <= max_distance2) {
+            function(i, j, dx);
+          }
+        }
+
+        // pairs with the half-shell, skipping the periodic images of i
+        for (int c = 0; c < ncandidates; ++c) {
+          const int j = candidate_indices[c];
+          const double_d dx = candidate_positions[c] - pi;
+          if (j != i &&
+              distance_helper<LNormNumber>::norm2(dx) <= max_distance2) {
+            function(i, j, dx);
+          }
+        }
+      }
+    }
+  }
+}
+
+} // namespace detail
+
+///
+/// @brief calls @p function(i, j, dx) once for every unordered pair of
+/// distinct particles i and j in the particle set of @p query that are within
+/// @p max_distance of each other, where dx is the distance $r_j-r_i$, taking
+/// into account periodicity
+///
+/// Unlike for_each_pair_within(), each pair is only visited once, so @p
+/// function can apply a symmetric action to both particles (e.g. adding
+/// $f_{ij}$ to particle i and $-f_{ij}$ to particle j). Only the upper half
+/// of the neighbouring buckets (or tree leaves) of each bucket is searched,
+/// which halves the number of distance checks. The pairs are visited by a
+/// single thread, see accumulate_symmetric_pairs() for a parallel sweep
+///
+/// @tparam LNormNumber the norm used to measure distance (default: 2, i.e.
+/// the euclidean distance)
+/// @param query the query object
+/// @param max_distance the maximum distance between the particles in a pair
+/// @param function called as function(i, j, dx) for each pair
+///
+template <int LNormNumber = 2, typename Query, typename Function>
+void for_each_symmetric_pair(const Query &query, const double max_distance,
+                             Function &&function) {
+  detail::symmetric_pair_search_impl<LNormNumber>(query, max_distance,
+                                                  function, false);
+}
+
+///
+/// @brief visits every unordered pair of distinct particles within @p
+/// max_distance of each other (see for_each_symmetric_pair()) in parallel,
+/// accumulating the contribution of each pair to both particles
+///
+/// @p function is called as function(i, j, dx, result_i, result_j), and
+/// should add the contribution of the pair to `result_i` and `result_j`.
+/// When OpenMP is enabled each thread adds to its own copy of @p result, and
+/// these are summed into @p result once all the pairs have been visited, so
+/// two threads never write to the same element
+///
+/// @tparam LNormNumber the norm used to measure distance (default: 2, i.e.
+/// the euclidean distance)
+/// @param query the query object
+/// @param max_distance the maximum distance between the particles in a pair
+/// @param result a vector with an element for each particle in @p query. The
+/// contributions are added to its existing values
+/// @param function called as function(i, j, dx, result_i, result_j) for each
+/// pair
+///
+template <int LNormNumber = 2, typename Query, typename T, typename Function>
+void accumulate_symmetric_pairs(const Query &query, const double max_distance,
+                                std::vector<T> &result, Function &&function) {
+  typedef typename Query::double_d double_d;
+  const size_t n = query.number_of_particles();
+  ASSERT(result.size() == n,
+         "result should have an element for each particle");
+  int nthreads = 1;
+#ifdef HAVE_OPENMP
+  if (detail::use_omp_backend<int *>(n)) {
+    nthreads = omp_get_max_threads();
+  }
+#endif
+  if (nthreads == 1) {
+    auto accumulate = [&](const int i, const int j, const double_d &dx) {
+      function(i, j, dx, result[i], result[j]);
+    };
+    detail::symmetric_pair_search_impl<LNormNumber>(query, max_distance,
+                                                    accumulate, false);
+    return;
+  }
+
+#ifdef HAVE_OPENMP
+  // thread 0 accumulates directly into result, the others allocate their own
+  // copy on first use
+  std::vector<std::vector<T>> thread_results(nthreads - 1);
+  auto accumulate = [&](const int i, const int j, const double_d &dx) {
+    const int thread = omp_get_thread_num();
+    std::vector<T> &r = thread == 0 ? result : thread_results[thread - 1];
+    if (r.empty()) {
+      r.resize(n, detail::VectorTraits<T>::Zero());
+    }
+    function(i, j, dx, r[i], r[j]);
+  };
+  detail::symmetric_pair_search_impl<LNormNumber>(query, max_distance,
+                                                  accumulate, true);
+
+#pragma omp parallel for
+  for (size_t i = 0; i < n; ++i) {
+    for (const std::vector<T> &r : thread_results) {
+      if (!r.empty()) {
+        result[i] += r[i];
+      }
+    }
+  }
+#endif
+}
+
 } // namespace Aboria
 
 #endif
@@ -0,0 +1,405 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Aboria.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include "Get.h"
+#include "Log.h"
+#include "detail/MappedFile.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <boost/mpl/for_each.hpp>
+#include <boost/mpl/vector.hpp>
+
+namespace Aboria {
+
+namespace detail {
+
+///
+/// @brief the start of a snapshot file, followed by a table of
+/// `n_columns` snapshot_column
+///
+struct snapshot_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t dimension;
+  uint64_t size;
+  uint32_t n_columns;
+  uint32_t alignment;
+};
+
+///
+/// @brief describes the contiguous block of one variable in a snapshot file
+///
+struct snapshot_column {
+  char name[48];
+  uint64_t element_size;
+  uint64_t offset;
+};
+
+static const char snapshot_magic[8] = {'A', 'B', 'O', 'R', 'I', 'A', 'S', 0};
+static const uint32_t snapshot_version = 1;
+
+/// each variable block starts on a page boundary, so it can be mapped
+/// without copying and written without sharing pages between threads
+static const size_t snapshot_alignment = 4096;
+
+inline size_t snapshot_align(const size_t offset) {
+  return (offset + snapshot_alignment - 1) / snapshot_alignment *
+         snapshot_alignment;
+}
+
+struct column_copy {
+  const char *src;
+  char *dst;
+  size_t bytes;
+};
+
+///
+/// @brief copies each of @p columns, split into chunks that are copied in
+/// parallel if OpenMP is enabled
+///
+inline void copy_columns(const std::vector<column_copy> &columns) {
+  const size_t chunk_size = 1 << 22;
+  std::vector<column_copy> chunks;
+  for (const column_copy &column : columns) {
+    for (size_t offset = 0; offset < column.bytes; offset += chunk_size) {
+      chunks.push_back({column.src + offset, column.dst + offset,
+                        std::min(chunk_size, column.bytes - offset)});
+    }
+  }
+  const int n = chunks.size();
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int i = 0; i < n; ++i) {
+    std::memcpy(chunks[i].dst, chunks[i].src, chunks[i].bytes);
+  }
+}
+
+///
+/// @brief the variables @p Variables, or all the variables of @p
+/// ParticlesType if @p Variables is empty, as an mpl sequence
+///
+template <typename ParticlesType, typename... Variables>
+struct select_variables {
+  typedef typename std::conditional<
+      sizeof...(Variables) == 0, typename ParticlesType::mpl_type_vector,
+      mpl::vector<Variables...>>::type type;
+};
+
+///
+/// @brief for each variable, adds its snapshot_column (without the offset) to
+/// @p columns and the location of its values to @p copies
+///
+template <typename ParticlesType> struct gather_snapshot_columns {
+  const ParticlesType &particles;
+  std::vector<snapshot_column> &columns;
+  std::vector<column_copy> &copies;
+
+  gather_snapshot_columns(const ParticlesType &particles,
+                          std::vector<snapshot_column> &columns,
+                          std::vector<column_copy> &copies)
+      : particles(particles), columns(columns), copies(copies) {}
+
+  template <typename Variable> void operator()(Variable) {
+    typedef typename Variable::value_type value_type;
+    const char *name = Variable().name;
+    CHECK(std::strlen(name) < sizeof(snapshot_column::name),
+          "variable name " << name << " is too long for a snapshot");
+    snapshot_column column;
+    std::memset(&column, 0, sizeof(snapshot_column));
+    std::strncpy(column.name, name, sizeof(column.name) - 1);
+    column.element_size = sizeof(value_type);
+    columns.push_back(column);
+
+    const size_t n = particles.size();
+    copies.push_back(
+        {reinterpret_cast<const char *>(get<Variable>(particles).data()),
+         nullptr, n * sizeof(value_type)});
+  }
+};
+
+///
+/// @brief writes a snapshot file of @p size particles, with the variables
+/// described by @p columns copied from the sources in @p copies. The offsets
+/// of @p columns and destinations of @p copies are set here
+///
+inline void write_snapshot(const std::string &filename,
+                           const unsigned int dimension, const size_t size,
+                           std::vector<snapshot_column> &columns,
+                           std::vector<column_copy> &copies) {
+  const size_t n_columns = columns.size();
+  snapshot_header header;
+  std::memset(&header, 0, sizeof(snapshot_header));
+  std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+  header.version = snapshot_version;
+  header.dimension = dimension;
+  header.size = size;
+  header.n_columns = n_columns;
+  header.alignment = snapshot_alignment;
+
+  size_t offset =
+      sizeof(snapshot_header) + n_columns * sizeof(snapshot_column);
+  for (size_t i = 0; i < n_columns; ++i) {
+    offset = snapshot_align(offset);
+    columns[i].offset = offset;
+    offset += copies[i].bytes;
+  }
+
+  mapped_file file(filename, mapped_file::create, offset);
+  std::memcpy(file.data(), &header, sizeof(snapshot_header));
+  std::memcpy(file.data() + sizeof(snapshot_header), columns.data(),
+              n_columns * sizeof(snapshot_column));
+  for (size_t i = 0; i < n_columns; ++i) {
+    copies[i].dst = file.data() + columns[i].offset;
+  }
+  copy_columns(copies);
+  LOG(2, "write_snapshot: wrote " << size << " particles to " << filename);
+}
+
+} // namespace detail
+
+///
+/// @brief writes the variables @p Variables (or all the variables if
+/// empty) of @p particles to the file @p filename in a columnar binary format.
+///
+/// The file starts with a header giving the dimension, number of particles
+/// and a table of the variables (their names and element sizes). Each variable
+/// follows as a contiguous block of raw values, aligned to a page boundary.
+/// Blocks are copied in parallel (if OpenMP is enabled) to a memory mapping of
+/// the file.
+///
+/// The variables are copied byte by byte, so their value types must not hold
+/// pointers (e.g. `std::vector`), and the file can only be read on machines
+/// with the same endianness. The particle set must be stored in host memory
+///
+/// @see Snapshot, read_snapshot(), AsyncWriter
+///
+template <typename... Variables, typename ParticlesType>
+void write_snapshot(const std::string &filename,
+                    const ParticlesType &particles) {
+  std::vector<detail::snapshot_column> columns;
+  std::vector<detail::column_copy> copies;
+  mpl::for_each<
+      typename detail::select_variables<ParticlesType, Variables...>::type>(
+      detail::gather_snapshot_columns<ParticlesType>(particles, columns,
+                                                     copies));
+  detail::write_snapshot(filename, ParticlesType::dimension, particles.size(),
+                         columns, copies);
+}
+
+///
+/// @brief a snapshot file written by write_snapshot(), mapped into memory.
+///
+/// The variable blocks are not read when the file is opened, get() returns a
+/// pointer directly into the mapping so the OS only reads the pages that are
+/// used. The mapping is private: values can be modified through get(), which
+/// copies only the pages written to and leaves the file unchanged.
+///
+/// copy_to() copies some or all of the variables into a particle set
+///
+class Snapshot {
+public:
+  Snapshot() : m_header(nullptr), m_columns(nullptr) {}
+
+  explicit Snapshot(const std::string &filename) : Snapshot() {
+    open(filename);
+  }
+
+  ///
+  /// @brief map the snapshot file @p filename and check its header
+  ///
+  void open(const std::string &filename) {
+    m_file.open(filename, detail::mapped_file::copy_on_write);
+    const size_t header_size = sizeof(detail::snapshot_header);
+    CHECK(m_file.size() >= header_size &&
+              std::memcmp(m_file.data(), detail::snapshot_magic,
+                          sizeof(detail::snapshot_magic)) == 0,
+          filename << " is not a snapshot file");
+    m_header = reinterpret_cast<const detail::snapshot_header *>(m_file.data());
+    CHECK(m_header->version == detail::snapshot_version,
+          filename << " has unsupported snapshot version "
+                   << m_header->version);
+    CHECK(m_file.size() >=
+              header_size +
+                  m_header->n_columns * sizeof(detail::snapshot_column),
+          filename << " is truncated");
+    m_columns = reinterpret_cast<const detail::snapshot_column *>(
+        m_file.data() + header_size);
+    for (size_t i = 0; i < m_header->n_columns; ++i) {
+      CHECK(m_columns[i].offset + m_columns[i].element_size * size() <=
+                m_file.size(),
+            filename << " is truncated");
+    }
+  }
+
+  void close() {
+    m_file.close();
+    m_header = nullptr;
+    m_columns = nullptr;
+  }
+
+  bool is_open() const { return m_header != nullptr; }
+
+  /// the number of particles in the snapshot
+  size_t size() const { return m_header->size; }
+
+  /// the spatial dimension of the particle set in the snapshot
+  unsigned int dimension() const { return m_header->dimension; }
+
+  /// the number of variables in the snapshot
+  size_t number_of_variables() const { return m_header->n_columns; }
+
+  /// the name of the @p i-th variable in the snapshot
+  std::string variable_name(const size_t i) const {
+    return m_columns[i].name;
+  }
+
+  ///
+  /// @brief returns true if the snapshot contains the variable @p Variable
+  ///
+  template <typename Variable> bool has() const {
+    return find_column<Variable>() != nullptr;
+  }
+
+  ///
+  /// @brief returns a pointer to the size() values of the variable @p
+  /// Variable, without copying them
+  ///
+  template <typename Variable> typename Variable::value_type *get() {
+    return reinterpret_cast<typename Variable::value_type *>(
+        m_file.data() + get_column<Variable>().offset);
+  }
+
+  template <typename Variable>
+  const typename Variable::value_type *get() const {
+    return reinterpret_cast<const typename Variable::value_type *>(
+        m_file.data() + get_column<Variable>().offset);
+  }
+
+  ///
+  /// @brief copies the variables @p Variables into @p particles, or all the
+  /// variables of @p particles if @p Variables is empty.
+  ///
+  /// @p particles is resized to size() if needed, and the variables not
+  /// copied are left unchanged. As for Particles::resize(), the neighbour
+  /// search is not updated, call Particles::update_positions() if the
+  /// positions have been copied
+  ///
+  template <typename... Variables, typename ParticlesType>
+  void copy_to(ParticlesType &particles) const {
+    typedef typename detail::select_variables<ParticlesType,
+                                              Variables...>::type
+        variables_type;
+    CHECK(dimension() == ParticlesType::dimension,
+          "snapshot dimension " << dimension()
+                                << " does not match the particle set");
+    if (particles.size() != size()) {
+      particles.resize(size());
+    }
+    std::vector<detail::column_copy> copies;
+    mpl::for_each<variables_type>(
+        gather_copies<ParticlesType>(*this, particles, copies));
+    detail::copy_columns(copies);
+  }
+
+private:
+  template <typename ParticlesType> struct gather_copies {
+    const Snapshot &snapshot;
+    ParticlesType &particles;
+    std::vector<detail::column_copy> &copies;
+
+    gather_copies(const Snapshot &snapshot, ParticlesType &particles,
+                  std::vector<detail::column_copy> &copies)
+        : snapshot(snapshot), particles(particles), copies(copies) {}
+
+    template <typename Variable> void operator()(Variable) {
+      typedef typename Variable::value_type value_type;
+      copies.push_back(
+          {reinterpret_cast<const char *>(snapshot.get<Variable>()),
+           reinterpret_cast<char *>(Aboria::get<Variable>(particles).data()),
+           snapshot.size() * sizeof(value_type)});
+    }
+  };
+
+  template <typename Variable>
+  const detail::snapshot_column *find_column() const {
+    const char *name = Variable().name;
+    for (size_t i = 0; i < m_header->n_columns; ++i) {
+      if (std::strncmp(m_columns[i].name, name,
+                       sizeof(detail::snapshot_column::name)) == 0) {
+        return &m_columns[i];
+      }
+    }
+    return nullptr;
+  }
+
+  template <typename Variable>
+  const detail::snapshot_column &get_column() const {
+    const detail::snapshot_column *column = find_column<Variable>();
+    CHECK(column != nullptr, "variable " << Variable().name << " not in "
+                                         << m_file.filename());
+    CHECK(column->element_size == sizeof(typename Variable::value_type),
+          "variable " << Variable().name << " in " << m_file.filename()
+                      << " has element size " << column->element_size);
+    return *column;
+  }
+
+  detail::mapped_file m_file;
+  const detail::snapshot_header *m_header;
+  const detail::snapshot_column *m_columns;
+};
+
+///
+/// @brief reads the variables @p Variables (or all variables if empty) of
+/// @p particles from the snapshot file @p filename
+///
+/// @see Snapshot::copy_to(), write_snapshot()
+///
+template <typename... Variables, typename ParticlesType>
+void read_snapshot(const std::string &filename, ParticlesType &particles) {
+  Snapshot(filename).copy_to<Variables...>(particles);
+}
+
+} // namespace Aboria
+
+#endif /* SNAPSHOT_H_ */
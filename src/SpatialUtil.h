@@ -134,6 +134,30 @@ std::ostream &operator<<(std::ostream &out, const bbox<D> &b) {
   return out << "bbox(" << b.bmin << "<->" << b.bmax << ")";
 }
 
+namespace detail {
+
+///
+/// @brief widens each dimension of @p b that is narrower than @p min_width
+/// to @p min_width, keeping the centre of the box fixed
+///
+/// The fast multipole methods interpolate over each box of a tree, so the
+/// tight bounding box of a set of particles is padded in this way to avoid
+/// boxes with zero width (e.g. a single particle)
+///
+template <unsigned int D>
+inline CUDA_HOST_DEVICE void pad_bounds(bbox<D> &b,
+                                        const Vector<double, D> &min_width) {
+  for (size_t i = 0; i < D; ++i) {
+    const double pad = 0.5 * (min_width[i] - (b.bmax[i] - b.bmin[i]));
+    if (pad > 0) {
+      b.bmin[i] -= pad;
+      b.bmax[i] += pad;
+    }
+  }
+}
+
+} // namespace detail
+
 /// @returns true if the hypersphere defined by \p centre and \p radius
 /// intersects with the 1D line defined by the two points \p a and \p b
 template <unsigned int D>
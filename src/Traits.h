@@ -4,6 +4,7 @@
 
 #include "CudaInclude.h"
 #include "Get.h"
+#include "MappedVector.h"
 #include "Variable.h"
 #include "Vector.h"
 #include <algorithm>
@@ -25,6 +26,9 @@ namespace mpl = boost::mpl;
 struct default_traits {
   template <typename T> struct vector_type { typedef std::vector<T> type; };
 
+  /// true if the vectors are stored out-of-core (see mapped_vector)
+  static const bool is_out_of_core = false;
+
 #ifdef ABORIA_THRUST_USE_THRUST_TUPLE
   template <typename T1 = thrust::null_type, typename T2 = thrust::null_type,
             typename T3 = thrust::null_type, typename T4 = thrust::null_type,
@@ -104,6 +108,11 @@ template <template <typename, typename> class VECTOR> struct Traits {};
 
 template <> struct Traits<std::vector> : public default_traits {};
 
+template <> struct Traits<mapped_vector> : public default_traits {
+  template <typename T> struct vector_type { typedef mapped_vector<T> type; };
+  static const bool is_out_of_core = true;
+};
+
 #ifdef HAVE_THRUST
 template <> struct Traits<thrust::device_vector> : public default_traits {
   template <typename T> struct vector_type {
@@ -0,0 +1,483 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Aboria.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TRAJECTORY_H_
+#define TRAJECTORY_H_
+
+#include "Get.h"
+#include "Log.h"
+#include "Variable.h"
+#include "detail/MappedFile.h"
+#include "detail/Trajectory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+namespace Aboria {
+
+namespace detail {
+
+struct trajectory_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t dimension;
+  double precision;
+  uint32_t keyframe_interval;
+  uint32_t block_size;
+};
+
+struct trajectory_frame_header {
+  uint64_t size;
+  uint32_t keyframe;
+  uint32_t n_blocks;
+};
+
+struct trajectory_index_entry {
+  uint64_t offset;
+  uint64_t keyframe;
+};
+
+struct trajectory_footer {
+  uint64_t index_offset;
+  uint64_t n_frames;
+  char magic[8];
+};
+
+static const char trajectory_magic[8] = {'A', 'B', 'O', 'R', 'I', 'A', 'T', 0};
+static const uint32_t trajectory_version = 1;
+
+} // namespace detail
+
+///
+/// @brief writes the positions of a particle set over time to a compressed
+/// trajectory file, to be read with TrajectoryReader.
+///
+/// Positions are quantised to a grid of spacing @p precision, starting at the
+/// lower bound of the domain (Particles::get_min()), so each coordinate is
+/// read back with an error of at most half of @p precision. The particles are
+/// sorted by id, and each frame is stored as the difference from the previous
+/// frame, which is small for a trajectory written often. Every @p
+/// keyframe_interval frames, or when the set of particle ids or the domain
+/// changes, a keyframe with the ids and absolute positions is stored instead.
+///
+/// The values are compressed with a Rice code, with a parameter chosen for
+/// each block of @p block_size particles and each dimension, and the blocks
+/// are encoded in parallel (if OpenMP is enabled). An index of the frames is
+/// written by close() (or the destructor), so that TrajectoryReader can read
+/// any frame by decoding at most @p keyframe_interval frames
+///
+class TrajectoryWriter {
+public:
+  TrajectoryWriter() : m_n_frames_since_keyframe(0) {}
+
+  TrajectoryWriter(const std::string &filename, const double precision,
+                   const unsigned int keyframe_interval = 10,
+                   const unsigned int block_size = 4096)
+      : TrajectoryWriter() {
+    open(filename, precision, keyframe_interval, block_size);
+  }
+
+  TrajectoryWriter(const TrajectoryWriter &) = delete;
+  TrajectoryWriter &operator=(const TrajectoryWriter &) = delete;
+
+  ~TrajectoryWriter() { close(); }
+
+  void open(const std::string &filename, const double precision,
+            const unsigned int keyframe_interval = 10,
+            const unsigned int block_size = 4096) {
+    close();
+    CHECK(precision > 0, "trajectory precision must be positive");
+    CHECK(keyframe_interval > 0, "keyframe interval must be positive");
+    CHECK(block_size > 0, "block size must be positive");
+    m_file.open(filename, std::ios::binary | std::ios::trunc);
+    CHECK(m_file, "could not open " << filename);
+    std::memset(&m_header, 0, sizeof(detail::trajectory_header));
+    std::memcpy(m_header.magic, detail::trajectory_magic,
+                sizeof(m_header.magic));
+    m_header.version = detail::trajectory_version;
+    m_header.precision = precision;
+    m_header.keyframe_interval = keyframe_interval;
+    m_header.block_size = block_size;
+    m_index.clear();
+    m_ids.clear();
+    m_quantised.clear();
+    m_min.clear();
+    m_n_frames_since_keyframe = 0;
+  }
+
+  ///
+  /// @brief write the index and close the file
+  ///
+  void close() {
+    if (!m_file.is_open()) {
+      return;
+    }
+    if (m_index.empty()) {
+      // no frames, so the dimension is unknown
+      write_header();
+    }
+    detail::trajectory_footer footer;
+    std::memset(&footer, 0, sizeof(detail::trajectory_footer));
+    footer.index_offset = m_file.tellp();
+    footer.n_frames = m_index.size();
+    std::memcpy(footer.magic, detail::trajectory_magic, sizeof(footer.magic));
+    m_file.write(reinterpret_cast<const char *>(m_index.data()),
+                 m_index.size() * sizeof(detail::trajectory_index_entry));
+    m_file.write(reinterpret_cast<const char *>(&footer),
+                 sizeof(detail::trajectory_footer));
+    m_file.close();
+  }
+
+  /// the number of frames written so far
+  size_t number_of_frames() const { return m_index.size(); }
+
+  ///
+  /// @brief append the positions and ids of @p particles as the next frame
+  ///
+  template <typename ParticlesType> void write(const ParticlesType &particles) {
+    typedef typename ParticlesType::position position;
+    const unsigned int dimension = ParticlesType::dimension;
+    CHECK(m_file.is_open(), "trajectory file is not open");
+    if (m_index.empty()) {
+      m_header.dimension = dimension;
+      write_header();
+    }
+    CHECK(m_header.dimension == dimension,
+          "all frames of a trajectory must have the same dimension");
+
+    // sort by id
+    const size_t n = particles.size();
+    const size_t *ids = get<id>(particles).data();
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    if (!std::is_sorted(ids, ids + n)) {
+      std::sort(order.begin(), order.end(),
+                [ids](const size_t a, const size_t b) {
+                  return ids[a] < ids[b];
+                });
+    }
+    std::vector<size_t> sorted_ids(n);
+    for (size_t i = 0; i < n; ++i) {
+      sorted_ids[i] = ids[order[i]];
+    }
+
+    // quantise
+    std::vector<double> min(dimension);
+    for (unsigned int d = 0; d < dimension; ++d) {
+      min[d] = particles.get_min()[d];
+    }
+    const double precision = m_header.precision;
+    const auto *positions = get<position>(particles).data();
+    std::vector<int64_t> quantised(n * dimension);
+    const int nn = n;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+    for (int i = 0; i < nn; ++i) {
+      for (unsigned int d = 0; d < dimension; ++d) {
+        quantised[i * dimension + d] =
+            std::llround((positions[order[i]][d] - min[d]) / precision);
+      }
+    }
+
+    const bool keyframe =
+        m_n_frames_since_keyframe == 0 ||
+        m_n_frames_since_keyframe >= m_header.keyframe_interval ||
+        sorted_ids != m_ids || min != m_min;
+
+    // the values to encode, with the id as an extra first component of
+    // keyframes
+    const unsigned int n_components = keyframe ? dimension + 1 : dimension;
+    const size_t block_size = m_header.block_size;
+    const int n_blocks = (n + block_size - 1) / block_size;
+    std::vector<std::vector<uint8_t>> blocks(n_blocks);
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int b = 0; b < n_blocks; ++b) {
+      const size_t begin = b * block_size;
+      const size_t end = std::min(n, begin + block_size);
+      std::vector<int64_t> values((end - begin) * n_components);
+      for (size_t i = begin; i < end; ++i) {
+        int64_t *value = &values[(i - begin) * n_components];
+        if (keyframe) {
+          // ids are sorted, so store the difference from the previous id
+          *value++ = i == begin ? sorted_ids[i]
+                                : sorted_ids[i] - sorted_ids[i - 1];
+        }
+        for (unsigned int d = 0; d < dimension; ++d) {
+          value[d] = keyframe ? quantised[i * dimension + d]
+                              : quantised[i * dimension + d] -
+                                    m_quantised[i * dimension + d];
+        }
+      }
+      detail::encode_block(values.data(), end - begin, n_components,
+                           blocks[b]);
+    }
+
+    detail::trajectory_index_entry entry;
+    entry.offset = m_file.tellp();
+    entry.keyframe = keyframe;
+    m_index.push_back(entry);
+
+    detail::trajectory_frame_header frame_header;
+    frame_header.size = n;
+    frame_header.keyframe = keyframe;
+    frame_header.n_blocks = n_blocks;
+    m_file.write(reinterpret_cast<const char *>(&frame_header),
+                 sizeof(detail::trajectory_frame_header));
+    m_file.write(reinterpret_cast<const char *>(min.data()),
+                 dimension * sizeof(double));
+    for (const std::vector<uint8_t> &block : blocks) {
+      const uint64_t bytes = block.size();
+      m_file.write(reinterpret_cast<const char *>(&bytes), sizeof(uint64_t));
+    }
+    size_t bytes = 0;
+    for (const std::vector<uint8_t> &block : blocks) {
+      m_file.write(reinterpret_cast<const char *>(block.data()), block.size());
+      bytes += block.size();
+    }
+    // pad to 8 bytes so that the headers are aligned when the file is mapped
+    const char padding[8] = {0};
+    m_file.write(padding, (8 - bytes % 8) % 8);
+    CHECK(m_file, "could not write trajectory frame");
+
+    m_n_frames_since_keyframe = keyframe ? 1 : m_n_frames_since_keyframe + 1;
+    m_ids.swap(sorted_ids);
+    m_quantised.swap(quantised);
+    m_min = min;
+  }
+
+private:
+  void write_header() {
+    m_file.seekp(0);
+    m_file.write(reinterpret_cast<const char *>(&m_header),
+                 sizeof(detail::trajectory_header));
+  }
+
+  std::ofstream m_file;
+  detail::trajectory_header m_header;
+  std::vector<detail::trajectory_index_entry> m_index;
+
+  /// the sorted ids, quantised positions and domain minimum of the last frame
+  std::vector<size_t> m_ids;
+  std::vector<int64_t> m_quantised;
+  std::vector<double> m_min;
+
+  unsigned int m_n_frames_since_keyframe;
+};
+
+///
+/// @brief reads frames from a trajectory file written by TrajectoryWriter.
+///
+/// The file is mapped into memory. Frames can be read in any order, reading
+/// a frame decodes the frames from the keyframe before it, or from the last
+/// frame read if that is closer
+///
+class TrajectoryReader {
+public:
+  TrajectoryReader()
+      : m_header(nullptr), m_index(nullptr), m_n_frames(0),
+        m_current_frame(-1) {}
+
+  explicit TrajectoryReader(const std::string &filename) : TrajectoryReader() {
+    open(filename);
+  }
+
+  void open(const std::string &filename) {
+    m_file.open(filename, detail::mapped_file::read_only);
+    m_current_frame = -1;
+    CHECK(m_file.size() >= sizeof(detail::trajectory_header) +
+                               sizeof(detail::trajectory_footer) &&
+              std::memcmp(m_file.data(), detail::trajectory_magic,
+                          sizeof(detail::trajectory_magic)) == 0,
+          filename << " is not a trajectory file");
+    m_header =
+        reinterpret_cast<const detail::trajectory_header *>(m_file.data());
+    CHECK(m_header->version == detail::trajectory_version,
+          filename << " has unsupported trajectory version "
+                   << m_header->version);
+    const detail::trajectory_footer *footer =
+        reinterpret_cast<const detail::trajectory_footer *>(
+            m_file.data() + m_file.size() - sizeof(detail::trajectory_footer));
+    CHECK(std::memcmp(footer->magic, detail::trajectory_magic,
+                      sizeof(detail::trajectory_magic)) == 0,
+          filename << " has no index, was the TrajectoryWriter closed?");
+    m_n_frames = footer->n_frames;
+    m_index = reinterpret_cast<const detail::trajectory_index_entry *>(
+        m_file.data() + footer->index_offset);
+  }
+
+  size_t number_of_frames() const { return m_n_frames; }
+  unsigned int dimension() const { return m_header->dimension; }
+  double precision() const { return m_header->precision; }
+
+  ///
+  /// @brief the number of particles in frame @p frame
+  ///
+  size_t size(const size_t frame) const {
+    return frame_header(frame).size;
+  }
+
+  ///
+  /// @brief read frame @p frame into @p particles. @p particles is resized to
+  /// the number of particles in the frame, which are in order of their id,
+  /// and their ids and positions are set. As for Particles::resize(), the
+  /// neighbour search is not updated
+  ///
+  template <typename ParticlesType>
+  void read(const size_t frame, ParticlesType &particles) {
+    typedef typename ParticlesType::position position;
+    const unsigned int dimension = ParticlesType::dimension;
+    CHECK(dimension == m_header->dimension,
+          "trajectory dimension " << m_header->dimension
+                                  << " does not match the particle set");
+    CHECK(frame < m_n_frames, "trajectory only has " << m_n_frames
+                                                     << " frames");
+    size_t start = frame;
+    while (!m_index[start].keyframe) {
+      --start;
+    }
+    if (m_current_frame >= static_cast<int>(start) &&
+        m_current_frame <= static_cast<int>(frame)) {
+      start = m_current_frame + 1;
+    }
+    for (size_t i = start; i <= frame; ++i) {
+      decode(i);
+    }
+
+    const size_t n = m_ids.size();
+    particles.resize(n);
+    size_t *ids = get<id>(particles).data();
+    auto *positions = get<position>(particles).data();
+    const double precision = m_header->precision;
+    const int nn = n;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+    for (int i = 0; i < nn; ++i) {
+      ids[i] = m_ids[i];
+      for (unsigned int d = 0; d < dimension; ++d) {
+        positions[i][d] = m_min[d] + m_quantised[i * dimension + d] * precision;
+      }
+    }
+  }
+
+private:
+  const detail::trajectory_frame_header &
+  frame_header(const size_t frame) const {
+    return *reinterpret_cast<const detail::trajectory_frame_header *>(
+        m_file.data() + m_index[frame].offset);
+  }
+
+  ///
+  /// @brief decode frame @p frame, which is either a keyframe or follows the
+  /// current frame
+  ///
+  void decode(const size_t frame) {
+    const unsigned int dimension = m_header->dimension;
+    const detail::trajectory_frame_header &header = frame_header(frame);
+    const bool keyframe = header.keyframe;
+    ASSERT(keyframe || m_current_frame == static_cast<int>(frame) - 1,
+           "delta frame must follow the current frame");
+    const size_t n = header.size;
+    const char *data = reinterpret_cast<const char *>(&header) +
+                       sizeof(detail::trajectory_frame_header);
+    const double *min = reinterpret_cast<const double *>(data);
+    data += dimension * sizeof(double);
+    const uint64_t *block_bytes = reinterpret_cast<const uint64_t *>(data);
+    data += header.n_blocks * sizeof(uint64_t);
+    std::vector<const uint8_t *> blocks(header.n_blocks + 1);
+    blocks[0] = reinterpret_cast<const uint8_t *>(data);
+    for (size_t b = 0; b < header.n_blocks; ++b) {
+      blocks[b + 1] = blocks[b] + block_bytes[b];
+    }
+
+    if (keyframe) {
+      m_min.assign(min, min + dimension);
+      m_ids.resize(n);
+      m_quantised.resize(n * dimension);
+    }
+    const unsigned int n_components = keyframe ? dimension + 1 : dimension;
+    const size_t block_size = m_header->block_size;
+    const int n_blocks = header.n_blocks;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int b = 0; b < n_blocks; ++b) {
+      const size_t begin = b * block_size;
+      const size_t end = std::min(n, begin + block_size);
+      std::vector<int64_t> values((end - begin) * n_components);
+      detail::decode_block(blocks[b], blocks[b + 1], end - begin,
+                           n_components, values.data());
+      for (size_t i = begin; i < end; ++i) {
+        const int64_t *value = &values[(i - begin) * n_components];
+        if (keyframe) {
+          m_ids[i] = i == begin ? *value : m_ids[i - 1] + *value;
+          ++value;
+        }
+        for (unsigned int d = 0; d < dimension; ++d) {
+          m_quantised[i * dimension + d] =
+              keyframe ? value[d] : m_quantised[i * dimension + d] + value[d];
+        }
+      }
+    }
+    m_current_frame = frame;
+  }
+
+  detail::mapped_file m_file;
+  const detail::trajectory_header *m_header;
+  const detail::trajectory_index_entry *m_index;
+  size_t m_n_frames;
+
+  /// the last frame decoded, -1 if none
+  int m_current_frame;
+
+  /// the sorted ids, quantised positions and domain minimum of the current
+  /// frame
+  std::vector<size_t> m_ids;
+  std::vector<int64_t> m_quantised;
+  std::vector<double> m_min;
+};
+
+} // namespace Aboria
+
+#endif /* TRAJECTORY_H_ */
@@ -0,0 +1,285 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Aboria.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef VERLET_LIST_H_
+#define VERLET_LIST_H_
+
+#include "Get.h"
+#include "Log.h"
+#include "NeighbourSearchBase.h"
+#include "Search.h"
+#include "Vector.h"
+#include "detail/Algorithms.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace Aboria {
+
+///
+/// @brief A cached Verlet neighbour list for a particle set.
+///
+/// For each particle, stores the indices of all the particles within a
+/// euclidean distance of `cutoff + skin` at the time the list was built,
+/// along with the positions of the particles at that time. The list remains
+/// valid (i.e. contains every pair of particles within `cutoff`) until the
+/// largest particle displacement since the last build exceeds `skin/2`, at
+/// which point update() rebuilds the list.
+///
+/// The list is owned by @ref Particles, and is enabled using
+/// Particles::init_verlet_list(). It is updated on every call to
+/// Particles::update_positions(), and is permuted along with the particles
+/// whenever the container is reordered by the neighbour search data
+/// structure. Note that the list is only supported on the host
+///
+/// @tparam Traits the @ref TraitsCommon type of the particle set
+///
+template <typename Traits> class VerletList {
+  typedef typename Traits::double_d double_d;
+  typedef typename Traits::position position;
+  static const unsigned int dimension = Traits::dimension;
+
+public:
+  typedef const int *neighbour_iterator;
+
+  VerletList()
+      : m_cutoff(0), m_skin(0), m_enabled(false), m_valid(false),
+        m_number_of_builds(0) {}
+
+  ///
+  /// @brief enable the list and set the cutoff and skin distances. The list
+  /// will be built on the next call to update()
+  ///
+  void init(const double cutoff, const double skin) {
+    CHECK(cutoff > 0, "Verlet list cutoff must be positive");
+    CHECK(skin >= 0, "Verlet list skin must be non-negative");
+    m_cutoff = cutoff;
+    m_skin = skin;
+    m_enabled = true;
+    m_valid = false;
+  }
+
+  ///
+  /// @brief force a full rebuild on the next call to update()
+  ///
+  void invalidate() { m_valid = false; }
+
+  ///
+  /// @brief returns true if init() has been called
+  ///
+  bool is_enabled() const { return m_enabled; }
+
+  ///
+  /// @brief returns true if the list has been built for a particle set with
+  /// @p n particles, and can be used to find all the neighbours within a
+  /// distance of @p radius
+  ///
+  bool is_valid_for(const size_t n, const double radius) const {
+    return m_valid && n == m_build_positions.size() && radius <= m_cutoff;
+  }
+
+  double get_cutoff() const { return m_cutoff; }
+  double get_skin() const { return m_skin; }
+
+  ///
+  /// @brief the number of times the list has been (re)built
+  ///
+  size_t number_of_builds() const { return m_number_of_builds; }
+
+  ///
+  /// @brief returns the range of indices of the candidate neighbours of
+  /// particle @p i. This includes the particle itself
+  ///
+  iterator_range<neighbour_iterator> get_neighbours(const size_t i) const {
+    ASSERT(i + 1 < m_row_begin.size(), "particle index out of range");
+    const int *neighbours = m_neighbours.data();
+    return iterator_range<neighbour_iterator>(neighbours + m_row_begin[i],
+                                              neighbours + m_row_begin[i + 1]);
+  }
+
+  ///
+  /// @brief checks the largest particle displacement since the last build,
+  /// and rebuilds the list if this is larger than `skin/2`, or if the number
+  /// of particles has changed
+  ///
+  /// @return true if the list was rebuilt
+  ///
+  template <typename ParticlesType> bool update(const ParticlesType &particles) {
+    if (!m_enabled) {
+      return false;
+    }
+    const size_t n = particles.size();
+    if (!m_valid || n != m_build_positions.size() ||
+        2 * max_displacement(particles) > m_skin) {
+      build(particles);
+      return true;
+    }
+    return false;
+  }
+
+  ///
+  /// @brief permutes the list to follow a reordering of the particle set, as
+  /// performed by Particles::reorder(). Particles before @p update_offset
+  /// are unchanged, and the particle at new index `update_offset + k` was
+  /// at the old index `order_begin[k]`. Any old particles in the update range
+  /// that are not in the order have been deleted, and are removed from the
+  /// list
+  ///
+  template <typename OrderIterator>
+  void reorder(const size_t update_offset, const OrderIterator &order_begin,
+               const OrderIterator &order_end) {
+    if (!m_valid) {
+      return;
+    }
+    const size_t old_n = m_build_positions.size();
+    const size_t n_alive = order_end - order_begin;
+    const size_t new_n = update_offset + n_alive;
+
+    bool identity = new_n == old_n;
+    for (size_t k = 0; identity && k < n_alive; ++k) {
+      identity = static_cast<size_t>(order_begin[k]) == update_offset + k;
+    }
+    if (identity) {
+      return;
+    }
+    LOG(3, "VerletList: reordering list");
+
+    std::vector<int> new_index(old_n, -1);
+    for (size_t i = 0; i < update_offset; ++i) {
+      new_index[i] = i;
+    }
+    for (size_t k = 0; k < n_alive; ++k) {
+      new_index[order_begin[k]] = update_offset + k;
+    }
+
+    std::vector<int> row_begin(new_n + 1);
+    std::vector<int> neighbours;
+    std::vector<double_d> build_positions(new_n);
+    neighbours.reserve(m_neighbours.size());
+    row_begin[0] = 0;
+    for (size_t i = 0; i < new_n; ++i) {
+      const size_t old_i =
+          i < update_offset ? i : order_begin[i - update_offset];
+      build_positions[i] = m_build_positions[old_i];
+      for (int j = m_row_begin[old_i]; j < m_row_begin[old_i + 1]; ++j) {
+        const int new_j = new_index[m_neighbours[j]];
+        if (new_j >= 0) {
+          neighbours.push_back(new_j);
+        }
+      }
+      row_begin[i + 1] = neighbours.size();
+    }
+    m_row_begin.swap(row_begin);
+    m_neighbours.swap(neighbours);
+    m_build_positions.swap(build_positions);
+  }
+
+  ///
+  /// @brief rebuilds the list from scratch using the neighbour search data
+  /// structure of @p particles
+  ///
+  template <typename ParticlesType> void build(const ParticlesType &particles) {
+    const size_t n = particles.size();
+    const double radius = m_cutoff + m_skin;
+    LOG(2, "VerletList: building list for " << n
+                                            << " particles with radius "
+                                            << radius);
+#ifndef NDEBUG
+    for (size_t d = 0; d < dimension; ++d) {
+      ASSERT(!particles.get_periodic()[d] ||
+                 2 * radius < particles.get_max()[d] - particles.get_min()[d],
+             "Verlet list radius must be less than half the periodic domain");
+    }
+#endif
+
+    const auto &query = particles.get_query();
+    const double_d *positions = get<position>(particles).data();
+
+    m_build_positions.assign(positions, positions + n);
+    batch_distance_search(query, positions, positions + n, radius,
+                          m_row_begin, m_neighbours);
+
+    m_valid = true;
+    ++m_number_of_builds;
+  }
+
+private:
+  template <typename ParticlesType>
+  double max_displacement(const ParticlesType &particles) const {
+    const size_t n = particles.size();
+    const double_d *positions = get<position>(particles).data();
+    double max_dx2 = 0;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for reduction(max : max_dx2)
+#endif
+    for (size_t i = 0; i < n; ++i) {
+      const double dx2 = particles
+                             .correct_dx_for_periodicity(positions[i] -
+                                                         m_build_positions[i])
+                             .squaredNorm();
+      max_dx2 = std::max(max_dx2, dx2);
+    }
+    return std::sqrt(max_dx2);
+  }
+
+  /// the distance within which all pairs are guarenteed to be in the list
+  double m_cutoff;
+
+  /// the extra distance added to m_cutoff when building the list
+  double m_skin;
+
+  /// has init() been called
+  bool m_enabled;
+
+  /// has the list been built since init() or invalidate()
+  bool m_valid;
+
+  /// number of times build() has been called
+  size_t m_number_of_builds;
+
+  /// CSR row pointers, the neighbours of particle i are in
+  /// m_neighbours[m_row_begin[i]] to m_neighbours[m_row_begin[i+1]]
+  std::vector<int> m_row_begin;
+
+  /// CSR column indices
+  std::vector<int> m_neighbours;
+
+  /// the particle positions at the time of the last build
+  std::vector<double_d> m_build_positions;
+};
+
+} // namespace Aboria
+
+#endif /* VERLET_LIST_H_ */
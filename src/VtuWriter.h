@@ -0,0 +1,433 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Aboria.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef VTU_WRITER_H_
+#define VTU_WRITER_H_
+
+#include "Get.h"
+#include "Log.h"
+#include "Snapshot.h"
+#include "Vector.h"
+#include "detail/MappedFile.h"
+
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <boost/mpl/for_each.hpp>
+
+namespace Aboria {
+
+namespace detail {
+
+///
+/// @brief a contiguous block of a variable's values, with the type
+/// information needed to describe it in a VTU or XDMF file
+///
+struct vtk_column {
+  std::string name;
+
+  /// 'f' for floating point, 'i' for signed and 'u' for unsigned integers
+  char kind;
+
+  /// size in bytes of each component
+  unsigned int component_size;
+
+  unsigned int n_components;
+  const char *data;
+  size_t bytes;
+};
+
+template <typename T, typename Enable = void> struct vtk_element {
+  static const bool writable = false;
+};
+
+template <typename T>
+struct vtk_element<T, typename std::enable_if<std::is_arithmetic<T>::value &&
+                                              sizeof(T) <= 8>::type> {
+  static const bool writable = true;
+  static const unsigned int n_components = 1;
+  typedef T component_type;
+};
+
+template <typename T, unsigned int N>
+struct vtk_element<Vector<T, N>,
+                   typename std::enable_if<std::is_arithmetic<T>::value &&
+                                           sizeof(T) <= 8>::type> {
+  static const bool writable = true;
+  static const unsigned int n_components = N;
+  typedef T component_type;
+};
+
+///
+/// @brief for each variable that can be written to a VTK file, adds a
+/// vtk_column pointing to its values to @p columns. As for
+/// Particles::copy_to_vtk_grid(), the position is written separately, and
+/// variables with names starting with "_" are skipped
+///
+template <typename ParticlesType> struct gather_vtk_columns {
+  typedef typename ParticlesType::position position;
+  const ParticlesType &particles;
+  std::vector<vtk_column> &columns;
+
+  gather_vtk_columns(const ParticlesType &particles,
+                     std::vector<vtk_column> &columns)
+      : particles(particles), columns(columns) {}
+
+  template <typename Variable> void operator()(Variable) {
+    typedef typename Variable::value_type value_type;
+    const char *name = Variable().name;
+    if (std::is_same<Variable, position>::value ||
+        !vtk_element<value_type>::writable || name[0] == '_') {
+      return;
+    }
+    add_column<Variable>(name);
+  }
+
+  template <typename Variable>
+  typename std::enable_if<
+      vtk_element<typename Variable::value_type>::writable>::type
+  add_column(const char *name) {
+    typedef typename Variable::value_type value_type;
+    typedef vtk_element<value_type> element;
+    typedef typename element::component_type component_type;
+    static_assert(sizeof(value_type) ==
+                      element::n_components * sizeof(component_type),
+                  "vector variables must be contiguous");
+    vtk_column column;
+    column.name = name;
+    column.kind = std::is_floating_point<component_type>::value
+                      ? 'f'
+                      : (std::is_signed<component_type>::value ? 'i' : 'u');
+    column.component_size = sizeof(component_type);
+    column.n_components = element::n_components;
+    column.data =
+        reinterpret_cast<const char *>(get<Variable>(particles).data());
+    column.bytes = particles.size() * sizeof(value_type);
+    columns.push_back(column);
+  }
+
+  template <typename Variable>
+  typename std::enable_if<
+      !vtk_element<typename Variable::value_type>::writable>::type
+  add_column(const char *name) {}
+};
+
+inline bool is_little_endian() {
+  const uint16_t one = 1;
+  return *reinterpret_cast<const uint8_t *>(&one) == 1;
+}
+
+inline std::string vtk_type_name(const char kind,
+                                 const unsigned int component_size) {
+  const char *prefix = kind == 'f' ? "Float" : (kind == 'i' ? "Int" : "UInt");
+  return prefix + std::to_string(8 * component_size);
+}
+
+///
+/// @brief copies the @p n positions of dimension @p dimension to @p points,
+/// padding with zeros (or truncating) to three dimensions
+///
+inline void pad_positions(const unsigned int dimension, const size_t n,
+                          const double *positions, double *points) {
+  const int nn = n;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+  for (int i = 0; i < nn; ++i) {
+    for (unsigned int d = 0; d < 3; ++d) {
+      points[3 * i + d] = d < dimension ? positions[dimension * i + d] : 0.0;
+    }
+  }
+}
+
+inline size_t align8(const size_t offset) { return (offset + 7) / 8 * 8; }
+
+///
+/// @brief writes a VTU file with @p n vertices at @p positions, and the point
+/// data in @p columns, with all the arrays in raw binary appended data
+///
+inline void write_vtu(const std::string &filename, const unsigned int dimension,
+                      const size_t n, const double *positions,
+                      const std::vector<vtk_column> &columns) {
+  // appended blocks (each a UInt64 byte count followed by the data): points,
+  // connectivity, offsets, types, then the columns
+  std::vector<size_t> bytes = {3 * n * sizeof(double), n * sizeof(int64_t),
+                               n * sizeof(int64_t), n * sizeof(uint8_t)};
+  for (const vtk_column &column : columns) {
+    bytes.push_back(column.bytes);
+  }
+  // start each block on an 8 byte boundary of the appended data so that it
+  // can be written with aligned stores
+  std::vector<size_t> offsets(bytes.size());
+  size_t appended_size = 0;
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    appended_size = align8(appended_size);
+    offsets[i] = appended_size;
+    appended_size += sizeof(uint64_t) + bytes[i];
+  }
+
+  std::ostringstream head;
+  head << "<?xml version=\"1.0\"?>\n"
+       << "<VTKFile type=\"UnstructuredGrid\" version=\"1.0\" byte_order=\""
+       << (is_little_endian() ? "LittleEndian" : "BigEndian")
+       << "\" header_type=\"UInt64\">\n"
+       << "<UnstructuredGrid>\n"
+       << "<Piece NumberOfPoints=\"" << n << "\" NumberOfCells=\"" << n
+       << "\">\n"
+       << "<PointData>\n";
+  for (size_t i = 0; i < columns.size(); ++i) {
+    head << "<DataArray type=\""
+         << vtk_type_name(columns[i].kind, columns[i].component_size)
+         << "\" Name=\"" << columns[i].name << "\" NumberOfComponents=\""
+         << columns[i].n_components << "\" format=\"appended\" offset=\""
+         << offsets[4 + i] << "\"/>\n";
+  }
+  head << "</PointData>\n"
+       << "<Points>\n"
+       << "<DataArray type=\"Float64\" NumberOfComponents=\"3\" "
+          "format=\"appended\" offset=\""
+       << offsets[0] << "\"/>\n"
+       << "</Points>\n"
+       << "<Cells>\n"
+       << "<DataArray type=\"Int64\" Name=\"connectivity\" "
+          "format=\"appended\" offset=\""
+       << offsets[1] << "\"/>\n"
+       << "<DataArray type=\"Int64\" Name=\"offsets\" format=\"appended\" "
+          "offset=\""
+       << offsets[2] << "\"/>\n"
+       << "<DataArray type=\"UInt8\" Name=\"types\" format=\"appended\" "
+          "offset=\""
+       << offsets[3] << "\"/>\n"
+       << "</Cells>\n"
+       << "</Piece>\n"
+       << "</UnstructuredGrid>\n"
+       << "<AppendedData encoding=\"raw\">";
+  // pad with whitespace so the appended data, which starts after the "_",
+  // is 8 byte aligned in the file
+  std::string head_string = head.str();
+  head_string.append(align8(head_string.size() + 1) - head_string.size() - 1,
+                     ' ');
+  head_string += '_';
+  const std::string tail = "\n</AppendedData>\n</VTKFile>\n";
+
+  const size_t file_size = head_string.size() + appended_size + tail.size();
+  mapped_file file(filename, mapped_file::create, file_size);
+  char *appended = file.data() + head_string.size();
+  std::memcpy(file.data(), head_string.data(), head_string.size());
+  // zero the alignment gaps
+  std::memset(appended, 0, appended_size);
+  std::memcpy(appended + appended_size, tail.data(), tail.size());
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    const uint64_t block_bytes = bytes[i];
+    std::memcpy(appended + offsets[i], &block_bytes, sizeof(uint64_t));
+  }
+
+  pad_positions(dimension, n, positions,
+                reinterpret_cast<double *>(appended + offsets[0] +
+                                           sizeof(uint64_t)));
+  int64_t *connectivity =
+      reinterpret_cast<int64_t *>(appended + offsets[1] + sizeof(uint64_t));
+  int64_t *cell_offsets =
+      reinterpret_cast<int64_t *>(appended + offsets[2] + sizeof(uint64_t));
+  uint8_t *types =
+      reinterpret_cast<uint8_t *>(appended + offsets[3] + sizeof(uint64_t));
+  const int nn = n;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+  for (int i = 0; i < nn; ++i) {
+    connectivity[i] = i;
+    cell_offsets[i] = i + 1;
+    types[i] = 1; // VTK_VERTEX
+  }
+
+  std::vector<column_copy> copies;
+  for (size_t i = 0; i < columns.size(); ++i) {
+    copies.push_back({columns[i].data,
+                      appended + offsets[4 + i] + sizeof(uint64_t),
+                      columns[i].bytes});
+  }
+  copy_columns(copies);
+  LOG(2, "write_vtu: wrote " << n << " particles to " << filename);
+}
+
+///
+/// @brief writes an XDMF file describing @p n vertices at @p positions with
+/// the point data in @p columns, all stored in the raw binary file
+/// @p raw_filename
+///
+inline void write_xdmf(const std::string &filename,
+                       const std::string &raw_filename,
+                       const unsigned int dimension, const size_t n,
+                       const double *positions,
+                       const std::vector<vtk_column> &columns) {
+  std::vector<size_t> offsets;
+  size_t raw_size = 3 * n * sizeof(double);
+  for (const vtk_column &column : columns) {
+    raw_size = align8(raw_size);
+    offsets.push_back(raw_size);
+    raw_size += column.bytes;
+  }
+
+  // the XDMF file refers to the raw file relative to itself
+  const std::string raw_name =
+      raw_filename.substr(raw_filename.find_last_of('/') + 1);
+  const char *endian = is_little_endian() ? "Little" : "Big";
+
+  std::ostringstream xdmf;
+  xdmf << "<?xml version=\"1.0\" ?>\n"
+       << "<Xdmf Version=\"3.0\">\n"
+       << "<Domain>\n"
+       << "<Grid Name=\"particles\" GridType=\"Uniform\">\n"
+       << "<Topology TopologyType=\"Polyvertex\" NumberOfElements=\"" << n
+       << "\" NodesPerElement=\"1\"/>\n"
+       << "<Geometry GeometryType=\"XYZ\">\n"
+       << "<DataItem Dimensions=\"" << n
+       << " 3\" NumberType=\"Float\" Precision=\"8\" Format=\"Binary\" "
+          "Endian=\""
+       << endian << "\" Seek=\"0\">" << raw_name << "</DataItem>\n"
+       << "</Geometry>\n";
+  for (size_t i = 0; i < columns.size(); ++i) {
+    const vtk_column &column = columns[i];
+    const char *number_type =
+        column.kind == 'f'
+            ? "Float"
+            : (column.component_size == 1
+                   ? (column.kind == 'i' ? "Char" : "UChar")
+                   : (column.kind == 'i' ? "Int" : "UInt"));
+    const char *attribute_type =
+        column.n_components == 1
+            ? "Scalar"
+            : (column.n_components == 3 ? "Vector" : "Matrix");
+    xdmf << "<Attribute Name=\"" << column.name << "\" AttributeType=\""
+         << attribute_type << "\" Center=\"Node\">\n"
+         << "<DataItem Dimensions=\"" << n;
+    if (column.n_components > 1) {
+      xdmf << ' ' << column.n_components;
+    }
+    xdmf << "\" NumberType=\"" << number_type << "\" Precision=\""
+         << column.component_size << "\" Format=\"Binary\" Endian=\""
+         << endian << "\" Seek=\"" << offsets[i] << "\">" << raw_name
+         << "</DataItem>\n"
+         << "</Attribute>\n";
+  }
+  xdmf << "</Grid>\n"
+       << "</Domain>\n"
+       << "</Xdmf>\n";
+  const std::string xdmf_string = xdmf.str();
+  mapped_file xdmf_file(filename, mapped_file::create, xdmf_string.size());
+  std::memcpy(xdmf_file.data(), xdmf_string.data(), xdmf_string.size());
+
+  mapped_file raw_file(raw_filename, mapped_file::create, raw_size);
+  pad_positions(dimension, n, positions,
+                reinterpret_cast<double *>(raw_file.data()));
+  std::vector<column_copy> copies;
+  for (size_t i = 0; i < columns.size(); ++i) {
+    copies.push_back(
+        {columns[i].data, raw_file.data() + offsets[i], columns[i].bytes});
+  }
+  copy_columns(copies);
+  LOG(2, "write_xdmf: wrote " << n << " particles to " << filename << " and "
+                              << raw_filename);
+}
+
+template <typename ParticlesType>
+const double *positions_data(const ParticlesType &particles) {
+  typedef typename ParticlesType::position position;
+  static_assert(std::is_same<typename position::value_type,
+                             Vector<double, ParticlesType::dimension>>::value,
+                "particle positions must be a vector of doubles");
+  return reinterpret_cast<const double *>(get<position>(particles).data());
+}
+
+} // namespace detail
+
+///
+/// @brief writes the positions and variables @p Variables (or all the
+/// variables if empty) of @p particles to the VTK unstructured grid file @p
+/// filename, without using the VTK library.
+///
+/// Each particle is written as a vertex. Variables with arithmetic or
+/// @ref Vector value types are written as point data in their own type,
+/// except for those with names starting with "_". All arrays are stored as raw
+/// binary appended data, which is copied straight from the particle set in
+/// parallel (if OpenMP is enabled)
+///
+/// @see write_xdmf(), AsyncWriter
+///
+template <typename... Variables, typename ParticlesType>
+void write_vtu(const std::string &filename, const ParticlesType &particles) {
+  std::vector<detail::vtk_column> columns;
+  mpl::for_each<
+      typename detail::select_variables<ParticlesType, Variables...>::type>(
+      detail::gather_vtk_columns<ParticlesType>(particles, columns));
+  detail::write_vtu(filename, ParticlesType::dimension, particles.size(),
+                    detail::positions_data(particles), columns);
+}
+
+///
+/// @brief writes the positions and variables @p Variables (or all the
+/// variables if empty) of @p particles to the XDMF file @p filename, with
+/// the data in a raw binary file alongside it.
+///
+/// The raw file has the same name as @p filename with the extension replaced
+/// by ".raw". It holds the positions, padded to three dimensions, followed by
+/// each variable as written by write_vtu()
+///
+template <typename... Variables, typename ParticlesType>
+void write_xdmf(const std::string &filename, const ParticlesType &particles) {
+  std::vector<detail::vtk_column> columns;
+  mpl::for_each<
+      typename detail::select_variables<ParticlesType, Variables...>::type>(
+      detail::gather_vtk_columns<ParticlesType>(particles, columns));
+  const size_t dot = filename.find_last_of('.');
+  const size_t slash = filename.find_last_of('/');
+  const std::string raw_filename =
+      (dot != std::string::npos && (slash == std::string::npos || dot > slash)
+           ? filename.substr(0, dot)
+           : filename) +
+      ".raw";
+  detail::write_xdmf(filename, raw_filename, ParticlesType::dimension,
+                     particles.size(), detail::positions_data(particles),
+                     columns);
+}
+
+} // namespace Aboria
+
+#endif /* VTU_WRITER_H_ */
@@ -4,10 +4,13 @@
 
 #include "../CudaInclude.h"
 #include "Get.h"
+#include "Log.h"
 #include "Traits.h"
 #include <algorithm>
+#include <boost/iterator/iterator_categories.hpp>
 #include <omp.h>
 #include <random>
+#include <vector>
 
 namespace Aboria {
 
@@ -98,6 +101,116 @@ template <typename T> struct upper_bound_impl {
   }
 };
 
+#ifdef HAVE_OPENMP
+///
+/// @brief ranges smaller than this are processed serially by the OpenMP
+/// backend, as the cost of starting the parallel region would dominate
+///
+static const size_t omp_serial_threshold = 10000;
+
+template <typename... Iterators> struct is_random_access;
+
+template <> struct is_random_access<> : std::true_type {};
+
+template <typename Iterator, typename... Iterators>
+struct is_random_access<Iterator, Iterators...>
+    : std::integral_constant<
+          bool,
+          std::is_convertible<
+              typename boost::iterator_traversal<Iterator>::type,
+              boost::random_access_traversal_tag>::value &&
+              is_random_access<Iterators...>::value> {};
+
+///
+/// @brief returns true if a range of length @p n should be processed using the
+/// OpenMP backend. Nested calls from within an existing parallel region are
+/// always run serially.
+///
+template <typename... Iterators> bool use_omp_backend(const size_t n) {
+  return is_random_access<Iterators...>::value && n >= omp_serial_threshold &&
+         omp_get_max_threads() > 1 && !omp_in_parallel();
+}
+
+///
+/// @brief parallel merge sort, each thread sorts a contiguous chunk of the
+/// range, then the chunks are merged pairwise in log2(threads) rounds
+///
+template <typename RandomIt, typename StrictWeakOrdering>
+void omp_sort(RandomIt first, RandomIt last, StrictWeakOrdering comp) {
+  const size_t n = last - first;
+  const int nchunks = omp_get_max_threads();
+  std::vector<size_t> bounds(nchunks + 1);
+  for (int i = 0; i <= nchunks; ++i) {
+    bounds[i] = (n * i) / nchunks;
+  }
+
+#pragma omp parallel for
+  for (int i = 0; i < nchunks; ++i) {
+    std::sort(first + bounds[i], first + bounds[i + 1], comp);
+  }
+
+  for (int width = 1; width < nchunks; width *= 2) {
+#pragma omp parallel for
+    for (int i = 0; i < nchunks - width; i += 2 * width) {
+      const int end_chunk = std::min(i + 2 * width, nchunks);
+      std::inplace_merge(first + bounds[i], first + bounds[i + width],
+                         first + bounds[end_chunk], comp);
+    }
+  }
+}
+
+///
+/// @brief two-pass blocked prefix sum. The first pass sums each thread's
+/// block, the second rescans each block starting from the sum of all the
+/// blocks before it. Safe to use in-place (i.e. with @p d_first == @p first)
+///
+template <typename T, typename InputIt, typename OutputIt>
+OutputIt omp_scan(InputIt first, InputIt last, OutputIt d_first, T init,
+                  const bool inclusive) {
+  const size_t n = last - first;
+  const int nblocks = omp_get_max_threads();
+  std::vector<T> block_sums(nblocks + 1);
+  block_sums[0] = init;
+
+#pragma omp parallel num_threads(nblocks)
+  {
+    const int nthreads = omp_get_num_threads();
+    const int block = omp_get_thread_num();
+    const size_t begin = (n * block) / nthreads;
+    const size_t end = (n * (block + 1)) / nthreads;
+
+    if (block < nthreads - 1) {
+      T sum = T();
+      for (size_t i = begin; i < end; ++i) {
+        sum = sum + first[i];
+      }
+      block_sums[block + 1] = sum;
+    }
+
+#pragma omp barrier
+#pragma omp single
+    for (int i = 1; i < nthreads; ++i) {
+      block_sums[i] = block_sums[i - 1] + block_sums[i];
+    }
+
+    T accum = block_sums[block];
+    if (inclusive) {
+      for (size_t i = begin; i < end; ++i) {
+        accum = accum + first[i];
+        d_first[i] = accum;
+      }
+    } else {
+      for (size_t i = begin; i < end; ++i) {
+        const T value = first[i];
+        d_first[i] = accum;
+        accum = accum + value;
+      }
+    }
+  }
+  return d_first + n;
+}
+#endif
+
 template <class ForwardIt, class T>
 void fill(ForwardIt first, ForwardIt last, const T &value, std::true_type) {
   std::fill(first, last, value);
@@ -137,6 +250,12 @@ UnaryFunction for_each(InputIt first, InputIt last, UnaryFunction f) {
 
 template <typename RandomIt>
 void sort(RandomIt start, RandomIt end, std::true_type) {
+#ifdef HAVE_OPENMP
+  if (use_omp_backend<RandomIt>(end - start)) {
+    omp_sort(start, end, [](const auto &a, const auto &b) { return a < b; });
+    return;
+  }
+#endif
   std::sort(start, end);
 }
 
@@ -154,6 +273,12 @@ template <typename RandomIt> void sort(RandomIt start, RandomIt end) {
 template <typename RandomIt, typename StrictWeakOrdering>
 void sort(RandomIt start, RandomIt end, StrictWeakOrdering comp,
           std::true_type) {
+#ifdef HAVE_OPENMP
+  if (use_omp_backend<RandomIt>(end - start)) {
+    omp_sort(start, end, comp);
+    return;
+  }
+#endif
   std::sort(start, end, comp);
 }
 
@@ -174,12 +299,20 @@ template <typename T1, typename T2>
 void sort_by_key(T1 start_keys, T1 end_keys, T2 start_data, std::true_type) {
   typedef zip_iterator<std::tuple<T1, T2>, mpl::vector<>> pair_zip_type;
 
-  std::sort(
-      pair_zip_type(start_keys, start_data),
-      pair_zip_type(end_keys, start_data + std::distance(start_keys, end_keys)),
-      [](auto a, auto b) {
-        return std::get<0>(a.get_tuple()) < std::get<0>(b.get_tuple());
-      });
+  auto compare_keys = [](const auto &a, const auto &b) {
+    return std::get<0>(a.get_tuple()) < std::get<0>(b.get_tuple());
+  };
+  const pair_zip_type start(start_keys, start_data);
+  const pair_zip_type end(end_keys,
+                          start_data + std::distance(start_keys, end_keys));
+
+#ifdef HAVE_OPENMP
+  if (use_omp_backend<T1, T2>(end - start)) {
+    omp_sort(start, end, compare_keys);
+    return;
+  }
+#endif
+  std::sort(start, end, compare_keys);
   /*
 std::sort(
   boost::make_zip_iterator(boost::make_tuple(start_keys, start_data)),
@@ -210,6 +343,17 @@ template <typename ForwardIterator, typename InputIterator,
 void lower_bound(ForwardIterator first, ForwardIterator last,
                  InputIterator values_first, InputIterator values_last,
                  OutputIterator result, std::true_type) {
+#ifdef HAVE_OPENMP
+  const size_t n = std::distance(values_first, values_last);
+  if (use_omp_backend<ForwardIterator, InputIterator, OutputIterator>(n)) {
+#pragma omp parallel for
+    for (size_t i = 0; i < n; ++i) {
+      *(result + i) = std::distance(
+          first, std::lower_bound(first, last, *(values_first + i)));
+    }
+    return;
+  }
+#endif
   std::transform(values_first, values_last, result,
                  detail::lower_bound_impl<ForwardIterator>(first, last));
 }
@@ -263,7 +407,17 @@ template <typename ForwardIterator, typename InputIterator,
 void upper_bound(ForwardIterator first, ForwardIterator last,
                  InputIterator values_first, InputIterator values_last,
                  OutputIterator result, std::true_type) {
-
+#ifdef HAVE_OPENMP
+  const size_t n = std::distance(values_first, values_last);
+  if (use_omp_backend<ForwardIterator, InputIterator, OutputIterator>(n)) {
+#pragma omp parallel for
+    for (size_t i = 0; i < n; ++i) {
+      *(result + i) = std::distance(
+          first, std::upper_bound(first, last, *(values_first + i)));
+    }
+    return;
+  }
+#endif
   std::transform(values_first, values_last, result,
                  detail::upper_bound_impl<ForwardIterator>(first, last));
 }
@@ -288,6 +442,218 @@ void upper_bound(ForwardIterator first, ForwardIterator last,
                       typename is_std_iterator<ForwardIterator>::type());
 }
 
+///
+/// @brief sorts the range [keys_first, keys_last) of integer keys in
+/// [0, nbuckets), permuting the data range starting at data_first alongside.
+/// On return, bucket_begin[b] and bucket_end[b] hold the sorted range of each
+/// key b.
+///
+/// The std version is a stable counting sort, O(N + nbuckets). Each chunk of
+/// the keys is histogrammed separately, the histograms are scanned to give
+/// each chunk its offset within each bucket, then the chunks are scattered to
+/// the output in parallel.
+///
+template <typename KeyIterator, typename DataIterator,
+          typename OutputIterator>
+void counting_sort_by_key(KeyIterator keys_first, KeyIterator keys_last,
+                          DataIterator data_first, const size_t nbuckets,
+                          OutputIterator bucket_begin,
+                          OutputIterator bucket_end, std::true_type) {
+  typedef typename std::iterator_traits<KeyIterator>::value_type key_type;
+  typedef typename std::iterator_traits<DataIterator>::value_type data_type;
+
+  const size_t n = std::distance(keys_first, keys_last);
+
+  // the per-chunk histograms use nchunks*nbuckets memory, so limit the
+  // number of chunks if there are many more buckets than keys
+  size_t nchunks = 1;
+#ifdef HAVE_OPENMP
+  if (use_omp_backend<KeyIterator, DataIterator, OutputIterator>(n)) {
+    nchunks = std::min(static_cast<size_t>(omp_get_max_threads()),
+                       std::max(size_t(1), 4 * n / std::max(nbuckets,
+                                                            size_t(1))));
+  }
+#endif
+  std::vector<size_t> chunk_bounds(nchunks + 1);
+  for (size_t c = 0; c <= nchunks; ++c) {
+    chunk_bounds[c] = (n * c) / nchunks;
+  }
+
+  // histogram each chunk
+  std::vector<size_t> offsets(nchunks * nbuckets, 0);
+#ifdef HAVE_OPENMP
+#pragma omp parallel for if (nchunks > 1)
+#endif
+  for (size_t c = 0; c < nchunks; ++c) {
+    size_t *counts = offsets.data() + c * nbuckets;
+    for (size_t i = chunk_bounds[c]; i < chunk_bounds[c + 1]; ++i) {
+      ++counts[keys_first[i]];
+    }
+  }
+
+  // start of each bucket in the sorted output
+  std::vector<size_t> bucket_offset(nbuckets, 0);
+  for (size_t c = 0; c < nchunks; ++c) {
+    const size_t *counts = offsets.data() + c * nbuckets;
+    for (size_t b = 0; b < nbuckets; ++b) {
+      bucket_offset[b] += counts[b];
+    }
+  }
+  size_t sum = 0;
+  for (size_t b = 0; b < nbuckets; ++b) {
+    const size_t count = bucket_offset[b];
+    bucket_offset[b] = sum;
+    sum += count;
+  }
+
+  // turn the histograms into each chunk's write offset within each bucket
+#ifdef HAVE_OPENMP
+#pragma omp parallel for if (nchunks > 1)
+#endif
+  for (size_t b = 0; b < nbuckets; ++b) {
+    size_t running = bucket_offset[b];
+    bucket_begin[b] = running;
+    for (size_t c = 0; c < nchunks; ++c) {
+      const size_t count = offsets[c * nbuckets + b];
+      offsets[c * nbuckets + b] = running;
+      running += count;
+    }
+    bucket_end[b] = running;
+  }
+
+  // scatter keys and data to their sorted positions
+  std::vector<key_type> sorted_keys(n);
+  std::vector<data_type> sorted_data(n);
+#ifdef HAVE_OPENMP
+#pragma omp parallel for if (nchunks > 1)
+#endif
+  for (size_t c = 0; c < nchunks; ++c) {
+    size_t *next = offsets.data() + c * nbuckets;
+    for (size_t i = chunk_bounds[c]; i < chunk_bounds[c + 1]; ++i) {
+      const size_t index = next[keys_first[i]]++;
+      sorted_keys[index] = keys_first[i];
+      sorted_data[index] = data_first[i];
+    }
+  }
+  std::copy(sorted_keys.begin(), sorted_keys.end(), keys_first);
+  std::copy(sorted_data.begin(), sorted_data.end(), data_first);
+}
+
+#ifdef HAVE_THRUST
+template <typename KeyIterator, typename DataIterator,
+          typename OutputIterator>
+void counting_sort_by_key(KeyIterator keys_first, KeyIterator keys_last,
+                          DataIterator data_first, const size_t nbuckets,
+                          OutputIterator bucket_begin,
+                          OutputIterator bucket_end, std::false_type) {
+  // fall back to a comparison sort followed by a binary search for each
+  // bucket
+  thrust::sort_by_key(keys_first, keys_last, data_first);
+  auto search_begin = thrust::make_counting_iterator(0);
+  thrust::lower_bound(keys_first, keys_last, search_begin,
+                      search_begin + nbuckets, bucket_begin);
+  thrust::upper_bound(keys_first, keys_last, search_begin,
+                      search_begin + nbuckets, bucket_end);
+}
+#endif
+
+template <typename KeyIterator, typename DataIterator,
+          typename OutputIterator>
+void counting_sort_by_key(KeyIterator keys_first, KeyIterator keys_last,
+                          DataIterator data_first, const size_t nbuckets,
+                          OutputIterator bucket_begin,
+                          OutputIterator bucket_end) {
+  detail::counting_sort_by_key(keys_first, keys_last, data_first, nbuckets,
+                               bucket_begin, bucket_end,
+                               typename is_std_iterator<KeyIterator>::type());
+}
+
+///
+/// @brief out-of-core version of counting_sort_by_key(), for keys and data
+/// that are stored in files (see mapped_vector). On return, bucket_begin[b]
+/// and bucket_end[b] hold the sorted range of each key b.
+///
+/// The buckets are split into consecutive partitions, each holding at most
+/// @p max_bytes of sorted keys and data. For each partition the keys and data
+/// are streamed through once, and those in the partition are scattered to a
+/// buffer in memory, which is then written in order to the ranges starting
+/// at @p sorted_keys_first and @p sorted_data_first. So the random writes of
+/// the counting sort stay within @p max_bytes of memory, at the cost of one
+/// sequential pass over the input per partition. Finally the sorted keys and
+/// data are copied back to the input ranges. If everything fits in @p
+/// max_bytes, this calls counting_sort_by_key() instead
+///
+template <typename KeyIterator, typename DataIterator,
+          typename OutputIterator>
+void external_counting_sort_by_key(KeyIterator keys_first,
+                                   KeyIterator keys_last,
+                                   DataIterator data_first,
+                                   const size_t nbuckets,
+                                   OutputIterator bucket_begin,
+                                   OutputIterator bucket_end,
+                                   KeyIterator sorted_keys_first,
+                                   DataIterator sorted_data_first,
+                                   const size_t max_bytes) {
+  typedef typename std::iterator_traits<KeyIterator>::value_type key_type;
+  typedef typename std::iterator_traits<DataIterator>::value_type data_type;
+
+  const size_t n = std::distance(keys_first, keys_last);
+  const size_t max_elements =
+      std::max(size_t(1), max_bytes / (sizeof(key_type) + sizeof(data_type)));
+  if (n <= max_elements) {
+    detail::counting_sort_by_key(keys_first, keys_last, data_first, nbuckets,
+                                 bucket_begin, bucket_end);
+    return;
+  }
+
+  // start of each bucket in the sorted output
+  std::vector<size_t> next(nbuckets + 1, 0);
+  for (size_t i = 0; i < n; ++i) {
+    ++next[keys_first[i] + 1];
+  }
+  for (size_t b = 0; b < nbuckets; ++b) {
+    next[b + 1] += next[b];
+    bucket_begin[b] = next[b];
+    bucket_end[b] = next[b + 1];
+  }
+
+  std::vector<key_type> keys_buffer;
+  std::vector<data_type> data_buffer;
+  size_t partition_begin = 0;
+  while (partition_begin < nbuckets) {
+    // the largest partition of buckets that fits in the buffer, or a single
+    // bucket if it does not
+    const size_t sorted_begin = next[partition_begin];
+    size_t partition_end = partition_begin + 1;
+    while (partition_end < nbuckets &&
+           next[partition_end + 1] - sorted_begin <= max_elements) {
+      ++partition_end;
+    }
+    const size_t sorted_end = next[partition_end];
+    LOG(3, "external_counting_sort_by_key: buckets "
+               << partition_begin << " to " << partition_end << " hold "
+               << sorted_end - sorted_begin << " elements");
+
+    keys_buffer.resize(sorted_end - sorted_begin);
+    data_buffer.resize(sorted_end - sorted_begin);
+    for (size_t i = 0; i < n; ++i) {
+      const size_t key = keys_first[i];
+      if (key >= partition_begin && key < partition_end) {
+        const size_t index = next[key]++ - sorted_begin;
+        keys_buffer[index] = key;
+        data_buffer[index] = data_first[i];
+      }
+    }
+    std::copy(keys_buffer.begin(), keys_buffer.end(),
+              sorted_keys_first + sorted_begin);
+    std::copy(data_buffer.begin(), data_buffer.end(),
+              sorted_data_first + sorted_begin);
+    partition_begin = partition_end;
+  }
+  std::copy(sorted_keys_first, sorted_keys_first + n, keys_first);
+  std::copy(sorted_data_first, sorted_data_first + n, data_first);
+}
+
 template <class InputIt, class T, class BinaryOperation>
 T reduce(InputIt first, InputIt last, T init, BinaryOperation op,
          std::true_type) {
@@ -315,6 +681,16 @@ template <class InputIterator, class OutputIterator, class UnaryOperation>
 OutputIterator transform(InputIterator first, InputIterator last,
                          OutputIterator result, UnaryOperation op,
                          std::true_type) {
+#ifdef HAVE_OPENMP
+  const size_t n = std::distance(first, last);
+  if (use_omp_backend<InputIterator, OutputIterator>(n)) {
+#pragma omp parallel for
+    for (size_t i = 0; i < n; ++i) {
+      *(result + i) = op(*(first + i));
+    }
+    return result + n;
+  }
+#endif
   return std::transform(first, last, result, op);
 }
 
@@ -526,6 +902,12 @@ OutputIterator transform_exclusive_scan(InputIterator first, InputIterator last,
 template <class InputIt, class OutputIt>
 OutputIt inclusive_scan(InputIt first, InputIt last, OutputIt d_first,
                         std::true_type) {
+#ifdef HAVE_OPENMP
+  typedef typename std::iterator_traits<InputIt>::value_type value_type;
+  if (use_omp_backend<InputIt, OutputIt>(std::distance(first, last))) {
+    return omp_scan(first, last, d_first, value_type(), true);
+  }
+#endif
 #if __cplusplus >= 201703L
   // C++17 code here
   return std::inclusive_scan(first, last, d_first);
@@ -551,15 +933,20 @@ OutputIt inclusive_scan(InputIt first, InputIt last, OutputIt d_first) {
 template <class InputIt, class OutputIt, class T>
 OutputIt exclusive_scan(InputIt first, InputIt last, OutputIt d_first, T init,
                         std::true_type) {
+#ifdef HAVE_OPENMP
+  if (use_omp_backend<InputIt, OutputIt>(std::distance(first, last))) {
+    return omp_scan(first, last, d_first, init, false);
+  }
+#endif
 #if __cplusplus >= 201703L
   // C++17 code here
   return std::exclusive_scan(first, last, d_first,init);
 #else
-  if (first != last) {
-    *d_first++ = init;
-    for (; first != last - 1; ++first, ++d_first) {
-      *d_first = *(d_first - 1) + *first;
-    }
+  // read each input before writing its output so this is safe in-place
+  for (; first != last; ++first, ++d_first) {
+    const T value = *first;
+    *d_first = init;
+    init = init + value;
   }
   return d_first;
 #endif
@@ -621,6 +1008,10 @@ template <typename InputIterator1, typename InputIterator2,
 void scatter(InputIterator1 first, InputIterator1 last, InputIterator2 map,
              RandomAccessIterator output, std::true_type) {
   const size_t n = last - first;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for if (use_omp_backend<InputIterator1, InputIterator2,   \
+                                             RandomAccessIterator>(n))
+#endif
   for (size_t i = 0; i < n; ++i) {
     output[map[i]] = first[i];
   }
@@ -651,6 +1042,11 @@ void scatter_if(InputIterator1 first, InputIterator1 last, InputIterator2 map,
                 Predicate pred, std::true_type) {
 
   const size_t n = last - first;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for if (use_omp_backend<InputIterator1, InputIterator2,   \
+                                             InputIterator3,                   \
+                                             RandomAccessIterator>(n))
+#endif
   for (size_t i = 0; i < n; ++i) {
     if (pred(stencil[i])) {
       output[map[i]] = first[i];
@@ -688,6 +1084,11 @@ void scatter_if(InputIterator1 first, InputIterator1 last, InputIterator2 map,
                 std::true_type) {
 
   const size_t n = last - first;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for if (use_omp_backend<InputIterator1, InputIterator2,   \
+                                             InputIterator3,                   \
+                                             RandomAccessIterator>(n))
+#endif
   for (size_t i = 0; i < n; ++i) {
     if (stencil[i]) {
       output[map[i]] = first[i];
@@ -720,10 +1121,23 @@ template <typename InputIterator, typename RandomAccessIterator,
 void gather(InputIterator map_first, InputIterator map_last,
             RandomAccessIterator input_first, OutputIterator result,
             std::true_type) {
-  std::transform(map_first, map_last, result,
-                 [&input_first](typename InputIterator::value_type const &i) {
-                   return input_first[i];
-                 });
+#ifdef HAVE_OPENMP
+  const size_t n = std::distance(map_first, map_last);
+  if (use_omp_backend<InputIterator, RandomAccessIterator, OutputIterator>(
+          n)) {
+#pragma omp parallel for
+    for (size_t i = 0; i < n; ++i) {
+      *(result + i) = *(input_first + *(map_first + i));
+    }
+    return;
+  }
+#endif
+  std::transform(
+      map_first, map_last, result,
+      [&input_first](
+          typename std::iterator_traits<InputIterator>::value_type const &i) {
+        return input_first[i];
+      });
 }
 
 #ifdef HAVE_THRUST
@@ -274,17 +274,41 @@ template <typename labels_type, typename dx_type> struct EvalCtx {
     const int LNormNumber = accumulate_type::norm_number_type::value;
 
     result_type sum = accum.init;
-    // TODO: get query range and put it in box search
-    for (auto b = distance_search<LNormNumber>(
-             particlesb.get_query(), get<position>(ai), accum.max_distance);
-         b != false; ++b) {
-      EvalCtx<map_type, list_type> const new_ctx(
-          // fusion::make_map<label_a_type, label_b_type>(ai, *b),
-          map_type(ai, *b),
-          list_type(b.dx())); // fusion::make_list(b.dx()));
 
-      sum = accum.functor(sum, proto::eval(expr, new_ctx));
+    // use the cached verlet list if a and b are the same particle set, and the
+    // list covers the search distance (only for norms where the search region
+    // lies within the euclidean ball of radius max_distance)
+    const double_d *positions_b = get<position>(particlesb).data();
+    const double_d *position_a = &get<position>(ai);
+    if ((LNormNumber == 1 || LNormNumber == 2) &&
+        particlesb.get_verlet_list().is_valid_for(particlesb.size(),
+                                                  accum.max_distance) &&
+        std::less_equal<const double_d *>()(positions_b, position_a) &&
+        std::less<const double_d *>()(position_a,
+                                      positions_b + particlesb.size())) {
+      const size_t i = position_a - positions_b;
+      const double max_distance2 =
+          detail::distance_helper<LNormNumber>::get_value_to_accumulate(
+              accum.max_distance);
+      for (const int j : particlesb.get_verlet_list().get_neighbours(i)) {
+        const double_d dx = particlesb.correct_dx_for_periodicity(
+            positions_b[j] - get<position>(ai));
+        if (detail::distance_helper<LNormNumber>::norm2(dx) <= max_distance2) {
+          EvalCtx<map_type, list_type> const new_ctx(map_type(ai, particlesb[j]),
+                                                     list_type(dx));
+          sum = accum.functor(sum, proto::eval(expr, new_ctx));
+        }
+      }
+      return sum;
     }
+
+    for_each_neighbour<LNormNumber>(
+        particlesb.get_query(), get<position>(ai), accum.max_distance,
+        [&](const int j, const double_d &dx) {
+          EvalCtx<map_type, list_type> const new_ctx(
+              map_type(ai, particlesb[j]), list_type(dx));
+          sum = accum.functor(sum, proto::eval(expr, new_ctx));
+        });
     return sum;
   }
 
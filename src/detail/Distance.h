@@ -101,6 +101,24 @@ template <int LNormNumber> struct distance_helper {
     return ret;
   }
 
+  ///
+  /// @brief inverse of get_value_to_accumulate(), converts an accumulated norm
+  /// value back to a distance
+  ///
+  CUDA_HOST_DEVICE
+  static inline double get_distance_from_accumulate(const double accum) {
+    switch (LNormNumber) {
+    case -1:
+    case 0:
+    case 1:
+      return accum;
+    case 2:
+      return std::sqrt(accum);
+    default:
+      return std::pow(accum, 1.0 / LNormNumber);
+    }
+  }
+
   CUDA_HOST_DEVICE
   static inline double do_accumulate(const double accum, const double value) {
     switch (LNormNumber) {
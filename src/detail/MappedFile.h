@@ -0,0 +1,222 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Aboria.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef DETAIL_MAPPED_FILE_H_
+#define DETAIL_MAPPED_FILE_H_
+
+#include "Log.h"
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Aboria {
+namespace detail {
+
+///
+/// @brief a file mapped into memory with `mmap`, which is unmapped and closed
+/// on destruction
+///
+class mapped_file {
+public:
+  enum mode_type {
+    /// map an existing file for reading
+    read_only,
+
+    /// map an existing file for reading and writing. Writes are private to
+    /// this mapping, and pages are only copied when first written to
+    copy_on_write,
+
+    /// create (or truncate) a file of a given size and map it for reading and
+    /// writing. Writes go to the file
+    create,
+
+    /// create a temporary file of a given size in the directory given as the
+    /// filename, and map it for reading and writing. The file is removed
+    /// straight away, so it is deleted when it is closed
+    temporary
+  };
+
+  mapped_file() : m_data(nullptr), m_size(0), m_fd(-1), m_mode(read_only) {}
+
+  mapped_file(const std::string &filename, const mode_type mode,
+              const size_t size = 0)
+      : mapped_file() {
+    open(filename, mode, size);
+  }
+
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  mapped_file(mapped_file &&other)
+      : m_data(other.m_data), m_size(other.m_size), m_fd(other.m_fd),
+        m_mode(other.m_mode), m_filename(std::move(other.m_filename)) {
+    other.m_data = nullptr;
+    other.m_size = 0;
+    other.m_fd = -1;
+  }
+
+  mapped_file &operator=(mapped_file &&other) {
+    if (this != &other) {
+      close();
+      m_data = other.m_data;
+      m_size = other.m_size;
+      m_fd = other.m_fd;
+      m_mode = other.m_mode;
+      m_filename = std::move(other.m_filename);
+      other.m_data = nullptr;
+      other.m_size = 0;
+      other.m_fd = -1;
+    }
+    return *this;
+  }
+
+  ~mapped_file() { close(); }
+
+  ///
+  /// @brief map the file @p filename into memory
+  ///
+  /// @param size the size of the file in bytes, only used if @p mode is
+  /// `create` or `temporary`. Otherwise the whole file is mapped
+  ///
+  void open(const std::string &filename, const mode_type mode,
+            const size_t size = 0) {
+    close();
+    m_mode = mode;
+    if (mode == temporary) {
+      std::string path = filename + "/aboria_XXXXXX";
+      std::vector<char> path_template(path.begin(), path.end());
+      path_template.push_back(0);
+      m_fd = ::mkstemp(path_template.data());
+      m_filename = path_template.data();
+      CHECK(m_fd != -1, "could not create a temporary file in "
+                            << filename << ": " << std::strerror(errno));
+      ::unlink(m_filename.c_str());
+    } else {
+      m_filename = filename;
+      m_fd = ::open(filename.c_str(),
+                    mode == create ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY,
+                    0644);
+      CHECK(m_fd != -1,
+            "could not open " << filename << ": " << std::strerror(errno));
+    }
+    if (mode == create || mode == temporary) {
+      truncate(size);
+    } else {
+      struct stat file_stat;
+      CHECK(::fstat(m_fd, &file_stat) == 0,
+            "could not stat " << filename << ": " << std::strerror(errno));
+      m_size = file_stat.st_size;
+    }
+    map();
+  }
+
+  ///
+  /// @brief change the size of a `create` or `temporary` file to @p size
+  /// bytes and map it again. The contents are kept, up to the new size, but
+  /// data() may change
+  ///
+  void resize(const size_t size) {
+    CHECK(m_mode == create || m_mode == temporary,
+          "only created files can be resized");
+    unmap();
+    truncate(size);
+    map();
+  }
+
+  ///
+  /// @brief unmap and close the file. Writes to a `create` mapping are
+  /// flushed to the file by the OS
+  ///
+  void close() {
+    unmap();
+    if (m_fd != -1) {
+      ::close(m_fd);
+      m_fd = -1;
+    }
+    m_size = 0;
+  }
+
+  bool is_open() const { return m_fd != -1; }
+
+  char *data() { return m_data; }
+  const char *data() const { return m_data; }
+  size_t size() const { return m_size; }
+  const std::string &filename() const { return m_filename; }
+
+private:
+  void truncate(const size_t size) {
+    CHECK(::ftruncate(m_fd, size) == 0,
+          "could not resize " << m_filename << ": " << std::strerror(errno));
+    m_size = size;
+  }
+
+  void map() {
+    // mmap fails for zero length
+    if (m_size > 0) {
+      const int protection =
+          m_mode == read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+      const int flags = m_mode == copy_on_write ? MAP_PRIVATE : MAP_SHARED;
+      void *data = ::mmap(nullptr, m_size, protection, flags, m_fd, 0);
+      CHECK(data != MAP_FAILED,
+            "could not map " << m_filename << ": " << std::strerror(errno));
+      m_data = static_cast<char *>(data);
+    }
+  }
+
+  void unmap() {
+    if (m_data != nullptr) {
+      ::munmap(m_data, m_size);
+      m_data = nullptr;
+    }
+  }
+
+  char *m_data;
+  size_t m_size;
+  int m_fd;
+  mode_type m_mode;
+  std::string m_filename;
+};
+
+} // namespace detail
+} // namespace Aboria
+
+#endif /* DETAIL_MAPPED_FILE_H_ */
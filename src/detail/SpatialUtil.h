@@ -7,11 +7,25 @@
 #include "Log.h"
 #include "Vector.h"
 
+#include <algorithm>
 #include <bitset>  // std::bitset
+#include <cstdint>
 #include <iomanip> // std::setw
 #include <limits>
+#include <numeric>
+#include <vector>
 
 namespace Aboria {
+
+///
+/// @brief the order in which the buckets of a cell list are numbered.
+///
+/// For CellListOrdered this is also the order in which the particles are
+/// stored, so a space-filling curve (morton or hilbert) keeps particles in
+/// neighbouring buckets close together in memory
+///
+enum class bucket_ordering { lexicographic, morton, hilbert };
+
 namespace detail {
 
 CUDA_HOST_DEVICE
@@ -40,11 +54,18 @@ template <unsigned int D> struct bucket_index {
 
   unsigned_int_d m_size;
 
+  // optional maps between the lexicographic index and the index along a
+  // space-filling curve (see bucket_ordering), nullptr for lexicographic
+  const int *m_order;
+  const int *m_inverse_order;
+
   CUDA_HOST_DEVICE
-  bucket_index(){};
+  bucket_index() : m_order(nullptr), m_inverse_order(nullptr){};
 
   CUDA_HOST_DEVICE
-  bucket_index(const unsigned_int_d &size) : m_size(size) {}
+  bucket_index(const unsigned_int_d &size, const int *order = nullptr,
+               const int *inverse_order = nullptr)
+      : m_size(size), m_order(order), m_inverse_order(inverse_order) {}
 
   inline CUDA_HOST_DEVICE int collapse_index_vector(const int_d &vindex) const {
     int index = 0;
@@ -55,7 +76,7 @@ template <unsigned int D> struct bucket_index {
       }
       index += multiplier * vindex[i];
     }
-    return index;
+    return m_order ? m_order[index] : index;
   }
 
   inline CUDA_HOST_DEVICE unsigned int
@@ -68,12 +89,12 @@ template <unsigned int D> struct bucket_index {
       }
       index += multiplier * vindex[i];
     }
-    return index;
+    return m_order ? m_order[index] : index;
   }
 
   inline CUDA_HOST_DEVICE int_d reassemble_index_vector(const int index) const {
     int_d vindex;
-    int i = index;
+    int i = m_inverse_order ? m_inverse_order[index] : index;
     for (int d = D - 1; d >= 0; --d) {
       double div = (double)i / m_size[d];
       vindex[d] = std::round((div - std::floor(div)) * m_size[d]);
@@ -85,7 +106,7 @@ template <unsigned int D> struct bucket_index {
   inline CUDA_HOST_DEVICE unsigned_int_d
   reassemble_index_vector(const unsigned int index) const {
     unsigned_int_d vindex;
-    unsigned int i = index;
+    unsigned int i = m_inverse_order ? m_inverse_order[index] : index;
     for (int d = D - 1; d >= 0; --d) {
       double div = (double)i / m_size[d];
       vindex[d] = std::round((div - std::floor(div)) * m_size[d]);
@@ -95,6 +116,107 @@ template <unsigned int D> struct bucket_index {
   }
 };
 
+///
+/// @brief index of the bucket @p vindex along a morton (z-order) curve,
+/// found by interleaving the lowest @p bits bits of each coordinate
+///
+template <unsigned int D>
+uint64_t morton_key(const Vector<unsigned int, D> &vindex, const int bits) {
+  uint64_t key = 0;
+  for (int b = bits - 1; b >= 0; --b) {
+    for (size_t i = 0; i < D; ++i) {
+      key = (key << 1) | ((vindex[i] >> b) & 1u);
+    }
+  }
+  return key;
+}
+
+///
+/// @brief index of the bucket @p vindex along a hilbert curve
+///
+/// Uses the algorithm from Skilling, J. (2004). "Programming the Hilbert
+/// curve", AIP Conference Proceedings 707, which transforms the coordinates
+/// to the "transposed" hilbert index. Interleaving the bits of this gives the
+/// index along the curve
+///
+template <unsigned int D>
+uint64_t hilbert_key(Vector<unsigned int, D> x, const int bits) {
+  if (bits > 0) {
+    const unsigned int m = 1u << (bits - 1);
+    // inverse undo
+    for (unsigned int q = m; q > 1; q >>= 1) {
+      const unsigned int p = q - 1;
+      for (size_t i = 0; i < D; ++i) {
+        if (x[i] & q) {
+          x[0] ^= p;
+        } else {
+          const unsigned int t = (x[0] ^ x[i]) & p;
+          x[0] ^= t;
+          x[i] ^= t;
+        }
+      }
+    }
+    // gray encode
+    for (size_t i = 1; i < D; ++i) {
+      x[i] ^= x[i - 1];
+    }
+    unsigned int t = 0;
+    for (unsigned int q = m; q > 1; q >>= 1) {
+      if (x[D - 1] & q) {
+        t ^= q - 1;
+      }
+    }
+    for (size_t i = 0; i < D; ++i) {
+      x[i] ^= t;
+    }
+  }
+  return morton_key(x, bits);
+}
+
+///
+/// @brief calculates the maps between the lexicographic index of each bucket
+/// in a grid of @p size buckets and its index along the space-filling curve
+/// given by @p ordering.
+///
+/// The curve is defined over the smallest power-of-two grid that contains @p
+/// size, buckets outside @p size are skipped so that the resultant indices
+/// are contiguous
+///
+/// @param order on return, maps lexicographic index to curve index
+/// @param inverse_order on return, maps curve index to lexicographic index
+///
+template <unsigned int D>
+void bucket_ordering_maps(const Vector<unsigned int, D> &size,
+                          const bucket_ordering ordering,
+                          std::vector<int> &order,
+                          std::vector<int> &inverse_order) {
+  const bucket_index<D> lexicographic(size);
+  const size_t n = size.prod();
+  int bits = 0;
+  while ((1u << bits) < size.maxCoeff()) {
+    ++bits;
+  }
+  ASSERT(bits * D <= 64,
+         "too many buckets to use a space-filling curve ordering");
+
+  std::vector<uint64_t> keys(n);
+  for (size_t i = 0; i < n; ++i) {
+    const Vector<unsigned int, D> vindex =
+        lexicographic.reassemble_index_vector(static_cast<unsigned int>(i));
+    keys[i] = ordering == bucket_ordering::hilbert ? hilbert_key(vindex, bits)
+                                                   : morton_key(vindex, bits);
+  }
+
+  inverse_order.resize(n);
+  std::iota(inverse_order.begin(), inverse_order.end(), 0);
+  std::sort(inverse_order.begin(), inverse_order.end(),
+            [&keys](const int a, const int b) { return keys[a] < keys[b]; });
+  order.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    order[inverse_order[i]] = i;
+  }
+}
+
 template <unsigned int D> struct point_to_bucket_index {
   typedef Vector<double, D> double_d;
   typedef Vector<int, D> int_d;
@@ -111,8 +233,10 @@ template <unsigned int D> struct point_to_bucket_index {
   CUDA_HOST_DEVICE
   point_to_bucket_index(const unsigned_int_d &size,
                         const double_d &bucket_side_length,
-                        const bbox<D> &bounds)
-      : m_bucket_index(size), m_bucket_side_length(bucket_side_length),
+                        const bbox<D> &bounds, const int *order = nullptr,
+                        const int *inverse_order = nullptr)
+      : m_bucket_index(size, order, inverse_order),
+        m_bucket_side_length(bucket_side_length),
         m_inv_bucket_side_length(1.0 / bucket_side_length), m_bounds(bounds) {}
 
   CUDA_HOST_DEVICE
@@ -224,6 +348,268 @@ template <unsigned int D> struct point_to_bucket_index {
   */
 };
 
+///
+/// @brief periodic images of the particles near the faces of a cell list
+/// domain, sorted into a layer of halo cells around the domain
+///
+/// The halo is m_halo cells thick across each periodic face, enough to cover
+/// a distance of m_width. Every cell of the extended lattice that is within
+/// m_width of a point in the domain therefore holds either real particles
+/// (the interior cells, which are not stored here) or their periodic images
+/// (the halo cells), so a search around that point can loop over a box of
+/// cells without wrapping any indices or positions. Only the host
+/// (std::vector) storage is supported
+///
+template <unsigned int D> struct ghost_layer {
+  typedef Vector<double, D> double_d;
+  typedef Vector<int, D> int_d;
+  typedef Vector<bool, D> bool_d;
+
+  // largest search distance covered by the halo, 0 if disabled
+  double m_width;
+
+  // number of halo cells across each face, 0 for non-periodic dimensions
+  int_d m_halo;
+
+  // number of cells in the interior lattice
+  int_d m_size;
+
+  double_d m_bucket_side_length;
+  bbox<D> m_bounds;
+
+  // ghosts in halo cell c are m_positions/m_indices[m_cell_begin[c]] to
+  // [m_cell_begin[c+1]-1], where c is given by collapse_index_vector()
+  std::vector<int> m_cell_begin;
+  std::vector<double_d> m_positions;
+  std::vector<int> m_indices;
+
+  ghost_layer() : m_width(0) {}
+
+  ///
+  /// @return the index into m_cell_begin of the cell @p cell of the extended
+  /// lattice, whose indices start at -m_halo
+  ///
+  int collapse_index_vector(const int_d &cell) const {
+    int index = 0;
+    for (size_t d = 0; d < D; ++d) {
+      index = index * (m_size[d] + 2 * m_halo[d]) + cell[d] + m_halo[d];
+    }
+    return index;
+  }
+
+  ///
+  /// @brief replicates the particles with positions [@p positions, @p
+  /// positions + @p n) that are within the halo of a periodic face
+  ///
+  /// @param size the number of cells of the interior lattice
+  ///
+  void build(const double_d *positions, const size_t n, const bbox<D> &bounds,
+             const bool_d &periodic, const double_d &bucket_side_length,
+             const int_d &size) {
+    m_positions.clear();
+    m_indices.clear();
+    m_bounds = bounds;
+    m_bucket_side_length = bucket_side_length;
+    m_size = size;
+    int ncells = 1;
+    for (size_t d = 0; d < D; ++d) {
+      m_halo[d] = periodic[d]
+                      ? static_cast<int>(
+                            std::ceil(m_width / bucket_side_length[d]))
+                      : 0;
+      ncells *= m_size[d] + 2 * m_halo[d];
+    }
+
+    // only the nearest image in each direction is generated, which covers
+    // the halo as long as it is no wider than the domain
+    const double_d domain_width = bounds.bmax - bounds.bmin;
+    for (size_t d = 0; d < D; ++d) {
+      CHECK(!periodic[d] || m_width <= domain_width[d],
+            "ghost width " << m_width << " is larger than the periodic domain");
+    }
+    const double_d lower = bounds.bmin - m_halo * bucket_side_length;
+    const double_d upper = bounds.bmax + m_halo * bucket_side_length;
+    const double_d inv_side_length = 1.0 / bucket_side_length;
+
+    // the shifts of each particle are the combinations of the shifts that
+    // keep it within the extended lattice in each dimension
+    std::vector<int> cells;
+    for (size_t i = 0; i < n; ++i) {
+      const double_d &p = positions[i];
+      int_d nshifts;
+      int shifts[3][D];
+      int nimages = 1;
+      for (size_t d = 0; d < D; ++d) {
+        nshifts[d] = 0;
+        shifts[nshifts[d]++][d] = 0;
+        if (periodic[d]) {
+          if (p[d] + domain_width[d] < upper[d]) {
+            shifts[nshifts[d]++][d] = 1;
+          }
+          if (p[d] - domain_width[d] >= lower[d]) {
+            shifts[nshifts[d]++][d] = -1;
+          }
+        }
+        nimages *= nshifts[d];
+      }
+      // image 0 is the particle itself
+      for (int image = 1; image < nimages; ++image) {
+        int_d cell;
+        double_d ghost;
+        int remainder = image;
+        for (size_t d = 0; d < D; ++d) {
+          const int shift = shifts[remainder % nshifts[d]][d];
+          remainder /= nshifts[d];
+          ghost[d] = p[d] + shift * domain_width[d];
+          cell[d] = std::min(
+              std::max(static_cast<int>(std::floor(
+                           (ghost[d] - bounds.bmin[d]) * inv_side_length[d])),
+                       -m_halo[d]),
+              m_size[d] + m_halo[d] - 1);
+        }
+        cells.push_back(collapse_index_vector(cell));
+        m_positions.push_back(ghost);
+        m_indices.push_back(i);
+      }
+    }
+
+    // sort the ghosts by cell
+    const int nghosts = cells.size();
+    m_cell_begin.assign(ncells + 1, 0);
+    for (int k = 0; k < nghosts; ++k) {
+      ++m_cell_begin[cells[k] + 1];
+    }
+    std::partial_sum(m_cell_begin.begin(), m_cell_begin.end(),
+                     m_cell_begin.begin());
+    std::vector<int> next(m_cell_begin.begin(), m_cell_begin.end() - 1);
+    std::vector<double_d> sorted_positions(nghosts);
+    std::vector<int> sorted_indices(nghosts);
+    for (int k = 0; k < nghosts; ++k) {
+      const int index = next[cells[k]]++;
+      sorted_positions[index] = m_positions[k];
+      sorted_indices[index] = m_indices[k];
+    }
+    m_positions.swap(sorted_positions);
+    m_indices.swap(sorted_indices);
+  }
+};
+
+///
+/// @brief an open-addressing hash table that maps the 64-bit keys of the
+/// occupied cells of a lattice to a compact cell index.
+///
+/// Collisions are resolved by linear probing. The table has at least twice
+/// as many slots as entries (see number_of_slots()), so a lookup only touches
+/// a few contiguous slots. The storage for the slots is owned elsewhere, so
+/// that the table can be copied into a query object
+///
+struct cell_hash_table {
+  static constexpr uint64_t empty_key = std::numeric_limits<uint64_t>::max();
+
+  uint64_t *m_keys;
+  int *m_values;
+  uint64_t m_mask;
+
+  cell_hash_table() : m_keys(nullptr), m_values(nullptr), m_mask(0) {}
+
+  ///
+  /// @param keys the slot keys, which must all be set to empty_key
+  /// @param values the slot values
+  /// @param nslots the number of slots, must be a power of two
+  ///
+  cell_hash_table(uint64_t *keys, int *values, const size_t nslots)
+      : m_keys(keys), m_values(values), m_mask(nslots - 1) {}
+
+  ///
+  /// @return the number of slots needed to store @p n entries
+  ///
+  static size_t number_of_slots(const size_t n) {
+    size_t nslots = 2;
+    while (nslots < 2 * n) {
+      nslots *= 2;
+    }
+    return nslots;
+  }
+
+  ///
+  /// @brief mixes the bits of @p key (the splitmix64 finaliser), so that
+  /// neighbouring cells are spread across the table
+  ///
+  static uint64_t hash(uint64_t key) {
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ull;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebull;
+    key ^= key >> 31;
+    return key;
+  }
+
+  ///
+  /// @brief inserts @p key with the value @p value, unless it is already in
+  /// the table
+  ///
+  /// @return the value of @p key in the table
+  ///
+  int insert(const uint64_t key, const int value) {
+    uint64_t slot = hash(key) & m_mask;
+    while (m_keys[slot] != empty_key) {
+      if (m_keys[slot] == key) {
+        return m_values[slot];
+      }
+      slot = (slot + 1) & m_mask;
+    }
+    m_keys[slot] = key;
+    m_values[slot] = value;
+    return value;
+  }
+
+  ///
+  /// @return the value of @p key, or -1 if it is not in the table
+  ///
+  int find(const uint64_t key) const {
+    if (m_keys == nullptr) {
+      return -1;
+    }
+    uint64_t slot = hash(key) & m_mask;
+    while (m_keys[slot] != empty_key) {
+      if (m_keys[slot] == key) {
+        return m_values[slot];
+      }
+      slot = (slot + 1) & m_mask;
+    }
+    return -1;
+  }
+};
+
+///
+/// @return the lexicographic index of the cell @p cell in a lattice of @p
+/// size cells, as a 64-bit key so that the lattice can have more cells than
+/// fit in an int
+///
+template <unsigned int D>
+inline uint64_t collapse_cell_key(const Vector<int, D> &cell,
+                                  const Vector<int, D> &size) {
+  uint64_t key = 0;
+  for (size_t d = 0; d < D; ++d) {
+    key = key * size[d] + cell[d];
+  }
+  return key;
+}
+
+///
+/// @return the cell whose key (see collapse_cell_key()) is @p key
+///
+template <unsigned int D>
+inline Vector<int, D> reassemble_cell_key(uint64_t key,
+                                          const Vector<int, D> &size) {
+  Vector<int, D> cell;
+  for (int d = D - 1; d >= 0; --d) {
+    cell[d] = key % size[d];
+    key /= size[d];
+  }
+  return cell;
+}
+
 // Utility functions to encode leaves and children in single int
 inline CUDA_HOST_DEVICE bool is_empty(int id) { return id == (int)0xffffffff; }
 
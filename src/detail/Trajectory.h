@@ -0,0 +1,210 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Aboria.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TRAJECTORY_DETAIL_H_
+#define TRAJECTORY_DETAIL_H_
+
+#include "Log.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace Aboria {
+namespace detail {
+
+inline uint64_t zigzag_encode(const int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t zigzag_decode(const uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+class bit_writer {
+public:
+  explicit bit_writer(std::vector<uint8_t> &bytes)
+      : m_bytes(bytes), m_buffer(0), m_n_bits(0) {}
+
+  /// write the lowest @p n_bits bits of @p value (n_bits <= 57)
+  void write(const uint64_t value, const unsigned int n_bits) {
+    m_buffer |= (n_bits == 0 ? 0 : value & (~uint64_t(0) >> (64 - n_bits)))
+                << m_n_bits;
+    m_n_bits += n_bits;
+    while (m_n_bits >= 8) {
+      m_bytes.push_back(static_cast<uint8_t>(m_buffer));
+      m_buffer >>= 8;
+      m_n_bits -= 8;
+    }
+  }
+
+  void write64(const uint64_t value) {
+    write(value & 0xffffffff, 32);
+    write(value >> 32, 32);
+  }
+
+  void flush() {
+    if (m_n_bits > 0) {
+      m_bytes.push_back(static_cast<uint8_t>(m_buffer));
+      m_buffer = 0;
+      m_n_bits = 0;
+    }
+  }
+
+private:
+  std::vector<uint8_t> &m_bytes;
+  uint64_t m_buffer;
+  unsigned int m_n_bits;
+};
+
+class bit_reader {
+public:
+  bit_reader(const uint8_t *begin, const uint8_t *end)
+      : m_next(begin), m_end(end), m_buffer(0), m_n_bits(0) {}
+
+  /// read @p n_bits bits (n_bits <= 57)
+  uint64_t read(const unsigned int n_bits) {
+    while (m_n_bits < n_bits) {
+      CHECK(m_next != m_end, "read past the end of an encoded block");
+      m_buffer |= static_cast<uint64_t>(*m_next++) << m_n_bits;
+      m_n_bits += 8;
+    }
+    const uint64_t value =
+        n_bits == 0 ? 0 : m_buffer & (~uint64_t(0) >> (64 - n_bits));
+    m_buffer = n_bits == 64 ? 0 : m_buffer >> n_bits;
+    m_n_bits -= n_bits;
+    return value;
+  }
+
+  uint64_t read64() {
+    const uint64_t low = read(32);
+    return low | (read(32) << 32);
+  }
+
+private:
+  const uint8_t *m_next;
+  const uint8_t *m_end;
+  uint64_t m_buffer;
+  unsigned int m_n_bits;
+};
+
+///
+/// @brief Rice coding of unsigned integers. Each value is written as its
+/// quotient by 2^k in unary, followed by the k low bits. Values with
+/// quotients of rice_escape or more are written as rice_escape ones followed
+/// by the raw 64 bit value
+///
+static const unsigned int rice_escape = 32;
+
+///
+/// @brief the Rice parameter k that minimises the encoded size of values with
+/// mean @p mean
+///
+inline unsigned int rice_parameter(const double mean) {
+  unsigned int k = 0;
+  while (k < 56 && static_cast<double>(uint64_t(1) << (k + 1)) <= mean) {
+    ++k;
+  }
+  return k;
+}
+
+inline void rice_encode(bit_writer &writer, const uint64_t value,
+                        const unsigned int k) {
+  const uint64_t quotient = value >> k;
+  if (quotient >= rice_escape) {
+    writer.write(~uint64_t(0), rice_escape);
+    writer.write64(value);
+  } else {
+    // quotient ones then a zero
+    writer.write(~uint64_t(0), quotient);
+    writer.write(0, 1);
+    writer.write(value, k);
+  }
+}
+
+inline uint64_t rice_decode(bit_reader &reader, const unsigned int k) {
+  uint64_t quotient = 0;
+  while (quotient < rice_escape && reader.read(1) == 1) {
+    ++quotient;
+  }
+  if (quotient == rice_escape) {
+    return reader.read64();
+  }
+  return (quotient << k) | reader.read(k);
+}
+
+///
+/// @brief encodes the signed @p values, each with @p n_components
+/// components, to @p bytes. Each component is Rice coded after zigzag
+/// encoding, with a Rice parameter chosen for that component
+///
+inline void encode_block(const int64_t *values, const size_t n,
+                         const unsigned int n_components,
+                         std::vector<uint8_t> &bytes) {
+  bit_writer writer(bytes);
+  for (unsigned int c = 0; c < n_components; ++c) {
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+      sum += zigzag_encode(values[i * n_components + c]);
+    }
+    const unsigned int k = rice_parameter(n > 0 ? sum / n : 0);
+    writer.write(k, 6);
+    for (size_t i = 0; i < n; ++i) {
+      rice_encode(writer, zigzag_encode(values[i * n_components + c]), k);
+    }
+  }
+  writer.flush();
+}
+
+///
+/// @brief decodes @p n values of @p n_components components, encoded by
+/// encode_block(), from the bytes [@p begin, @p end) to @p values
+///
+inline void decode_block(const uint8_t *begin, const uint8_t *end,
+                         const size_t n, const unsigned int n_components,
+                         int64_t *values) {
+  bit_reader reader(begin, end);
+  for (unsigned int c = 0; c < n_components; ++c) {
+    const unsigned int k = reader.read(6);
+    for (size_t i = 0; i < n; ++i) {
+      values[i * n_components + c] = zigzag_decode(rice_decode(reader, k));
+    }
+  }
+}
+
+} // namespace detail
+} // namespace Aboria
+
+#endif /* TRAJECTORY_DETAIL_H_ */
@@ -0,0 +1,271 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Aboria.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef BENCHMARK_BUCKET_ORDERING_H_
+#define BENCHMARK_BUCKET_ORDERING_H_
+
+#include "Aboria.h"
+#include <chrono>
+#include <cxxtest/TestSuite.h>
+typedef std::chrono::system_clock Clock;
+#include <algorithm>
+#include <fstream> // std::ofstream
+#include <iomanip>
+#include <numeric>
+#include <random>
+
+using namespace Aboria;
+
+//
+// compares the lexicographic, morton and hilbert bucket orderings of
+// CellListOrdered, which determine the order the particles are stored in
+//
+class BenchmarkBucketOrdering : public CxxTest::TestSuite {
+public:
+  const char *ordering_name(const bucket_ordering ordering) {
+    switch (ordering) {
+    case bucket_ordering::morton:
+      return "morton";
+    case bucket_ordering::hilbert:
+      return "hilbert";
+    default:
+      return "lexicographic";
+    }
+  }
+
+  // linear spring molecular dynamics (see md.h), N particles at random
+  // positions in a periodic unit cube
+  template <template <typename> class SearchMethod>
+  double md_step(const size_t N, const bucket_ordering ordering,
+                 const size_t timesteps) {
+    ABORIA_VARIABLE(velocity, vdouble3, "velocity")
+    ABORIA_VARIABLE(force, vdouble3, "force")
+    typedef Particles<std::tuple<velocity, force>, 3, std::vector,
+                      SearchMethod>
+        particles_type;
+    typedef typename particles_type::position position;
+    particles_type particles(N);
+
+    // approx 10 neighbours per particle
+    const double diameter = std::cbrt(10.0 * 3.0 / (4.0 * N * 3.14159));
+    const double k = 1.0;
+    const double mass = 1.0;
+    const double dt = 0.01;
+
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> uniform(0, 1);
+    for (size_t i = 0; i < N; ++i) {
+      get<position>(particles)[i] =
+          vdouble3(uniform(gen), uniform(gen), uniform(gen));
+      get<velocity>(particles)[i] = vdouble3::Constant(0);
+    }
+    particles.set_bucket_ordering(ordering);
+    particles.init_neighbour_search(vdouble3::Constant(0),
+                                    vdouble3::Constant(1),
+                                    vbool3::Constant(true));
+
+    auto t0 = Clock::now();
+    for (size_t ts = 0; ts < timesteps; ++ts) {
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+      for (size_t i = 0; i < particles.size(); ++i) {
+        vdouble3 f = vdouble3::Constant(0);
+        for (auto j = euclidean_search(particles.get_query(),
+                                       get<position>(particles)[i], diameter);
+             j != false; ++j) {
+          const double r = j.dx().norm();
+          if (r != 0) {
+            f -= k * (diameter / r - 1.0) * j.dx();
+          }
+        }
+        get<force>(particles)[i] = f;
+      }
+      for (size_t i = 0; i < particles.size(); ++i) {
+        get<velocity>(particles)[i] += dt * get<force>(particles)[i] / mass;
+        get<position>(particles)[i] += dt * get<velocity>(particles)[i];
+      }
+      particles.update_positions();
+    }
+    auto t1 = Clock::now();
+    std::chrono::duration<double> time = t1 - t0;
+    std::cout << "md_step: N = " << N << " ordering = "
+              << ordering_name(ordering)
+              << " time per step = " << time.count() / timesteps << std::endl;
+    return time.count() / timesteps;
+  }
+
+  // SPH density summation and pressure force (see sph.h) on a jittered
+  // lattice of N particles, periodic in x and y
+  template <template <typename> class SearchMethod>
+  double sph_step(const size_t N, const bucket_ordering ordering,
+                  const size_t timesteps) {
+    ABORIA_VARIABLE(density, double, "density")
+    ABORIA_VARIABLE(velocity, vdouble3, "velocity")
+    ABORIA_VARIABLE(force, vdouble3, "force")
+    typedef Particles<std::tuple<density, velocity, force>, 3, std::vector,
+                      SearchMethod>
+        particles_type;
+    typedef typename particles_type::position position;
+
+    const size_t nx = std::cbrt(N);
+    const double psep = 1.0 / nx;
+    const double h = 1.5 * psep;
+    const double mass = std::pow(psep, 3);
+    const double wcon = 495.0 / (32.0 * 3.14159);
+    const double dt = 1e-4;
+    const double prb = 1.0;
+    particles_type particles(nx * nx * nx);
+
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> jitter(-0.1 * psep, 0.1 * psep);
+    std::vector<size_t> shuffled(particles.size());
+    std::iota(shuffled.begin(), shuffled.end(), 0);
+    std::shuffle(shuffled.begin(), shuffled.end(), gen);
+    for (size_t i = 0; i < nx; ++i) {
+      for (size_t j = 0; j < nx; ++j) {
+        for (size_t k = 0; k < nx; ++k) {
+          const size_t index = shuffled[(i * nx + j) * nx + k];
+          get<position>(particles)[index] =
+              vdouble3((i + 0.5) * psep + jitter(gen),
+                       (j + 0.5) * psep + jitter(gen), (k + 0.5) * psep);
+          get<velocity>(particles)[index] = vdouble3::Constant(0);
+        }
+      }
+    }
+    particles.set_bucket_ordering(ordering);
+    particles.init_neighbour_search(vdouble3::Constant(0),
+                                    vdouble3(1, 1, 1 + 2 * h),
+                                    vbool3(true, true, false));
+
+    auto W = [&](const double r) {
+      const double q = r / h;
+      return q <= 2.0 ? wcon / std::pow(h, 3) * std::pow(2.0 - q, 4) *
+                            (1.0 + 2.0 * q)
+                      : 0.0;
+    };
+    auto F = [&](const double r) {
+      const double q = r / h;
+      return (r == 0 || q > 2.0)
+                 ? 0.0
+                 : wcon / std::pow(h, 5) *
+                       (-4 * std::pow(2 - q, 3) * (1 + 2 * q) +
+                        2 * std::pow(2 - q, 4)) /
+                       q;
+    };
+
+    auto t0 = Clock::now();
+    for (size_t ts = 0; ts < timesteps; ++ts) {
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+      for (size_t i = 0; i < particles.size(); ++i) {
+        double rho = 0;
+        for (auto j = euclidean_search(particles.get_query(),
+                                       get<position>(particles)[i], 2 * h);
+             j != false; ++j) {
+          rho += mass * W(j.dx().norm());
+        }
+        get<density>(particles)[i] = rho;
+      }
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+      for (size_t i = 0; i < particles.size(); ++i) {
+        const double pdr2_i = prb / std::pow(get<density>(particles)[i], 2);
+        vdouble3 f = vdouble3::Constant(0);
+        for (auto j = euclidean_search(particles.get_query(),
+                                       get<position>(particles)[i], 2 * h);
+             j != false; ++j) {
+          const double pdr2_j = prb / std::pow(get<density>(*j), 2);
+          f += mass * (pdr2_i + pdr2_j) * F(j.dx().norm()) * j.dx();
+        }
+        get<force>(particles)[i] = f;
+      }
+      for (size_t i = 0; i < particles.size(); ++i) {
+        get<velocity>(particles)[i] += dt * get<force>(particles)[i];
+        get<position>(particles)[i] += dt * get<velocity>(particles)[i];
+      }
+      particles.update_positions();
+    }
+    auto t1 = Clock::now();
+    std::chrono::duration<double> time = t1 - t0;
+    std::cout << "sph_step: N = " << particles.size() << " ordering = "
+              << ordering_name(ordering)
+              << " time per step = " << time.count() / timesteps << std::endl;
+    return time.count() / timesteps;
+  }
+
+  template <typename Step>
+  void helper_bucket_ordering(const std::string &name, Step step) {
+    const bucket_ordering orderings[] = {bucket_ordering::lexicographic,
+                                         bucket_ordering::morton,
+                                         bucket_ordering::hilbert};
+    std::ofstream file;
+    file.open("benchmark_bucket_ordering_" + name + ".csv");
+    file << "#" << std::setw(14) << "N";
+    for (auto ordering : orderings) {
+      file << std::setw(15) << ordering_name(ordering);
+    }
+    file << std::endl;
+    for (double N = 1000; N < 2e6; N *= 4) {
+      const size_t timesteps = 1e6 / N + 2;
+      file << std::setw(15) << static_cast<size_t>(N);
+      for (auto ordering : orderings) {
+        file << std::setw(15) << step(N, ordering, timesteps);
+      }
+      file << std::endl;
+    }
+    file.close();
+  }
+
+  void test_md(void) {
+    helper_bucket_ordering(
+        "md", [&](const size_t N, const bucket_ordering ordering,
+                  const size_t timesteps) {
+          return md_step<CellListOrdered>(N, ordering, timesteps);
+        });
+  }
+
+  void test_sph(void) {
+    helper_bucket_ordering(
+        "sph", [&](const size_t N, const bucket_ordering ordering,
+                   const size_t timesteps) {
+          return sph_step<CellListOrdered>(N, ordering, timesteps);
+        });
+  }
+};
+
+#endif /* BENCHMARK_BUCKET_ORDERING_H_ */
@@ -559,6 +559,22 @@ public:
     helper_fast_methods<3, std::vector, HyperOctree>(N);
 #ifdef HAVE_GPERFTOOLS
     ProfilerStop();
+#endif
+  }
+
+  void test_fast_methods_LBVH(void) {
+    const size_t N = 1000;
+#ifdef HAVE_GPERFTOOLS
+    ProfilerStart("fmm_lbvh");
+#endif
+    std::cout << "LBVH: testing 1D..." << std::endl;
+    helper_fast_methods<1, std::vector, LBVH>(N);
+    std::cout << "LBVH: testing 2D..." << std::endl;
+    helper_fast_methods<2, std::vector, LBVH>(N);
+    std::cout << "LBVH: testing 3D..." << std::endl;
+    helper_fast_methods<3, std::vector, LBVH>(N);
+#ifdef HAVE_GPERFTOOLS
+    ProfilerStop();
 #endif
   }
 };
@@ -897,6 +897,18 @@ public:
     helper_fast_methods<3, std::vector, HyperOctree>(N);
     */
 
+#endif
+  }
+
+  void test_fast_methods_LBVH(void) {
+#ifdef HAVE_H2LIB
+    const size_t N = 1000;
+    std::cout << "LBVH: testing 1D..." << std::endl;
+    helper_fast_methods<1, std::vector, LBVH>(N);
+    std::cout << "LBVH: testing 2D..." << std::endl;
+    helper_fast_methods<2, std::vector, LBVH>(N);
+    std::cout << "LBVH: testing 3D..." << std::endl;
+    helper_fast_methods<3, std::vector, LBVH>(N);
 #endif
   }
 };
@@ -326,6 +326,14 @@ O(log(N)) time.
     helper_d_test_list_random<std::vector, CellListOrdered>();
   }
 
+  void test_std_vector_HashedCellList(void) {
+    helper_d_test_list_random<std::vector, HashedCellList>();
+  }
+
+  void test_std_vector_AdaptiveCellList(void) {
+    helper_d_test_list_random<std::vector, AdaptiveCellList>();
+  }
+
   void test_std_vector_Kdtree(void) {
 #if not defined(__CUDACC__)
     helper_d_test_list_random<std::vector, Kdtree>();
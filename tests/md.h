@@ -330,29 +330,115 @@ public:
   }
   //]
 
+  template <template <typename> class SearchMethod>
+  void helper_md_symmetric(void) {
+    const double PI = boost::math::constants::pi<double>();
+    ABORIA_VARIABLE(velocity, vdouble2, "velocity")
+    typedef Particles<std::tuple<velocity>, 2, std::vector, SearchMethod>
+        container_type;
+    typedef typename container_type::position position;
+    container_type particles;
+
+    const int timesteps = 300;
+    const double L = 31.0 / 1000.0;
+    const int N = 30;
+    const double diameter = 0.0022;
+    const double k = 1.0e01;
+    const double dens = 1160.0;
+    const double mass = PI * std::pow(0.5 * diameter, 2) * dens;
+    const double reduced_mass = 0.5 * mass;
+    const double dt = (1.0 / 50.0) * PI / std::sqrt(k / reduced_mass);
+    const double v0 = L / (timesteps * dt);
+
+    particles.init_neighbour_search(vdouble2(0, 0), vdouble2(L, L),
+                                    vbool2(true, true));
+
+    // place the particles with an overlap of up to half a diameter, so that
+    // the spring forces are non-zero
+    std::uniform_real_distribution<double> uni(0, 1);
+    for (int i = 0; i < N; ++i) {
+      typename container_type::value_type p;
+      const double theta = uni(generator) * 2 * PI;
+      get<velocity>(p) = v0 * vdouble2(cos(theta), sin(theta));
+      bool free_position = false;
+      while (free_position == false) {
+        get<position>(p) = vdouble2(uni(generator) * L, uni(generator) * L);
+        free_position = true;
+        for_each_neighbour(particles.get_query(), get<position>(p),
+                           0.5 * diameter,
+                           [&](const int, const vdouble2 &) {
+                             free_position = false;
+                           });
+      }
+      particles.push_back(p);
+    }
+
+    vdouble2 momentum = vdouble2::Zero();
+    for (size_t i = 0; i < particles.size(); ++i) {
+      momentum += mass * get<velocity>(particles)[i];
+    }
+
+    for (int t = 0; t < timesteps; t++) {
+      // the spring force is calculated once for each pair, and applied to
+      // both particles with opposite signs
+      std::vector<vdouble2> force(particles.size(), vdouble2::Zero());
+      accumulate_symmetric_pairs(
+          particles.get_query(), diameter, force,
+          [&](const int, const int, const vdouble2 &dx, vdouble2 &force_i,
+              vdouble2 &force_j) {
+            const double r = dx.norm();
+            if (r != 0) {
+              const vdouble2 f = -k * (diameter / r - 1.0) * dx;
+              force_i += f;
+              force_j -= f;
+            }
+          });
+      for (size_t i = 0; i < particles.size(); ++i) {
+        get<velocity>(particles)[i] += dt * force[i] / mass;
+      }
+      for (size_t i = 0; i < particles.size(); ++i) {
+        get<position>(particles)[i] += dt * get<velocity>(particles)[i];
+      }
+      particles.update_positions();
+    }
+
+    // equal and opposite forces conserve the total momentum
+    vdouble2 new_momentum = vdouble2::Zero();
+    for (size_t i = 0; i < particles.size(); ++i) {
+      new_momentum += mass * get<velocity>(particles)[i];
+    }
+    TS_ASSERT_DELTA((new_momentum - momentum).norm(), 0,
+                    1e-10 * N * mass * v0);
+  }
+
   void test_CellListOrdered() {
     helper_md_iterator<CellListOrdered>();
     helper_md_symbolic<CellListOrdered>();
+    helper_md_symmetric<CellListOrdered>();
   }
 
   void test_CellList() {
     helper_md_iterator<CellList>();
     helper_md_symbolic<CellList>();
+    helper_md_symmetric<CellList>();
   }
 
   void test_Kdtree() {
     helper_md_iterator<Kdtree>();
     helper_md_symbolic<Kdtree>();
+    helper_md_symmetric<Kdtree>();
   }
 
   void test_KdtreeNanoflann() {
     helper_md_iterator<KdtreeNanoflann>();
     helper_md_symbolic<KdtreeNanoflann>();
+    helper_md_symmetric<KdtreeNanoflann>();
   }
 
   void test_HyperOctree() {
     helper_md_iterator<HyperOctree>();
     helper_md_symbolic<HyperOctree>();
+    helper_md_symmetric<HyperOctree>();
   }
 };
 
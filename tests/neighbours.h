@@ -99,6 +99,23 @@ public:
     particles.init_neighbour_search(min, max, periodic);
     /*`
 
+    If the extent of the particles is not known in advance, calling
+    `particles.init_neighbour_search(padding)` instead sets a non-periodic
+    domain from the bounding box of the particles, enlarged on each side by
+    `padding` times its longest side. This domain grows whenever a particle
+    leaves it, and shrinks once it is more than twice as wide as needed, so no
+    particles are removed for being outside it.
+
+    The `n_particles_in_leaf` argument has a large effect on the speed of the
+    search, and its best value depends on the data structure, the dimension,
+    the search radius and the number of threads. Calling
+    `particles.init_neighbour_search_tuning(radius)` after initialising the
+    search times rebuilds and searches of `radius` on the particle set for a
+    range of values, and keeps the fastest. The choice is cached, and the
+    particle set is re-tuned once the number of particles doubles or halves.
+    [memberref Aboria::Particles::get_neighbour_search_tuner] gives the
+    chosen value and its timings.
+
     Once this is done you can begin using the neighbourhood search queries using
     the [funcref Aboria::euclidean_search] function. This returns an
     forward-only iterator providing const access to a sequence of particles that
@@ -159,6 +176,66 @@ public:
 
     /*`
 
+    If instead you need a fixed number of neighbours rather than all the
+    neighbours within a fixed distance, you can use the [funcref
+    Aboria::knn_search] function, which returns a `std::vector` containing the
+    `k` closest particles to a given point, sorted by increasing distance. Each
+    element of this vector is a [classref Aboria::knn_neighbour], holding an
+    iterator to the particle along with the `dx` vector and distance to the
+    query point. Like the other searches, the periodicity of the domain is taken
+    into account.
+
+    */
+
+    for (const auto &n : knn_search(particles.get_query(),
+                                    vdouble3::Constant(0), 5)) {
+      std::cout << "Found a particle with distance = " << n.distance
+                << " and id = " << get<id>(*n.particle) << "\n";
+    }
+
+    /*`
+
+    The search iterators above carry all the state of the search between
+    particles. If you only need to visit each neighbour once, the [funcref
+    Aboria::for_each_neighbour] function instead calls a function object for
+    every particle within the search distance, passing the index of the
+    particle and the `dx` vector. The loops over the particles are internal
+    to the function, so they can be inlined with your function object. To
+    visit every pair of particles within a given distance, use [funcref
+    Aboria::for_each_pair_within]. This processes the particles a bucket at a
+    time, in parallel if OpenMP is enabled, and [funcref
+    Aboria::batch_distance_search] does the same for an arbitrary set of
+    query points.
+
+    If the action of each pair is symmetric (e.g. equal and opposite forces),
+    [funcref Aboria::for_each_symmetric_pair] visits each unordered pair only
+    once, so only half the distances are calculated, and [funcref
+    Aboria::accumulate_symmetric_pairs] does this in parallel, adding the
+    contribution of each pair to both particles.
+
+    In a periodic domain, each of these searches normally also searches the
+    periodic images of the search point. For the cell lists, calling
+    `particles.get_neighbour_search().set_ghost_width(radius)` instead copies
+    the particles within `radius` of each periodic face into a layer of halo
+    cells around the domain at every update, so that searches of up to
+    `radius` from a point in the domain are a plain loop over the nearby
+    cells.
+
+    */
+
+    int count_neighbours = 0;
+    for_each_neighbour(particles.get_query(), vdouble3::Constant(0), radius,
+                       [&](const int j, const vdouble3 &dx) {
+                         //<-
+                         (void)j;
+                         (void)dx;
+                         //->
+                         ++count_neighbours;
+                       });
+    std::cout << "There are " << count_neighbours << " particles.\n";
+
+    /*`
+
     Once you start to alter the positions of the particles, you will need to
     update the neighbourhood data structure that is used for the search. This is
     done using the [memberref Aboria::Particles::update_positions] function.
@@ -274,6 +351,40 @@ public:
 
     /*`
 
+    Both of these cell lists store every cell in the domain, which can use a
+    lot of memory if the domain is very large or mostly empty (e.g. a thin bed
+    of particles at the bottom of a tall box). The [classref
+    Aboria::HashedCellList] data structure (with query object [classref
+    Aboria::HashedCellListQuery]) is otherwise the same as [classref
+    Aboria::CellListOrdered], but only stores the occupied cells, which it
+    finds using a hash table. It also chooses the cell size so that the
+    occupied cells hold roughly `n_particles_in_leaf` particles, rather than
+    averaging over the whole domain.
+
+    */
+
+    typedef Particles<std::tuple<>, 3, std::vector, HashedCellList>
+        particle_bs_hashed_t;
+    particle_bs_hashed_t particle_bs_hashed;
+
+    /*`
+
+    The cell size of all of these cell lists assumes that the particles are
+    spread uniformly, so for strongly clustered particles the cells in a
+    cluster can hold many times `n_particles_in_leaf` particles. The
+    [classref Aboria::AdaptiveCellList] data structure (with query object
+    [classref Aboria::AdaptiveCellListQuery]) divides each of these overfull
+    cells into a regular grid of smaller cells, so that the particle in a given
+    point can still be found in constant time.
+
+    */
+
+    typedef Particles<std::tuple<>, 3, std::vector, AdaptiveCellList>
+        particle_bs_adaptive_t;
+    particle_bs_adaptive_t particle_bs_adaptive;
+
+    /*`
+
 
     [endsect]
 
@@ -971,7 +1082,9 @@ public:
   void helper_d_random(const int N, const double r, const int neighbour_n,
                        const bool is_periodic,
                        const bool push_back_construction,
-                       const Transform &transform = Transform()) {
+                       const Transform &transform = Transform(),
+                       const bucket_ordering ordering =
+                           bucket_ordering::lexicographic) {
     typedef Particles<
         std::tuple<neighbours_brute, neighbours_aboria, bucket_neighbours_brute,
                    bucket_neighbours_aboria>,
@@ -990,8 +1103,11 @@ public:
               << "  N=" << N << " r=" << r << " neighbour_n=" << neighbour_n
               << " push_back_construction = " << push_back_construction
               << " transform = " << typeid(transform).name()
+              << " ordering = " << static_cast<int>(ordering)
               << "):" << std::endl;
 
+    particles.set_bucket_ordering(ordering);
+
     unsigned seed1 =
         std::chrono::system_clock::now().time_since_epoch().count();
     std::cout << "seed is " << seed1 << std::endl;
@@ -1326,6 +1442,77 @@ public:
     }
   }
 
+  template <template <typename, typename> class VectorType,
+            template <typename> class SearchMethod>
+  void helper_d_test_list_bucket_ordering() {
+    for (auto ordering : {bucket_ordering::morton, bucket_ordering::hilbert}) {
+      const IdentityTransform identity;
+      helper_d_random<1, VectorType, SearchMethod>(1000, 0.1, 10, true, false,
+                                                   identity, ordering);
+      helper_d_random<2, VectorType, SearchMethod>(1000, 0.2, 1, true, false,
+                                                   identity, ordering);
+      helper_d_random<2, VectorType, SearchMethod>(1000, 0.5, 10, false,
+                                                   false, identity, ordering);
+      helper_d_random<2, VectorType, SearchMethod>(100, 0.5, 10, false, true,
+                                                   identity, ordering);
+      helper_d_random<3, VectorType, SearchMethod>(1000, 0.2, 1, true, false,
+                                                   identity, ordering);
+      helper_d_random<3, VectorType, SearchMethod>(1000, 0.2, 10, false,
+                                                   false, identity, ordering);
+    }
+    helper_bucket_ordering_copy<SearchMethod>(bucket_ordering::morton);
+    helper_bucket_ordering_copy<SearchMethod>(bucket_ordering::hilbert);
+  }
+
+  template <template <typename> class SearchMethod>
+  void helper_bucket_ordering_copy(const bucket_ordering ordering) {
+    typedef Particles<std::tuple<>, 2, std::vector, SearchMethod>
+        particles_type;
+    typedef position_d<2> position;
+    typedef Vector<double, 2> double_d;
+    typedef Vector<bool, 2> bool_d;
+    const int N = 1000;
+    const double r = 0.1;
+
+    std::cout << "bucket ordering copy test (ordering = "
+              << static_cast<int>(ordering) << ")" << std::endl;
+
+    // the copy must not refer to the bucket ordering tables of the original
+    particles_type *original = new particles_type(N);
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> uniform(0, 1);
+    for (int i = 0; i < N; ++i) {
+      get<position>(*original)[i] = double_d(uniform(gen), uniform(gen));
+    }
+    original->set_bucket_ordering(ordering);
+    original->init_neighbour_search(double_d::Constant(0),
+                                    double_d::Constant(1),
+                                    bool_d::Constant(false));
+    particles_type particles(*original);
+    delete original;
+
+    for (int i = 0; i < N; ++i) {
+      get<position>(particles)[i] = double_d(uniform(gen), uniform(gen));
+    }
+    particles.update_positions();
+
+    for (size_t i = 0; i < particles.size(); ++i) {
+      const double_d &xi = get<position>(particles)[i];
+      int brute = 0;
+      for (size_t j = 0; j < particles.size(); ++j) {
+        if ((get<position>(particles)[j] - xi).squaredNorm() < r * r) {
+          ++brute;
+        }
+      }
+      int aboria = 0;
+      for (auto j = euclidean_search(particles.get_query(), xi, r); j != false;
+           ++j) {
+        ++aboria;
+      }
+      TS_ASSERT_EQUALS(aboria, brute);
+    }
+  }
+
   template <template <typename, typename> class VectorType,
             template <typename> class SearchMethod>
   void helper_d_test_list_random_fast_bucketsearch(bool test_push_back = true) {
@@ -1382,6 +1569,915 @@ public:
     }
   }
 
+  template <unsigned int D, template <typename, typename> class VectorType,
+            template <typename> class SearchMethod>
+  void helper_knn(const int N, const size_t k, const int neighbour_n,
+                  const bool is_periodic) {
+    typedef Particles<std::tuple<scalar>, D, VectorType, SearchMethod>
+        particles_type;
+    typedef position_d<D> position;
+    typedef Vector<double, D> double_d;
+    typedef Vector<int, D> int_d;
+    typedef Vector<bool, D> bool_d;
+    const double_d min = double_d::Constant(-1);
+    const double_d max = double_d::Constant(1);
+    const bool_d periodic = bool_d::Constant(is_periodic);
+
+    std::cout << "knn test (D=" << D << " periodic= " << is_periodic
+              << "  N=" << N << " k=" << k << " neighbour_n=" << neighbour_n
+              << "):" << std::endl;
+
+    particles_type particles(N);
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    for (int i = 0; i < N; ++i) {
+      for (size_t d = 0; d < D; ++d) {
+        get<position>(particles)[i][d] = uniform(gen);
+      }
+    }
+    particles.init_neighbour_search(min, max, periodic, neighbour_n);
+
+    for (int test = 0; test < 20; ++test) {
+      double_d centre;
+      for (size_t d = 0; d < D; ++d) {
+        centre[d] = 1.2 * uniform(gen);
+      }
+
+      // brute force: sorted distance to every particle
+      std::vector<double> brute;
+      for (size_t i = 0; i < particles.size(); ++i) {
+        const double_d &p = get<position>(particles)[i];
+        double dist = (p - centre).norm();
+        if (is_periodic) {
+          for (lattice_iterator<D> periodic_it(int_d::Constant(-1),
+                                               int_d::Constant(2));
+               periodic_it != false; ++periodic_it) {
+            dist = std::min(
+                dist, (p - centre + (*periodic_it) * (max - min)).norm());
+          }
+        }
+        brute.push_back(dist);
+      }
+      std::sort(brute.begin(), brute.end());
+
+      const auto result = knn_search(particles.get_query(), centre, k);
+      TS_ASSERT_EQUALS(result.size(), std::min(k, brute.size()));
+      for (size_t i = 0; i < result.size(); ++i) {
+        TS_ASSERT_DELTA(result[i].distance, brute[i], 1e-10);
+        TS_ASSERT_DELTA(result[i].dx.norm(), result[i].distance, 1e-10);
+        const double_d &p = get<position>(*result[i].particle);
+        if (!is_periodic) {
+          TS_ASSERT_DELTA((p - centre - result[i].dx).norm(), 0, 1e-10);
+        }
+      }
+    }
+  }
+
+  template <template <typename, typename> class VectorType,
+            template <typename> class SearchMethod>
+  void helper_knn_list() {
+    helper_knn<1, VectorType, SearchMethod>(1000, 10, 10, false);
+    helper_knn<1, VectorType, SearchMethod>(1000, 10, 10, true);
+    helper_knn<2, VectorType, SearchMethod>(1000, 1, 10, false);
+    helper_knn<2, VectorType, SearchMethod>(1000, 20, 10, false);
+    helper_knn<2, VectorType, SearchMethod>(1000, 20, 10, true);
+    helper_knn<2, VectorType, SearchMethod>(1000, 20, 1, true);
+    helper_knn<3, VectorType, SearchMethod>(1000, 15, 10, false);
+    helper_knn<3, VectorType, SearchMethod>(1000, 15, 10, true);
+    helper_knn<3, VectorType, SearchMethod>(10, 15, 10, false);
+  }
+
+  void test_std_vector_knn_search(void) {
+    helper_knn_list<std::vector, CellList>();
+    helper_knn_list<std::vector, CellListOrdered>();
+    helper_knn_list<std::vector, HashedCellList>();
+    helper_knn_list<std::vector, AdaptiveCellList>();
+    helper_knn_list<std::vector, Kdtree>();
+#if not defined(__CUDACC__)
+    helper_knn_list<std::vector, KdtreeNanoflann>();
+#endif
+    helper_knn_list<std::vector, HyperOctree>();
+    helper_knn_list<std::vector, LBVH>();
+  }
+
+  template <unsigned int D, int LNormNumber,
+            template <typename, typename> class VectorType,
+            template <typename> class SearchMethod>
+  void helper_block_scan(const int N, const double r, const int neighbour_n,
+                         const bool is_periodic) {
+    typedef Particles<std::tuple<scalar>, D, VectorType, SearchMethod>
+        particles_type;
+    typedef position_d<D> position;
+    typedef Vector<double, D> double_d;
+    typedef Vector<int, D> int_d;
+    typedef Vector<bool, D> bool_d;
+    const double_d min = double_d::Constant(-1);
+    const double_d max = double_d::Constant(1);
+    const bool_d periodic = bool_d::Constant(is_periodic);
+
+    std::cout << "block scan test (D=" << D << " L=" << LNormNumber
+              << " periodic= " << is_periodic << "  N=" << N << " r=" << r
+              << " neighbour_n=" << neighbour_n << "):" << std::endl;
+
+    particles_type particles(N);
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    for (int i = 0; i < N; ++i) {
+      for (size_t d = 0; d < D; ++d) {
+        get<position>(particles)[i][d] = uniform(gen);
+      }
+    }
+    particles.init_neighbour_search(min, max, periodic, neighbour_n);
+
+    for (int test = 0; test < 50; ++test) {
+      double_d centre;
+      for (size_t d = 0; d < D; ++d) {
+        centre[d] = uniform(gen);
+      }
+
+      // brute force: indices of particles within r, for any periodic image
+      std::vector<int> expected;
+      for (int i = 0; i < N; ++i) {
+        const double_d &p = get<position>(particles)[i];
+        bool within = false;
+        for (lattice_iterator<D> periodic_it(
+                 int_d::Constant(is_periodic ? -1 : 0),
+                 int_d::Constant(is_periodic ? 2 : 1));
+             periodic_it != false; ++periodic_it) {
+          const double_d dx = p - centre + (*periodic_it) * (max - min);
+          within |= detail::distance_helper<LNormNumber>::norm2(dx) <=
+                    detail::distance_helper<LNormNumber>::
+                        get_value_to_accumulate(r);
+        }
+        if (within) {
+          expected.push_back(i);
+        }
+      }
+
+      std::vector<int> found;
+      for (auto j = distance_search<LNormNumber>(particles.get_query(), centre,
+                                                 r);
+           j != false; ++j) {
+        const double_d &p = get<position>(*j);
+        found.push_back(&p - get<position>(particles).data());
+        if (!is_periodic) {
+          TS_ASSERT_DELTA((p - centre - j.dx()).norm(), 0, 1e-10);
+        }
+      }
+      std::sort(found.begin(), found.end());
+      TS_ASSERT(found == expected);
+    }
+  }
+
+  template <template <typename, typename> class VectorType,
+            template <typename> class SearchMethod>
+  void helper_block_scan_list() {
+    helper_block_scan<2, 2, VectorType, SearchMethod>(2000, 0.2, 30, false);
+    helper_block_scan<2, 2, VectorType, SearchMethod>(2000, 0.2, 30, true);
+    helper_block_scan<3, 1, VectorType, SearchMethod>(2000, 0.3, 30, false);
+    helper_block_scan<3, 1, VectorType, SearchMethod>(2000, 0.3, 30, true);
+    helper_block_scan<3, -1, VectorType, SearchMethod>(2000, 0.2, 30, false);
+    helper_block_scan<3, -1, VectorType, SearchMethod>(2000, 0.2, 30, true);
+    helper_block_scan<1, 2, VectorType, SearchMethod>(500, 0.05, 13, true);
+  }
+
+  void test_std_vector_block_scan(void) {
+    helper_block_scan_list<std::vector, CellList>();
+    helper_block_scan_list<std::vector, CellListOrdered>();
+    helper_block_scan_list<std::vector, Kdtree>();
+    helper_block_scan_list<std::vector, HyperOctree>();
+    helper_block_scan_list<std::vector, LBVH>();
+  }
+
+  template <unsigned int D, int LNormNumber,
+            template <typename, typename> class VectorType,
+            template <typename> class SearchMethod>
+  void helper_for_each_neighbour(const int N, const double r,
+                                 const int neighbour_n,
+                                 const bool is_periodic) {
+    typedef Particles<std::tuple<scalar>, D, VectorType, SearchMethod>
+        particles_type;
+    typedef position_d<D> position;
+    typedef Vector<double, D> double_d;
+    typedef Vector<bool, D> bool_d;
+    const double_d min = double_d::Constant(-1);
+    const double_d max = double_d::Constant(1);
+    const bool_d periodic = bool_d::Constant(is_periodic);
+
+    std::cout << "for_each_neighbour test (D=" << D << " L=" << LNormNumber
+              << " periodic= " << is_periodic << "  N=" << N << " r=" << r
+              << " neighbour_n=" << neighbour_n << "):" << std::endl;
+
+    particles_type particles(N);
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    for (int i = 0; i < N; ++i) {
+      for (size_t d = 0; d < D; ++d) {
+        get<position>(particles)[i][d] = uniform(gen);
+      }
+    }
+    particles.init_neighbour_search(min, max, periodic, neighbour_n);
+    const double_d *positions = get<position>(particles).data();
+
+    // for_each_neighbour finds the same particles as distance_search
+    for (int test = 0; test < 50; ++test) {
+      double_d centre;
+      for (size_t d = 0; d < D; ++d) {
+        centre[d] = 1.2 * uniform(gen);
+      }
+      std::vector<std::pair<int, double_d>> expected;
+      for (auto j = distance_search<LNormNumber>(particles.get_query(),
+                                                 centre, r);
+           j != false; ++j) {
+        expected.push_back(
+            std::make_pair(&get<position>(*j) - positions, j.dx()));
+      }
+      std::vector<std::pair<int, double_d>> found;
+      for_each_neighbour<LNormNumber>(
+          particles.get_query(), centre, r,
+          [&](const int j, const double_d &dx) {
+            found.push_back(std::make_pair(j, dx));
+          });
+      auto by_index = [](const std::pair<int, double_d> &a,
+                         const std::pair<int, double_d> &b) {
+        return a.first < b.first;
+      };
+      std::sort(expected.begin(), expected.end(), by_index);
+      std::sort(found.begin(), found.end(), by_index);
+      TS_ASSERT_EQUALS(found.size(), expected.size());
+      for (size_t k = 0; k < std::min(found.size(), expected.size()); ++k) {
+        TS_ASSERT_EQUALS(found[k].first, expected[k].first);
+        TS_ASSERT_DELTA((found[k].second - expected[k].second).norm(), 0,
+                        1e-10);
+      }
+    }
+
+    // for_each_pair_within visits each particle's neighbours once
+    std::vector<int> count(N, 0);
+    for_each_pair_within<LNormNumber>(
+        particles.get_query(), r,
+        [&](const int i, const int j, const double_d &dx) {
+          TS_ASSERT_LESS_THAN_EQUALS(
+              detail::distance_helper<LNormNumber>::norm2(dx),
+              detail::distance_helper<LNormNumber>::get_value_to_accumulate(
+                  r));
+          ++count[i];
+        });
+    for (int i = 0; i < N; ++i) {
+      TS_ASSERT_EQUALS(count[i],
+                       distance_search<LNormNumber>(particles.get_query(),
+                                                    positions[i], r)
+                           .distance_to_end());
+    }
+  }
+
+  template <template <typename, typename> class VectorType,
+            template <typename> class SearchMethod>
+  void helper_for_each_neighbour_list() {
+    helper_for_each_neighbour<1, 2, VectorType, SearchMethod>(500, 0.05, 10,
+                                                             true);
+    helper_for_each_neighbour<2, 2, VectorType, SearchMethod>(1000, 0.1, 10,
+                                                             false);
+    helper_for_each_neighbour<2, -1, VectorType, SearchMethod>(1000, 0.1, 10,
+                                                              true);
+    helper_for_each_neighbour<3, 1, VectorType, SearchMethod>(1000, 0.2, 10,
+                                                             false);
+    helper_for_each_neighbour<3, 2, VectorType, SearchMethod>(1000, 0.2, 10,
+                                                             true);
+  }
+
+  void test_std_vector_for_each_neighbour(void) {
+    helper_for_each_neighbour_list<std::vector, CellList>();
+    helper_for_each_neighbour_list<std::vector, CellListOrdered>();
+    helper_for_each_neighbour_list<std::vector, HashedCellList>();
+    helper_for_each_neighbour_list<std::vector, AdaptiveCellList>();
+    helper_for_each_neighbour_list<std::vector, Kdtree>();
+    helper_for_each_neighbour_list<std::vector, HyperOctree>();
+    helper_for_each_neighbour_list<std::vector, LBVH>();
+  }
+
+  template <unsigned int D, template <typename, typename> class VectorType,
+            template <typename> class SearchMethod>
+  void helper_neighbour_graph(const int N, const double r,
+                              const bool is_periodic) {
+    typedef Particles<std::tuple<scalar>, D, VectorType, SearchMethod>
+        particles_type;
+    typedef position_d<D> position;
+    typedef Vector<double, D> double_d;
+    typedef Vector<int, D> int_d;
+    typedef Vector<bool, D> bool_d;
+    const double_d min = double_d::Constant(-1);
+    const double_d max = double_d::Constant(1);
+    const bool_d periodic = bool_d::Constant(is_periodic);
+
+    std::cout << "neighbour graph test (D=" << D << " periodic= " << is_periodic
+              << "  N=" << N << " r=" << r << "):" << std::endl;
+
+    particles_type particles(N);
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    for (int i = 0; i < N; ++i) {
+      for (size_t d = 0; d < D; ++d) {
+        get<position>(particles)[i][d] = uniform(gen);
+      }
+    }
+    particles.init_neighbour_search(min, max, periodic);
+    const double_d *positions = get<position>(particles).data();
+
+    // brute force: smallest distance vector to each neighbour
+    std::vector<std::vector<std::pair<int, double_d>>> expected(N);
+    for (int i = 0; i < N; ++i) {
+      for (int j = 0; j < N; ++j) {
+        for (lattice_iterator<D> periodic_it(
+                 int_d::Constant(is_periodic ? -1 : 0),
+                 int_d::Constant(is_periodic ? 2 : 1));
+             periodic_it != false; ++periodic_it) {
+          const double_d dx =
+              positions[j] - positions[i] + (*periodic_it) * (max - min);
+          if (dx.norm() <= r) {
+            expected[i].push_back(std::make_pair(j, dx));
+          }
+        }
+      }
+    }
+
+    for (const bool symmetric : {false, true}) {
+      const auto graph = build_neighbour_graph(particles, r, symmetric, true);
+      TS_ASSERT_EQUALS(graph.size(), static_cast<size_t>(N));
+      TS_ASSERT_EQUALS(graph.dx.size(), graph.col_idx.size());
+      size_t npairs = 0;
+      for (int i = 0; i < N; ++i) {
+        std::vector<std::pair<int, double_d>> row;
+        for (int k = graph.row_ptr[i]; k < graph.row_ptr[i + 1]; ++k) {
+          row.push_back(std::make_pair(graph.col_idx[k], graph.dx[k]));
+        }
+        std::vector<std::pair<int, double_d>> expected_row;
+        for (const auto &pair : expected[i]) {
+          if (!symmetric || pair.first >= i) {
+            expected_row.push_back(pair);
+          }
+        }
+        npairs += expected_row.size();
+        auto by_index = [](const std::pair<int, double_d> &a,
+                           const std::pair<int, double_d> &b) {
+          return a.first < b.first;
+        };
+        std::sort(row.begin(), row.end(), by_index);
+        std::sort(expected_row.begin(), expected_row.end(), by_index);
+        TS_ASSERT_EQUALS(row.size(), expected_row.size());
+        for (size_t k = 0; k < std::min(row.size(), expected_row.size());
+             ++k) {
+          TS_ASSERT_EQUALS(row[k].first, expected_row[k].first);
+          TS_ASSERT_DELTA((row[k].second - expected_row[k].second).norm(), 0,
+                          1e-10);
+        }
+      }
+      TS_ASSERT_EQUALS(graph.number_of_pairs(), npairs);
+    }
+  }
+
+  template <template <typename, typename> class VectorType,
+            template <typename> class SearchMethod>
+  void helper_neighbour_graph_list() {
+    helper_neighbour_graph<1, VectorType, SearchMethod>(300, 0.05, true);
+    helper_neighbour_graph<2, VectorType, SearchMethod>(1000, 0.1, false);
+    helper_neighbour_graph<2, VectorType, SearchMethod>(1000, 0.1, true);
+    helper_neighbour_graph<3, VectorType, SearchMethod>(1000, 0.2, true);
+  }
+
+  void test_std_vector_neighbour_graph(void) {
+    helper_neighbour_graph_list<std::vector, CellList>();
+    helper_neighbour_graph_list<std::vector, CellListOrdered>();
+    helper_neighbour_graph_list<std::vector, HashedCellList>();
+    helper_neighbour_graph_list<std::vector, AdaptiveCellList>();
+    helper_neighbour_graph_list<std::vector, Kdtree>();
+    helper_neighbour_graph_list<std::vector, HyperOctree>();
+    helper_neighbour_graph_list<std::vector, LBVH>();
+  }
+
+  template <unsigned int D, template <typename, typename> class VectorType,
+            template <typename> class SearchMethod>
+  void helper_symmetric_pairs(const int N, const double r,
+                              const bool is_periodic) {
+    typedef Particles<std::tuple<scalar>, D, VectorType, SearchMethod>
+        particles_type;
+    typedef position_d<D> position;
+    typedef Vector<double, D> double_d;
+    typedef Vector<int, D> int_d;
+    typedef Vector<bool, D> bool_d;
+    const double_d min = double_d::Constant(-1);
+    const double_d max = double_d::Constant(1);
+    const bool_d periodic = bool_d::Constant(is_periodic);
+
+    std::cout << "symmetric pairs test (D=" << D << " periodic= " << is_periodic
+              << "  N=" << N << " r=" << r << "):" << std::endl;
+
+    particles_type particles(N);
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    for (int i = 0; i < N; ++i) {
+      for (size_t d = 0; d < D; ++d) {
+        get<position>(particles)[i][d] = uniform(gen);
+      }
+    }
+    particles.init_neighbour_search(min, max, periodic);
+    const double_d *positions = get<position>(particles).data();
+
+    // brute force: number of neighbours and sum of distance vectors
+    std::vector<int> expected_count(N, 0);
+    std::vector<double_d> expected_sum(N, double_d::Zero());
+    int expected_pairs = 0;
+    for (int i = 0; i < N; ++i) {
+      for (int j = 0; j < N; ++j) {
+        if (j == i) {
+          continue;
+        }
+        for (lattice_iterator<D> periodic_it(
+                 int_d::Constant(is_periodic ? -1 : 0),
+                 int_d::Constant(is_periodic ? 2 : 1));
+             periodic_it != false; ++periodic_it) {
+          const double_d dx =
+              positions[j] - positions[i] + (*periodic_it) * (max - min);
+          if (dx.norm() <= r) {
+            ++expected_count[i];
+            expected_sum[i] += dx;
+            if (j > i) {
+              ++expected_pairs;
+            }
+          }
+        }
+      }
+    }
+
+    // each pair is visited once, and both particles are updated
+    std::vector<int> count(N, 0);
+    std::vector<double_d> sum(N, double_d::Zero());
+    int pairs = 0;
+    for_each_symmetric_pair(particles.get_query(), r,
+                            [&](const int i, const int j, const double_d &dx) {
+                              TS_ASSERT_DIFFERS(i, j);
+                              TS_ASSERT_LESS_THAN_EQUALS(dx.norm(), r);
+                              ++pairs;
+                              ++count[i];
+                              ++count[j];
+                              sum[i] += dx;
+                              sum[j] -= dx;
+                            });
+    TS_ASSERT_EQUALS(pairs, expected_pairs);
+    for (int i = 0; i < N; ++i) {
+      TS_ASSERT_EQUALS(count[i], expected_count[i]);
+      TS_ASSERT_DELTA((sum[i] - expected_sum[i]).norm(), 0, 1e-10);
+    }
+
+    // the parallel sweep gives the same result
+    std::vector<int> parallel_count(N, 0);
+    accumulate_symmetric_pairs(
+        particles.get_query(), r, parallel_count,
+        [](const int, const int, const double_d &, int &count_i,
+           int &count_j) {
+          ++count_i;
+          ++count_j;
+        });
+    std::vector<double_d> parallel_sum(N, double_d::Zero());
+    accumulate_symmetric_pairs(
+        particles.get_query(), r, parallel_sum,
+        [](const int, const int, const double_d &dx, double_d &sum_i,
+           double_d &sum_j) {
+          sum_i += dx;
+          sum_j -= dx;
+        });
+    for (int i = 0; i < N; ++i) {
+      TS_ASSERT_EQUALS(parallel_count[i], expected_count[i]);
+      TS_ASSERT_DELTA((parallel_sum[i] - expected_sum[i]).norm(), 0, 1e-10);
+    }
+  }
+
+  template <template <typename, typename> class VectorType,
+            template <typename> class SearchMethod>
+  void helper_symmetric_pairs_list() {
+    helper_symmetric_pairs<1, VectorType, SearchMethod>(300, 0.05, true);
+    helper_symmetric_pairs<2, VectorType, SearchMethod>(1000, 0.1, false);
+    helper_symmetric_pairs<2, VectorType, SearchMethod>(1000, 0.1, true);
+    helper_symmetric_pairs<2, VectorType, SearchMethod>(200, 0.9, true);
+    helper_symmetric_pairs<3, VectorType, SearchMethod>(1000, 0.2, true);
+  }
+
+  void test_std_vector_symmetric_pairs(void) {
+    helper_symmetric_pairs_list<std::vector, CellList>();
+    helper_symmetric_pairs_list<std::vector, CellListOrdered>();
+    helper_symmetric_pairs_list<std::vector, HashedCellList>();
+    helper_symmetric_pairs_list<std::vector, AdaptiveCellList>();
+    helper_symmetric_pairs_list<std::vector, Kdtree>();
+    helper_symmetric_pairs_list<std::vector, HyperOctree>();
+    helper_symmetric_pairs_list<std::vector, LBVH>();
+  }
+
+  template <unsigned int D, template <typename, typename> class VectorType,
+            template <typename> class SearchMethod>
+  void helper_ghost_layer(const int N, const double r,
+                          const Vector<bool, D> &periodic) {
+    typedef Particles<std::tuple<scalar>, D, VectorType, SearchMethod>
+        particles_type;
+    typedef position_d<D> position;
+    typedef Vector<double, D> double_d;
+    const double_d min = double_d::Constant(-1);
+    const double_d max = double_d::Constant(1);
+
+    std::cout << "ghost layer test (D=" << D << " periodic= " << periodic
+              << "  N=" << N << " r=" << r << "):" << std::endl;
+
+    particles_type particles(N);
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    for (int i = 0; i < N; ++i) {
+      for (size_t d = 0; d < D; ++d) {
+        get<position>(particles)[i][d] = uniform(gen);
+      }
+    }
+    particles.init_neighbour_search(min, max, periodic);
+    particles.get_neighbour_search().set_ghost_width(r);
+    TS_ASSERT_EQUALS(particles.get_neighbour_search().get_ghost_width(), r);
+
+    // for_each_neighbour using the halo finds the same particles as
+    // distance_search, for search distances within and beyond the halo
+    auto check_searches = [&]() {
+      const double_d *positions = get<position>(particles).data();
+      for (int test = 0; test < 50; ++test) {
+        double_d centre;
+        for (size_t d = 0; d < D; ++d) {
+          centre[d] = 1.1 * uniform(gen);
+        }
+        for (const double radius : {0.5 * r, r, 1.5 * r}) {
+          std::vector<std::pair<int, double_d>> expected;
+          for (auto j = euclidean_search(particles.get_query(), centre, radius);
+               j != false; ++j) {
+            expected.push_back(
+                std::make_pair(&get<position>(*j) - positions, j.dx()));
+          }
+          std::vector<std::pair<int, double_d>> found;
+          for_each_neighbour(particles.get_query(), centre, radius,
+                             [&](const int j, const double_d &dx) {
+                               found.push_back(std::make_pair(j, dx));
+                             });
+          auto by_index_and_dx = [](const std::pair<int, double_d> &a,
+                                    const std::pair<int, double_d> &b) {
+            return a.first < b.first ||
+                   (a.first == b.first && a.second[0] < b.second[0]);
+          };
+          std::sort(expected.begin(), expected.end(), by_index_and_dx);
+          std::sort(found.begin(), found.end(), by_index_and_dx);
+          TS_ASSERT_EQUALS(found.size(), expected.size());
+          for (size_t k = 0; k < std::min(found.size(), expected.size());
+               ++k) {
+            TS_ASSERT_EQUALS(found[k].first, expected[k].first);
+            TS_ASSERT_DELTA((found[k].second - expected[k].second).norm(), 0,
+                            1e-10);
+          }
+        }
+      }
+    };
+    check_searches();
+
+    // the halo follows the particles as they move...
+    for (int i = 0; i < N; ++i) {
+      for (size_t d = 0; d < D; ++d) {
+        get<position>(particles)[i][d] += 0.3 * uniform(gen);
+      }
+    }
+    particles.update_positions();
+    check_searches();
+
+    // ... and as they are deleted
+    for (size_t i = 0; i < particles.size(); i += 7) {
+      get<alive>(particles)[i] = false;
+    }
+    particles.update_positions();
+    check_searches();
+
+    // disabling the halo goes back to searching the periodic images
+    particles.get_neighbour_search().set_ghost_width(0);
+    check_searches();
+  }
+
+  template <template <typename, typename> class VectorType,
+            template <typename> class SearchMethod>
+  void helper_ghost_layer_list() {
+    helper_ghost_layer<1, VectorType, SearchMethod>(
+        300, 0.05, vbool1::Constant(true));
+    helper_ghost_layer<2, VectorType, SearchMethod>(1000, 0.1,
+                                                    vbool2(true, true));
+    helper_ghost_layer<2, VectorType, SearchMethod>(1000, 0.3,
+                                                    vbool2(true, false));
+    helper_ghost_layer<3, VectorType, SearchMethod>(1000, 0.2,
+                                                    vbool3(true, true, true));
+  }
+
+  void test_std_vector_ghost_layer(void) {
+    helper_ghost_layer_list<std::vector, CellList>();
+    helper_ghost_layer_list<std::vector, CellListOrdered>();
+  }
+
+  template <unsigned int D, template <typename, typename> class VectorType,
+            template <typename> class SearchMethod>
+  void helper_batch_search(const int N, const double r, const int neighbour_n,
+                           const bool is_periodic) {
+    typedef Particles<std::tuple<scalar>, D, VectorType, SearchMethod>
+        particles_type;
+    typedef position_d<D> position;
+    typedef Vector<double, D> double_d;
+    typedef Vector<bool, D> bool_d;
+    const double_d min = double_d::Constant(-1);
+    const double_d max = double_d::Constant(1);
+    const bool_d periodic = bool_d::Constant(is_periodic);
+
+    std::cout << "batch search test (D=" << D << " periodic= " << is_periodic
+              << "  N=" << N << " r=" << r << " neighbour_n=" << neighbour_n
+              << "):" << std::endl;
+
+    particles_type particles(N);
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    for (int i = 0; i < N; ++i) {
+      for (size_t d = 0; d < D; ++d) {
+        get<position>(particles)[i][d] = uniform(gen);
+      }
+    }
+    particles.init_neighbour_search(min, max, periodic, neighbour_n);
+
+    // query points, some of which are outside the domain
+    std::vector<double_d> points(N / 2);
+    for (double_d &p : points) {
+      for (size_t d = 0; d < D; ++d) {
+        p[d] = 1.2 * uniform(gen);
+      }
+    }
+
+    // expected neighbours from a distance search around each point
+    std::vector<std::vector<int>> expected(points.size());
+    for (size_t i = 0; i < points.size(); ++i) {
+      for (auto j = euclidean_search(particles.get_query(), points[i], r);
+           j != false; ++j) {
+        expected[i].push_back(&get<position>(*j) -
+                              get<position>(particles).data());
+      }
+      std::sort(expected[i].begin(), expected[i].end());
+    }
+
+    // functor version
+    std::vector<std::vector<int>> found(points.size());
+    batch_distance_search(
+        particles.get_query(), points.begin(), points.end(), r,
+        [&](const int i, const int j, const double_d &dx) {
+          const double_d &pj = get<position>(particles)[j];
+          if (!is_periodic) {
+            TS_ASSERT_DELTA((pj - points[i] - dx).norm(), 0, 1e-10);
+          }
+          TS_ASSERT_LESS_THAN_EQUALS(dx.norm(), r);
+          found[i].push_back(j);
+        });
+    for (size_t i = 0; i < points.size(); ++i) {
+      std::sort(found[i].begin(), found[i].end());
+      TS_ASSERT(found[i] == expected[i]);
+    }
+
+    // CSR version
+    std::vector<size_t> row_offsets;
+    std::vector<size_t> col_indices;
+    batch_distance_search(particles.get_query(), points.begin(), points.end(),
+                          r, row_offsets, col_indices);
+    TS_ASSERT_EQUALS(row_offsets.size(), points.size() + 1);
+    TS_ASSERT_EQUALS(row_offsets.back(), col_indices.size());
+    for (size_t i = 0; i < points.size(); ++i) {
+      std::vector<int> row(col_indices.begin() + row_offsets[i],
+                           col_indices.begin() + row_offsets[i + 1]);
+      std::sort(row.begin(), row.end());
+      TS_ASSERT(row == expected[i]);
+    }
+  }
+
+  template <template <typename, typename> class VectorType,
+            template <typename> class SearchMethod>
+  void helper_batch_search_list() {
+    helper_batch_search<1, VectorType, SearchMethod>(1000, 0.05, 10, false);
+    helper_batch_search<1, VectorType, SearchMethod>(1000, 0.05, 10, true);
+    helper_batch_search<2, VectorType, SearchMethod>(1000, 0.1, 10, false);
+    helper_batch_search<2, VectorType, SearchMethod>(1000, 0.1, 10, true);
+    helper_batch_search<2, VectorType, SearchMethod>(1000, 0.3, 1, true);
+    helper_batch_search<3, VectorType, SearchMethod>(1000, 0.2, 10, false);
+    helper_batch_search<3, VectorType, SearchMethod>(1000, 0.2, 10, true);
+    helper_batch_search<3, VectorType, SearchMethod>(10, 0.5, 10, false);
+    helper_batch_search<3, VectorType, SearchMethod>(40000, 0.05, 10, true);
+  }
+
+  void test_std_vector_batch_search(void) {
+    helper_batch_search_list<std::vector, CellList>();
+    helper_batch_search_list<std::vector, CellListOrdered>();
+    helper_batch_search_list<std::vector, HashedCellList>();
+    helper_batch_search_list<std::vector, AdaptiveCellList>();
+    helper_batch_search_list<std::vector, Kdtree>();
+#if not defined(__CUDACC__)
+    helper_batch_search_list<std::vector, KdtreeNanoflann>();
+#endif
+    helper_batch_search_list<std::vector, HyperOctree>();
+    helper_batch_search_list<std::vector, LBVH>();
+  }
+
+  template <template <typename> class SearchMethod> void helper_auto_domain() {
+    typedef Particles<std::tuple<>, 2, std::vector, SearchMethod>
+        particles_type;
+    typedef position_d<2> position;
+    typedef Vector<double, 2> double_d;
+    const int N = 1000;
+    const double padding = 0.2;
+    const double growth = 1.2;
+    const int nsteps = 20;
+
+    std::cout << "auto domain test (search method = "
+              << typeid(SearchMethod<typename particles_type::traits_type>)
+                     .name()
+              << ")" << std::endl;
+
+    particles_type particles(N);
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> uniform(-0.5, 0.5);
+    for (int i = 0; i < N; ++i) {
+      get<position>(particles)[i] = double_d(uniform(gen), uniform(gen));
+    }
+    particles.init_neighbour_search(padding);
+
+    double scale = 1;
+    auto check = [&]() {
+      // no particles are lost, and the domain covers them all without being
+      // much larger than needed
+      TS_ASSERT_EQUALS(particles.size(), static_cast<size_t>(N));
+      bbox<2> bounds;
+      for (size_t i = 0; i < particles.size(); ++i) {
+        bounds = bounds + bbox<2>(get<position>(particles)[i]);
+      }
+      const double_d width = bounds.bmax - bounds.bmin;
+      const double_d domain_width = particles.get_max() - particles.get_min();
+      TS_ASSERT((bounds.bmin >= particles.get_min()).all());
+      TS_ASSERT((bounds.bmax < particles.get_max()).all());
+      TS_ASSERT((domain_width <= 2 * (1 + 2 * padding) * width).all());
+
+      // compare neighbour search against brute force
+      const double r = 0.1 * scale;
+      for (size_t i = 0; i < particles.size(); i += 7) {
+        const double_d &xi = get<position>(particles)[i];
+        int brute = 0;
+        for (size_t j = 0; j < particles.size(); ++j) {
+          if ((get<position>(particles)[j] - xi).squaredNorm() < r * r) {
+            ++brute;
+          }
+        }
+        int aboria = 0;
+        for (auto j = euclidean_search(particles.get_query(), xi, r);
+             j != false; ++j) {
+          ++aboria;
+        }
+        TS_ASSERT_EQUALS(aboria, brute);
+      }
+    };
+    check();
+
+    // expand and then contract the particles, the domain is only reset every
+    // few steps
+    for (const double factor : {growth, 1.0 / growth}) {
+      int nresets = 0;
+      for (int step = 0; step < nsteps; ++step) {
+        const double_d old_max = particles.get_max();
+        for (size_t i = 0; i < particles.size(); ++i) {
+          get<position>(particles)[i] *= factor;
+        }
+        scale *= factor;
+        particles.update_positions();
+        if ((particles.get_max() != old_max).any()) {
+          ++nresets;
+        }
+        check();
+      }
+      std::cout << "domain reset " << nresets << " times in " << nsteps
+                << " steps" << std::endl;
+      TS_ASSERT_LESS_THAN(0, nresets);
+      TS_ASSERT_LESS_THAN(nresets, nsteps);
+    }
+  }
+
+  void test_std_vector_auto_domain(void) {
+    helper_auto_domain<CellList>();
+    helper_auto_domain<CellListOrdered>();
+    helper_auto_domain<HashedCellList>();
+    helper_auto_domain<AdaptiveCellList>();
+    helper_auto_domain<Kdtree>();
+#if not defined(__CUDACC__)
+    helper_auto_domain<KdtreeNanoflann>();
+#endif
+    helper_auto_domain<HyperOctree>();
+    helper_auto_domain<LBVH>();
+  }
+
+  template <template <typename> class SearchMethod>
+  void helper_neighbour_search_tuning() {
+    typedef Particles<std::tuple<>, 2, std::vector, SearchMethod>
+        particles_type;
+    typedef position_d<2> position;
+    typedef Vector<double, 2> double_d;
+    typedef Vector<bool, 2> bool_d;
+    const int N = 4000;
+    const double r = 0.05;
+    const std::vector<double> candidates = {2, 8, 32};
+
+    std::cout << "neighbour search tuning test (search method = "
+              << typeid(SearchMethod<typename particles_type::traits_type>)
+                     .name()
+              << ")" << std::endl;
+
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> uniform(0, 1);
+    auto set_positions = [&](particles_type &particles) {
+      for (size_t i = 0; i < particles.size(); ++i) {
+        get<position>(particles)[i] = double_d(uniform(gen), uniform(gen));
+      }
+    };
+    auto check = [&](const particles_type &particles) {
+      const neighbour_search_tuning &tuning =
+          particles.get_neighbour_search_tuner().get_tuning();
+      std::cout << "n_particles_in_leaf = " << tuning.n_particles_in_leaf
+                << " rebuild time = " << tuning.rebuild_time
+                << " search time = " << tuning.search_time
+                << " cached = " << tuning.cached << std::endl;
+      TS_ASSERT(std::find(candidates.begin(), candidates.end(),
+                          tuning.n_particles_in_leaf) != candidates.end());
+      TS_ASSERT_EQUALS(particles.get_neighbour_search().get_max_bucket_size(),
+                       tuning.n_particles_in_leaf);
+
+      // compare neighbour search against brute force
+      for (size_t i = 0; i < particles.size(); i += 37) {
+        const double_d &xi = get<position>(particles)[i];
+        int brute = 0;
+        for (size_t j = 0; j < particles.size(); ++j) {
+          if ((get<position>(particles)[j] - xi).squaredNorm() < r * r) {
+            ++brute;
+          }
+        }
+        int aboria = 0;
+        for (auto j = euclidean_search(particles.get_query(), xi, r);
+             j != false; ++j) {
+          ++aboria;
+        }
+        TS_ASSERT_EQUALS(aboria, brute);
+      }
+    };
+
+    particles_type particles(N);
+    set_positions(particles);
+    particles.init_neighbour_search(double_d::Constant(0),
+                                    double_d::Constant(1),
+                                    bool_d::Constant(false));
+    particles.init_neighbour_search_tuning(r, 200, candidates);
+    TS_ASSERT_EQUALS(particles.get_neighbour_search_tuner().number_of_tunings(),
+                     1u);
+    TS_ASSERT(!particles.get_neighbour_search_tuner().get_tuning().cached);
+    TS_ASSERT_EQUALS(particles.get_neighbour_search_tuner().get_tuning().n,
+                     static_cast<size_t>(N));
+    check(particles);
+
+    // a similar particle set uses the cached setting
+    particles_type other(N + N / 2);
+    set_positions(other);
+    other.init_neighbour_search(double_d::Constant(0), double_d::Constant(1),
+                                bool_d::Constant(false));
+    other.init_neighbour_search_tuning(r, 200, candidates);
+    TS_ASSERT_EQUALS(other.get_neighbour_search_tuner().number_of_tunings(),
+                     0u);
+    TS_ASSERT(other.get_neighbour_search_tuner().get_tuning().cached);
+    check(other);
+
+    // moving the particles does not re-tune, but increasing their number does
+    set_positions(particles);
+    particles.update_positions();
+    TS_ASSERT_EQUALS(particles.get_neighbour_search_tuner().number_of_tunings(),
+                     1u);
+    particles.resize(3 * N);
+    set_positions(particles);
+    particles.update_positions();
+    TS_ASSERT_EQUALS(particles.get_neighbour_search_tuner().number_of_tunings(),
+                     2u);
+    TS_ASSERT_EQUALS(particles.get_neighbour_search_tuner().get_tuning().n,
+                     static_cast<size_t>(3 * N));
+    check(particles);
+  }
+
+  void test_std_vector_neighbour_search_tuning(void) {
+    helper_neighbour_search_tuning<CellList>();
+    helper_neighbour_search_tuning<CellListOrdered>();
+    helper_neighbour_search_tuning<HashedCellList>();
+    helper_neighbour_search_tuning<AdaptiveCellList>();
+    helper_neighbour_search_tuning<Kdtree>();
+    helper_neighbour_search_tuning<HyperOctree>();
+    helper_neighbour_search_tuning<LBVH>();
+  }
+
   void test_std_vector_CellList(void) {
     helper_d_test_list_random<std::vector, CellList>();
     helper_single_particle<std::vector, CellList>();
@@ -1397,6 +2493,259 @@ public:
     helper_d_test_list_regular<std::vector, CellListOrdered>();
   }
 
+  void test_mapped_vector_CellListOrdered(void) {
+    // store anything over 4kB in temporary files, and sort in partitions of
+    // 4kB
+    const size_t threshold = get_out_of_core_threshold();
+    set_out_of_core_threshold(4096);
+
+    mapped_vector<double> values;
+    for (int i = 0; i < 10000; ++i) {
+      values.push_back(i);
+    }
+    TS_ASSERT(values.is_mapped());
+    TS_ASSERT_EQUALS(values.size(), 10000);
+    values.erase(values.begin(), values.begin() + 5000);
+    values.insert(values.begin(), -1.0);
+    TS_ASSERT_EQUALS(values.size(), 5001);
+    TS_ASSERT_EQUALS(values[0], -1.0);
+    for (int i = 1; i < 5001; ++i) {
+      TS_ASSERT_EQUALS(values[i], i + 4999);
+    }
+    mapped_vector<double> copy(values);
+    TS_ASSERT(copy.is_mapped());
+    TS_ASSERT(copy == values);
+    mapped_vector<double> small(10, 1.0);
+    TS_ASSERT(!small.is_mapped());
+
+    helper_d_test_list_random<mapped_vector, CellListOrdered>();
+    helper_single_particle<mapped_vector, CellListOrdered>();
+    helper_two_particles<mapped_vector, CellListOrdered>();
+    helper_d_test_list_regular<mapped_vector, CellListOrdered>();
+
+    set_out_of_core_threshold(threshold);
+  }
+
+  template <unsigned int D> void helper_hilbert_curve_adjacency(const int n) {
+    typedef Vector<unsigned int, D> unsigned_int_d;
+    const unsigned_int_d size = unsigned_int_d::Constant(n);
+    const detail::bucket_index<D> lexicographic(size);
+    std::vector<int> order, inverse_order;
+    detail::bucket_ordering_maps(size, bucket_ordering::hilbert, order,
+                                 inverse_order);
+    TS_ASSERT_EQUALS(order.size(), size.prod());
+    for (size_t i = 0; i < order.size(); ++i) {
+      TS_ASSERT_EQUALS(order[inverse_order[i]], static_cast<int>(i));
+    }
+    // consecutive buckets along a hilbert curve share a face
+    for (size_t i = 1; i < inverse_order.size(); ++i) {
+      const unsigned_int_d a =
+          lexicographic.reassemble_index_vector(inverse_order[i - 1]);
+      const unsigned_int_d b =
+          lexicographic.reassemble_index_vector(inverse_order[i]);
+      int dist = 0;
+      for (size_t d = 0; d < D; ++d) {
+        dist += std::abs(static_cast<int>(a[d]) - static_cast<int>(b[d]));
+      }
+      TS_ASSERT_EQUALS(dist, 1);
+    }
+  }
+
+  void test_std_vector_bucket_ordering(void) {
+    helper_hilbert_curve_adjacency<2>(8);
+    helper_hilbert_curve_adjacency<3>(4);
+    helper_d_test_list_bucket_ordering<std::vector, CellList>();
+    helper_d_test_list_bucket_ordering<std::vector, CellListOrdered>();
+    helper_d_test_list_bucket_ordering<std::vector, HashedCellList>();
+  }
+
+  template <typename Traits>
+  void set_incremental_threshold(CellListOrdered<Traits> &search,
+                                 const double threshold) {
+    search.set_incremental_update_threshold(threshold);
+  }
+
+  template <typename Traits>
+  void set_incremental_threshold(Kdtree<Traits> &search,
+                                 const double threshold) {
+    search.set_refit_imbalance_factor(threshold);
+  }
+
+  template <unsigned int D, template <typename> class SearchMethod>
+  void helper_incremental_update(const int N, const double threshold) {
+    typedef Particles<std::tuple<>, D, std::vector, SearchMethod>
+        particles_type;
+    typedef position_d<D> position;
+    typedef Vector<double, D> double_d;
+    typedef Vector<bool, D> bool_d;
+    const double_d min = double_d::Constant(-1);
+    const double_d max = double_d::Constant(1);
+    const double r = 0.2;
+
+    std::cout << "incremental update test (D=" << D << " N=" << N
+              << " threshold=" << threshold << ")" << std::endl;
+
+    particles_type particles(N);
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    for (int i = 0; i < N; ++i) {
+      for (size_t d = 0; d < D; ++d) {
+        get<position>(particles)[i][d] = 0.99 * uniform(gen);
+      }
+    }
+    particles.init_neighbour_search(min, max, bool_d::Constant(false), 5);
+    particles.init_id_search();
+    set_incremental_threshold(particles.get_neighbour_search(), threshold);
+
+    // no particles moved, so no reorder should be needed
+    particles.update_positions();
+    if (threshold > 0) {
+      TS_ASSERT(!particles.get_neighbour_search().reorder_needed());
+    }
+
+    for (int step = 0; step < 20; ++step) {
+      // move a few particles a long way and the rest a small distance
+      for (int i = 0; i < N; ++i) {
+        const double dx = (i % 50 == step) ? 0.5 : 0.01;
+        for (size_t d = 0; d < D; ++d) {
+          double &x = get<position>(particles)[i][d];
+          x += dx * uniform(gen);
+          x = std::max(-0.99, std::min(0.99, x));
+        }
+      }
+      particles.update_positions();
+      TS_ASSERT_EQUALS(particles.size(), N);
+
+      // every particle must be stored in the bucket containing it
+      const auto &query = particles.get_query();
+      size_t count = 0;
+      for (auto bucket = query.get_subtree(); bucket != false; ++bucket) {
+        const size_t bucket_index = query.get_bucket_index(*bucket);
+        for (auto p = query.get_bucket_particles(*bucket); p != false; ++p) {
+          if (!query.is_tree()) {
+            TS_ASSERT_EQUALS(query.get_bucket_index(
+                                 *query.get_bucket(get<position>(*p))),
+                             bucket_index);
+          }
+          ++count;
+        }
+      }
+      TS_ASSERT_EQUALS(count, particles.size());
+
+      // compare neighbour search against brute force
+      for (size_t i = 0; i < particles.size(); i += 7) {
+        const double_d &xi = get<position>(particles)[i];
+        int brute = 0;
+        for (size_t j = 0; j < particles.size(); ++j) {
+          if ((get<position>(particles)[j] - xi).squaredNorm() < r * r) {
+            ++brute;
+          }
+        }
+        int aboria = 0;
+        for (auto j = euclidean_search(query, xi, r); j != false; ++j) {
+          ++aboria;
+        }
+        TS_ASSERT_EQUALS(aboria, brute);
+      }
+
+      // the id map must follow the particles
+      for (size_t i = 0; i < particles.size(); i += 37) {
+        auto p = particles.get_query().find(get<id>(particles)[i]);
+        TS_ASSERT_EQUALS(*get<id>(p), get<id>(particles)[i]);
+        TS_ASSERT((*get<position>(p) == get<position>(particles)[i]).all());
+      }
+    }
+  }
+
+  void test_std_vector_CellListOrdered_incremental(void) {
+    helper_incremental_update<2, CellListOrdered>(1000, 0.1);
+    helper_incremental_update<3, CellListOrdered>(1000, 0.1);
+    helper_incremental_update<2, CellListOrdered>(1000, 1.0);
+    helper_incremental_update<2, CellListOrdered>(1000, 0.0);
+  }
+
+  template <unsigned int D>
+  void helper_kdtree_build(const int N, const int n_in_leaf,
+                           const double fraction_duplicate) {
+    typedef Particles<std::tuple<>, D, std::vector, Kdtree> particles_type;
+    typedef position_d<D> position;
+    typedef Vector<double, D> double_d;
+    typedef Vector<bool, D> bool_d;
+    const double r = 0.3;
+
+    std::cout << "kdtree build test (D=" << D << " N=" << N
+              << " n_in_leaf=" << n_in_leaf
+              << " fraction_duplicate=" << fraction_duplicate << ")"
+              << std::endl;
+
+    particles_type particles(N);
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    for (int i = 0; i < N; ++i) {
+      for (size_t d = 0; d < D; ++d) {
+        get<position>(particles)[i][d] =
+            i < fraction_duplicate * N ? 0.5 : uniform(gen);
+      }
+    }
+    particles.init_neighbour_search(double_d::Constant(-1),
+                                    double_d::Constant(1),
+                                    bool_d::Constant(false), n_in_leaf);
+
+    // leafs cover all particles, and only duplicates can overfill a leaf
+    const auto &query = particles.get_query();
+    size_t count = 0;
+    for (auto bucket = query.get_subtree(); bucket != false; ++bucket) {
+      size_t bucket_count = 0;
+      bool all_duplicates = true;
+      for (auto p = query.get_bucket_particles(*bucket); p != false; ++p) {
+        all_duplicates &= (get<position>(*p) == double_d::Constant(0.5)).all();
+        ++bucket_count;
+      }
+      TS_ASSERT(bucket_count <= static_cast<size_t>(n_in_leaf) ||
+                all_duplicates);
+      count += bucket_count;
+    }
+    TS_ASSERT_EQUALS(count, particles.size());
+
+    // median splits give a balanced tree
+    if (fraction_duplicate == 0 && N > n_in_leaf) {
+      TS_ASSERT_LESS_THAN_EQUALS(
+          query.number_of_levels(),
+          std::ceil(std::log2(static_cast<double>(N) / n_in_leaf)) + 2);
+    }
+
+    // compare neighbour search against brute force
+    for (int i = 0; i < N; i += std::max(1, N / 100)) {
+      const double_d &xi = get<position>(particles)[i];
+      int brute = 0;
+      for (int j = 0; j < N; ++j) {
+        if ((get<position>(particles)[j] - xi).squaredNorm() < r * r) {
+          ++brute;
+        }
+      }
+      int aboria = 0;
+      for (auto j = euclidean_search(query, xi, r); j != false; ++j) {
+        ++aboria;
+      }
+      TS_ASSERT_EQUALS(aboria, brute);
+    }
+  }
+
+  void test_std_vector_Kdtree_build(void) {
+    helper_kdtree_build<2>(0, 10, 0);
+    helper_kdtree_build<2>(5, 10, 0);
+    helper_kdtree_build<3>(50000, 10, 0);
+    helper_kdtree_build<3>(10000, 10, 0.3);
+    helper_kdtree_build<8>(20000, 20, 0);
+  }
+
+  void test_std_vector_Kdtree_refit(void) {
+    helper_incremental_update<2, Kdtree>(1000, 4.0);
+    helper_incremental_update<3, Kdtree>(1000, 4.0);
+    helper_incremental_update<2, Kdtree>(1000, 1.5);
+    helper_incremental_update<2, Kdtree>(1000, 0.0);
+  }
+
   void test_std_vector_CellList_fast_bucketsearch(void) {
     helper_d_test_list_random_fast_bucketsearch<std::vector, CellList>();
     helper_single_particle<std::vector, CellList>();
@@ -1414,6 +2763,8 @@ public:
   void test_std_vector_Kdtree(void) {
     helper_d_test_list_random<std::vector, Kdtree>();
     helper_d_test_list_regular<std::vector, Kdtree>();
+    helper_tight_bounds<2, Kdtree>(5000);
+    helper_tight_bounds<3, Kdtree>(5000);
   }
 
   void test_std_vector_KdtreeNanoflann(void) {
@@ -1426,6 +2777,332 @@ public:
   void test_std_vector_HyperOctree(void) {
     helper_d_test_list_random<std::vector, HyperOctree>();
     helper_d_test_list_regular<std::vector, HyperOctree>();
+    helper_tight_bounds<2, HyperOctree>(5000);
+    helper_tight_bounds<3, HyperOctree>(5000);
+  }
+
+  template <unsigned int D, template <typename> class SearchMethod>
+  void helper_tight_bounds(const int N) {
+    typedef Particles<std::tuple<>, D, std::vector, SearchMethod>
+        particles_type;
+    typedef typename particles_type::query_type query_type;
+    typedef typename query_type::child_iterator child_iterator;
+    typedef position_d<D> position;
+    typedef Vector<double, D> double_d;
+    typedef Vector<bool, D> bool_d;
+    typedef bbox<D> box_type;
+    const double r = 0.05;
+
+    std::cout << "tight bounds test (D=" << D << " N=" << N << ")"
+              << std::endl;
+
+    // a few tight clusters in a large domain
+    particles_type particles(N);
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> uniform(-0.9, 0.9);
+    std::normal_distribution<double> normal(0, 0.01);
+    std::vector<double_d> centres(5);
+    for (auto &c : centres) {
+      for (size_t d = 0; d < D; ++d) {
+        c[d] = uniform(gen);
+      }
+    }
+    for (int i = 0; i < N; ++i) {
+      for (size_t d = 0; d < D; ++d) {
+        get<position>(particles)[i][d] = centres[i % 5][d] + normal(gen);
+      }
+    }
+    particles.init_neighbour_search(double_d::Constant(-1),
+                                    double_d::Constant(1),
+                                    bool_d::Constant(false), 10);
+
+    // each box contains its children, and the leaf boxes are tight
+    const query_type &query = particles.get_query();
+    size_t count = 0;
+    std::vector<child_iterator> stack;
+    for (auto ci = query.get_children(); ci != false; ++ci) {
+      stack.push_back(ci);
+    }
+    while (!stack.empty()) {
+      const child_iterator ci = stack.back();
+      stack.pop_back();
+      const box_type &bounds = query.get_bounds(ci);
+      if (query.is_leaf_node(*ci)) {
+        box_type tight;
+        for (auto p = query.get_bucket_particles(*ci); p != false; ++p) {
+          tight = tight + box_type(get<position>(*p));
+          ++count;
+        }
+        for (size_t d = 0; d < D && !tight.is_empty(); ++d) {
+          TS_ASSERT_DELTA(bounds.bmin[d], tight.bmin[d], 1e-8);
+          TS_ASSERT_DELTA(bounds.bmax[d], tight.bmax[d], 1e-8);
+        }
+      } else {
+        for (auto cj = query.get_children(ci); cj != false; ++cj) {
+          const box_type &child_bounds = query.get_bounds(cj);
+          for (size_t d = 0; d < D; ++d) {
+            TS_ASSERT_LESS_THAN_EQUALS(bounds.bmin[d], child_bounds.bmin[d]);
+            TS_ASSERT_LESS_THAN_EQUALS(child_bounds.bmax[d], bounds.bmax[d]);
+          }
+          stack.push_back(cj);
+        }
+      }
+    }
+    TS_ASSERT_EQUALS(count, particles.size());
+
+    // compare neighbour search against brute force
+    for (int i = 0; i < N; i += 13) {
+      const double_d &xi = get<position>(particles)[i];
+      int brute = 0;
+      for (int j = 0; j < N; ++j) {
+        if ((get<position>(particles)[j] - xi).squaredNorm() < r * r) {
+          ++brute;
+        }
+      }
+      int aboria = 0;
+      for (auto j = euclidean_search(query, xi, r); j != false; ++j) {
+        ++aboria;
+      }
+      TS_ASSERT_EQUALS(aboria, brute);
+    }
+  }
+
+  template <unsigned int D, template <typename> class SearchMethod>
+  void helper_sparse_domain(const int N) {
+    typedef Particles<std::tuple<>, D, std::vector, SearchMethod>
+        particles_type;
+    typedef typename particles_type::query_type query_type;
+    typedef position_d<D> position;
+    typedef Vector<double, D> double_d;
+    typedef Vector<bool, D> bool_d;
+    const double r = 0.1;
+    const double n_particles_in_leaf = 10;
+
+    std::cout << "sparse domain test (D=" << D << " N=" << N << ")"
+              << std::endl;
+
+    // a thin bed of particles at the bottom of a huge domain, a dense cell
+    // list of this domain would need ~1e13 buckets
+    particles_type particles(N);
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> uniform(0, 1);
+    auto set_positions = [&]() {
+      for (int i = 0; i < N; ++i) {
+        for (size_t d = 0; d < D; ++d) {
+          get<position>(particles)[i][d] =
+              (d == D - 1 ? 0.5 : 10.0) * uniform(gen);
+        }
+      }
+    };
+    set_positions();
+    particles.init_neighbour_search(double_d::Constant(0),
+                                    double_d::Constant(1e4),
+                                    bool_d::Constant(false),
+                                    n_particles_in_leaf);
+
+    auto check = [&](const particles_type &particles) {
+      const query_type &query = particles.get_query();
+
+      // only the occupied buckets are stored, and they are not too full
+      TS_ASSERT_LESS_THAN_EQUALS(query.number_of_buckets(), particles.size());
+      TS_ASSERT_LESS_THAN_EQUALS(particles.size(),
+                                 2 * n_particles_in_leaf *
+                                     query.number_of_buckets());
+      size_t nbuckets = 0;
+      size_t count = 0;
+      for (auto ci = query.get_subtree(); ci != false; ++ci) {
+        TS_ASSERT_EQUALS(query.get_bucket_index(*ci), nbuckets);
+        ++nbuckets;
+        for (auto p = query.get_bucket_particles(*ci); p != false; ++p) {
+          const double_d &x = get<position>(*p);
+          const auto bounds = query.get_bucket_bbox(*ci);
+          TS_ASSERT((x >= bounds.bmin).all() && (x <= bounds.bmax).all());
+          ++count;
+        }
+      }
+      TS_ASSERT_EQUALS(nbuckets, query.number_of_buckets());
+      TS_ASSERT_EQUALS(count, particles.size());
+
+      // compare neighbour search against brute force
+      for (size_t i = 0; i < particles.size(); i += 13) {
+        const double_d &xi = get<position>(particles)[i];
+        int brute = 0;
+        for (size_t j = 0; j < particles.size(); ++j) {
+          if ((get<position>(particles)[j] - xi).squaredNorm() < r * r) {
+            ++brute;
+          }
+        }
+        int aboria = 0;
+        for (auto j = euclidean_search(query, xi, r); j != false; ++j) {
+          ++aboria;
+        }
+        TS_ASSERT_EQUALS(aboria, brute);
+      }
+
+      // points in empty space find nothing
+      const double_d empty_point = double_d::Constant(5e3);
+      TS_ASSERT(euclidean_search(query, empty_point, 10 * r) == false);
+    };
+
+    check(particles);
+
+    // move the particles, keeping the same bucket size
+    set_positions();
+    particles.update_positions();
+    check(particles);
+
+    // a small move leaves most particles in the same bucket
+    get<position>(particles)[0] = double_d::Constant(0.25);
+    particles.update_positions();
+    check(particles);
+
+    // a copy that is updated without any particle changing bucket must
+    // search its own buckets, not those of the original
+    particles_type copy(particles);
+    set_positions();
+    particles.update_positions();
+    copy.update_positions();
+    check(copy);
+    check(particles);
+  }
+
+  template <unsigned int D, template <typename> class SearchMethod>
+  void helper_clustered_domain(const int N) {
+    typedef Particles<std::tuple<>, D, std::vector, SearchMethod>
+        particles_type;
+    typedef typename particles_type::query_type query_type;
+    typedef position_d<D> position;
+    typedef Vector<double, D> double_d;
+    typedef Vector<bool, D> bool_d;
+    const double r = 0.02;
+    const double n_particles_in_leaf = 10;
+
+    std::cout << "clustered domain test (D=" << D << " N=" << N << ")"
+              << std::endl;
+
+    // most of the particles are in a few tight clusters, the rest are spread
+    // uniformly over the domain
+    particles_type particles(N);
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::normal_distribution<double> normal(0, 0.01);
+    const int nclusters = 4;
+    std::vector<double_d> centres(nclusters);
+    auto set_positions = [&]() {
+      for (int c = 0; c < nclusters; ++c) {
+        for (size_t d = 0; d < D; ++d) {
+          centres[c][d] = 0.2 + 0.6 * uniform(gen);
+        }
+      }
+      for (int i = 0; i < N; ++i) {
+        for (size_t d = 0; d < D; ++d) {
+          get<position>(particles)[i][d] =
+              i % 10 == 0
+                  ? uniform(gen)
+                  : std::min(std::max(centres[i % nclusters][d] + normal(gen),
+                                      0.0),
+                             1.0);
+        }
+      }
+    };
+    set_positions();
+    particles.init_neighbour_search(double_d::Constant(0),
+                                    double_d::Constant(1),
+                                    bool_d::Constant(false),
+                                    n_particles_in_leaf);
+
+    auto check = [&](const particles_type &particles) {
+      const query_type &query = particles.get_query();
+
+      // the clusters are divided so that no bucket is very full
+      size_t nbuckets = 0;
+      size_t count = 0;
+      size_t max_count = 0;
+      for (auto ci = query.get_subtree(); ci != false; ++ci) {
+        TS_ASSERT_EQUALS(query.get_bucket_index(*ci), nbuckets);
+        ++nbuckets;
+        size_t bucket_count = 0;
+        for (auto p = query.get_bucket_particles(*ci); p != false; ++p) {
+          const double_d &x = get<position>(*p);
+          const auto bounds = query.get_bucket_bbox(*ci);
+          TS_ASSERT((x >= bounds.bmin).all() && (x <= bounds.bmax).all());
+          TS_ASSERT_EQUALS(query.get_bucket_index(*query.get_bucket(x)),
+                           query.get_bucket_index(*ci));
+          ++bucket_count;
+        }
+        max_count = std::max(max_count, bucket_count);
+        count += bucket_count;
+      }
+      TS_ASSERT_EQUALS(nbuckets, query.number_of_buckets());
+      TS_ASSERT_EQUALS(count, particles.size());
+      TS_ASSERT_LESS_THAN_EQUALS(max_count, 2 * n_particles_in_leaf);
+
+      // compare neighbour search against brute force
+      for (size_t i = 0; i < particles.size(); i += 13) {
+        const double_d &xi = get<position>(particles)[i];
+        int brute = 0;
+        for (size_t j = 0; j < particles.size(); ++j) {
+          if ((get<position>(particles)[j] - xi).squaredNorm() < r * r) {
+            ++brute;
+          }
+        }
+        int aboria = 0;
+        for (auto j = euclidean_search(query, xi, r); j != false; ++j) {
+          ++aboria;
+        }
+        TS_ASSERT_EQUALS(aboria, brute);
+      }
+    };
+
+    check(particles);
+
+    // move the clusters
+    set_positions();
+    particles.update_positions();
+    check(particles);
+
+    // updating without moving leaves the particles in the same order
+    const size_t id0 = get<id>(particles)[0];
+    particles.update_positions();
+    TS_ASSERT_EQUALS(get<id>(particles)[0], id0);
+    check(particles);
+
+    // a copy that is updated without any particle changing leaf must search
+    // its own leafs, not those of the original
+    particles_type copy(particles);
+    set_positions();
+    particles.update_positions();
+    copy.update_positions();
+    check(copy);
+    check(particles);
+  }
+
+  void test_std_vector_HashedCellList(void) {
+    helper_d_test_list_random<std::vector, HashedCellList>();
+    helper_single_particle<std::vector, HashedCellList>();
+    helper_two_particles<std::vector, HashedCellList>();
+    helper_d_test_list_regular<std::vector, HashedCellList>();
+    helper_sparse_domain<2, HashedCellList>(5000);
+    helper_sparse_domain<3, HashedCellList>(5000);
+  }
+
+  void test_std_vector_AdaptiveCellList(void) {
+    helper_d_test_list_random<std::vector, AdaptiveCellList>();
+    helper_single_particle<std::vector, AdaptiveCellList>();
+    helper_two_particles<std::vector, AdaptiveCellList>();
+    helper_d_test_list_regular<std::vector, AdaptiveCellList>();
+    helper_clustered_domain<2, AdaptiveCellList>(10000);
+    helper_clustered_domain<3, AdaptiveCellList>(10000);
+  }
+
+  void test_std_vector_LBVH(void) {
+    helper_d_test_list_random<std::vector, LBVH>();
+    helper_d_test_list_regular<std::vector, LBVH>();
+    helper_single_particle<std::vector, LBVH>();
+    helper_two_particles<std::vector, LBVH>();
+    helper_tight_bounds<2, LBVH>(5000);
+    helper_tight_bounds<3, LBVH>(20000);
+    helper_tight_bounds<6, LBVH>(5000);
   }
 
   // void test_thrust_vector_CellList(void) {
@@ -98,7 +98,10 @@ public:
 
     [note currently the only data structure that is created or updated in serial
     is [classref Aboria::KdtreeNanoflann]. All the rest are done in parallel
-    using either OpenMP or CUDA]
+    using either OpenMP or CUDA. If you are not using Thrust, the sorts, scans,
+    gathers and scatters used to build the data structures are run using
+    Aboria's own OpenMP implementations, so all you need to do is compile with
+    `HAVE_OPENMP` defined]
     */
 
     particles.init_neighbour_search(
@@ -259,6 +262,130 @@ public:
        */
     //]
   }
+
+  template <typename F> double time_with_threads(const int nthreads, F f) {
+#ifdef HAVE_OPENMP
+    const int old_nthreads = omp_get_max_threads();
+    omp_set_num_threads(nthreads);
+#endif
+    auto t0 = Clock::now();
+    f();
+    auto t1 = Clock::now();
+#ifdef HAVE_OPENMP
+    omp_set_num_threads(old_nthreads);
+#endif
+    std::chrono::duration<double> dt = t1 - t0;
+    return dt.count();
+  }
+
+  void test_algorithms_scaling(void) {
+    const size_t N = 500000;
+    std::default_random_engine gen;
+    std::uniform_int_distribution<int> uniform(0, N / 10);
+
+    std::vector<int> keys(N);
+    std::vector<int> data(N);
+    std::vector<int> alive(N);
+    for (size_t i = 0; i < N; ++i) {
+      keys[i] = uniform(gen);
+      data[i] = i;
+      alive[i] = keys[i] % 3 != 0;
+    }
+
+    // serial reference results
+    std::vector<int> sorted_keys = keys;
+    std::stable_sort(sorted_keys.begin(), sorted_keys.end());
+    std::vector<int> scan_sum(N);
+    int sum = 0;
+    for (size_t i = 0; i < N; ++i) {
+      scan_sum[i] = sum;
+      sum += alive[i];
+    }
+
+    int max_threads = 1;
+#ifdef HAVE_OPENMP
+    max_threads = omp_get_max_threads();
+#endif
+    for (int nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+      std::vector<int> k = keys;
+      std::vector<int> d = data;
+      const double t_sort = time_with_threads(
+          nthreads, [&]() { detail::sort_by_key(k.begin(), k.end(), d.begin()); });
+      TS_ASSERT(std::equal(k.begin(), k.end(), sorted_keys.begin()));
+      for (size_t i = 0; i < N; ++i) {
+        TS_ASSERT_EQUALS(keys[d[i]], k[i]);
+      }
+
+      std::vector<int> ck = keys;
+      std::vector<int> cd = data;
+      std::vector<int> bucket_begin(N / 10 + 1);
+      std::vector<int> bucket_end(N / 10 + 1);
+      const double t_counting_sort = time_with_threads(nthreads, [&]() {
+        detail::counting_sort_by_key(ck.begin(), ck.end(), cd.begin(),
+                                     bucket_begin.size(), bucket_begin.begin(),
+                                     bucket_end.begin());
+      });
+      TS_ASSERT(std::equal(ck.begin(), ck.end(), sorted_keys.begin()));
+      for (size_t i = 0; i < N; ++i) {
+        TS_ASSERT_EQUALS(keys[cd[i]], ck[i]);
+        // counting sort is stable
+        if (i > 0 && ck[i] == ck[i - 1]) {
+          TS_ASSERT_LESS_THAN(cd[i - 1], cd[i]);
+        }
+      }
+      for (size_t b = 0; b < bucket_begin.size(); ++b) {
+        TS_ASSERT_EQUALS(bucket_begin[b],
+                         std::lower_bound(ck.begin(), ck.end(), b) -
+                             ck.begin());
+        TS_ASSERT_EQUALS(bucket_end[b],
+                         std::upper_bound(ck.begin(), ck.end(), b) -
+                             ck.begin());
+      }
+
+      // in-place scan
+      std::vector<int> s = alive;
+      const double t_scan = time_with_threads(nthreads, [&]() {
+        detail::exclusive_scan(s.begin(), s.end(), s.begin(), 0);
+      });
+      TS_ASSERT(std::equal(s.begin(), s.end(), scan_sum.begin()));
+
+      std::vector<int> alive_indices(sum);
+      const double t_scatter = time_with_threads(nthreads, [&]() {
+        detail::scatter_if(data.begin(), data.end(), s.begin(), alive.begin(),
+                           alive_indices.begin());
+      });
+      for (size_t i = 0; i < alive_indices.size(); ++i) {
+        TS_ASSERT(alive[alive_indices[i]]);
+        TS_ASSERT_EQUALS(s[alive_indices[i]], static_cast<int>(i));
+      }
+
+      std::vector<int> gathered(alive_indices.size());
+      const double t_gather = time_with_threads(nthreads, [&]() {
+        detail::gather(alive_indices.begin(), alive_indices.end(),
+                       keys.begin(), gathered.begin());
+      });
+      for (size_t i = 0; i < gathered.size(); ++i) {
+        TS_ASSERT_EQUALS(gathered[i], keys[alive_indices[i]]);
+      }
+
+      std::vector<int> bounds(N);
+      const double t_bound = time_with_threads(nthreads, [&]() {
+        detail::lower_bound(k.begin(), k.end(), keys.begin(), keys.end(),
+                            bounds.begin());
+      });
+      for (size_t i = 0; i < N; ++i) {
+        TS_ASSERT_EQUALS(bounds[i],
+                         std::lower_bound(k.begin(), k.end(), keys[i]) -
+                             k.begin());
+      }
+
+      std::cout << "threads = " << nthreads << " sort_by_key = " << t_sort
+                << " counting_sort_by_key = " << t_counting_sort
+                << " exclusive_scan = " << t_scan
+                << " scatter_if = " << t_scatter << " gather = " << t_gather
+                << " lower_bound = " << t_bound << std::endl;
+    }
+  }
 };
 
 #endif /* PARALLEL_H_ */
@@ -37,6 +37,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define PARTICLE_CONTAINER_H_
 
 #include <cxxtest/TestSuite.h>
+#include <fstream>
 
 #include "Level1.h"
 
@@ -419,6 +420,127 @@ public:
 
     [endsect]
 
+    [section VTK output without VTK]
+
+    Aboria can also write VTK unstructured grid files without the VTK library,
+    using the [funcref Aboria::write_vtu] function. Each variable is written
+    in its own type as raw binary data, copied in parallel straight from the
+    particle set. As for [memberref Aboria::Particles::get_grid], variables
+    with names starting with "_" are not written. A list of variables can be
+    given to write only those
+
+    ```
+    write_vtu("doc.vtu", particles);
+    write_vtu<velocity>("doc_velocity.vtu", particles);
+    ```
+
+    The [funcref Aboria::write_xdmf] function instead writes an XDMF file that
+    describes the particle set, with the data in a raw binary file alongside
+    it (here `doc.raw`). Both can be read by Paraview or Visit
+
+    ```
+    write_xdmf("doc.xmf", particles);
+    ```
+
+    [endsect]
+
+    [section Columnar binary snapshots]
+
+    For checkpointing large particle sets, the [funcref Aboria::write_snapshot]
+    function writes all the variables of a particle set to a binary file, with
+    one contiguous block per variable. The blocks are copied in parallel if
+    OpenMP is enabled
+
+    ```
+    write_snapshot("doc.snap", particles);
+    ```
+
+    The snapshot can be read back into a particle set using [funcref
+    Aboria::read_snapshot], which copies either all the variables or only those
+    given as template arguments. As for [memberref Aboria::Particles::resize],
+    the neighbour search is not updated
+
+    ```
+    read_snapshot("doc.snap", particles);
+    read_snapshot<velocity>("doc.snap", particles);
+    particles.update_positions();
+    ```
+
+    The [classref Aboria::Snapshot] class maps the file into memory, and gives
+    pointers directly to the values of each variable without copying them.
+    Only the pages of the file that are used are read, and any writes are
+    private to the mapping
+
+    ```
+    Snapshot snapshot("doc.snap");
+    const vdouble3 *v = snapshot.get<velocity>();
+    ```
+
+    [endsect]
+
+    [section Asynchronous output]
+
+    Writing a file blocks the simulation until the file has been written. The
+    [classref Aboria::AsyncWriter] class instead copies the variables to be
+    written into a staging buffer, and writes the file on a background thread
+    while the simulation carries on. The constructor argument is the number of
+    staged frames that can wait to be written, once this is reached each write
+    waits for the oldest frame to be written. Frames can be written as
+    snapshots ([memberref Aboria::AsyncWriter::write_snapshot]) or VTK files
+    ([memberref Aboria::AsyncWriter::write_vtu]). The following writes the
+    positions and velocities every 100 steps
+
+    ```
+    AsyncWriter writer(1);
+    for (int i = 0; i < 1000; ++i) {
+      // update particles here...
+      if (i % 100 == 0) {
+        writer.write_snapshot<position, velocity>(
+            "doc" + std::to_string(i) + ".snap", particles);
+      }
+    }
+    writer.flush();
+    ```
+
+    The destructor of [classref Aboria::AsyncWriter] also waits for all the
+    frames to be written
+
+    [endsect]
+
+    [section Compressed trajectories]
+
+    Long trajectories are stored more compactly with the [classref
+    Aboria::TrajectoryWriter] class. This writes only the ids and positions of
+    the particles, quantised to a given precision relative to the lower
+    bound of the domain, so each coordinate is stored with an error of at most
+    half of the precision. Each frame is stored as the change from the
+    previous frame in order of id, and compressed with a simple entropy coder.
+    The constructor takes the file name, the precision and the number of
+    frames between keyframes, which store the full positions
+
+    ```
+    TrajectoryWriter trajectory("doc.traj", 1e-6, 10);
+    for (int i = 0; i < 1000; ++i) {
+      // update particles here...
+      if (i % 100 == 0) {
+        trajectory.write(particles);
+      }
+    }
+    trajectory.close();
+    ```
+
+    The [classref Aboria::TrajectoryReader] class reads any frame of the
+    trajectory back into a particle set, in order of id. As for [memberref
+    Aboria::Particles::resize], the neighbour search is not updated
+
+    ```
+    TrajectoryReader reader("doc.traj");
+    reader.read(reader.number_of_frames() - 1, particles);
+    particles.update_positions();
+    ```
+
+    [endsect]
+
     [endsect]
      */
     //]
@@ -437,6 +559,319 @@ public:
 #endif
   }
 
+  void test_snapshot(void) {
+    ABORIA_VARIABLE(velocity, vdouble3, "velocity")
+    ABORIA_VARIABLE(weight, double, "weight")
+    typedef Particles<std::tuple<velocity, weight>, 3, std::vector, CellList>
+        particles_type;
+    typedef particles_type::position position;
+    const size_t n = 1000;
+    particles_type particles(n);
+    for (size_t i = 0; i < n; ++i) {
+      get<position>(particles)[i] = vdouble3(i / double(n), 0.5, 0.5);
+      get<velocity>(particles)[i] = vdouble3(i, -1.0 * i, 2.0 * i);
+      get<weight>(particles)[i] = 0.5 * i;
+    }
+    write_snapshot("test.snap", particles);
+
+    Snapshot snapshot("test.snap");
+    TS_ASSERT_EQUALS(snapshot.size(), n);
+    TS_ASSERT_EQUALS(snapshot.dimension(), 3);
+    TS_ASSERT_EQUALS(snapshot.number_of_variables(), 6);
+    TS_ASSERT(snapshot.has<weight>());
+    TS_ASSERT_EQUALS(snapshot.variable_name(5), "weight");
+    for (size_t i = 0; i < n; ++i) {
+      TS_ASSERT_EQUALS(snapshot.get<id>()[i], get<id>(particles)[i]);
+      TS_ASSERT_EQUALS(snapshot.get<weight>()[i], get<weight>(particles)[i]);
+      TS_ASSERT(
+          (snapshot.get<velocity>()[i] == get<velocity>(particles)[i]).all());
+    }
+
+    // writes to the mapping do not change the file
+    snapshot.get<weight>()[0] = -1.0;
+    TS_ASSERT_EQUALS(snapshot.get<weight>()[0], -1.0);
+
+    // read all the variables
+    particles_type all;
+    read_snapshot("test.snap", all);
+    TS_ASSERT_EQUALS(all.size(), n);
+    for (size_t i = 0; i < n; ++i) {
+      TS_ASSERT_EQUALS(get<id>(all)[i], get<id>(particles)[i]);
+      TS_ASSERT_EQUALS(get<weight>(all)[i], get<weight>(particles)[i]);
+      TS_ASSERT((get<position>(all)[i] == get<position>(particles)[i]).all());
+      TS_ASSERT((get<velocity>(all)[i] == get<velocity>(particles)[i]).all());
+    }
+
+    // read only the weight into an existing set
+    particles_type some(n);
+    for (size_t i = 0; i < n; ++i) {
+      get<velocity>(some)[i] = vdouble3::Constant(1);
+    }
+    read_snapshot<weight>("test.snap", some);
+    for (size_t i = 0; i < n; ++i) {
+      TS_ASSERT_EQUALS(get<weight>(some)[i], get<weight>(particles)[i]);
+      TS_ASSERT((get<velocity>(some)[i] == vdouble3::Constant(1)).all());
+    }
+
+    // positions can be searched once the neighbour search is updated
+    all.init_neighbour_search(vdouble3::Constant(0), vdouble3::Constant(1),
+                              vbool3::Constant(false));
+    int count = 0;
+    for (auto i = euclidean_search(all.get_query(), vdouble3(0.5, 0.5, 0.5),
+                                   0.0105);
+         i != false; ++i) {
+      ++count;
+    }
+    TS_ASSERT_EQUALS(count, 21);
+
+    std::remove("test.snap");
+  }
+
+  void test_async_writer(void) {
+    ABORIA_VARIABLE(weight, double, "weight")
+    typedef Particles<std::tuple<weight>, 2> particles_type;
+    typedef particles_type::position position;
+    const size_t n = 1000;
+    const int n_frames = 5;
+    particles_type particles(n);
+    {
+      AsyncWriter writer(1);
+      for (int frame = 0; frame < n_frames; ++frame) {
+        for (size_t i = 0; i < n; ++i) {
+          get<position>(particles)[i] = vdouble2(i, frame);
+          get<weight>(particles)[i] = frame * n + i;
+        }
+        writer.write_snapshot<position, weight>(
+            "test_async" + std::to_string(frame) + ".snap", particles);
+      }
+      writer.flush();
+      TS_ASSERT_EQUALS(writer.number_written(), n_frames);
+
+      // the destructor waits for the last frame
+      writer.write_snapshot("test_async_all.snap", particles);
+    }
+
+    for (int frame = 0; frame < n_frames; ++frame) {
+      const std::string filename =
+          "test_async" + std::to_string(frame) + ".snap";
+      Snapshot snapshot(filename);
+      TS_ASSERT_EQUALS(snapshot.size(), n);
+      TS_ASSERT_EQUALS(snapshot.number_of_variables(), 2);
+      TS_ASSERT(!snapshot.has<id>());
+      for (size_t i = 0; i < n; ++i) {
+        TS_ASSERT_EQUALS(snapshot.get<weight>()[i], frame * n + i);
+        TS_ASSERT((snapshot.get<position>()[i] == vdouble2(i, frame)).all());
+      }
+      snapshot.close();
+      std::remove(filename.c_str());
+    }
+
+    particles_type all;
+    read_snapshot("test_async_all.snap", all);
+    TS_ASSERT_EQUALS(all.size(), n);
+    for (size_t i = 0; i < n; ++i) {
+      TS_ASSERT_EQUALS(get<id>(all)[i], get<id>(particles)[i]);
+      TS_ASSERT_EQUALS(get<weight>(all)[i], get<weight>(particles)[i]);
+    }
+    std::remove("test_async_all.snap");
+  }
+
+  template <typename T>
+  std::vector<T> read_vtu_array(const std::string &contents,
+                                const std::string &tag) {
+    const size_t array = contents.find(tag);
+    const size_t offset =
+        std::stoul(contents.substr(contents.find("offset=\"", array) + 8));
+    const size_t appended =
+        contents.find('_', contents.find("<AppendedData")) + 1 + offset;
+    uint64_t bytes;
+    std::memcpy(&bytes, &contents[appended], sizeof(uint64_t));
+    std::vector<T> values(bytes / sizeof(T));
+    std::memcpy(values.data(), &contents[appended + sizeof(uint64_t)], bytes);
+    return values;
+  }
+
+  std::string read_file(const std::string &filename) {
+    std::ifstream file(filename, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file),
+                       std::istreambuf_iterator<char>());
+  }
+
+  void test_vtu_output(void) {
+    ABORIA_VARIABLE(velocity, vdouble3, "velocity")
+    ABORIA_VARIABLE(weight, float, "weight")
+    ABORIA_VARIABLE(hidden, double, "_hidden")
+    typedef Particles<std::tuple<velocity, weight, hidden>, 2> particles_type;
+    typedef particles_type::position position;
+    const size_t n = 100;
+    particles_type particles(n);
+    for (size_t i = 0; i < n; ++i) {
+      get<position>(particles)[i] = vdouble2(i, -1.0 * i);
+      get<velocity>(particles)[i] = vdouble3(i, 2.0 * i, 3.0 * i);
+      get<weight>(particles)[i] = 0.5 * i;
+    }
+
+    write_vtu("test.vtu", particles);
+    const std::string vtu = read_file("test.vtu");
+    TS_ASSERT_EQUALS(vtu.find("_hidden"), std::string::npos);
+    TS_ASSERT_EQUALS(vtu.find("random_generator_seed"), std::string::npos);
+    const std::vector<double> points = read_vtu_array<double>(vtu, "<Points>");
+    const std::vector<double> velocities =
+        read_vtu_array<double>(vtu, "Name=\"velocity\"");
+    const std::vector<float> weights =
+        read_vtu_array<float>(vtu, "Name=\"weight\"");
+    const std::vector<size_t> ids = read_vtu_array<size_t>(vtu, "Name=\"id\"");
+    const std::vector<int64_t> connectivity =
+        read_vtu_array<int64_t>(vtu, "Name=\"connectivity\"");
+    const std::vector<int64_t> offsets =
+        read_vtu_array<int64_t>(vtu, "Name=\"offsets\"");
+    const std::vector<uint8_t> types =
+        read_vtu_array<uint8_t>(vtu, "Name=\"types\"");
+    TS_ASSERT_EQUALS(points.size(), 3 * n);
+    TS_ASSERT_EQUALS(velocities.size(), 3 * n);
+    TS_ASSERT_EQUALS(weights.size(), n);
+    TS_ASSERT_EQUALS(types.size(), n);
+    for (size_t i = 0; i < n; ++i) {
+      TS_ASSERT_EQUALS(points[3 * i], i);
+      TS_ASSERT_EQUALS(points[3 * i + 1], -1.0 * i);
+      TS_ASSERT_EQUALS(points[3 * i + 2], 0.0);
+      for (size_t d = 0; d < 3; ++d) {
+        TS_ASSERT_EQUALS(velocities[3 * i + d], get<velocity>(particles)[i][d]);
+      }
+      TS_ASSERT_EQUALS(weights[i], get<weight>(particles)[i]);
+      TS_ASSERT_EQUALS(ids[i], get<id>(particles)[i]);
+      TS_ASSERT_EQUALS(connectivity[i], i);
+      TS_ASSERT_EQUALS(offsets[i], i + 1);
+      TS_ASSERT_EQUALS(types[i], 1);
+    }
+
+    // only the selected variables
+    write_vtu<weight>("test_weight.vtu", particles);
+    const std::string vtu_weight = read_file("test_weight.vtu");
+    TS_ASSERT_EQUALS(vtu_weight.find("velocity"), std::string::npos);
+    TS_ASSERT(read_vtu_array<float>(vtu_weight, "Name=\"weight\"") == weights);
+
+    // the asynchronous writer writes the same file
+    {
+      AsyncWriter writer;
+      writer.write_vtu("test_async.vtu", particles);
+    }
+    TS_ASSERT(read_file("test_async.vtu") == vtu);
+
+    write_xdmf("test.xmf", particles);
+    const std::string xdmf = read_file("test.xmf");
+    const std::string raw = read_file("test.raw");
+    TS_ASSERT_EQUALS(xdmf.find("_hidden"), std::string::npos);
+    TS_ASSERT_DIFFERS(xdmf.find("Polyvertex"), std::string::npos);
+    const size_t seek = std::stoul(
+        xdmf.substr(xdmf.find("Seek=\"", xdmf.find("Name=\"weight\"")) + 6));
+    for (size_t i = 0; i < n; ++i) {
+      double point[3];
+      std::memcpy(point, &raw[3 * i * sizeof(double)], sizeof(point));
+      TS_ASSERT_EQUALS(point[0], i);
+      TS_ASSERT_EQUALS(point[1], -1.0 * i);
+      TS_ASSERT_EQUALS(point[2], 0.0);
+      float w;
+      std::memcpy(&w, &raw[seek + i * sizeof(float)], sizeof(float));
+      TS_ASSERT_EQUALS(w, get<weight>(particles)[i]);
+    }
+
+    for (const char *filename : {"test.vtu", "test_weight.vtu",
+                                 "test_async.vtu", "test.xmf", "test.raw"}) {
+      std::remove(filename);
+    }
+  }
+
+  void test_trajectory(void) {
+    typedef Particles<std::tuple<>, 3, std::vector, CellList> particles_type;
+    typedef particles_type::position position;
+    const size_t n = 10000;
+    const double precision = 1e-5;
+    particles_type particles(n);
+    particles.init_neighbour_search(vdouble3::Constant(0),
+                                    vdouble3::Constant(1),
+                                    vbool3::Constant(false));
+    generator_type gen(1);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::normal_distribution<double> normal(0, 1e-3);
+    for (size_t i = 0; i < n; ++i) {
+      get<position>(particles)[i] =
+          vdouble3(uniform(gen), uniform(gen), uniform(gen));
+    }
+    particles.update_positions();
+
+    // keep the positions of each frame, in order of id
+    const size_t n_frames = 25;
+    std::vector<std::vector<vdouble3>> frames(n_frames,
+                                              std::vector<vdouble3>(n));
+    {
+      TrajectoryWriter writer("test.traj", precision, 10, 1000);
+      for (size_t frame = 0; frame < n_frames; ++frame) {
+        for (size_t i = 0; i < particles.size(); ++i) {
+          frames[frame][get<id>(particles)[i]] = get<position>(particles)[i];
+        }
+        writer.write(particles);
+        for (size_t i = 0; i < particles.size(); ++i) {
+          for (size_t d = 0; d < 3; ++d) {
+            get<position>(particles)[i][d] = std::min(
+                0.999, std::max(0.0, get<position>(particles)[i][d] +
+                                         normal(gen)));
+          }
+        }
+        particles.update_positions();
+      }
+      TS_ASSERT_EQUALS(writer.number_of_frames(), n_frames);
+    }
+
+    // much smaller than the raw positions
+    std::ifstream file("test.traj", std::ios::binary | std::ios::ate);
+    const size_t bytes = file.tellg();
+    std::cout << "trajectory is " << bytes << " bytes, raw positions are "
+              << n_frames * n * sizeof(vdouble3) << " bytes" << std::endl;
+    TS_ASSERT_LESS_THAN(bytes, n_frames * n * sizeof(vdouble3) / 3);
+
+    TrajectoryReader reader("test.traj");
+    TS_ASSERT_EQUALS(reader.number_of_frames(), n_frames);
+    TS_ASSERT_EQUALS(reader.dimension(), 3);
+    TS_ASSERT_EQUALS(reader.precision(), precision);
+
+    // read out of order, to test seeking to keyframes
+    particles_type read_particles;
+    for (const size_t frame : {24, 3, 4, 5, 0, 19, 12, 13, 12}) {
+      TS_ASSERT_EQUALS(reader.size(frame), n);
+      reader.read(frame, read_particles);
+      TS_ASSERT_EQUALS(read_particles.size(), n);
+      for (size_t i = 0; i < n; ++i) {
+        TS_ASSERT_EQUALS(get<id>(read_particles)[i], i);
+        for (size_t d = 0; d < 3; ++d) {
+          TS_ASSERT_DELTA(get<position>(read_particles)[i][d],
+                          frames[frame][i][d], 0.5 * precision + 1e-12);
+        }
+      }
+    }
+
+    // removing particles changes the ids, which forces a keyframe
+    {
+      TrajectoryWriter writer("test.traj", precision);
+      writer.write(particles);
+      for (size_t i = 0; i < 10; ++i) {
+        particles.erase(particles.begin() + i * 100);
+      }
+      writer.write(particles);
+    }
+    reader.open("test.traj");
+    TS_ASSERT_EQUALS(reader.number_of_frames(), 2);
+    TS_ASSERT_EQUALS(reader.size(0), n);
+    TS_ASSERT_EQUALS(reader.size(1), n - 10);
+    reader.read(1, read_particles);
+    TS_ASSERT_EQUALS(read_particles.size(), n - 10);
+    for (size_t i = 1; i < read_particles.size(); ++i) {
+      TS_ASSERT_LESS_THAN(get<id>(read_particles)[i - 1],
+                          get<id>(read_particles)[i]);
+    }
+    std::remove("test.traj");
+  }
+
   void test_std_vector_CellList(void) {
     helper_add_particle1<std::vector, CellList>();
     helper_add_particle2<std::vector, CellList>();
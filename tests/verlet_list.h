@@ -0,0 +1,214 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Aboria.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef VERLET_LIST_TEST_H_
+#define VERLET_LIST_TEST_H_
+
+#include <cxxtest/TestSuite.h>
+
+#include "Aboria.h"
+
+using namespace Aboria;
+
+class VerletListTest : public CxxTest::TestSuite {
+public:
+  ABORIA_VARIABLE(neighbours_search, int, "number of neighbours (search)")
+  ABORIA_VARIABLE(neighbours_verlet, int, "number of neighbours (verlet)")
+  ABORIA_VARIABLE(scalar, double, "scalar")
+
+  template <template <typename> class SearchMethod>
+  void helper_verlet_list(const bool is_periodic) {
+    typedef Particles<std::tuple<neighbours_search, neighbours_verlet, scalar>,
+                      2, std::vector, SearchMethod>
+        particles_type;
+    typedef typename particles_type::position position;
+
+    const size_t N = 500;
+    const double cutoff = 0.1;
+    const double skin = 0.04;
+    const double step = 0.004;
+    const int timesteps = 30;
+
+    std::cout << "verlet list test (periodic = " << is_periodic << ")"
+              << std::endl;
+
+    particles_type particles(N);
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> uniform(0, 1);
+    for (size_t i = 0; i < N; ++i) {
+      get<position>(particles)[i] = vdouble2(uniform(gen), uniform(gen));
+    }
+    particles.init_neighbour_search(vdouble2::Constant(0),
+                                    vdouble2::Constant(1),
+                                    vbool2::Constant(is_periodic));
+    particles.init_verlet_list(cutoff, skin);
+    TS_ASSERT_EQUALS(particles.get_verlet_list().number_of_builds(), 1);
+
+    Symbol<neighbours_verlet> nv;
+    Symbol<scalar> s;
+    Label<0, particles_type> a(particles);
+    Label<1, particles_type> b(particles);
+    auto dx = create_dx(a, b);
+    AccumulateWithinDistance<std::plus<int>> count(cutoff);
+    AccumulateWithinDistance<std::plus<double>> sum(cutoff);
+
+    std::uniform_real_distribution<double> uniform_step(-step, step);
+    for (int t = 0; t < timesteps; ++t) {
+      for (size_t i = 0; i < particles.size(); ++i) {
+        vdouble2 &p = get<position>(particles)[i];
+        p += vdouble2(uniform_step(gen), uniform_step(gen));
+        if (!is_periodic) {
+          for (size_t d = 0; d < 2; ++d) {
+            p[d] = std::min(std::max(p[d], 0.0), 0.999);
+          }
+        }
+      }
+      // delete a particle every few steps
+      if (t % 7 == 3) {
+        get<alive>(particles)[t] = false;
+      }
+      particles.update_positions();
+
+      // every pair within the cutoff must be in the list
+      const auto &verlet = particles.get_verlet_list();
+      TS_ASSERT(verlet.is_valid_for(particles.size(), cutoff));
+      for (size_t i = 0; i < particles.size(); ++i) {
+        const vdouble2 &pi = get<position>(particles)[i];
+        int count_search = 0;
+        for (auto j = euclidean_search(particles.get_query(), pi, cutoff);
+             j != false; ++j) {
+          ++count_search;
+          const size_t index_j =
+              &get<position>(*j) - get<position>(particles).data();
+          const auto range = verlet.get_neighbours(i);
+          TS_ASSERT(std::find(range.begin(), range.end(), index_j) !=
+                    range.end());
+        }
+        get<neighbours_search>(particles)[i] = count_search;
+      }
+
+      // symbolic sums should use the list and agree with the search
+      nv[a] = count(b, 1);
+      s[a] = sum(b, norm(dx));
+      for (size_t i = 0; i < particles.size(); ++i) {
+        TS_ASSERT_EQUALS(get<neighbours_verlet>(particles)[i],
+                         get<neighbours_search>(particles)[i]);
+        double sum_search = 0;
+        for (auto j = euclidean_search(particles.get_query(),
+                                       get<position>(particles)[i], cutoff);
+             j != false; ++j) {
+          sum_search += j.dx().norm();
+        }
+        TS_ASSERT_DELTA(get<scalar>(particles)[i], sum_search, 1e-10);
+      }
+    }
+
+    // particles move at most sqrt(2)*step per timestep, so the list should
+    // be rebuilt much less often than every step, but it should still have
+    // been rebuilt
+    const size_t builds = particles.get_verlet_list().number_of_builds();
+    std::cout << "\tnumber of builds = " << builds << std::endl;
+    TS_ASSERT_LESS_THAN(builds, timesteps / 2);
+    TS_ASSERT_LESS_THAN(1, builds);
+  }
+
+  template <template <typename> class SearchMethod>
+  void helper_verlet_kernel_sparse() {
+#ifdef HAVE_EIGEN
+    typedef Particles<std::tuple<scalar>, 2, std::vector, SearchMethod>
+        particles_type;
+    typedef typename particles_type::position position;
+    typedef typename particles_type::const_reference const_reference;
+
+    const size_t N = 300;
+    const double cutoff = 0.1;
+
+    particles_type particles(N);
+    std::default_random_engine gen;
+    std::uniform_real_distribution<double> uniform(0, 1);
+    for (size_t i = 0; i < N; ++i) {
+      get<position>(particles)[i] = vdouble2(uniform(gen), uniform(gen));
+      get<scalar>(particles)[i] = uniform(gen);
+    }
+    particles.init_neighbour_search(vdouble2::Constant(0),
+                                    vdouble2::Constant(1),
+                                    vbool2::Constant(true));
+
+    auto kernel = [](const vdouble2 &dx, const_reference i,
+                     const_reference j) {
+      return get<scalar>(i) * get<scalar>(j) * (1.0 + dx.norm());
+    };
+    auto K = create_sparse_operator(particles, particles, cutoff, kernel);
+
+    // evaluate before and after enabling the verlet list
+    Eigen::VectorXd x = Eigen::VectorXd::Random(N);
+    Eigen::VectorXd y_no_verlet = K * x;
+    particles.init_verlet_list(cutoff, 0.03);
+    Eigen::VectorXd y = K * x;
+    TS_ASSERT(y.isApprox(y_no_verlet));
+
+    Eigen::SparseMatrix<double> K_eigen(N, N);
+    K.assemble(K_eigen);
+    Eigen::VectorXd y_eigen = K_eigen * x;
+    TS_ASSERT(y.isApprox(y_eigen));
+#endif
+  }
+
+  void test_CellList(void) {
+    helper_verlet_list<CellList>(false);
+    helper_verlet_list<CellList>(true);
+    helper_verlet_kernel_sparse<CellList>();
+  }
+
+  void test_CellListOrdered(void) {
+    helper_verlet_list<CellListOrdered>(false);
+    helper_verlet_list<CellListOrdered>(true);
+    helper_verlet_kernel_sparse<CellListOrdered>();
+  }
+
+  void test_Kdtree(void) {
+    helper_verlet_list<Kdtree>(false);
+    helper_verlet_list<Kdtree>(true);
+    helper_verlet_kernel_sparse<Kdtree>();
+  }
+
+  void test_HyperOctree(void) {
+    helper_verlet_list<HyperOctree>(false);
+    helper_verlet_list<HyperOctree>(true);
+    helper_verlet_kernel_sparse<HyperOctree>();
+  }
+};
+
+#endif /* VERLET_LIST_TEST_H_ */